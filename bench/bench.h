@@ -0,0 +1,77 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * Small helpers shared by the loopback benchmarks in bench/.
+ * Each benchmark is a standalone program linked against the wrapper library
+ * (everything in src/ except main.c). Run them all with `make bench`.
+ */
+
+#include "../src/socket.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+static inline long long bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline void bench_sleep_us(long us)
+{
+    struct timespec pause = {us / 1000000, (us % 1000000) * 1000};
+    nanosleep(&pause, NULL);
+}
+
+// Listening ServerSocket on 127.0.0.1 with a kernel-chosen port
+static inline ServerSocket *bench_listen(int backlog, int *port)
+{
+    ServerSocket *server = create_server_socket("127.0.0.1", 0, backlog);
+    if (!server || server_bind(server) < 0 || server_listen(server) < 0)
+    {
+        fprintf(stderr, "bench: could not listen on loopback\n");
+        exit(1);
+    }
+
+    struct sockaddr_in bound;
+    socklen_t len = sizeof(bound);
+    getsockname(server->server_socket.fd, (struct sockaddr *)&bound, &len);
+    *port = ntohs(bound.sin_port);
+    server->server_socket.port = *port;
+    return server;
+}
+
+static int bench_compare_ll(const void *a, const void *b)
+{
+    long long left = *(const long long *)a;
+    long long right = *(const long long *)b;
+    return (left > right) - (left < right);
+}
+
+// Sorts samples in place; pct in [0, 100]
+static inline long long bench_percentile(long long *samples, int count, double pct)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    qsort(samples, count, sizeof(long long), bench_compare_ll);
+    int index = (int)(pct / 100.0 * (count - 1) + 0.5);
+    return samples[index];
+}
+
+static inline void bench_print_latency(const char *label, long long *samples, int count, double seconds)
+{
+    printf("%-28s n=%-6d p50=%8.1fus p99=%8.1fus p99.9=%8.1fus  %9.0f req/s\n",
+           label, count,
+           bench_percentile(samples, count, 50.0) / 1000.0,
+           bench_percentile(samples, count, 99.0) / 1000.0,
+           bench_percentile(samples, count, 99.9) / 1000.0,
+           seconds > 0 ? count / seconds : 0.0);
+}
+
+#endif
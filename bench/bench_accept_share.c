@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/loop_group.h"
+#include <pthread.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/*
+ * LOOPS event loops serving one port, for each way of sharing it (see
+ * loop_group.c). A client opens a connection, sends one request, waits for
+ * the reply and the close, and starts over, so the loops are mostly idle in
+ * epoll_wait() when a connection arrives.
+ *
+ * Reported per mode: listener wakeups per accepted connection (1.0 is
+ * ideal; the thundering herd shows up as more, with the extra wakeups
+ * finding accept() empty), context switches per connection for the whole
+ * process (the herd's extra wakeups cost a switch each even when the kernel
+ * finds the listener drained before epoll_wait() returns), and connection
+ * latency (connect to close).
+ *
+ * "one loop stalled" adds a long-lived client whose every request blocks
+ * the loop that accepted it for STALL_US, like a slow synchronous call in a
+ * handler. Connections that land on that loop wait for it: with
+ * SO_REUSEPORT the hash sends a fixed share there, while EPOLLEXCLUSIVE
+ * wakes a loop that is actually waiting.
+ */
+
+#define LOOPS 4
+#define REQUEST_SIZE 16
+#define STALL_US 2000
+#define DURATION_MS 1000
+#define MAX_SAMPLES 1000000
+
+static int on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)length;
+    (void)ctx;
+    if (data[0] == 'H')
+    {
+        bench_sleep_us(STALL_US); // The stalling client: keep this loop busy
+        return connection_send(conn, "h", 1);
+    }
+    int result = connection_send(conn, "ok\n", 3);
+    connection_close(conn);
+    return result;
+}
+
+static const Handler handler = {NULL, on_data, NULL, NULL};
+
+typedef struct
+{
+    struct sockaddr_in addr;
+    atomic_int stop;
+} Staller;
+
+static void *staller_main(void *arg)
+{
+    Staller *staller = (Staller *)arg;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&staller->addr, sizeof(staller->addr)) < 0)
+    {
+        perror("bench_accept_share: connect");
+        return NULL;
+    }
+    char request[REQUEST_SIZE];
+    memset(request, 'H', sizeof(request));
+    char reply[1];
+    while (!atomic_load(&staller->stop))
+    {
+        send(fd, request, sizeof(request), MSG_NOSIGNAL);
+        if (recv(fd, reply, sizeof(reply), 0) <= 0)
+        {
+            break;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void run(const char *label, LoopShare share, int stalled)
+{
+    int port;
+    ServerSocket *server = create_server_socket("127.0.0.1", 0, 1024);
+    if (!server || (share == LOOP_SHARE_REUSEPORT && server_reuse_port(server) < 0) || server_bind(server) < 0 ||
+        server_listen(server) < 0)
+    {
+        fprintf(stderr, "bench_accept_share: could not listen\n");
+        exit(1);
+    }
+    struct sockaddr_in bound;
+    socklen_t len = sizeof(bound);
+    getsockname(server->server_socket.fd, (struct sockaddr *)&bound, &len);
+    port = ntohs(bound.sin_port);
+    server->server_socket.port = port;
+
+    LoopGroup *group = loop_group_create(server, LOOPS, share, &handler, NULL);
+    if (!group || loop_group_start(group, NULL) < 0)
+    {
+        fprintf(stderr, "bench_accept_share: could not start the loops\n");
+        exit(1);
+    }
+
+    Staller staller;
+    memset(&staller, 0, sizeof(staller));
+    staller.addr.sin_family = AF_INET;
+    staller.addr.sin_port = htons(port);
+    staller.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    pthread_t staller_thread;
+    if (stalled)
+    {
+        pthread_create(&staller_thread, NULL, staller_main, &staller);
+        bench_sleep_us(20000);
+    }
+
+    long long *samples = (long long *)malloc(sizeof(long long) * MAX_SAMPLES);
+    int count = 0;
+    char request[REQUEST_SIZE];
+    memset(request, 'q', sizeof(request));
+    struct rusage before;
+    getrusage(RUSAGE_SELF, &before);
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    while (bench_now_ns() < end && count < MAX_SAMPLES)
+    {
+        long long opened = bench_now_ns();
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)&staller.addr, sizeof(staller.addr)) < 0)
+        {
+            perror("bench_accept_share: connect");
+            exit(1);
+        }
+        send(fd, request, sizeof(request), MSG_NOSIGNAL);
+        char reply[16];
+        while (recv(fd, reply, sizeof(reply), 0) > 0)
+        {
+        }
+        close(fd);
+        samples[count++] = bench_now_ns() - opened;
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+    struct rusage after;
+    getrusage(RUSAGE_SELF, &after);
+    long long switches = (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw);
+
+    if (stalled)
+    {
+        atomic_store(&staller.stop, 1);
+        pthread_join(staller_thread, NULL);
+    }
+    loop_group_stop(group);
+
+    long long wakeups = 0, misses = 0, accepted = 0, most = 0, least = -1;
+    for (int i = 0; i < LOOPS; i++)
+    {
+        EventLoop *loop = group->loops[i];
+        wakeups += loop->listener_wakeups;
+        misses += loop->accept_misses;
+        accepted += loop->accepted;
+        most = loop->accepted > most ? loop->accepted : most;
+        least = least < 0 || loop->accepted < least ? loop->accepted : least;
+    }
+    double per = accepted > 0 ? (double)accepted : 1.0;
+    bench_print_latency(label, samples, count, seconds);
+    printf("    %.2f listener wakeups/accept (%.2f found nothing), %.1f context switches/connection,"
+           " accepts per loop %lld..%lld\n",
+           wakeups / per, misses / per, switches / (count > 0 ? (double)count : 1.0), least, most);
+
+    loop_group_free(group);
+    server_free(server);
+    free(samples);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_accept_share: %d loops, one connection per request, %d ms per mode\n", LOOPS, DURATION_MS);
+    printf("-- even load\n");
+    run("herd (no flag)", LOOP_SHARE_HERD, 0);
+    run("EPOLLEXCLUSIVE", LOOP_SHARE_EXCLUSIVE, 0);
+    run("SO_REUSEPORT", LOOP_SHARE_REUSEPORT, 0);
+    printf("-- one loop stalled %d us per request\n", STALL_US);
+    run("herd (no flag)", LOOP_SHARE_HERD, 1);
+    run("EPOLLEXCLUSIVE", LOOP_SHARE_EXCLUSIVE, 1);
+    run("SO_REUSEPORT", LOOP_SHARE_REUSEPORT, 1);
+    return 0;
+}
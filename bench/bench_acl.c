@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/acl.h"
+#include <arpa/inet.h>
+#include <pthread.h>
+
+/*
+ * Lookup rate of the compiled ACL against a linear scan of the same rules.
+ *
+ * Builds V4_RULES random IPv4 prefixes (mostly /24, some shorter and longer,
+ * mixed allow and deny) and V6_RULES random IPv6 prefixes, checks a sample of
+ * lookups against the linear scan so the numbers are for correct answers,
+ * then times random lookups. A second part times acl_check_v4() on the live
+ * Acl while another thread keeps swapping in freshly compiled tables.
+ */
+
+#define V4_RULES 50000
+#define V6_RULES 20000
+#define LOOKUPS 4000000
+#define LINEAR_LOOKUPS 2000
+#define VERIFY 200000
+#define SWAP_LOOKUPS 2000000
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t next_random(void)
+{
+    // xorshift64: fast and deterministic, so every run sees the same rules
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int random_v4_length(void)
+{
+    int roll = (int)(next_random() % 100);
+    if (roll < 60)
+    {
+        return 24;
+    }
+    if (roll < 80)
+    {
+        return 16 + (int)(next_random() % 8);
+    }
+    if (roll < 90)
+    {
+        return 8 + (int)(next_random() % 8);
+    }
+    return 25 + (int)(next_random() % 8);
+}
+
+// Reference answer: longest matching prefix, later rule wins a tie
+static AclAction linear_lookup(const AclBuilder *builder, int v6, uint64_t hi, uint64_t lo)
+{
+    int best = -1;
+    AclAction action = ACL_ALLOW;
+    for (int i = 0; i < builder->count; i++)
+    {
+        const AclRule *rule = &builder->rules[i];
+        if (rule->v6 != v6 || rule->length < best)
+        {
+            continue;
+        }
+        uint64_t hi_mask = rule->length >= 64 ? ~0ULL : (rule->length == 0 ? 0 : ~0ULL << (64 - rule->length));
+        uint64_t lo_mask = rule->length <= 64 ? 0 : (rule->length >= 128 ? ~0ULL : ~0ULL << (128 - rule->length));
+        if ((hi & hi_mask) == rule->hi && (lo & lo_mask) == rule->lo)
+        {
+            best = rule->length;
+            action = rule->action;
+        }
+    }
+    return action;
+}
+
+static AclBuilder *random_rules(void)
+{
+    AclBuilder *builder = acl_builder_create();
+    for (int i = 0; i < V4_RULES; i++)
+    {
+        uint32_t addr = htonl((uint32_t)next_random());
+        acl_builder_add_v4(builder, addr, random_v4_length(), next_random() % 4 ? ACL_DENY : ACL_ALLOW);
+    }
+    for (int i = 0; i < V6_RULES; i++)
+    {
+        struct in6_addr addr;
+        uint64_t hi = 0x2000000000000000ULL | (next_random() >> 3); // Global unicast 2000::/3
+        uint64_t lo = next_random();
+        for (int b = 0; b < 8; b++)
+        {
+            addr.s6_addr[b] = (uint8_t)(hi >> (56 - 8 * b));
+            addr.s6_addr[8 + b] = (uint8_t)(lo >> (56 - 8 * b));
+        }
+        int length = 32 + (int)(next_random() % 97); // /32 .. /128
+        acl_builder_add_v6(builder, &addr, length, next_random() % 4 ? ACL_DENY : ACL_ALLOW);
+    }
+    return builder;
+}
+
+// Addresses that hit a rule about half the time: a rule's prefix with random host bits
+static uint32_t *random_v4_keys(const AclBuilder *builder, int count)
+{
+    uint32_t *keys = (uint32_t *)malloc(sizeof(uint32_t) * count);
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t random = (uint32_t)next_random();
+        if (i & 1)
+        {
+            const AclRule *rule = &builder->rules[next_random() % V4_RULES];
+            uint32_t prefix = (uint32_t)(rule->hi >> 32);
+            uint32_t host_mask = rule->length >= 32 ? 0 : 0xffffffffu >> rule->length;
+            random = prefix | (random & host_mask);
+        }
+        keys[i] = htonl(random);
+    }
+    return keys;
+}
+
+static int verify(const AclTable *table, const AclBuilder *builder)
+{
+    uint32_t *keys = random_v4_keys(builder, VERIFY);
+    int mismatches = 0;
+    for (int i = 0; i < VERIFY / 100; i++)
+    {
+        uint64_t hi = (uint64_t)ntohl(keys[i]) << 32;
+        mismatches += acl_table_lookup_v4(table, keys[i]) != linear_lookup(builder, 0, hi, 0);
+    }
+    for (int i = 0; i < VERIFY / 100; i++)
+    {
+        struct in6_addr addr;
+        const AclRule *rule = &builder->rules[V4_RULES + next_random() % V6_RULES];
+        uint64_t hi = i & 1 ? rule->hi | (next_random() & 0xffff) : next_random();
+        uint64_t lo = next_random();
+        for (int b = 0; b < 8; b++)
+        {
+            addr.s6_addr[b] = (uint8_t)(hi >> (56 - 8 * b));
+            addr.s6_addr[8 + b] = (uint8_t)(lo >> (56 - 8 * b));
+        }
+        mismatches += acl_table_lookup_v6(table, &addr) != linear_lookup(builder, 1, hi, lo);
+    }
+    free(keys);
+    return mismatches;
+}
+
+typedef struct
+{
+    Acl *acl;
+    AclBuilder *builder;
+    atomic_int stop;
+    int swaps;
+} Swapper;
+
+static void *swap_main(void *arg)
+{
+    Swapper *swapper = (Swapper *)arg;
+    while (!atomic_load(&swapper->stop))
+    {
+        acl_swap(swapper->acl, acl_builder_compile(swapper->builder, ACL_ALLOW));
+        swapper->swaps++;
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    AclBuilder *builder = random_rules();
+
+    long long start = bench_now_ns();
+    AclTable *table = acl_builder_compile(builder, ACL_ALLOW);
+    double compile_ms = (bench_now_ns() - start) / 1e6;
+
+    printf("bench_acl: %d IPv4 + %d IPv6 rules, compiled in %.1f ms, %zu KiB "
+           "(v4: %u nodes %u leaves, v6: %u nodes %u leaves)\n",
+           V4_RULES, V6_RULES, compile_ms, acl_table_memory(table) / 1024,
+           table->v4.node_count, table->v4.leaf_count, table->v6.node_count, table->v6.leaf_count);
+
+    int mismatches = verify(table, builder);
+    printf("verified %d lookups against a linear scan: %d mismatches\n", 2 * (VERIFY / 100), mismatches);
+    if (mismatches)
+    {
+        return 1;
+    }
+
+    uint32_t *keys = random_v4_keys(builder, LOOKUPS);
+    int denied = 0;
+    start = bench_now_ns();
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        denied += acl_table_lookup_v4(table, keys[i]) == ACL_DENY;
+    }
+    double trie_ns = (double)(bench_now_ns() - start) / LOOKUPS;
+    printf("%-28s %8.1f ns/lookup  %7.1f M lookups/s  (%d denied)\n",
+           "poptrie IPv4", trie_ns, 1000.0 / trie_ns, denied);
+
+    struct in6_addr *keys6 = (struct in6_addr *)malloc(sizeof(struct in6_addr) * LOOKUPS / 4);
+    for (int i = 0; i < LOOKUPS / 4; i++)
+    {
+        const AclRule *rule = &builder->rules[V4_RULES + next_random() % V6_RULES];
+        uint64_t hi = rule->hi | (next_random() & 0xffff);
+        uint64_t lo = rule->lo | (next_random() & 0xffff);
+        for (int b = 0; b < 8; b++)
+        {
+            keys6[i].s6_addr[b] = (uint8_t)(hi >> (56 - 8 * b));
+            keys6[i].s6_addr[8 + b] = (uint8_t)(lo >> (56 - 8 * b));
+        }
+    }
+    denied = 0;
+    start = bench_now_ns();
+    for (int i = 0; i < LOOKUPS / 4; i++)
+    {
+        denied += acl_table_lookup_v6(table, &keys6[i]) == ACL_DENY;
+    }
+    double trie6_ns = (double)(bench_now_ns() - start) / (LOOKUPS / 4);
+    printf("%-28s %8.1f ns/lookup  %7.1f M lookups/s  (%d denied)\n",
+           "poptrie IPv6", trie6_ns, 1000.0 / trie6_ns, denied);
+
+    denied = 0;
+    start = bench_now_ns();
+    for (int i = 0; i < LINEAR_LOOKUPS; i++)
+    {
+        denied += linear_lookup(builder, 0, (uint64_t)ntohl(keys[i]) << 32, 0) == ACL_DENY;
+    }
+    double linear_ns = (double)(bench_now_ns() - start) / LINEAR_LOOKUPS;
+    printf("%-28s %8.1f ns/lookup  %7.3f M lookups/s  (%.0fx slower)\n",
+           "linear scan IPv4", linear_ns, 1000.0 / linear_ns, linear_ns / trie_ns);
+
+    // The live path: reader counters plus a writer swapping tables underneath
+    Swapper swapper;
+    memset(&swapper, 0, sizeof(swapper));
+    swapper.acl = acl_create(table);
+    swapper.builder = builder;
+    pthread_t thread;
+    pthread_create(&thread, NULL, swap_main, &swapper);
+
+    denied = 0;
+    start = bench_now_ns();
+    for (int i = 0; i < SWAP_LOOKUPS; i++)
+    {
+        denied += acl_check_v4(swapper.acl, keys[i]) == ACL_DENY;
+    }
+    double live_ns = (double)(bench_now_ns() - start) / SWAP_LOOKUPS;
+    atomic_store(&swapper.stop, 1);
+    pthread_join(thread, NULL);
+    printf("%-28s %8.1f ns/lookup  %7.1f M lookups/s  (%d swaps during the run)\n",
+           "acl_check_v4 while swapping", live_ns, 1000.0 / live_ns, swapper.swaps);
+
+    acl_free(swapper.acl);
+    acl_builder_free(builder);
+    free(keys);
+    free(keys6);
+    return 0;
+}
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/admin.h"
+#include <poll.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * The admin channel: how long a listing takes, and what answering it costs
+ * a loop that is busy serving.
+ *
+ *   list, N idle       `list` round trip over the Unix socket while the loop
+ *                      holds N idle connections: every row sorted and printed
+ *   count, N idle      the same with limit=0: the loop's walk and the
+ *                      round trip, without the formatting
+ *   close all          close every connection through the channel, then
+ *                      a `list` to check that none is left
+ *   echo, N Hz         the loop's echo throughput while an admin client
+ *                      lists every connection N times a second
+ */
+
+#define IDLE 4096
+#define LISTS 200
+#define CONNECTIONS 16
+#define MESSAGE_SIZE 32
+#define DURATION_MS 500
+
+static const char *admin_path = "/tmp/bench_admin.sock";
+
+static int echo_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)ctx;
+    return connection_send(conn, data, length);
+}
+
+static const Handler echo_handler = {NULL, echo_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+static int loopback(int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bench_admin: connect");
+        exit(1);
+    }
+    return fd;
+}
+
+// One command; the last line of the reply (the summary) goes into 'summary'
+static void command(const char *line, char *summary, int size)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    memcpy(addr.sun_path, admin_path, strlen(admin_path));
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bench_admin: admin connect");
+        exit(1);
+    }
+    dprintf(fd, "%s\n", line);
+    shutdown(fd, SHUT_WR);
+    static char reply[1 << 20];
+    int length = 0;
+    ssize_t n;
+    while ((n = recv(fd, reply + length, sizeof(reply) - 1 - length, 0)) > 0)
+    {
+        length += (int)n;
+    }
+    close(fd);
+    reply[length] = '\0';
+    if (length > 0 && reply[length - 1] == '\n')
+    {
+        reply[--length] = '\0';
+    }
+    char *last = strrchr(reply, '\n');
+    snprintf(summary, size, "%.100s", last ? last + 1 : reply); // The summary line is short
+}
+
+static atomic_int listing;
+
+static void *lister_main(void *arg)
+{
+    long interval_us = *(long *)arg;
+    char summary[128];
+    while (atomic_load(&listing))
+    {
+        command("list", summary, sizeof(summary));
+        bench_sleep_us(interval_us);
+    }
+    return NULL;
+}
+
+static void echo(int hz, int port)
+{
+    pthread_t lister;
+    long interval_us = hz > 0 ? 1000000 / hz : 0;
+    atomic_store(&listing, hz > 0);
+    if (hz > 0)
+    {
+        pthread_create(&lister, NULL, lister_main, &interval_us);
+    }
+
+    struct pollfd pfds[CONNECTIONS];
+    char message[MESSAGE_SIZE];
+    memset(message, 'a', sizeof(message));
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        pfds[i].fd = loopback(port);
+        pfds[i].events = POLLIN;
+        send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+    }
+
+    long long requests = 0;
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    while (bench_now_ns() < end)
+    {
+        if (poll(pfds, CONNECTIONS, 100) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            char buffer[MESSAGE_SIZE];
+            // Echoes are small enough to arrive whole
+            if (pfds[i].revents & POLLIN && recv(pfds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT) == MESSAGE_SIZE)
+            {
+                requests++;
+                send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+            }
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    atomic_store(&listing, 0);
+    if (hz > 0)
+    {
+        pthread_join(lister, NULL);
+    }
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        close(pfds[i].fd);
+    }
+    char label[32];
+    snprintf(label, sizeof(label), "echo, listed %d Hz", hz);
+    printf("%-28s %9.0f req/s\n", label, requests / seconds);
+}
+
+static void list(const char *format, const char *line)
+{
+    char summary[128];
+    long long *samples = malloc(LISTS * sizeof(long long));
+    long long start = bench_now_ns();
+    for (int i = 0; i < LISTS; i++)
+    {
+        long long begun = bench_now_ns();
+        command(line, summary, sizeof(summary));
+        samples[i] = bench_now_ns() - begun;
+    }
+    char label[32];
+    snprintf(label, sizeof(label), format, IDLE);
+    bench_print_latency(label, samples, LISTS, (bench_now_ns() - start) / 1e9);
+    free(samples);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+    int port;
+    ServerSocket *server = bench_listen(1024, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    AdminServer *admin = admin_start(admin_path, &loop, 1);
+    if (!loop || !admin)
+    {
+        return 1;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    printf("bench_admin: %d idle connections; %d connections echoing %d-byte requests, %d ms each\n", IDLE,
+           CONNECTIONS, MESSAGE_SIZE, DURATION_MS);
+    int *idle = malloc(IDLE * sizeof(int));
+    for (int i = 0; i < IDLE; i++)
+    {
+        idle[i] = loopback(port);
+    }
+    char summary[128];
+    do
+    {
+        bench_sleep_us(10000); // Until the loop has accepted them all
+        command("list limit=0", summary, sizeof(summary));
+    } while (atoi(summary) < IDLE);
+
+    list("list, %d idle", "list sort=age");
+    list("count, %d idle", "list limit=0");
+
+    echo(0, port);
+    echo(10, port);
+    echo(100, port);
+
+    command("close all", summary, sizeof(summary));
+    printf("%-28s %s\n", "close all", summary);
+    command("list", summary, sizeof(summary));
+    printf("%-28s %s\n", "list after close", summary);
+
+    for (int i = 0; i < IDLE; i++)
+    {
+        close(idle[i]);
+    }
+    free(idle);
+    admin_stop(admin);
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+    event_loop_free(loop);
+    server_free(server);
+    return 0;
+}
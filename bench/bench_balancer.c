@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/balancer.h"
+#include "../src/proxy.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Balancing policies under skewed backend latency.
+ *
+ * Four loopback backends, each with BACKEND_WORKERS blocking workers (so a
+ * backend has finite capacity and builds a queue when overloaded). Backend 0
+ * takes SLOW_US per request, the others FAST_US. CLIENTS closed-loop clients
+ * go through the proxy, one connection per request, with one warm pooled
+ * upstream connection per backend.
+ *
+ * Round-robin keeps sending a quarter of the traffic to the slow backend and
+ * its queue sets the tail. P2C and bounded-load chash steer around it.
+ */
+
+#define BACKENDS 4
+#define BACKEND_WORKERS 2
+#define FAST_US 1000
+#define SLOW_US 10000
+#define CLIENTS 8
+#define REQUESTS_PER_CLIENT 100
+
+typedef struct
+{
+    ServerSocket *server;
+    long service_us;
+    int served;
+} BenchBackend;
+
+static BenchBackend backends[BACKENDS];
+static int proxy_port;
+
+static void *backend_worker(void *arg)
+{
+    BenchBackend *backend = (BenchBackend *)arg;
+    char buffer[256];
+
+    for (;;)
+    {
+        Socket *client = server_accept(backend->server);
+        if (!client)
+        {
+            return NULL;
+        }
+        if (recv(client->fd, buffer, sizeof(buffer), 0) > 0)
+        {
+            bench_sleep_us(backend->service_us);
+            send(client->fd, "pong\n", 5, MSG_NOSIGNAL);
+            __atomic_fetch_add(&backend->served, 1, __ATOMIC_RELAXED);
+        }
+        socket_close(client);
+        free(client);
+    }
+}
+
+typedef struct
+{
+    long long *samples;
+    int count;
+} ClientResult;
+
+static void *client_main(void *arg)
+{
+    ClientResult *result = (ClientResult *)arg;
+    char buffer[64];
+
+    for (int i = 0; i < REQUESTS_PER_CLIENT; i++)
+    {
+        long long start = bench_now_ns();
+        ClientSocket *client = create_client_socket("127.0.0.1", proxy_port);
+        if (!client || client_connect(client) < 0)
+        {
+            client_free(client);
+            continue;
+        }
+        send(client->client_socket.fd, "ping\n", 5, MSG_NOSIGNAL);
+        while (recv(client->client_socket.fd, buffer, sizeof(buffer), 0) > 0)
+        {
+        }
+        client_free(client);
+        result->samples[result->count++] = bench_now_ns() - start;
+    }
+    return NULL;
+}
+
+static void *proxy_main(void *arg)
+{
+    proxy_run((Proxy *)arg);
+    return NULL;
+}
+
+static void run_policy(BalancePolicy policy)
+{
+    Balancer *lb = balancer_create(policy);
+    for (int b = 0; b < BACKENDS; b++)
+    {
+        balancer_add_backend(lb, "127.0.0.1", backends[b].server->server_socket.port);
+        backends[b].served = 0;
+    }
+    balancer_finalize(lb);
+
+    ServerSocket *listener = bench_listen(128, &proxy_port);
+    Proxy *proxy = proxy_create(listener, lb, 1);
+    pthread_t proxy_thread;
+    pthread_create(&proxy_thread, NULL, proxy_main, proxy);
+
+    pthread_t threads[CLIENTS];
+    ClientResult results[CLIENTS];
+    long long *samples = (long long *)malloc(sizeof(long long) * CLIENTS * REQUESTS_PER_CLIENT);
+
+    long long start = bench_now_ns();
+    for (int c = 0; c < CLIENTS; c++)
+    {
+        results[c].samples = samples + c * REQUESTS_PER_CLIENT;
+        results[c].count = 0;
+        pthread_create(&threads[c], NULL, client_main, &results[c]);
+    }
+
+    int total = 0;
+    for (int c = 0; c < CLIENTS; c++)
+    {
+        pthread_join(threads[c], NULL);
+        // Compact into one contiguous sample array
+        memmove(samples + total, results[c].samples, sizeof(long long) * results[c].count);
+        total += results[c].count;
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    proxy_stop(proxy);
+    pthread_join(proxy_thread, NULL);
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s (slow share %d%%)", balancer_policy_name(policy),
+             total ? backends[0].served * 100 / total : 0);
+    bench_print_latency(label, samples, total, seconds);
+
+    proxy_free(proxy);
+    server_free(listener);
+    balancer_free(lb);
+    free(samples);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    pthread_t workers[BACKENDS][BACKEND_WORKERS];
+    for (int b = 0; b < BACKENDS; b++)
+    {
+        int port;
+        backends[b].server = bench_listen(64, &port);
+        backends[b].service_us = b == 0 ? SLOW_US : FAST_US;
+        for (int w = 0; w < BACKEND_WORKERS; w++)
+        {
+            pthread_create(&workers[b][w], NULL, backend_worker, &backends[b]);
+        }
+    }
+
+    printf("bench_balancer: %d backends (1 x %dus, %d x %dus), %d clients x %d requests\n",
+           BACKENDS, SLOW_US, BACKENDS - 1, FAST_US, CLIENTS, REQUESTS_PER_CLIENT);
+    run_policy(BALANCE_ROUND_ROBIN);
+    run_policy(BALANCE_P2C);
+    run_policy(BALANCE_CHASH);
+
+    for (int b = 0; b < BACKENDS; b++)
+    {
+        server_stop(backends[b].server);
+    }
+    for (int b = 0; b < BACKENDS; b++)
+    {
+        for (int w = 0; w < BACKEND_WORKERS; w++)
+        {
+            pthread_join(workers[b][w], NULL);
+        }
+        server_free(backends[b].server);
+    }
+    return 0;
+}
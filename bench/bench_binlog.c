@@ -0,0 +1,108 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/binlog.h"
+#include "../src/clock.h"
+#include <pthread.h>
+
+/*
+ * What a log message costs as text and as a binary record.
+ *
+ *   fprintf, buffered     the verbose message formatted into a stdio
+ *                         buffer on /dev/null: the formatting alone, with
+ *                         the write() amortised over 4 KiB
+ *   BINLOG                the same message as a format id, a timestamp and
+ *                         the raw arguments in this thread's chunk; the
+ *                         clock ticks once per 16 messages, as in a loop
+ *                         iteration serving 16 events
+ *   BINLOG, fd only       "[CLOSE] Closing socket (fd: %d)": one integer
+ *   BINLOG, THREADS       THREADS threads logging at once, each into its
+ *                         own chunks
+ *   decode                binlog_decode() rendering the whole file as text,
+ *                         offline; it must find every event
+ */
+
+#define MESSAGES 2000000
+#define THREADS 4
+#define BINLOG_FILE "build/bench_binlog.bin"
+
+static const char *payload = "GET /index.html HTTP/1.1";
+
+static void report(const char *label, long long start)
+{
+    printf("%-28s %6.1f ns/message\n", label, (double)(bench_now_ns() - start) / MESSAGES);
+}
+
+static void *logger_main(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < MESSAGES / THREADS; i++)
+    {
+        if (i % 16 == 0)
+        {
+            clock_tick();
+        }
+        BINLOG("[SEND] Sent %d bytes: %s\n", i, payload);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    FILE *null = fopen("/dev/null", "w");
+    if (!null || binlog_open(BINLOG_FILE, 512UL << 20) < 0)
+    {
+        return 1;
+    }
+    printf("bench_binlog: %d messages per run\n", MESSAGES);
+
+    long long start = bench_now_ns();
+    for (int i = 0; i < MESSAGES; i++)
+    {
+        fprintf(null, "[SEND] Sent %d bytes: %s\n", i, payload);
+    }
+    report("fprintf, buffered", start);
+
+    start = bench_now_ns();
+    for (int i = 0; i < MESSAGES; i++)
+    {
+        if (i % 16 == 0)
+        {
+            clock_tick();
+        }
+        BINLOG("[SEND] Sent %d bytes: %s\n", i, payload);
+    }
+    report("BINLOG", start);
+
+    start = bench_now_ns();
+    for (int i = 0; i < MESSAGES; i++)
+    {
+        if (i % 16 == 0)
+        {
+            clock_tick();
+        }
+        BINLOG("[CLOSE] Closing socket (fd: %d)\n", i);
+    }
+    report("BINLOG, fd only", start);
+
+    pthread_t threads[THREADS];
+    start = bench_now_ns();
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, logger_main, NULL);
+    }
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    report("BINLOG, 4 threads", start);
+    binlog_close();
+    fclose(null);
+
+    FILE *out = fopen("/dev/null", "w");
+    start = bench_now_ns();
+    int decoded = binlog_decode(BINLOG_FILE, out);
+    fclose(out);
+    printf("%-28s %6.1f ns/message, %d of %d events\n", "decode", (double)(bench_now_ns() - start) / decoded,
+           decoded, 3 * MESSAGES);
+    return decoded == 3 * MESSAGES ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/clock.h"
+
+/*
+ * What stamping every event with the time costs.
+ *
+ * An "iteration" is a batch of BATCH events, as epoll_wait() would return
+ * them; each event takes the time once (to set a deadline, say) and the
+ * loop keeps the earliest deadline.
+ *
+ *   clock_gettime per event    what the wrapper did before
+ *   tick + cached              clock_tick() per iteration, clock_cached_ns() per event
+ *   TSC per event              clock_now_ns() reading the TSC directly
+ *   TSC tick + cached          both
+ *
+ * Then how far the TSC clock drifts from CLOCK_MONOTONIC over a second.
+ */
+
+#define BATCH 64
+#define ITERATIONS 200000
+#define TIMEOUT_NS 5000000LL
+
+static volatile long long sink; // Keeps the deadlines from being optimised away
+
+typedef enum
+{
+    PER_EVENT,
+    PER_ITERATION,
+} Stamping;
+
+static void run(const char *label, Stamping stamping)
+{
+    long long earliest = 0;
+    long long start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        if (stamping == PER_ITERATION)
+        {
+            clock_tick();
+        }
+        for (int e = 0; e < BATCH; e++)
+        {
+            long long now = stamping == PER_EVENT ? clock_now_ns() : clock_cached_ns();
+            long long deadline = now + TIMEOUT_NS + e;
+            if (!earliest || deadline < earliest)
+            {
+                earliest = deadline;
+            }
+        }
+    }
+    long long elapsed = bench_now_ns() - start;
+    sink = earliest;
+    double events = (double)ITERATIONS * BATCH;
+    printf("%-28s %6.2f ns/event  %7.1f M events/s\n", label, elapsed / events, events / (elapsed / 1e9) / 1e6);
+}
+
+static long long monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(void)
+{
+    printf("bench_clock: %d iterations x %d events\n", ITERATIONS, BATCH);
+    clock_use_tsc(0);
+    run("clock_gettime per event", PER_EVENT);
+    run("tick + cached", PER_ITERATION);
+
+    if (!clock_use_tsc(1))
+    {
+        printf("%-28s skipped: no invariant TSC\n", "TSC");
+        return 0;
+    }
+    run("TSC per event", PER_EVENT);
+    run("TSC tick + cached", PER_ITERATION);
+
+    long long worst = 0;
+    long long start = monotonic_ns();
+    while (monotonic_ns() - start < 1000000000LL)
+    {
+        long long before = monotonic_ns();
+        long long tsc = clock_now_ns();
+        long long after = monotonic_ns();
+        long long error = tsc < before ? before - tsc : tsc > after ? tsc - after : 0;
+        worst = error > worst ? error : worst;
+        bench_sleep_us(10000);
+    }
+    printf("TSC against CLOCK_MONOTONIC over 1 s: at most %lld ns apart\n", worst);
+    return 0;
+}
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/event_loop.h"
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/*
+ * Output coalescing: a server that answers each request with MESSAGES small
+ * messages (think of a pub/sub fan-out or a streamed result set).
+ *
+ *   send per message   the handler calls send() for every message; with
+ *                      Nagle's algorithm on (the default) small writes also
+ *                      wait for ACKs, which delayed ACKs hold back ~40 ms
+ *   ... + TCP_NODELAY  the same without Nagle: only the syscall cost remains
+ *   queued (EPOLLOUT)  connection_send() queueing only (write_first off):
+ *                      written on EPOLLOUT
+ *   end of iteration   coalesced, flushed after each batch of events
+ *   4 KiB or 200 us    coalesced across iterations: size or deadline
+ *
+ * CONNECTIONS clients keep PIPELINE requests in flight each. Reported per
+ * mode: request latency, server syscalls per message (recv + send +
+ * epoll_ctl or io_uring_enter + epoll_wait, counted by the loop) and bytes
+ * per send().
+ *
+ * The deadline mode makes the fewest syscalls but, in this closed loop where
+ * clients wait for answers before asking again, every held-back response is
+ * up to max_delay_us late and throughput drops with it. Deadlines pay off for
+ * open-loop traffic (streams, fan-out) where more data arrives meanwhile.
+ */
+
+#define CONNECTIONS 16
+#define PIPELINE 4
+#define REQUEST_SIZE 16
+#define MESSAGES 8
+#define MESSAGE_SIZE 64
+#define RESPONSE_SIZE (MESSAGES * MESSAGE_SIZE)
+#define DURATION_MS 1000
+#define MAX_SAMPLES 2000000
+
+typedef struct
+{
+    int direct;                   // send() per message from the handler
+    int nodelay;                  // TCP_NODELAY on accepted sockets
+    const CoalescePolicy *policy; // NULL = plain connection_send()
+    long long direct_sends;
+    long long messages;
+} Mode;
+
+static int on_accept(Connection *conn, void *ctx)
+{
+    Mode *mode = (Mode *)ctx;
+    connection_set_coalescing(conn, mode->policy);
+    if (mode->nodelay)
+    {
+        int one = 1;
+        setsockopt(conn->socket->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    conn->user = (void *)(intptr_t)0; // Bytes of an incomplete request
+    return 0;
+}
+
+static int on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)data;
+    Mode *mode = (Mode *)ctx;
+    int pending = (int)(intptr_t)conn->user + length;
+    char message[MESSAGE_SIZE];
+    memset(message, 'm', sizeof(message));
+    message[MESSAGE_SIZE - 1] = '\n';
+
+    for (; pending >= REQUEST_SIZE; pending -= REQUEST_SIZE)
+    {
+        for (int m = 0; m < MESSAGES; m++)
+        {
+            mode->messages++;
+            if (mode->direct && conn->output_length == 0)
+            {
+                mode->direct_sends++;
+                ssize_t n = send(conn->socket->fd, message, sizeof(message), MSG_NOSIGNAL);
+                if (n == (ssize_t)sizeof(message))
+                {
+                    continue;
+                }
+                if (n < 0 && errno != EAGAIN)
+                {
+                    return -1;
+                }
+                if (connection_send(conn, message + (n > 0 ? n : 0), (int)sizeof(message) - (n > 0 ? (int)n : 0)) < 0)
+                {
+                    return -1;
+                }
+                continue;
+            }
+            if (connection_send(conn, message, sizeof(message)) < 0)
+            {
+                return -1;
+            }
+        }
+    }
+    conn->user = (void *)(intptr_t)pending;
+    return 0;
+}
+
+static const Handler handler = {on_accept, on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+typedef struct
+{
+    long long sent_at[PIPELINE];
+    int head;
+    int received;
+} ClientState;
+
+static void run(const char *label, Mode *mode)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &handler, mode);
+    loop->write_first = 0; // Write-first would make "queued" a send per message
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    struct pollfd pfds[CONNECTIONS];
+    static ClientState clients[CONNECTIONS];
+    char request[REQUEST_SIZE];
+    memset(request, 'r', sizeof(request));
+    memset(clients, 0, sizeof(clients));
+
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        pfds[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        pfds[i].events = POLLIN;
+        if (connect(pfds[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bench_coalesce: connect");
+            exit(1);
+        }
+        for (int p = 0; p < PIPELINE; p++)
+        {
+            clients[i].sent_at[p] = bench_now_ns();
+            send(pfds[i].fd, request, sizeof(request), MSG_NOSIGNAL);
+        }
+    }
+
+    long long *samples = (long long *)malloc(sizeof(long long) * MAX_SAMPLES);
+    int count = 0;
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    char buffer[65536];
+
+    while (bench_now_ns() < end)
+    {
+        if (poll(pfds, CONNECTIONS, 100) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            if (!(pfds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            int n = (int)recv(pfds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n <= 0)
+            {
+                continue;
+            }
+            ClientState *c = &clients[i];
+            c->received += n;
+            long long now = bench_now_ns();
+            while (c->received >= RESPONSE_SIZE)
+            {
+                // Responses come back in order: the oldest request is done
+                c->received -= RESPONSE_SIZE;
+                if (count < MAX_SAMPLES)
+                {
+                    samples[count++] = now - c->sent_at[c->head];
+                }
+                c->sent_at[c->head] = now;
+                c->head = (c->head + 1) % PIPELINE;
+                send(pfds[i].fd, request, sizeof(request), MSG_NOSIGNAL);
+            }
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        close(pfds[i].fd);
+    }
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+
+    long long sends = loop->send_calls + mode->direct_sends;
+    long long syscalls = loop->recv_calls + sends + loop->ctl_calls + loop->ring_calls + loop->iterations;
+    long long changes = loop->ctl_calls + loop->ring_ops;
+    double messages = mode->messages > 0 ? (double)mode->messages : 1.0;
+    bench_print_latency(label, samples, count, seconds);
+    printf("    %.3f syscalls/message (%.3f send, %.3f epoll changes), %.0f bytes/send\n",
+           syscalls / messages, sends / messages, changes / messages,
+           sends ? messages * MESSAGE_SIZE / sends : 0.0);
+
+    event_loop_free(loop);
+    server_free(server);
+    free(samples);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_coalesce: %d connections x %d pipelined requests, %d x %d-byte messages per response\n",
+           CONNECTIONS, PIPELINE, MESSAGES, MESSAGE_SIZE);
+
+    static const CoalescePolicy end_of_iteration = {0, 1, 0};
+    static const CoalescePolicy size_or_deadline = {4096, 0, 200};
+    Mode direct = {1, 0, NULL, 0, 0};
+    Mode direct_nodelay = {1, 1, NULL, 0, 0};
+    Mode queued = {0, 0, NULL, 0, 0};
+    Mode iteration = {0, 0, &end_of_iteration, 0, 0};
+    Mode deadline = {0, 0, &size_or_deadline, 0, 0};
+
+    run("send per message", &direct);
+    run("send per message + NODELAY", &direct_nodelay);
+    run("queued (EPOLLOUT)", &queued);
+    run("coalesced: end of iteration", &iteration);
+    run("coalesced: 4 KiB or 200 us", &deadline);
+    return 0;
+}
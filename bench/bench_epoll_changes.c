@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/event_loop.h"
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Cost of epoll bookkeeping under connection churn: every client connects,
+ * sends one request, gets one reply and is closed by the server (think
+ * HTTP/1.0). BATCH clients connect at once, so an iteration of the loop
+ * accepts many connections together.
+ *
+ *   epoll_ctl    the loop's change list applied with one epoll_ctl() each
+ *   io_uring     the same list as one io_uring_enter() per iteration
+ *
+ * Either way the server never needs EPOLL_CTL_DEL (close() does it) and
+ * write-first replies never arm EPOLLOUT, so the only change left per
+ * connection is its EPOLL_CTL_ADD. Before the change list, the same
+ * workload cost an ADD and a DEL per connection, each its own syscall.
+ */
+
+#define BATCH 64
+#define REQUEST_SIZE 16
+#define DURATION_MS 1000
+
+static int reply_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)data;
+    (void)length;
+    (void)ctx;
+    int result = connection_send(conn, "ok\n", 3);
+    connection_close(conn);
+    return result;
+}
+
+static const Handler reply_handler = {NULL, reply_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+static void run(const char *label, int use_ring)
+{
+    int port;
+    ServerSocket *server = bench_listen(1024, &port);
+    server_defer_accept(server, 1); // Accept connections in bursts, once their request is in
+    EventLoop *loop = event_loop_create(server, &reply_handler, NULL);
+    if (!event_loop_use_ring(loop, use_ring) && use_ring)
+    {
+        printf("%-28s skipped: io_uring with IORING_OP_EPOLL_CTL is not available\n", label);
+        event_loop_free(loop);
+        server_free(server);
+        return;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    char request[REQUEST_SIZE];
+    memset(request, 'q', sizeof(request));
+    long long connections = 0;
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    while (bench_now_ns() < end)
+    {
+        struct pollfd pfds[BATCH];
+        for (int i = 0; i < BATCH; i++)
+        {
+            pfds[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+            pfds[i].events = POLLIN;
+            if (connect(pfds[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+            {
+                perror("bench_epoll_changes: connect");
+                exit(1);
+            }
+        }
+        for (int i = 0; i < BATCH; i++)
+        {
+            send(pfds[i].fd, request, sizeof(request), MSG_NOSIGNAL);
+        }
+
+        // Each client is done when the server has replied and closed (EOF)
+        int open = BATCH;
+        while (open > 0 && poll(pfds, BATCH, 1000) > 0)
+        {
+            for (int i = 0; i < BATCH; i++)
+            {
+                char reply[16];
+                if (pfds[i].fd >= 0 && pfds[i].revents & (POLLIN | POLLHUP) &&
+                    recv(pfds[i].fd, reply, sizeof(reply), MSG_DONTWAIT) <= 0)
+                {
+                    close(pfds[i].fd);
+                    pfds[i].fd = -1;
+                    open--;
+                    connections++;
+                }
+            }
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+
+    double per = connections > 0 ? (double)connections : 1.0;
+    printf("%-28s %8.0f connections/s  %.3f epoll syscalls/connection (%.3f changes), %.1f changes per syscall\n",
+           label, connections / seconds, (loop->ctl_calls + loop->ring_calls) / per,
+           (loop->ctl_calls + loop->ring_ops) / per,
+           loop->ctl_calls + loop->ring_calls
+               ? (double)(loop->ctl_calls + loop->ring_ops) / (loop->ctl_calls + loop->ring_calls)
+               : 0.0);
+
+    event_loop_free(loop);
+    server_free(server);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_epoll_changes: %d clients at a time, one request each, %d ms per mode\n", BATCH, DURATION_MS);
+    run("epoll_ctl", 0);
+    run("io_uring", 1);
+    return 0;
+}
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/event_loop.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Fairness under a firehose: an echo server on the event loop, SMALL clients
+ * each keeping one MESSAGE_SIZE request in flight, and optionally one bulk
+ * client that writes BULK_CHUNK-byte blocks as fast as the server takes them
+ * (and throws the echo away).
+ *
+ * Without a budget every bulk event costs a 64 KiB read, a 64 KiB copy into
+ * the output queue and a write of everything queued, and the small requests
+ * that became ready at the same time wait behind it. With a FairnessBudget
+ * the bulk connection gets that many bytes per iteration and is continued in
+ * the next one: a smaller budget trades bulk throughput for small-client
+ * latency.
+ *
+ * All three parties share the machine: with few cores the tail is set by
+ * the bulk client's thread holding a CPU the server needs, which no budget
+ * in the server can fix. On one CPU the small clients' p99 goes from under
+ * 100 us alone to over a millisecond with the bulk client, budget or not
+ * (2 KiB brings it to about half a millisecond); the median and the small
+ * requests per second show the loop's share.
+ */
+
+#define SMALL 8
+#define MESSAGE_SIZE 32
+#define BULK_CHUNK 65536
+#define DURATION_MS 1000
+#define MAX_SAMPLES 2000000
+
+static int echo_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)ctx;
+    return connection_send(conn, data, length);
+}
+
+static const Handler echo_handler = {NULL, echo_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+typedef struct
+{
+    int port;
+    atomic_int stop;
+    long long bytes; // Echoed back to the bulk client
+} BulkClient;
+
+static void *bulk_main(void *arg)
+{
+    BulkClient *bulk = (BulkClient *)arg;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(bulk->port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bench_fairness: bulk connect");
+        return NULL;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    static char chunk[BULK_CHUNK];
+    static char sink[BULK_CHUNK];
+    memset(chunk, 'b', sizeof(chunk));
+    struct pollfd pfd = {fd, POLLIN | POLLOUT, 0};
+    while (!atomic_load(&bulk->stop))
+    {
+        if (poll(&pfd, 1, 100) <= 0)
+        {
+            continue;
+        }
+        if (pfd.revents & POLLIN)
+        {
+            ssize_t n;
+            while ((n = recv(fd, sink, sizeof(sink), 0)) > 0)
+            {
+                bulk->bytes += n;
+            }
+        }
+        if (pfd.revents & POLLOUT)
+        {
+            send(fd, chunk, sizeof(chunk), MSG_NOSIGNAL);
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void run(const char *label, int with_bulk, const FairnessBudget *budget)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    event_loop_set_budget(loop, budget);
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    BulkClient bulk = {port, 0, 0};
+    pthread_t bulk_thread;
+    if (with_bulk)
+    {
+        pthread_create(&bulk_thread, NULL, bulk_main, &bulk);
+        bench_sleep_us(50000); // Let it saturate the server first
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    struct pollfd pfds[SMALL];
+    long long sent_at[SMALL];
+    int received[SMALL];
+    char message[MESSAGE_SIZE];
+    memset(message, 's', sizeof(message));
+    for (int i = 0; i < SMALL; i++)
+    {
+        pfds[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        pfds[i].events = POLLIN;
+        if (connect(pfds[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bench_fairness: connect");
+            exit(1);
+        }
+    }
+
+    long long *samples = (long long *)malloc(sizeof(long long) * MAX_SAMPLES);
+    int count = 0;
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    for (int i = 0; i < SMALL; i++)
+    {
+        sent_at[i] = bench_now_ns();
+        received[i] = 0;
+        send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+    }
+
+    while (bench_now_ns() < end)
+    {
+        if (poll(pfds, SMALL, 100) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < SMALL; i++)
+        {
+            if (!(pfds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            char buffer[MESSAGE_SIZE];
+            int n = (int)recv(pfds[i].fd, buffer, sizeof(buffer) - received[i], MSG_DONTWAIT);
+            if (n <= 0)
+            {
+                continue;
+            }
+            received[i] += n;
+            if (received[i] == MESSAGE_SIZE)
+            {
+                long long now = bench_now_ns();
+                if (count < MAX_SAMPLES)
+                {
+                    samples[count++] = now - sent_at[i];
+                }
+                received[i] = 0;
+                sent_at[i] = now;
+                send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+            }
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+    long long bulk_bytes = bulk.bytes;
+
+    for (int i = 0; i < SMALL; i++)
+    {
+        close(pfds[i].fd);
+    }
+    if (with_bulk)
+    {
+        atomic_store(&bulk.stop, 1);
+        pthread_join(bulk_thread, NULL);
+    }
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+
+    bench_print_latency(label, samples, count, seconds);
+    if (with_bulk)
+    {
+        printf("    bulk client: %.0f MB/s echoed, cut off by its budget %lld times\n",
+               bulk_bytes / seconds / 1e6, loop->over_budget);
+    }
+
+    event_loop_free(loop);
+    server_free(server);
+    free(samples);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_fairness: %d small clients x %d-byte requests, bulk client writing %d-byte blocks\n",
+           SMALL, MESSAGE_SIZE, BULK_CHUNK);
+
+    static const FairnessBudget budget = {8192, 8192, 4};
+    static const FairnessBudget tight = {2048, 2048, 1};
+    run("small clients only", 0, NULL);
+    run("small only, 8 KiB budget", 0, &budget);
+    run("+ bulk, no budget", 1, NULL);
+    run("+ bulk, 8 KiB budget", 1, &budget);
+    run("+ bulk, 2 KiB budget", 1, &tight);
+    return 0;
+}
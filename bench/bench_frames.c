@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/frame.h"
+#include "../src/sniff.h"
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Receive-side batching on the binary protocol (sniff.h framing). The client
+ * sends BURST frames in one write and waits for all echoes; the server is
+ *
+ *   frame by frame   recv(header) + recv(payload) + send() per frame, as a
+ *                    blocking handler without a reader is usually written
+ *   reader, 1 reply  frame_reader_next() batches, but one send() per frame
+ *   reader, batched  frame_reader_serve(): one send() for the whole batch
+ *
+ * Reported: burst round-trip latency, frames per second and server syscalls
+ * per frame. With BURST 1 every read holds one frame and the modes should
+ * be close; the batch pays off as soon as clients pipeline.
+ */
+
+#define PAYLOAD_SIZE 32
+#define FRAME_SIZE (SNIFF_BINARY_HEADER + PAYLOAD_SIZE)
+#define MAX_BURST 32
+#define DURATION_MS 500
+#define MAX_SAMPLES 1000000
+
+typedef enum
+{
+    MODE_FRAME_BY_FRAME,
+    MODE_READER_PER_FRAME,
+    MODE_READER_BATCHED,
+} Mode;
+
+typedef struct
+{
+    ServerSocket *server;
+    Mode mode;
+    long long recv_calls;
+    long long send_calls;
+    long long frames;
+} ServerThread;
+
+static int echo_each(Socket *client, const Frame *frames, int count, void *ctx)
+{
+    ServerThread *t = (ServerThread *)ctx;
+    for (int i = 0; i < count; i++)
+    {
+        t->send_calls++;
+        if (send(client->fd, frames[i].data, frames[i].length, MSG_NOSIGNAL) != frames[i].length)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int echo_batch(Socket *client, const Frame *frames, int count, void *ctx)
+{
+    ServerThread *t = (ServerThread *)ctx;
+    const Frame *last = &frames[count - 1];
+    int length = (int)(last->data + last->length - frames[0].data);
+    t->send_calls++;
+    return send(client->fd, frames[0].data, length, MSG_NOSIGNAL) == length ? 0 : -1;
+}
+
+static void *server_main(void *arg)
+{
+    ServerThread *t = (ServerThread *)arg;
+    Socket *client = server_accept(t->server);
+    if (!client)
+    {
+        return NULL;
+    }
+    // Without this, Nagle holds each small per-frame reply for the previous ACK
+    int one = 1;
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (t->mode == MODE_FRAME_BY_FRAME)
+    {
+        unsigned char frame[SNIFF_BINARY_HEADER + 65535];
+        for (;;)
+        {
+            t->recv_calls++;
+            if (recv(client->fd, frame, SNIFF_BINARY_HEADER, MSG_WAITALL) != SNIFF_BINARY_HEADER)
+            {
+                break;
+            }
+            int length = frame[2] << 8 | frame[3];
+            t->recv_calls++;
+            if (recv(client->fd, frame + SNIFF_BINARY_HEADER, length, MSG_WAITALL) != length)
+            {
+                break;
+            }
+            t->frames++;
+            t->send_calls++;
+            send(client->fd, frame, SNIFF_BINARY_HEADER + length, MSG_NOSIGNAL);
+        }
+    }
+    else
+    {
+        FrameReader *reader = frame_reader_create(client, frame_size_binary, SNIFF_BINARY_HEADER + 65535);
+        frame_reader_serve(reader, t->mode == MODE_READER_BATCHED ? echo_batch : echo_each, t);
+        t->recv_calls = reader->reads;
+        t->frames = reader->frames_read;
+        frame_reader_free(reader);
+    }
+    socket_close(client);
+    free(client);
+    return NULL;
+}
+
+static void run(const char *label, Mode mode, int burst)
+{
+    int port;
+    ServerThread t = {bench_listen(16, &port), mode, 0, 0, 0};
+    pthread_t thread;
+    pthread_create(&thread, NULL, server_main, &t);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bench_frames: connect");
+        exit(1);
+    }
+
+    unsigned char request[MAX_BURST * FRAME_SIZE];
+    for (int i = 0; i < burst; i++)
+    {
+        unsigned char *frame = request + i * FRAME_SIZE;
+        frame[0] = SNIFF_BINARY_MAGIC;
+        frame[1] = SNIFF_BINARY_VERSION;
+        frame[2] = PAYLOAD_SIZE >> 8;
+        frame[3] = PAYLOAD_SIZE & 0xff;
+        memset(frame + SNIFF_BINARY_HEADER, 'p', PAYLOAD_SIZE);
+    }
+
+    long long *samples = (long long *)malloc(sizeof(long long) * MAX_SAMPLES);
+    int count = 0;
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    unsigned char reply[MAX_BURST * FRAME_SIZE];
+
+    while (bench_now_ns() < end && count < MAX_SAMPLES)
+    {
+        long long sent_at = bench_now_ns();
+        send(fd, request, burst * FRAME_SIZE, MSG_NOSIGNAL);
+        if (recv(fd, reply, burst * FRAME_SIZE, MSG_WAITALL) != burst * FRAME_SIZE)
+        {
+            fprintf(stderr, "bench_frames: short reply\n");
+            exit(1);
+        }
+        samples[count++] = bench_now_ns() - sent_at;
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    close(fd);
+    pthread_join(thread, NULL);
+
+    double frames = t.frames > 0 ? (double)t.frames : 1.0;
+    bench_print_latency(label, samples, count, seconds);
+    printf("    %.0f frames/s, %.3f recv + %.3f send per frame\n",
+           t.frames / seconds, t.recv_calls / frames, t.send_calls / frames);
+
+    server_free(t.server);
+    free(samples);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_frames: %d-byte frames, %d ms per mode\n", FRAME_SIZE, DURATION_MS);
+    int bursts[] = {1, 16};
+    for (size_t b = 0; b < sizeof(bursts) / sizeof(bursts[0]); b++)
+    {
+        printf("-- burst of %d frames\n", bursts[b]);
+        run("frame by frame", MODE_FRAME_BY_FRAME, bursts[b]);
+        run("reader, reply per frame", MODE_READER_PER_FRAME, bursts[b]);
+        run("reader, batched reply", MODE_READER_BATCHED, bursts[b]);
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/hedge.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/*
+ * Hedged requests against replicas with an occasional slow response.
+ *
+ * REPLICAS loopback replicas answer in FAST_US, except SLOW_PCT percent of
+ * requests which take SLOW_US (a "momentarily slow replica"). Each replica
+ * handles every connection on its own thread, so a slow request does not
+ * hold up the others.
+ *
+ *   1) no hedging              - p99 is the slow path
+ *   2) hedging at p95          - p99 collapses towards FAST_US + hedge delay
+ *   3) then every request slow - the same client still hedges at its old
+ *                                p95, which would double the load; the retry
+ *                                budget caps extra attempts at 10% plus a
+ *                                small burst
+ */
+
+#define REPLICAS 3
+#define FAST_US 200
+#define SLOW_US 20000
+#define REQUESTS 1000
+#define OVERLOAD_REQUESTS 200
+
+static atomic_int slow_pct;
+
+typedef struct
+{
+    ServerSocket *server;
+    int port;
+} BenchReplica;
+
+static void *replica_connection(void *arg)
+{
+    Socket *client = (Socket *)arg;
+    char buffer[256];
+    if (recv(client->fd, buffer, sizeof(buffer), 0) > 0)
+    {
+        int slow = rand() % 100 < atomic_load(&slow_pct);
+        bench_sleep_us(slow ? SLOW_US : FAST_US);
+        send(client->fd, "pong\n", 5, MSG_NOSIGNAL);
+    }
+    socket_close(client);
+    free(client);
+    return NULL;
+}
+
+static void *replica_main(void *arg)
+{
+    BenchReplica *replica = (BenchReplica *)arg;
+    for (;;)
+    {
+        Socket *client = server_accept(replica->server);
+        if (!client)
+        {
+            return NULL;
+        }
+        pthread_t thread;
+        pthread_create(&thread, NULL, replica_connection, client);
+        pthread_detach(thread);
+    }
+}
+
+static HedgeClient *make_client(BenchReplica *replicas, int hedging)
+{
+    HedgeClient *client = hedge_client_create();
+    client->hedging = hedging;
+    client->hedge_percentile = 95.0;
+    for (int r = 0; r < REPLICAS; r++)
+    {
+        hedge_add_replica(client, "127.0.0.1", replicas[r].port);
+    }
+    return client;
+}
+
+static void run(const char *label, HedgeClient *client, int requests, int pct)
+{
+    atomic_store(&slow_pct, pct);
+    memset(&client->stats, 0, sizeof(client->stats));
+
+    long long *samples = (long long *)malloc(sizeof(long long) * requests);
+    int count = 0;
+    char response[64];
+    long long start = bench_now_ns();
+    for (int i = 0; i < requests; i++)
+    {
+        long long t0 = bench_now_ns();
+        if (hedge_request(client, "ping\n", response, sizeof(response)) >= 0)
+        {
+            samples[count++] = bench_now_ns() - t0;
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    bench_print_latency(label, samples, count, seconds);
+    printf("%-28s extra attempts %.1f%% (hedges %lld, won %lld, budget denied %lld)\n", "",
+           100.0 * (client->stats.hedges + client->stats.retries) / client->stats.requests,
+           client->stats.hedges, client->stats.hedge_wins, client->stats.budget_denied);
+    free(samples);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+    srand(42);
+
+    BenchReplica replicas[REPLICAS];
+    pthread_t threads[REPLICAS];
+    for (int r = 0; r < REPLICAS; r++)
+    {
+        replicas[r].server = bench_listen(128, &replicas[r].port);
+        pthread_create(&threads[r], NULL, replica_main, &replicas[r]);
+    }
+
+    printf("bench_hedge: %d replicas, %dus normally, %dus for the slow requests, %d requests\n",
+           REPLICAS, FAST_US, SLOW_US, REQUESTS);
+    HedgeClient *plain = make_client(replicas, 0);
+    run("2% slow, no hedging", plain, REQUESTS, 2);
+    hedge_client_free(plain);
+
+    HedgeClient *hedged = make_client(replicas, 1);
+    run("2% slow, hedge at p95", hedged, REQUESTS, 2);
+    run("100% slow, hedge at old p95", hedged, OVERLOAD_REQUESTS, 100);
+    hedge_client_free(hedged);
+
+    for (int r = 0; r < REPLICAS; r++)
+    {
+        server_stop(replicas[r].server);
+        pthread_join(threads[r], NULL);
+        server_free(replicas[r].server);
+    }
+    return 0;
+}
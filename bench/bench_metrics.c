@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/event_loop.h"
+#include "../src/metrics.h"
+#include "../src/stats.h"
+#include "../src/watchdog.h"
+#include <fcntl.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * The Prometheus endpoint: what a scrape costs, and what it costs the loops.
+ *
+ *   render             one metrics_render() of LOOPS loops' counters, their
+ *                      iteration histograms and a few user metrics, to
+ *                      /dev/null; with the heap growth over all of them
+ *                      (should be 0: the scrape reuses one buffer)
+ *   scrape             a whole GET /metrics over loopback, as Prometheus
+ *                      does it: connect, request, read to EOF
+ *   echo, N Hz         an echo loop's throughput while a scraper polls the
+ *                      endpoint N times a second (0 = not at all)
+ */
+
+#define LOOPS 8
+#define RENDERS 20000
+#define SCRAPES 2000
+#define CONNECTIONS 16
+#define MESSAGE_SIZE 32
+#define DURATION_MS 500
+
+static int metrics_port;
+
+static int echo_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)ctx;
+    return connection_send(conn, data, length);
+}
+
+static const Handler echo_handler = {NULL, echo_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+// One GET /metrics; the bytes of the response, -1 on failure
+static int scrape(void)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(metrics_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    static const char request[] = "GET /metrics HTTP/1.1\r\nHost: bench\r\n\r\n";
+    send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+    char buffer[16384];
+    int total = 0;
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+    {
+        total += (int)n;
+    }
+    close(fd);
+    return total;
+}
+
+static atomic_int scraping;
+
+// Scrape every 'arg' microseconds until told to stop
+static void *scraper_main(void *arg)
+{
+    long interval_us = *(long *)arg;
+    while (atomic_load(&scraping))
+    {
+        scrape();
+        bench_sleep_us(interval_us);
+    }
+    return NULL;
+}
+
+static void render(void)
+{
+    int null = open("/dev/null", O_WRONLY);
+    int bytes = metrics_render(null); // Warm-up: the first scrape may touch pages for the first time
+    size_t heap = mallinfo2().uordblks;
+    long long start = bench_now_ns();
+    for (int i = 0; i < RENDERS; i++)
+    {
+        metrics_render(null);
+    }
+    double ns = (double)(bench_now_ns() - start) / RENDERS;
+    long long grown = (long long)mallinfo2().uordblks - (long long)heap;
+    close(null);
+    printf("%-28s %6.1f us for %d bytes, heap grew %lld bytes over %d renders\n", "render", ns / 1000, bytes, grown,
+           RENDERS);
+
+    long long *samples = malloc(SCRAPES * sizeof(long long));
+    start = bench_now_ns();
+    for (int i = 0; i < SCRAPES; i++)
+    {
+        long long begun = bench_now_ns();
+        if (scrape() <= 0)
+        {
+            fprintf(stderr, "bench_metrics: scrape failed\n");
+            exit(1);
+        }
+        samples[i] = bench_now_ns() - begun;
+    }
+    bench_print_latency("scrape", samples, SCRAPES, (bench_now_ns() - start) / 1e9);
+    free(samples);
+}
+
+static void echo(int hz, StatsSegment *stats)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    stats_attach_loop(stats, loop);
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    pthread_t scraper;
+    long interval_us = hz > 0 ? 1000000 / hz : 0;
+    atomic_store(&scraping, hz > 0);
+    if (hz > 0)
+    {
+        pthread_create(&scraper, NULL, scraper_main, &interval_us);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    struct pollfd pfds[CONNECTIONS];
+    char message[MESSAGE_SIZE];
+    memset(message, 'm', sizeof(message));
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        pfds[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        pfds[i].events = POLLIN;
+        if (connect(pfds[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bench_metrics: connect");
+            exit(1);
+        }
+        send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+    }
+
+    long long requests = 0;
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    while (bench_now_ns() < end)
+    {
+        if (poll(pfds, CONNECTIONS, 100) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            char buffer[MESSAGE_SIZE];
+            // Echoes are small enough to arrive whole
+            if (pfds[i].revents & POLLIN && recv(pfds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT) == MESSAGE_SIZE)
+            {
+                requests++;
+                send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+            }
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    atomic_store(&scraping, 0);
+    if (hz > 0)
+    {
+        pthread_join(scraper, NULL);
+    }
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        close(pfds[i].fd);
+    }
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+    char label[32];
+    snprintf(label, sizeof(label), "echo, scraped %d Hz", hz);
+    printf("%-28s %9.0f req/s\n", label, requests / seconds);
+    event_loop_free(loop);
+    server_free(server);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+    watchdog_start(1000); // For the iteration histograms
+    StatsSegment *stats = stats_create();
+    if (!stats || metrics_start("127.0.0.1", 0, stats) < 0)
+    {
+        return 1;
+    }
+    struct sockaddr_in bound;
+    socklen_t len = sizeof(bound);
+    getsockname(metrics->server->server_socket.fd, (struct sockaddr *)&bound, &len);
+    metrics_port = ntohs(bound.sin_port);
+
+    // LOOPS loops that never run, each with a slot and a heartbeat on the page
+    int port;
+    ServerSocket *server = bench_listen(16, &port);
+    EventLoop *loops[LOOPS];
+    for (int i = 0; i < LOOPS; i++)
+    {
+        loops[i] = event_loop_create(server, &echo_handler, NULL);
+        stats_attach_loop(stats, loops[i]);
+        watchdog_heartbeat("loop");
+    }
+    static const double bounds[] = {0.001, 0.01, 0.1, 1};
+    Metric *requests = metrics_counter("bench_requests_total", "Requests.");
+    Metric *queue = metrics_gauge("bench_queue_depth", "Queued requests.");
+    Metric *latency = metrics_histogram("bench_latency_seconds", "Request latency.", bounds, 4);
+    for (int i = 0; i < 1000; i++)
+    {
+        metric_add(requests, 1);
+        metric_set(queue, i % 7);
+        metric_observe(latency, i / 1000.0);
+    }
+
+    printf("bench_metrics: %d loops on the page; %d connections echoing %d-byte requests, %d ms each\n", LOOPS,
+           CONNECTIONS, MESSAGE_SIZE, DURATION_MS);
+    render();
+    echo(0, stats);
+    echo(10, stats);
+    echo(1000, stats);
+
+    metrics_stop();
+    for (int i = 0; i < LOOPS; i++)
+    {
+        event_loop_free(loops[i]);
+    }
+    server_free(server);
+    stats_free(stats);
+    watchdog_stop();
+    return 0;
+}
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/event_loop.h"
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Long-lived connections that all landed on one loop of LOOPS. Every loop
+ * has a listener, but the clients only connect to loop 0's, as when
+ * SO_REUSEPORT's hash or an unlucky accept race piles connections onto one
+ * thread. CONNECTIONS clients then keep one request in flight each, and
+ * each request holds the loop for WORK_US (a blocking call standing in for
+ * CPU work, so the loops can overlap on a machine with a single core too).
+ *
+ *   pinned      connections stay on loop 0; the other loops idle
+ *   migrating   loop 0 hands its active connections to idle peers every
+ *               INTERVAL_MS while it is THRESHOLD_PCT points busier
+ *
+ * Reported: latency and throughput, where the connections ended up, and
+ * each loop's share of the run spent outside epoll_wait().
+ */
+
+#define LOOPS 4
+#define CONNECTIONS 16
+#define MESSAGE_SIZE 32
+#define WORK_US 50
+#define INTERVAL_MS 50
+#define THRESHOLD_PCT 25
+#define DURATION_MS 1500
+#define MAX_SAMPLES 2000000
+
+static int work_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)ctx;
+    bench_sleep_us(WORK_US);
+    return connection_send(conn, data, length);
+}
+
+static const Handler work_handler = {NULL, work_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+static void run(const char *label, int migrate)
+{
+    // Both runs measure load the same way; the pinned one never crosses the threshold
+    MigrationPolicy policy = {INTERVAL_MS, migrate ? THRESHOLD_PCT : 1000, 4};
+    ServerSocket *servers[LOOPS];
+    EventLoop *loops[LOOPS];
+    pthread_t threads[LOOPS];
+    int port = 0;
+    for (int i = 0; i < LOOPS; i++)
+    {
+        int loop_port;
+        servers[i] = bench_listen(128, &loop_port);
+        port = i == 0 ? loop_port : port;
+        loops[i] = event_loop_create(servers[i], &work_handler, NULL);
+    }
+    for (int i = 0; i < LOOPS; i++)
+    {
+        event_loop_set_migration(loops[i], loops, LOOPS, &policy);
+        pthread_create(&threads[i], NULL, loop_main, loops[i]);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    struct pollfd pfds[CONNECTIONS];
+    long long sent_at[CONNECTIONS];
+    int received[CONNECTIONS];
+    char message[MESSAGE_SIZE];
+    memset(message, 'm', sizeof(message));
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        pfds[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        pfds[i].events = POLLIN;
+        if (connect(pfds[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bench_migration: connect");
+            exit(1);
+        }
+    }
+    bench_sleep_us(20000); // Let loop 0 accept everyone
+
+    long long busy[LOOPS];
+    long long start = bench_now_ns();
+    for (int i = 0; i < LOOPS; i++)
+    {
+        busy[i] = atomic_load(&loops[i]->busy_ns);
+    }
+    long long *samples = (long long *)malloc(sizeof(long long) * MAX_SAMPLES);
+    int count = 0;
+    long long end = start + DURATION_MS * 1000000LL;
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        sent_at[i] = bench_now_ns();
+        received[i] = 0;
+        send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+    }
+
+    while (bench_now_ns() < end)
+    {
+        if (poll(pfds, CONNECTIONS, 100) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            if (!(pfds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            char buffer[MESSAGE_SIZE];
+            int n = (int)recv(pfds[i].fd, buffer, sizeof(buffer) - received[i], MSG_DONTWAIT);
+            if (n <= 0)
+            {
+                continue;
+            }
+            received[i] += n;
+            if (received[i] == MESSAGE_SIZE)
+            {
+                long long now = bench_now_ns();
+                if (count < MAX_SAMPLES)
+                {
+                    samples[count++] = now - sent_at[i];
+                }
+                received[i] = 0;
+                sent_at[i] = now;
+                send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+            }
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    char loads[128];
+    char spread[64];
+    int offset = 0;
+    int spread_offset = 0;
+    long long migrated = 0;
+    for (int i = 0; i < LOOPS; i++)
+    {
+        offset += snprintf(loads + offset, sizeof(loads) - offset, " %.0f%%",
+                           (atomic_load(&loops[i]->busy_ns) - busy[i]) / (seconds * 1e7));
+        spread_offset += snprintf(spread + spread_offset, sizeof(spread) - spread_offset, " %d",
+                                  loops[i]->connection_count);
+        migrated += loops[i]->migrated_out;
+    }
+
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        close(pfds[i].fd);
+    }
+    for (int i = 0; i < LOOPS; i++)
+    {
+        event_loop_stop(loops[i]);
+    }
+    for (int i = 0; i < LOOPS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    bench_print_latency(label, samples, count, seconds);
+    printf("    connections per loop:%s  busy:%s  %lld handed off\n", spread, loads, migrated);
+
+    for (int i = 0; i < LOOPS; i++)
+    {
+        event_loop_free(loops[i]);
+        server_free(servers[i]);
+    }
+    free(samples);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_migration: %d loops, %d connections accepted by loop 0, %d us per request, %d ms each\n",
+           LOOPS, CONNECTIONS, WORK_US, DURATION_MS);
+    run("pinned", 0);
+    run("migrating", 1);
+    return 0;
+}
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/dispatch.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Worker-pool server at twice its capacity, with and without overload control.
+ *
+ * The handler holds one shared "resource" (a mutex) for SERVICE_US, so the
+ * server can complete at most 1/SERVICE_US requests per second no matter how
+ * many workers run, and latency grows with concurrency - like a CPU- or
+ * disk-bound service. An open-loop generator offers OFFERED_RATE new
+ * connections per second for DURATION_MS; clients give up after
+ * CLIENT_TIMEOUT_MS.
+ *
+ * Without control the accept queue grows without bound and almost every
+ * request times out. With CoDel and the adaptive limiter the excess is
+ * rejected within milliseconds and the rest is served at near-normal latency.
+ */
+
+#define WORKERS 32
+#define SERVICE_US 1000
+#define OFFERED_RATE 2000
+#define DURATION_MS 1000
+#define CLIENT_TIMEOUT_MS 1000
+#define MAX_OUTSTANDING 8192
+
+static pthread_mutex_t resource = PTHREAD_MUTEX_INITIALIZER;
+
+static void handle(Socket *client, void *ctx)
+{
+    (void)ctx;
+    char buffer[64];
+    if (recv(client->fd, buffer, sizeof(buffer), 0) <= 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&resource);
+    bench_sleep_us(SERVICE_US);
+    pthread_mutex_unlock(&resource);
+    send(client->fd, "pong\n", 5, MSG_NOSIGNAL);
+}
+
+static void *pool_main(void *arg)
+{
+    worker_pool_run((WorkerPool *)arg);
+    return NULL;
+}
+
+typedef struct
+{
+    int fd;
+    int sent;
+    long long start;
+} Outstanding;
+
+typedef struct
+{
+    long long ok;
+    long long rejected;
+    long long timed_out;
+    long long errors;
+    long long *ok_latency;
+    long long *reject_latency;
+} LoadResult;
+
+// Open-loop generator: new connections at a fixed rate, regardless of answers
+static void generate_load(int port, LoadResult *result)
+{
+    static Outstanding outstanding[MAX_OUTSTANDING];
+    struct pollfd pfds[MAX_OUTSTANDING];
+    int count = 0;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    long long next = start;
+    long long gap = 1000000000LL / OFFERED_RATE;
+
+    while (bench_now_ns() < end || count > 0)
+    {
+        long long now = bench_now_ns();
+        while (next <= now && next < end && count < MAX_OUTSTANDING)
+        {
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+            {
+                result->errors++;
+                close(fd);
+            }
+            else
+            {
+                outstanding[count].fd = fd;
+                outstanding[count].sent = 0;
+                outstanding[count].start = next;
+                count++;
+            }
+            next += gap;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            pfds[i].fd = outstanding[i].fd;
+            pfds[i].events = outstanding[i].sent ? POLLIN : POLLOUT;
+        }
+        poll(pfds, count, 1);
+        now = bench_now_ns();
+
+        for (int i = 0; i < count; i++)
+        {
+            Outstanding *o = &outstanding[i];
+            int done = 0;
+            if (pfds[i].revents & POLLOUT && !o->sent)
+            {
+                o->sent = send(o->fd, "ping\n", 5, MSG_NOSIGNAL) == 5;
+                done = !o->sent;
+                result->errors += done;
+            }
+            else if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                char buffer[64];
+                int n = recv(o->fd, buffer, sizeof(buffer), 0);
+                if (n > 0 && buffer[0] == 'p')
+                {
+                    result->ok_latency[result->ok++] = now - o->start;
+                }
+                else if (n > 0)
+                {
+                    result->reject_latency[result->rejected++] = now - o->start;
+                }
+                else
+                {
+                    result->errors++;
+                }
+                done = 1;
+            }
+            else if (now - o->start > CLIENT_TIMEOUT_MS * 1000000LL)
+            {
+                result->timed_out++;
+                done = 1;
+            }
+
+            if (done)
+            {
+                close(o->fd);
+                outstanding[i] = outstanding[--count];
+                pfds[i] = pfds[count];
+                i--;
+            }
+        }
+    }
+}
+
+static void run(const char *label, LimitAlgorithm algorithm, int codel_target_ms)
+{
+    int port;
+    ServerSocket *server = bench_listen(4096, &port);
+    CodelQueue *queue = codel_create(MAX_OUTSTANDING, codel_target_ms * 1000000LL, 100 * 1000000LL);
+    ConcurrencyLimiter *limiter = limiter_create(algorithm, WORKERS, 1, WORKERS);
+    WorkerPool *pool = worker_pool_create(server, WORKERS, queue, limiter, handle, NULL);
+    if (!pool)
+    {
+        fprintf(stderr, "bench_overload: could not start the worker pool\n");
+        exit(1);
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, pool_main, pool);
+
+    int max_requests = OFFERED_RATE * DURATION_MS / 1000 + 16;
+    LoadResult result;
+    memset(&result, 0, sizeof(result));
+    result.ok_latency = (long long *)malloc(sizeof(long long) * max_requests);
+    result.reject_latency = (long long *)malloc(sizeof(long long) * max_requests);
+
+    generate_load(port, &result);
+
+    worker_pool_stop(pool);
+    pthread_join(thread, NULL);
+    worker_pool_free(pool);
+
+    long long total = result.ok + result.rejected + result.timed_out + result.errors;
+    printf("%-24s ok %5lld  rejected %5lld  timed out %5lld  (of %lld)  final limit %d\n",
+           label, result.ok, result.rejected, result.timed_out, total, limiter_current(limiter));
+    bench_print_latency("    served latency", result.ok_latency, (int)result.ok, DURATION_MS / 1000.0);
+    bench_print_latency("    rejection latency", result.reject_latency, (int)result.rejected, DURATION_MS / 1000.0);
+
+    free(result.ok_latency);
+    free(result.reject_latency);
+    limiter_free(limiter);
+    codel_free(queue);
+    server_free(server);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_overload: capacity %d req/s, offered %d req/s for %d ms, %d workers\n",
+           1000000 / SERVICE_US, OFFERED_RATE, DURATION_MS, WORKERS);
+    run("no control", LIMIT_OFF, 0);
+    run("codel only", LIMIT_OFF, 5);
+    run("codel + aimd", LIMIT_AIMD, 5);
+    run("codel + gradient", LIMIT_GRADIENT, 5);
+    return 0;
+}
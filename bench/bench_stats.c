@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/clock.h"
+#include "../src/event_loop.h"
+#include "../src/stats.h"
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * The stats segment: what publishing costs the loop, and whether a reader
+ * ever sees a torn snapshot.
+ *
+ *   publish            one stats_publish(), as at the end of every iteration
+ *   snapshot           one stats_snapshot() by a reader, e.g. `top`
+ *   torn reads         a writer publishes counters that are always equal
+ *                      while a reader snapshots them for DURATION_MS: any
+ *                      snapshot where they differ is torn (should be 0)
+ *   echo, off / on     an echo loop's throughput without and with a slot
+ */
+
+#define PUBLISHES 10000000
+#define CONNECTIONS 16
+#define MESSAGE_SIZE 32
+#define DURATION_MS 500
+
+static int echo_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)ctx;
+    return connection_send(conn, data, length);
+}
+
+static const Handler echo_handler = {NULL, echo_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+static atomic_int writing;
+
+// Publish equal counters until told to stop
+static void *writer_main(void *arg)
+{
+    EventLoop *loop = (EventLoop *)arg;
+    while (atomic_load_explicit(&writing, memory_order_relaxed))
+    {
+        loop->iterations++;
+        loop->accepted = loop->iterations;
+        loop->bytes_in = loop->iterations;
+        loop->bytes_out = loop->iterations;
+        stats_publish(loop);
+    }
+    return NULL;
+}
+
+static void seqlock(StatsSegment *stats, EventLoop *loop)
+{
+    int index = stats_attach_loop(stats, loop);
+    clock_tick(); // As a loop does every iteration: the publish stamp is the cached time
+    long long start = bench_now_ns();
+    for (int i = 0; i < PUBLISHES; i++)
+    {
+        stats_publish(loop);
+    }
+    printf("%-28s %6.1f ns\n", "publish", (double)(bench_now_ns() - start) / PUBLISHES);
+
+    long long counters[STATS_COUNTERS];
+    start = bench_now_ns();
+    for (int i = 0; i < PUBLISHES; i++)
+    {
+        stats_snapshot(stats, index, counters);
+    }
+    printf("%-28s %6.1f ns\n", "snapshot", (double)(bench_now_ns() - start) / PUBLISHES);
+
+    atomic_store(&writing, 1);
+    pthread_t writer;
+    pthread_create(&writer, NULL, writer_main, loop);
+    long long snapshots = 0;
+    long long torn = 0;
+    long long retried_out = 0;
+    long long end = bench_now_ns() + DURATION_MS * 1000000LL;
+    while (bench_now_ns() < end)
+    {
+        if (stats_snapshot(stats, index, counters) < 0)
+        {
+            retried_out++;
+            continue;
+        }
+        snapshots++;
+        long long value = counters[STATS_ITERATIONS];
+        if (counters[STATS_ACCEPTED] != value || counters[STATS_BYTES_IN] != value ||
+            counters[STATS_BYTES_OUT] != value)
+        {
+            torn++;
+        }
+    }
+    atomic_store(&writing, 0);
+    pthread_join(writer, NULL);
+    printf("%-28s %lld of %lld snapshots (%lld gave up), %lld publishes\n", "torn reads", torn, snapshots,
+           retried_out, loop->iterations);
+    loop->stats = NULL;
+}
+
+static void echo(const char *label, StatsSegment *stats)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    if (stats)
+    {
+        stats_attach_loop(stats, loop);
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    struct pollfd pfds[CONNECTIONS];
+    char message[MESSAGE_SIZE];
+    memset(message, 's', sizeof(message));
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        pfds[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        pfds[i].events = POLLIN;
+        if (connect(pfds[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bench_stats: connect");
+            exit(1);
+        }
+        send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+    }
+
+    long long requests = 0;
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    while (bench_now_ns() < end)
+    {
+        if (poll(pfds, CONNECTIONS, 100) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            char buffer[MESSAGE_SIZE];
+            // Echoes are small enough to arrive whole
+            if (pfds[i].revents & POLLIN && recv(pfds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT) == MESSAGE_SIZE)
+            {
+                requests++;
+                send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+            }
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        close(pfds[i].fd);
+    }
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+    printf("%-28s %9.0f req/s\n", label, requests / seconds);
+    event_loop_free(loop);
+    server_free(server);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+    StatsSegment *stats = stats_create();
+    if (!stats)
+    {
+        return 1;
+    }
+
+    printf("bench_stats: %d connections echoing %d-byte requests, %d ms each\n", CONNECTIONS, MESSAGE_SIZE,
+           DURATION_MS);
+    int port;
+    ServerSocket *server = bench_listen(16, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    seqlock(stats, loop);
+    event_loop_free(loop);
+    server_free(server);
+
+    echo("echo, no stats", NULL);
+    echo("echo, publishing", stats);
+    stats_free(stats);
+    return 0;
+}
@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/event_loop.h"
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * System calls per request, by kind, as the wrapper counts them (syscalls.c).
+ *
+ *   echo, write-first  CONNECTIONS clients keep one request in flight each;
+ *                      connection_send() writes at once
+ *   echo, queued       the same with write_first off: the reply waits for
+ *                      EPOLLOUT, arming and disarming it every request;
+ *                      the changes batched through io_uring (skipped
+ *                      where the kernel has none)
+ *   echo, epoll_ctl    queued, with one epoll_ctl() per change instead
+ *   accept + close     connect, send one request, read the echo and close,
+ *                      one connection at a time: the cost of a connection
+ *   blocking client    socket_send() + socket_receive() on a ClientSocket,
+ *                      counted on the calling thread
+ *
+ * Every scenario has a budget per request for each kind. One over budget
+ * fails the run (exit 1), so a change that adds a syscall to the hot path
+ * breaks `make bench` instead of going unnoticed.
+ */
+
+#define CONNECTIONS 32
+#define MESSAGE_SIZE 64
+#define DURATION_MS 500
+#define CHURN 2000
+#define ROUND_TRIPS 20000
+
+typedef struct
+{
+    const char *label;
+    double budget[SYSCALL_KINDS]; // Per request; 0 = none allowed
+} Budget;
+
+static int over_budget;
+
+static int echo_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)ctx;
+    return connection_send(conn, data, length);
+}
+
+static const Handler echo_handler = {NULL, echo_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+static int loopback(int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bench_syscalls: connect");
+        exit(1);
+    }
+    return fd;
+}
+
+// Print what each request cost and check it against the budget
+static void report(const Budget *budget, const SyscallCounts *calls, long long requests,
+                   const long long *iterations)
+{
+    double per = requests > 0 ? (double)requests : 1.0;
+    printf("%-20s %8lld requests  %6.3f syscalls/request", budget->label, requests, syscall_total(calls) / per);
+    if (iterations)
+    {
+        long long count = 0;
+        for (int bucket = 0; bucket < SYSCALL_BUCKETS; bucket++)
+        {
+            count += iterations[bucket];
+        }
+        // The bucket holding the median iteration: 0, 1, 2-3, 4-7, ...
+        long long seen = 0;
+        int median = 0;
+        while (median < SYSCALL_BUCKETS - 1 && (seen += iterations[median]) * 2 < count)
+        {
+            median++;
+        }
+        printf("  %lld iterations, median %lld-%lld syscalls", count, median ? 1LL << (median - 1) : 0,
+               median ? (1LL << median) - 1 : 0);
+    }
+    printf("\n   ");
+    for (int kind = 0; kind < SYSCALL_KINDS; kind++)
+    {
+        double used = calls->calls[kind] / per;
+        if (calls->calls[kind] == 0 && budget->budget[kind] == 0)
+        {
+            continue;
+        }
+        int over = used > budget->budget[kind];
+        printf(" %s %.3f%s", syscall_names[kind], used, over ? " OVER" : "");
+        if (over)
+        {
+            fprintf(stderr, "bench_syscalls: %s: %.3f %s per request, budget %.3f\n", budget->label, used,
+                    syscall_names[kind], budget->budget[kind]);
+            over_budget = 1;
+        }
+    }
+    printf("\n");
+}
+
+static void subtract(SyscallCounts *delta, const SyscallCounts *now, const SyscallCounts *then)
+{
+    for (int kind = 0; kind < SYSCALL_KINDS; kind++)
+    {
+        delta->calls[kind] = now->calls[kind] - then->calls[kind];
+    }
+}
+
+static void echo(const Budget *budget, int write_first, int ring)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    loop->write_first = write_first;
+    if (event_loop_use_ring(loop, ring) != ring)
+    {
+        printf("%-20s skipped: no io_uring\n", budget->label);
+        event_loop_free(loop);
+        server_free(server);
+        return;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    struct pollfd pfds[CONNECTIONS];
+    int received[CONNECTIONS];
+    char message[MESSAGE_SIZE];
+    memset(message, 's', sizeof(message));
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        pfds[i].fd = loopback(port);
+        pfds[i].events = POLLIN;
+        received[i] = 0;
+    }
+    bench_sleep_us(20000); // Let the loop accept everyone before counting
+
+    // Read while the loop runs, as bench_write_first does: the accepts and the teardown are not per request
+    SyscallCounts then = loop->syscalls;
+    long long requests = loop->requests;
+    long long iterations[SYSCALL_BUCKETS];
+    memcpy(iterations, loop->iteration_syscalls, sizeof(iterations));
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+    }
+    long long end = bench_now_ns() + DURATION_MS * 1000000LL;
+    while (bench_now_ns() < end)
+    {
+        if (poll(pfds, CONNECTIONS, 100) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            char buffer[MESSAGE_SIZE];
+            int n;
+            if (!(pfds[i].revents & POLLIN) ||
+                (n = (int)recv(pfds[i].fd, buffer, sizeof(buffer) - received[i], MSG_DONTWAIT)) <= 0)
+            {
+                continue;
+            }
+            received[i] += n;
+            if (received[i] == MESSAGE_SIZE)
+            {
+                received[i] = 0;
+                send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+            }
+        }
+    }
+    bench_sleep_us(10000); // The requests in flight are answered; the loop goes back to sleep
+
+    SyscallCounts now = loop->syscalls;
+    SyscallCounts delta;
+    subtract(&delta, &now, &then);
+    requests = loop->requests - requests;
+    for (int bucket = 0; bucket < SYSCALL_BUCKETS; bucket++)
+    {
+        iterations[bucket] = loop->iteration_syscalls[bucket] - iterations[bucket];
+    }
+    report(budget, &delta, requests, iterations);
+
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        close(pfds[i].fd);
+    }
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+    event_loop_free(loop);
+    server_free(server);
+}
+
+static void churn(const Budget *budget)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    char message[MESSAGE_SIZE];
+    memset(message, 'c', sizeof(message));
+    for (int i = 0; i < CHURN; i++)
+    {
+        int fd = loopback(port);
+        send(fd, message, sizeof(message), MSG_NOSIGNAL);
+        char buffer[MESSAGE_SIZE];
+        int received = 0;
+        int n;
+        while (received < MESSAGE_SIZE && (n = (int)recv(fd, buffer, sizeof(buffer) - received, 0)) > 0)
+        {
+            received += n;
+        }
+        close(fd);
+    }
+    bench_sleep_us(20000); // The last close reaches the loop
+
+    // Here a request is a connection: counted from a loop that has done nothing else
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+    SyscallCounts calls = loop->syscalls;
+    calls.calls[SYSCALL_EVENTFD]--; // The wakeup event_loop_stop() sent
+    report(budget, &calls, loop->requests, loop->iteration_syscalls);
+    event_loop_free(loop);
+    server_free(server);
+}
+
+static void blocking(const Budget *budget)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    ClientSocket *client = create_client_socket("127.0.0.1", port);
+    if (!client || client_connect(client) < 0)
+    {
+        fprintf(stderr, "bench_syscalls: client connect failed\n");
+        exit(1);
+    }
+    char message[MESSAGE_SIZE];
+    memset(message, 'b', sizeof(message) - 1);
+    message[MESSAGE_SIZE - 1] = '\0';
+    char buffer[MESSAGE_SIZE];
+
+    SyscallCounts then = syscall_counts; // This thread's own calls
+    for (int i = 0; i < ROUND_TRIPS; i++)
+    {
+        socket_send(&client->client_socket, message);
+        int received = 0;
+        while (received < MESSAGE_SIZE - 1)
+        {
+            int n = socket_receive(&client->client_socket, buffer, sizeof(buffer));
+            if (n <= 0)
+            {
+                fprintf(stderr, "bench_syscalls: echo lost\n");
+                exit(1);
+            }
+            received += n;
+        }
+    }
+    SyscallCounts delta;
+    subtract(&delta, &syscall_counts, &then);
+    report(budget, &delta, ROUND_TRIPS, NULL);
+
+    client_free(client);
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+    event_loop_free(loop);
+    server_free(server);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    /*
+     * What each request may cost. The echoes' epoll_wait share is under one
+     * because a wakeup serves several connections, and the ring's share
+     * because one io_uring_enter() carries a wakeup's changes. accept +
+     * close pays the accept that finds the queue empty, two fcntl() for
+     * O_NONBLOCK and the registration (epoll_ctl or through the ring).
+     */
+    static const Budget budgets[] = {
+        {"echo, write-first", {[SYSCALL_RECV] = 1, [SYSCALL_SEND] = 1, [SYSCALL_EPOLL_WAIT] = 1}},
+        {"echo, queued",
+         {[SYSCALL_RECV] = 1, [SYSCALL_SEND] = 1, [SYSCALL_EPOLL_WAIT] = 1, [SYSCALL_IO_URING_ENTER] = 1}},
+        {"echo, epoll_ctl",
+         {[SYSCALL_RECV] = 1, [SYSCALL_SEND] = 1, [SYSCALL_EPOLL_WAIT] = 1, [SYSCALL_EPOLL_CTL] = 2}},
+        {"accept + close",
+         {[SYSCALL_ACCEPT] = 2, [SYSCALL_FCNTL] = 2, [SYSCALL_RECV] = 2, [SYSCALL_SEND] = 1, [SYSCALL_EPOLL_WAIT] = 3,
+          [SYSCALL_EPOLL_CTL] = 1, [SYSCALL_IO_URING_ENTER] = 1, [SYSCALL_CLOSE] = 1}},
+        {"blocking client", {[SYSCALL_SEND] = 1, [SYSCALL_RECV] = 1}},
+    };
+
+    printf("bench_syscalls: %d connections x %d-byte requests, %d ms each; %d connections; %d round trips\n",
+           CONNECTIONS, MESSAGE_SIZE, DURATION_MS, CHURN, ROUND_TRIPS);
+    echo(&budgets[0], 1, 0);
+    echo(&budgets[1], 0, 1);
+    echo(&budgets[2], 0, 0);
+    churn(&budgets[3]);
+    blocking(&budgets[4]);
+    return over_budget;
+}
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/event_loop.h"
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Kernel timestamps (SO_TIMESTAMPING) on an echo loop, over loopback.
+ *
+ *   echo, off          CONNECTIONS clients keep one request in flight each:
+ *                      throughput and syscalls per request without stamps
+ *   echo, stamped      the same with timestamping on: what it costs, and
+ *                      the RX delay (kernel arrival to recv()) and TX delay
+ *                      (send() to the driver) it measures
+ *   slow handler       stamped, with a handler that spins HANDLER_US per
+ *                      request: requests now wait their turn behind the
+ *                      others' handlers, and the RX delay shows it while
+ *                      the TX delay stays where it was
+ *
+ * The run fails if a stamped loop got no RX or no TX stamps while the
+ * kernel accepted SO_TIMESTAMPING: the stamps are not coming back.
+ */
+
+#define CONNECTIONS 32
+#define MESSAGE_SIZE 64
+#define DURATION_MS 500
+#define HANDLER_US 20
+
+static int failed;
+
+static int echo_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    long spin_us = *(const long *)ctx;
+    if (spin_us > 0)
+    {
+        long long until = bench_now_ns() + spin_us * 1000;
+        while (bench_now_ns() < until)
+        {
+        }
+    }
+    return connection_send(conn, data, length);
+}
+
+static const Handler echo_handler = {NULL, echo_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+// Upper bound of the bucket 'pct' percent of the delays fall in, in microseconds
+static double delay_percentile(const DelayHistogram *histogram, double pct)
+{
+    long long rank = (long long)(pct / 100.0 * histogram->count);
+    long long seen = 0;
+    for (int bucket = 0; bucket < TIMESTAMP_BUCKETS; bucket++)
+    {
+        seen += histogram->buckets[bucket];
+        if (seen > rank)
+        {
+            return (128LL << bucket) / 1000.0;
+        }
+    }
+    return (128LL << (TIMESTAMP_BUCKETS - 1)) / 1000.0;
+}
+
+static void print_delay(const char *label, const DelayHistogram *histogram)
+{
+    printf("    %s %8lld stamps  mean %7.2fus  p50 <%8.2fus  p99 <%8.2fus\n", label, histogram->count,
+           histogram->count > 0 ? histogram->sum_ns / 1000.0 / histogram->count : 0, delay_percentile(histogram, 50),
+           delay_percentile(histogram, 99));
+}
+
+static void echo(const char *label, int stamped, long spin_us)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, &spin_us);
+    if (stamped)
+    {
+        event_loop_use_timestamping(loop, 1);
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    struct pollfd pfds[CONNECTIONS];
+    int received[CONNECTIONS];
+    char message[MESSAGE_SIZE];
+    memset(message, 't', sizeof(message));
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        pfds[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        pfds[i].events = POLLIN;
+        received[i] = 0;
+        if (connect(pfds[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bench_timestamping: connect");
+            exit(1);
+        }
+    }
+    // The loop enables it on its side; whether the kernel takes it at all is checked on a spare connection
+    int probe = socket(AF_INET, SOCK_STREAM, 0);
+    int supported = !stamped || (connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+                                 timestamping_enable(probe) == 0);
+    close(probe);
+    bench_sleep_us(20000); // Let the loop accept everyone before counting
+
+    SyscallCounts then = loop->syscalls;
+    long long requests = loop->requests;
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+    }
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    while (bench_now_ns() < end)
+    {
+        if (poll(pfds, CONNECTIONS, 100) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            char buffer[MESSAGE_SIZE];
+            int n;
+            if (!(pfds[i].revents & POLLIN) ||
+                (n = (int)recv(pfds[i].fd, buffer, sizeof(buffer) - received[i], MSG_DONTWAIT)) <= 0)
+            {
+                continue;
+            }
+            received[i] += n;
+            if (received[i] == MESSAGE_SIZE)
+            {
+                received[i] = 0;
+                send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+            }
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+    bench_sleep_us(10000); // The requests in flight are answered and their TX stamps drained
+
+    SyscallCounts now = loop->syscalls;
+    requests = loop->requests - requests;
+    long long calls = syscall_total(&now) - syscall_total(&then);
+    printf("%-20s %9.0f req/s  %6.3f syscalls/request:", label, requests / seconds,
+           requests > 0 ? (double)calls / requests : 0);
+    for (int kind = 0; kind < SYSCALL_KINDS; kind++)
+    {
+        if (now.calls[kind] > then.calls[kind])
+        {
+            printf(" %s %.3f", syscall_names[kind], (double)(now.calls[kind] - then.calls[kind]) / requests);
+        }
+    }
+    printf("\n");
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        close(pfds[i].fd);
+    }
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+
+    if (stamped && !supported)
+    {
+        printf("    skipped: the kernel refused SO_TIMESTAMPING\n");
+    }
+    else if (stamped)
+    {
+        print_delay("rx", &loop->timestamps->rx);
+        print_delay("tx", &loop->timestamps->tx);
+        printf("    %lld TX stamps without their send()\n", loop->timestamps->tx_unmatched);
+        if (loop->timestamps->rx.count == 0 || loop->timestamps->tx.count == 0)
+        {
+            fprintf(stderr, "bench_timestamping: %s: no %s stamps came back\n", label,
+                    loop->timestamps->rx.count == 0 ? "RX" : "TX");
+            failed = 1;
+        }
+    }
+    event_loop_free(loop);
+    server_free(server);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_timestamping: %d connections x %d-byte requests, %d ms each\n", CONNECTIONS, MESSAGE_SIZE,
+           DURATION_MS);
+    echo("echo, off", 0, 0);
+    echo("echo, stamped", 1, 0);
+    echo("slow handler", 1, HANDLER_US);
+    return failed;
+}
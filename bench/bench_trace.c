@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/event_loop.h"
+#include "../src/trace.h"
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * What span tracing costs, off and on.
+ *
+ *   span, tracing off/on   one trace_begin()/trace_end() pair
+ *   echo, tracing off/on   an echo loop serving CONNECTIONS clients; with
+ *                          tracing on every request records epoll_wait,
+ *                          recv, on_data and send spans
+ *
+ * The last run is written to build/bench_trace.json; open it in
+ * ui.perfetto.dev or chrome://tracing.
+ */
+
+#define SPANS 10000000
+#define CONNECTIONS 16
+#define MESSAGE_SIZE 32
+#define DURATION_MS 500
+#define TRACE_FILE "build/bench_trace.json"
+
+static int echo_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)ctx;
+    return connection_send(conn, data, length);
+}
+
+static const Handler echo_handler = {NULL, echo_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+static void span_cost(const char *label)
+{
+    long long start = bench_now_ns();
+    for (int i = 0; i < SPANS; i++)
+    {
+        long long traced = trace_begin();
+        trace_end("bench", traced, i);
+    }
+    printf("%-28s %6.1f ns/span\n", label, (double)(bench_now_ns() - start) / SPANS);
+}
+
+static void echo(const char *label)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    struct pollfd pfds[CONNECTIONS];
+    char message[MESSAGE_SIZE];
+    memset(message, 't', sizeof(message));
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        pfds[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        pfds[i].events = POLLIN;
+        if (connect(pfds[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bench_trace: connect");
+            exit(1);
+        }
+        send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+    }
+
+    long long requests = 0;
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    while (bench_now_ns() < end)
+    {
+        if (poll(pfds, CONNECTIONS, 100) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            char buffer[MESSAGE_SIZE];
+            // Echoes are small enough to arrive whole
+            if (pfds[i].revents & POLLIN && recv(pfds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT) == MESSAGE_SIZE)
+            {
+                requests++;
+                send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+            }
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        close(pfds[i].fd);
+    }
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+    printf("%-28s %9.0f req/s\n", label, requests / seconds);
+    event_loop_free(loop);
+    server_free(server);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_trace: %d connections echoing %d-byte requests, %d ms each\n", CONNECTIONS, MESSAGE_SIZE,
+           DURATION_MS);
+    span_cost("span, tracing off");
+    trace_set_enabled(1);
+    span_cost("span, tracing on");
+    trace_set_enabled(0);
+    trace_reset();
+
+    echo("echo, tracing off");
+    trace_set_enabled(1);
+    echo("echo, tracing on");
+    trace_set_enabled(0);
+
+    int spans = trace_dump(TRACE_FILE);
+    if (spans >= 0)
+    {
+        printf("wrote the last %d spans to %s\n", spans, TRACE_FILE);
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/clock.h"
+#include "../src/event_loop.h"
+#include "../src/watchdog.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * The watchdog's cost and what it catches.
+ *
+ *   heartbeat         what a loop iteration pays with the watchdog on:
+ *                     heartbeat_begin(), two heartbeat_enter() and
+ *                     heartbeat_end() with its clock reading
+ *   echo, off / on    an echo loop's throughput without and with it
+ *   stall             one request makes the handler sleep STALL_MS (as if
+ *                     it blocked in a recv()); the watchdog, with a
+ *                     THRESHOLD_MS threshold, should report it once, naming
+ *                     on_data and the fd, while it is happening
+ */
+
+#define ITERATIONS 10000000
+#define CONNECTIONS 16
+#define MESSAGE_SIZE 32
+#define DURATION_MS 500
+#define THRESHOLD_MS 50
+#define STALL_MS 200
+
+static int echo_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)ctx;
+    if (data[0] == 'S')
+    {
+        bench_sleep_us(STALL_MS * 1000);
+    }
+    return connection_send(conn, data, length);
+}
+
+static const Handler echo_handler = {NULL, echo_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+static void heartbeat_cost(void)
+{
+    Heartbeat *heartbeat = watchdog_heartbeat("bench");
+    long long start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        heartbeat_begin(heartbeat, clock_tick());
+        heartbeat_enter(heartbeat, "on_accept", i);
+        heartbeat_enter(heartbeat, "on_data", i);
+        heartbeat_end(heartbeat, clock_now_ns());
+    }
+    long long per = (bench_now_ns() - start) / ITERATIONS;
+
+    start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        clock_tick(); // The loop reads the clock once per iteration anyway
+    }
+    per -= (bench_now_ns() - start) / ITERATIONS;
+    printf("%-28s %lld ns/iteration on top of the loop's own clock read\n", "heartbeat", per);
+    heartbeat_retire(heartbeat);
+}
+
+// Echo CONNECTIONS clients for DURATION_MS; with 'stall', one request takes STALL_MS
+static void echo(const char *label, int stall)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fds[CONNECTIONS];
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fds[i], (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bench_watchdog: connect");
+            exit(1);
+        }
+    }
+
+    char message[MESSAGE_SIZE];
+    memset(message, 'e', sizeof(message));
+    long long requests = 0;
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    while (bench_now_ns() < end)
+    {
+        // One round: every client sends, then every client reads its echo
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            message[0] = stall && requests == 0 && i == 0 ? 'S' : 'e';
+            send(fds[i], message, sizeof(message), MSG_NOSIGNAL);
+        }
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            int received = 0;
+            while (received < MESSAGE_SIZE)
+            {
+                char buffer[MESSAGE_SIZE];
+                int n = (int)recv(fds[i], buffer, MESSAGE_SIZE - received, 0);
+                if (n <= 0)
+                {
+                    exit(1);
+                }
+                received += n;
+            }
+        }
+        requests += CONNECTIONS;
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        close(fds[i]);
+    }
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+
+    printf("%-28s %9.0f req/s\n", label, requests / seconds);
+    if (loop->heartbeat)
+    {
+        printf("    ");
+        heartbeat_print(loop->heartbeat, stdout);
+        printf("    %lld stall(s) reported\n", loop->heartbeat->stalls);
+    }
+    event_loop_free(loop);
+    server_free(server);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_watchdog: threshold %d ms, %d connections echoing %d-byte requests\n", THRESHOLD_MS, CONNECTIONS,
+           MESSAGE_SIZE);
+    echo("echo, watchdog off", 0);
+    if (watchdog_start(THRESHOLD_MS) < 0)
+    {
+        return 1;
+    }
+    heartbeat_cost();
+    echo("echo, watchdog on", 0);
+    fflush(stdout);
+    echo("echo with one stall", 1);
+    watchdog_stop();
+    return 0;
+}
@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/event_loop.h"
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Write-first against queue-and-arm-EPOLLOUT on an echo server.
+ *
+ *   queue + EPOLLOUT  connection_send() queues, the loop arms EPOLLOUT,
+ *                     writes on the next wakeup and disarms it again
+ *   write-first       connection_send() calls send() at once; EPOLLOUT is
+ *                     only armed when the socket is full (EAGAIN)
+ *
+ * CONNECTIONS clients keep one request in flight each. Reported: server
+ * syscalls per request (recv + send + epoll_ctl or io_uring_enter +
+ * epoll_wait, counted by the loop) and latency. Over loopback the socket
+ * always has room, so write-first should never touch epoll after accept.
+ */
+
+#define CONNECTIONS 32
+#define MESSAGE_SIZE 64
+#define DURATION_MS 1000
+#define MAX_SAMPLES 2000000
+
+static int echo_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)ctx;
+    return connection_send(conn, data, length);
+}
+
+static const Handler echo_handler = {NULL, echo_on_data, NULL, NULL};
+
+static void *loop_main(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
+
+static void run(const char *label, int write_first)
+{
+    int port;
+    ServerSocket *server = bench_listen(128, &port);
+    EventLoop *loop = event_loop_create(server, &echo_handler, NULL);
+    loop->write_first = write_first;
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_main, loop);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    struct pollfd pfds[CONNECTIONS];
+    long long sent_at[CONNECTIONS];
+    int received[CONNECTIONS];
+    char message[MESSAGE_SIZE];
+    memset(message, 'w', sizeof(message));
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        pfds[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        pfds[i].events = POLLIN;
+        if (connect(pfds[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bench_write_first: connect");
+            exit(1);
+        }
+    }
+    bench_sleep_us(20000); // Let the loop accept everyone before counting
+
+    long long iterations = loop->iterations;
+    long long recv_calls = loop->recv_calls;
+    long long send_calls = loop->send_calls;
+    long long ctl_calls = loop->ctl_calls + loop->ring_calls;
+    long long changes = loop->ctl_calls + loop->ring_ops;
+
+    long long *samples = (long long *)malloc(sizeof(long long) * MAX_SAMPLES);
+    int count = 0;
+    long long start = bench_now_ns();
+    long long end = start + DURATION_MS * 1000000LL;
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        sent_at[i] = bench_now_ns();
+        received[i] = 0;
+        send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+    }
+
+    while (bench_now_ns() < end)
+    {
+        if (poll(pfds, CONNECTIONS, 100) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < CONNECTIONS; i++)
+        {
+            if (!(pfds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            char buffer[MESSAGE_SIZE];
+            int n = (int)recv(pfds[i].fd, buffer, sizeof(buffer) - received[i], MSG_DONTWAIT);
+            if (n <= 0)
+            {
+                continue;
+            }
+            received[i] += n;
+            if (received[i] == MESSAGE_SIZE)
+            {
+                long long now = bench_now_ns();
+                if (count < MAX_SAMPLES)
+                {
+                    samples[count++] = now - sent_at[i];
+                }
+                received[i] = 0;
+                sent_at[i] = now;
+                send(pfds[i].fd, message, sizeof(message), MSG_NOSIGNAL);
+            }
+        }
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+
+    // Snapshot before closing: the teardown is not per request
+    iterations = loop->iterations - iterations;
+    recv_calls = loop->recv_calls - recv_calls;
+    send_calls = loop->send_calls - send_calls;
+    ctl_calls = loop->ctl_calls + loop->ring_calls - ctl_calls;
+    changes = loop->ctl_calls + loop->ring_ops - changes;
+
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        close(pfds[i].fd);
+    }
+    event_loop_stop(loop);
+    pthread_join(thread, NULL);
+
+    double requests = count > 0 ? (double)count : 1.0;
+    bench_print_latency(label, samples, count, seconds);
+    printf("    %.3f syscalls/request: %.3f recv, %.3f send, %.3f epoll_ctl/io_uring_enter"
+           " (%.3f interest changes), %.3f epoll_wait\n",
+           (iterations + recv_calls + send_calls + ctl_calls) / requests, recv_calls / requests,
+           send_calls / requests, ctl_calls / requests, changes / requests, iterations / requests);
+
+    event_loop_free(loop);
+    server_free(server);
+    free(samples);
+}
+
+int main(void)
+{
+    socket_verbose = 0;
+
+    printf("bench_write_first: echo, %d connections x %d-byte requests, %d ms each\n",
+           CONNECTIONS, MESSAGE_SIZE, DURATION_MS);
+    run("queue + EPOLLOUT", 0);
+    run("write-first", 1);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#!/bin/sh
+#
+# Per-benchmark speedup of optimized builds over the default one (make speedup).
+#
+#   sh bench/speedup.sh "<baseline dir> <variant dir>..." <bench name>...
+#
+# Runs every benchmark from every build directory RUNS times (default 3),
+# keeps each output in <baseline dir>/speedup/<variant>/<bench>.<run>.txt,
+# and compares each variant's outputs with the baseline's figure by figure.
+# A figure is a number with a unit: per second (req/s, MB/s, ...) is better
+# higher, a time (ns, us, ms) is better lower. Figures are matched by the
+# label that starts their line and their place on it; header lines
+# (bench_*: ...) only describe the run. Each figure counts with its best
+# value over the runs: loopback benchmarks share the CPUs with the
+# scheduler and everything else, and one run can land on a bad moment.
+# A benchmark's speedup is the geometric mean of its figures' ratios, and
+# the last row is the geometric mean over the benchmarks.
+
+dirs=$1
+shift
+baseline=${dirs%% *}
+runs=${RUNS:-3}
+out=$baseline/speedup
+results=$out/results.txt
+mkdir -p "$out"
+: > "$results"
+
+label()
+{
+    if [ "$1" = "$baseline" ]; then echo default; else echo "${1#"$baseline"/}"; fi
+}
+
+# The output files of a variant's runs of a benchmark
+outputs()
+{
+    run=1
+    while [ "$run" -le "$runs" ]; do
+        echo "$out/$1/$2.$run.txt"
+        run=$((run + 1))
+    done
+}
+
+# "<ratio> <figures>" of a variant's outputs against the baseline's
+compare()
+{
+    awk -v runs="$runs" '
+        function scan(line, into,    name, s, m, k, key, value) {
+            if (line ~ /^bench_/) return
+            name = line
+            sub(/[0-9].*/, "", name)
+            gsub(/ +/, " ", name)
+            name = name "@" (++seen[FILENAME, name])
+            k = 0
+            s = line
+            while (match(s, /[0-9]+(\.[0-9]+)? *(ns|us|ms|[A-Za-z]*\/s)([^A-Za-z]|$)/)) {
+                m = substr(s, RSTART, RLENGTH)
+                s = substr(s, RSTART + RLENGTH)
+                key = name "#" (++k)
+                value = m + 0
+                higher[key] = m ~ /\/s/
+                if (!(key in into) || (higher[key] ? value > into[key] : value < into[key]))
+                    into[key] = value
+            }
+        }
+        FNR == 1 { files++ }
+        files <= runs { scan($0, base); next }
+        { scan($0, variant) }
+        END {
+            for (key in variant) {
+                if ((key in base) && base[key] > 0 && variant[key] > 0) {
+                    ratio = higher[key] ? variant[key] / base[key] : base[key] / variant[key]
+                    sum += log(ratio)
+                    n++
+                }
+            }
+            if (n > 0) printf "%.3f %d\n", exp(sum / n), n
+            else print "- 0"
+        }' $(outputs default "$1") $(outputs "$2" "$1")
+}
+
+for bench in "$@"; do
+    for dir in $dirs; do
+        variant=$(label "$dir")
+        mkdir -p "$out/$variant"
+        echo "▶️ Running $dir/$bench x $runs..."
+        status=ok
+        for file in $(outputs "$variant" "$bench"); do
+            ./"$dir/$bench" > "$file" 2> /dev/null || status=failed
+        done
+        if [ "$status" = failed ]; then
+            echo "$bench $variant failed 0" >> "$results"
+        elif [ "$dir" != "$baseline" ]; then
+            echo "$bench $variant $(compare "$bench" "$variant")" >> "$results"
+        fi
+    done
+done
+
+echo
+echo "Speedup over the default build ($baseline, -O0); geometric mean of each benchmark's figures, best of $runs runs"
+awk -v variants="$(for dir in $dirs; do [ "$dir" = "$baseline" ] || label "$dir"; done)" '
+    BEGIN {
+        count = split(variants, names, "\n")
+        printf "%-24s", "benchmark"
+        for (i = 1; i <= count; i++) printf " %12s", names[i]
+        printf "  figures\n"
+    }
+    {
+        if (!($1 in row)) order[++benches] = $1
+        row[$1] = 1
+        ratio[$1, $2] = $3
+        if ($4 > 0) figures[$1] = $4
+        if ($3 + 0 > 0) { logs[$2] += log($3); counted[$2]++ }
+    }
+    END {
+        for (b = 1; b <= benches; b++) {
+            printf "%-24s", order[b]
+            for (i = 1; i <= count; i++) {
+                r = ratio[order[b], names[i]]
+                if (r + 0 > 0) printf " %11.2fx", r
+                else printf " %12s", r == "" ? "-" : r
+            }
+            printf "  %7d\n", figures[order[b]]
+        }
+        printf "%-24s", "geometric mean"
+        for (i = 1; i <= count; i++) {
+            if (counted[names[i]] > 0) printf " %11.2fx", exp(logs[names[i]] / counted[names[i]])
+            else printf " %12s", "-"
+        }
+        printf "\n"
+    }' "$results"
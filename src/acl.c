@@ -0,0 +1,616 @@
+#define _GNU_SOURCE
+#include "acl.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Longest-prefix-match allow/deny lists, checked on every accept.
+ *
+ * A list of tens of thousands of CIDR rules can't be scanned per connection,
+ * so rules are compiled into a Poptrie (Asai & Ohara, SIGCOMM 2015):
+ *
+ *   - The first 16 address bits index a flat array ("direct pointing"). Most
+ *     IPv4 lookups end right there or one level down.
+ *   - Below that, each node consumes 6 bits, i.e. has 64 entries, but stores
+ *     them as two 64-bit bitmaps. An entry's child or leaf is found with one
+ *     popcount of the bitmap below it, because a node's children (and its
+ *     leaves) are laid out contiguously.
+ *   - Leaves are "pushed" down when compiling: every entry holds the final
+ *     answer for its whole range, so a lookup never backtracks. Runs of equal
+ *     leaves are stored once (leafvec marks where a new run starts).
+ *
+ * A lookup is a handful of dependent loads from a few compact arrays. Both
+ * families use the same code; IPv4 keys are simply 32 bits long.
+ *
+ * Tables are immutable once compiled. Reloading builds a new one and swaps
+ * the pointer in Acl; see acl_swap() for how the old one is freed safely.
+ */
+
+#define ACL_TOP_BITS 16
+#define ACL_STRIDE 6
+#define ACL_TOP_LEAF 0x80000000u
+
+// Uncompressed node used only while compiling
+typedef struct BuildNode
+{
+    struct BuildNode *child[64];
+    uint8_t value[64]; // 0 = no rule ends here; otherwise an AclAction
+} BuildNode;
+
+typedef struct
+{
+    BuildNode **top_child;
+    uint8_t *top_value;
+} BuildTrie;
+
+// The 6 key bits starting at bit 'offset' (offsets are 16 + 6k, so never straddle hi/lo)
+static inline unsigned key_bits(uint64_t hi, uint64_t lo, unsigned offset)
+{
+    if (offset + ACL_STRIDE <= 64)
+    {
+        return (unsigned)(hi >> (64 - ACL_STRIDE - offset)) & 63;
+    }
+    if (offset + ACL_STRIDE <= 128)
+    {
+        return (unsigned)(lo >> (128 - ACL_STRIDE - offset)) & 63;
+    }
+    return (unsigned)(lo << (offset + ACL_STRIDE - 128)) & 63; // Past the end: pad with zeros
+}
+
+AclBuilder *acl_builder_create(void)
+{
+    AclBuilder *builder = (AclBuilder *)malloc(sizeof(AclBuilder));
+    if (!builder)
+    {
+        perror("[ACL] malloc failed");
+        return NULL;
+    }
+    memset(builder, 0, sizeof(AclBuilder));
+    return builder;
+}
+
+static int builder_push(AclBuilder *builder, int v6, int length, uint64_t hi, uint64_t lo, AclAction action)
+{
+    if (builder->count == builder->capacity)
+    {
+        int capacity = builder->capacity ? builder->capacity * 2 : 256;
+        AclRule *rules = (AclRule *)realloc(builder->rules, sizeof(AclRule) * capacity);
+        if (!rules)
+        {
+            perror("[ACL] realloc failed");
+            return -1;
+        }
+        builder->rules = rules;
+        builder->capacity = capacity;
+    }
+
+    // Clear the host bits so "10.1.2.3/8" means 10.0.0.0/8
+    uint64_t hi_mask = length >= 64 ? ~0ULL : (length == 0 ? 0 : ~0ULL << (64 - length));
+    uint64_t lo_mask = length <= 64 ? 0 : (length >= 128 ? ~0ULL : ~0ULL << (128 - length));
+
+    AclRule *rule = &builder->rules[builder->count++];
+    rule->v6 = v6;
+    rule->length = length;
+    rule->hi = hi & hi_mask;
+    rule->lo = lo & lo_mask;
+    rule->action = action;
+    return 0;
+}
+
+// addr in network byte order, like sockaddr_in.sin_addr.s_addr
+int acl_builder_add_v4(AclBuilder *builder, uint32_t addr, int length, AclAction action)
+{
+    if (length < 0 || length > 32)
+    {
+        return -1;
+    }
+    return builder_push(builder, 0, length, (uint64_t)ntohl(addr) << 32, 0, action);
+}
+
+int acl_builder_add_v6(AclBuilder *builder, const struct in6_addr *addr, int length, AclAction action)
+{
+    if (length < 0 || length > 128)
+    {
+        return -1;
+    }
+    uint64_t hi = 0, lo = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        hi = hi << 8 | addr->s6_addr[i];
+        lo = lo << 8 | addr->s6_addr[8 + i];
+    }
+    return builder_push(builder, 1, length, hi, lo, action);
+}
+
+// "192.0.2.0/24", "2001:db8::/32" or a bare address (a host route)
+int acl_builder_add(AclBuilder *builder, const char *cidr, AclAction action)
+{
+    char text[INET6_ADDRSTRLEN + 8];
+    if (strlen(cidr) >= sizeof(text))
+    {
+        return -1;
+    }
+    strcpy(text, cidr);
+
+    // No slash is a host route; a length that is there must be 0..32 (0..128 for v6)
+    int host = 1;
+    int length = 0;
+    char *slash = strchr(text, '/');
+    if (slash)
+    {
+        *slash = '\0';
+        char *end;
+        long parsed = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || parsed < 0 || parsed > 128)
+        {
+            return -1;
+        }
+        host = 0;
+        length = (int)parsed;
+    }
+
+    struct in_addr v4;
+    struct in6_addr v6;
+    if (inet_pton(AF_INET, text, &v4) == 1)
+    {
+        return acl_builder_add_v4(builder, v4.s_addr, host ? 32 : length, action);
+    }
+    if (inet_pton(AF_INET6, text, &v6) == 1)
+    {
+        return acl_builder_add_v6(builder, &v6, host ? 128 : length, action);
+    }
+    return -1;
+}
+
+void acl_builder_free(AclBuilder *builder)
+{
+    if (builder)
+    {
+        free(builder->rules);
+        free(builder);
+    }
+}
+
+// Shorter prefixes first, so longer ones overwrite them; ties keep file order
+static int compare_rules(const void *a, const void *b)
+{
+    const AclRule *left = *(const AclRule *const *)a;
+    const AclRule *right = *(const AclRule *const *)b;
+    if (left->length != right->length)
+    {
+        return left->length - right->length;
+    }
+    return (left > right) - (left < right);
+}
+
+static int build_insert(BuildTrie *trie, const AclRule *rule)
+{
+    unsigned top = (unsigned)(rule->hi >> (64 - ACL_TOP_BITS));
+    if (rule->length <= ACL_TOP_BITS)
+    {
+        unsigned span = 1u << (ACL_TOP_BITS - rule->length);
+        memset(&trie->top_value[top & ~(span - 1)], rule->action, span);
+        return 0;
+    }
+
+    BuildNode **slot = &trie->top_child[top];
+    unsigned offset = ACL_TOP_BITS;
+    for (;;)
+    {
+        if (!*slot && !(*slot = (BuildNode *)calloc(1, sizeof(BuildNode))))
+        {
+            perror("[ACL] calloc failed");
+            return -1;
+        }
+        unsigned bits = key_bits(rule->hi, rule->lo, offset);
+        int remaining = rule->length - (int)offset;
+        if (remaining <= ACL_STRIDE)
+        {
+            unsigned span = 1u << (ACL_STRIDE - remaining);
+            memset(&(*slot)->value[bits & ~(span - 1)], rule->action, span);
+            return 0;
+        }
+        slot = &(*slot)->child[bits];
+        offset += ACL_STRIDE;
+    }
+}
+
+static void build_free(BuildNode *node)
+{
+    if (node)
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            build_free(node->child[i]);
+        }
+        free(node);
+    }
+}
+
+static int grow(void **array, uint32_t *capacity, uint32_t needed, size_t item)
+{
+    if (needed <= *capacity)
+    {
+        return 0;
+    }
+    uint32_t next = *capacity ? *capacity : 1024;
+    while (next < needed)
+    {
+        next *= 2;
+    }
+    void *grown = realloc(*array, next * item);
+    if (!grown)
+    {
+        perror("[ACL] realloc failed");
+        return -1;
+    }
+    *array = grown;
+    *capacity = next;
+    return 0;
+}
+
+typedef struct
+{
+    Poptrie *trie;
+    uint32_t node_capacity;
+    uint32_t leaf_capacity;
+} Compiler;
+
+static int reserve_nodes(Compiler *c, uint32_t count, uint32_t *first)
+{
+    if (grow((void **)&c->trie->nodes, &c->node_capacity, c->trie->node_count + count, sizeof(PoptrieNode)) < 0)
+    {
+        return -1;
+    }
+    *first = c->trie->node_count;
+    c->trie->node_count += count;
+    return 0;
+}
+
+// Compress one build node into nodes[index], then its children into the block it reserves
+static int compile_node(Compiler *c, const BuildNode *build, uint8_t inherited, uint32_t index)
+{
+    PoptrieNode node;
+    memset(&node, 0, sizeof(node));
+    node.base0 = c->trie->leaf_count;
+
+    uint8_t effective[64];
+    uint32_t children = 0;
+    int last_leaf = -1;
+    for (int i = 0; i < 64; i++)
+    {
+        effective[i] = build->value[i] ? build->value[i] : inherited;
+        if (build->child[i])
+        {
+            node.vector |= 1ULL << i;
+            children++;
+        }
+        else if (last_leaf < 0 || effective[i] != last_leaf)
+        {
+            if (grow((void **)&c->trie->leaves, &c->leaf_capacity, c->trie->leaf_count + 1, 1) < 0)
+            {
+                return -1;
+            }
+            node.leafvec |= 1ULL << i;
+            c->trie->leaves[c->trie->leaf_count++] = effective[i];
+            last_leaf = effective[i];
+        }
+    }
+
+    if (reserve_nodes(c, children, &node.base1) < 0)
+    {
+        return -1;
+    }
+    c->trie->nodes[index] = node;
+
+    uint32_t next = node.base1;
+    for (int i = 0; i < 64; i++)
+    {
+        if (build->child[i] && compile_node(c, build->child[i], effective[i], next++) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int compile_family(Poptrie *trie, AclRule **rules, int count, AclAction default_action)
+{
+    BuildTrie build;
+    build.top_child = (BuildNode **)calloc(1u << ACL_TOP_BITS, sizeof(BuildNode *));
+    build.top_value = (uint8_t *)calloc(1u << ACL_TOP_BITS, 1);
+    trie->top = (uint32_t *)malloc(sizeof(uint32_t) << ACL_TOP_BITS);
+    int result = build.top_child && build.top_value && trie->top ? 0 : -1;
+
+    for (int i = 0; i < count && result == 0; i++)
+    {
+        result = build_insert(&build, rules[i]);
+    }
+
+    Compiler compiler = {trie, 0, 0};
+    for (uint32_t t = 0; t < (1u << ACL_TOP_BITS) && result == 0; t++)
+    {
+        uint8_t effective = build.top_value && build.top_value[t] ? build.top_value[t] : (uint8_t)default_action;
+        if (!build.top_child[t])
+        {
+            trie->top[t] = ACL_TOP_LEAF | effective;
+            continue;
+        }
+        uint32_t index;
+        result = reserve_nodes(&compiler, 1, &index);
+        if (result == 0)
+        {
+            trie->top[t] = index;
+            result = compile_node(&compiler, build.top_child[t], effective, index);
+        }
+    }
+
+    if (build.top_child)
+    {
+        for (uint32_t t = 0; t < (1u << ACL_TOP_BITS); t++)
+        {
+            build_free(build.top_child[t]);
+        }
+    }
+    free(build.top_child);
+    free(build.top_value);
+    return result;
+}
+
+AclTable *acl_builder_compile(AclBuilder *builder, AclAction default_action)
+{
+    AclTable *table = (AclTable *)malloc(sizeof(AclTable));
+    AclRule **sorted = (AclRule **)malloc(sizeof(AclRule *) * (builder->count + 1));
+    if (!table || !sorted)
+    {
+        perror("[ACL] malloc failed");
+        free(table);
+        free(sorted);
+        return NULL;
+    }
+    memset(table, 0, sizeof(AclTable));
+    table->rules = builder->count;
+
+    // Split by family (keeping order), then sort each by prefix length
+    int v4_count = 0;
+    for (int i = 0; i < builder->count; i++)
+    {
+        if (!builder->rules[i].v6)
+        {
+            sorted[v4_count++] = &builder->rules[i];
+        }
+    }
+    int v6_count = 0;
+    for (int i = 0; i < builder->count; i++)
+    {
+        if (builder->rules[i].v6)
+        {
+            sorted[v4_count + v6_count++] = &builder->rules[i];
+        }
+    }
+    qsort(sorted, v4_count, sizeof(AclRule *), compare_rules);
+    qsort(sorted + v4_count, v6_count, sizeof(AclRule *), compare_rules);
+
+    int result = compile_family(&table->v4, sorted, v4_count, default_action);
+    if (result == 0)
+    {
+        result = compile_family(&table->v6, sorted + v4_count, v6_count, default_action);
+    }
+    free(sorted);
+
+    if (result < 0)
+    {
+        acl_table_free(table);
+        return NULL;
+    }
+    return table;
+}
+
+/*
+ * Rule file: one "allow <cidr>" or "deny <cidr>" per line. Blank lines and
+ * lines starting with '#' are ignored. The longest matching prefix wins;
+ * among identical prefixes the later line wins.
+ */
+AclTable *acl_table_load(const char *path, AclAction default_action)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "[ACL] Could not open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    AclBuilder *builder = acl_builder_create();
+    if (!builder)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    char line[256];
+    int line_number = 0;
+    int errors = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        line_number++;
+        char word[16], cidr[INET6_ADDRSTRLEN + 8];
+        char *start = line;
+        while (isspace((unsigned char)*start))
+        {
+            start++;
+        }
+        if (*start == '\0' || *start == '#')
+        {
+            continue;
+        }
+
+        AclAction action;
+        if (sscanf(start, "%15s %55s", word, cidr) != 2 || acl_parse_action(word, &action) < 0 ||
+            acl_builder_add(builder, cidr, action) < 0)
+        {
+            fprintf(stderr, "[ACL] %s:%d: expected \"allow|deny <cidr>\"\n", path, line_number);
+            errors++;
+        }
+    }
+    fclose(file);
+
+    AclTable *table = errors ? NULL : acl_builder_compile(builder, default_action);
+    acl_builder_free(builder);
+    return table;
+}
+
+static inline AclAction poptrie_lookup(const Poptrie *trie, uint64_t hi, uint64_t lo)
+{
+    uint32_t entry = trie->top[hi >> (64 - ACL_TOP_BITS)];
+    if (entry & ACL_TOP_LEAF)
+    {
+        return (AclAction)(entry & 0xff);
+    }
+
+    unsigned offset = ACL_TOP_BITS;
+    for (;;)
+    {
+        const PoptrieNode *node = &trie->nodes[entry];
+        unsigned bits = key_bits(hi, lo, offset);
+        uint64_t upto = (2ULL << bits) - 1; // Bits 0..bits (wraps to all ones for bit 63)
+        if (!(node->vector >> bits & 1))
+        {
+            return (AclAction)trie->leaves[node->base0 + __builtin_popcountll(node->leafvec & upto) - 1];
+        }
+        entry = node->base1 + __builtin_popcountll(node->vector & upto) - 1;
+        offset += ACL_STRIDE;
+    }
+}
+
+// addr in network byte order
+AclAction acl_table_lookup_v4(const AclTable *table, uint32_t addr)
+{
+    return poptrie_lookup(&table->v4, (uint64_t)ntohl(addr) << 32, 0);
+}
+
+AclAction acl_table_lookup_v6(const AclTable *table, const struct in6_addr *addr)
+{
+    uint64_t hi = 0, lo = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        hi = hi << 8 | addr->s6_addr[i];
+        lo = lo << 8 | addr->s6_addr[8 + i];
+    }
+    return poptrie_lookup(&table->v6, hi, lo);
+}
+
+size_t acl_table_memory(const AclTable *table)
+{
+    size_t bytes = sizeof(AclTable);
+    const Poptrie *tries[2] = {&table->v4, &table->v6};
+    for (int i = 0; i < 2; i++)
+    {
+        bytes += sizeof(uint32_t) << ACL_TOP_BITS;
+        bytes += (size_t)tries[i]->node_count * sizeof(PoptrieNode) + tries[i]->leaf_count;
+    }
+    return bytes;
+}
+
+void acl_table_free(AclTable *table)
+{
+    if (table)
+    {
+        free(table->v4.top);
+        free(table->v4.nodes);
+        free(table->v4.leaves);
+        free(table->v6.top);
+        free(table->v6.nodes);
+        free(table->v6.leaves);
+        free(table);
+    }
+}
+
+Acl *acl_create(AclTable *table)
+{
+    Acl *acl = (Acl *)aligned_alloc(64, sizeof(Acl));
+    if (!acl)
+    {
+        perror("[ACL] malloc failed");
+        return NULL;
+    }
+    memset(acl, 0, sizeof(Acl));
+    atomic_init(&acl->current, table);
+    pthread_mutex_init(&acl->swap_lock, NULL);
+    return acl;
+}
+
+/*
+ * Lookups against the live table take no lock. A reader announces itself in
+ * the counter for the current generation's parity before loading the table
+ * pointer, and leaves afterwards (a tiny userspace RCU).
+ */
+AclAction acl_check_v4(Acl *acl, uint32_t addr)
+{
+    unsigned parity = atomic_load(&acl->generation) & 1;
+    atomic_fetch_add(&acl->readers[parity], 1);
+    AclTable *table = atomic_load(&acl->current);
+    AclAction action = acl_table_lookup_v4(table, addr);
+    atomic_fetch_sub(&acl->readers[parity], 1);
+
+    if (action == ACL_DENY)
+    {
+        atomic_fetch_add_explicit(&acl->denied, 1, memory_order_relaxed);
+    }
+    return action;
+}
+
+/*
+ * Publish a new table and free the old one once no lookup can still use it.
+ * Any reader holding the old table registered in one of the two counters
+ * before the exchange. Flipping the generation sends new readers to the
+ * other counter, so the old one is guaranteed to drain; doing it twice
+ * (as userspace RCU does) covers readers that sampled the generation just
+ * before a flip and registered late.
+ */
+void acl_swap(Acl *acl, AclTable *table)
+{
+    pthread_mutex_lock(&acl->swap_lock);
+    AclTable *old = atomic_exchange(&acl->current, table);
+    for (int flip = 0; flip < 2; flip++)
+    {
+        unsigned parity = atomic_fetch_add(&acl->generation, 1) & 1;
+        while (atomic_load(&acl->readers[parity]) != 0)
+        {
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&acl->swap_lock);
+    acl_table_free(old);
+}
+
+void acl_free(Acl *acl)
+{
+    if (acl)
+    {
+        acl_table_free(atomic_load(&acl->current));
+        pthread_mutex_destroy(&acl->swap_lock);
+        free(acl);
+    }
+}
+
+int acl_parse_action(const char *name, AclAction *action)
+{
+    if (strcmp(name, "allow") == 0)
+    {
+        *action = ACL_ALLOW;
+    }
+    else if (strcmp(name, "deny") == 0)
+    {
+        *action = ACL_DENY;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
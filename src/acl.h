@@ -0,0 +1,90 @@
+#ifndef ACL_H
+#define ACL_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef enum
+{
+    ACL_ALLOW = 1,
+    ACL_DENY = 2,
+} AclAction;
+
+// One compressed trie node: 64 children (6 address bits) in two bitmaps
+typedef struct
+{
+    uint64_t vector;  // Bit i set: entry i is an internal node
+    uint64_t leafvec; // Bit i set: entry i starts a new run of identical leaves
+    uint32_t base0;   // First leaf of this node in Poptrie.leaves
+    uint32_t base1;   // First child of this node in Poptrie.nodes (children are contiguous)
+} PoptrieNode;
+
+// One address family. The top 16 bits index 'top' directly
+typedef struct
+{
+    uint32_t *top;      // 65536 entries: node index, or ACL_TOP_LEAF | action
+    PoptrieNode *nodes;
+    uint8_t *leaves;
+    uint32_t node_count;
+    uint32_t leaf_count;
+} Poptrie;
+
+// An immutable, compiled rule set; replaced as a whole on reload
+typedef struct
+{
+    Poptrie v4;
+    Poptrie v6;
+    int rules;
+} AclTable;
+
+typedef struct
+{
+    int v6;
+    int length;
+    uint64_t hi, lo; // Address bits, left-aligned (IPv4 in the top 32 bits of hi)
+    AclAction action;
+} AclRule;
+
+// Collects rules before compiling them into an AclTable
+typedef struct
+{
+    AclRule *rules;
+    int count;
+    int capacity;
+} AclBuilder;
+
+// The live ACL consulted by server_accept(); acl_swap() replaces its table
+typedef struct Acl
+{
+    _Atomic(AclTable *) current;
+    atomic_uint generation;
+    pthread_mutex_t swap_lock;
+    _Alignas(64) atomic_long readers[2]; // In-flight lookups per generation parity
+    _Alignas(64) atomic_llong denied;
+} Acl;
+
+/* Function prototypes for building and querying rule tables */
+AclBuilder *acl_builder_create(void);
+int acl_builder_add(AclBuilder *builder, const char *cidr, AclAction action);
+int acl_builder_add_v4(AclBuilder *builder, uint32_t addr, int length, AclAction action);
+int acl_builder_add_v6(AclBuilder *builder, const struct in6_addr *addr, int length, AclAction action);
+AclTable *acl_builder_compile(AclBuilder *builder, AclAction default_action);
+void acl_builder_free(AclBuilder *builder);
+
+AclTable *acl_table_load(const char *path, AclAction default_action);
+AclAction acl_table_lookup_v4(const AclTable *table, uint32_t addr);
+AclAction acl_table_lookup_v6(const AclTable *table, const struct in6_addr *addr);
+size_t acl_table_memory(const AclTable *table);
+void acl_table_free(AclTable *table);
+
+// The live, swappable ACL
+Acl *acl_create(AclTable *table);
+AclAction acl_check_v4(Acl *acl, uint32_t addr);
+void acl_swap(Acl *acl, AclTable *table);
+void acl_free(Acl *acl);
+
+int acl_parse_action(const char *name, AclAction *action);
+
+#endif
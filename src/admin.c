@@ -0,0 +1,601 @@
+#define _GNU_SOURCE
+#include "admin.h"
+#include "clock.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/*
+ * An admin channel on a Unix socket: list the open connections of every
+ * event loop, filtered and sorted, and close some of them.
+ *
+ *   list [FILTER...] [sort=KEY] [limit=N]     (limit=0: just count)
+ *   close FILTER... | close all
+ *
+ *   FILTER: loop=N fd=N peer=IP[:PORT] state=S min-age=SECONDS
+ *           min-in=BYTES min-out=BYTES min-queued=BYTES
+ *   KEY:    age in out queued (largest first), loop fd peer (ascending)
+ *
+ * A connection belongs to one loop and only that loop's thread may touch
+ * it, so the admin thread never walks a connection list itself. It posts
+ * the command to each loop's mailbox (EventLoop.admin) and writes the
+ * loop's eventfd, exactly as a peer handing over connections does. The
+ * loop answers at the end of its current iteration (admin_serve()): it
+ * walks its own list, appends a row per match and, for `close`, closes
+ * them; then the last loop to finish writes an eventfd back. No loop
+ * stops or takes a lock, and each pays one walk of its own connections.
+ *
+ * A loop stuck in a handler cannot answer. After ADMIN_TIMEOUT_MS the
+ * admin thread takes the command back from every loop that has not picked
+ * it up yet and reports them; a loop that did pick it up is in the middle
+ * of a walk and is waited for.
+ *
+ * The socket is created mode 0600: `close` is for its owner only.
+ */
+
+// What a connection is doing, for the STATE column and state= filters
+static const char *connection_state(const Connection *conn)
+{
+    if (conn->close_after_flush)
+    {
+        return "closing";
+    }
+    if (conn->continue_events)
+    {
+        return "over-budget";
+    }
+    if (conn->flush_queued)
+    {
+        return "coalescing";
+    }
+    if (conn->output_length > 0)
+    {
+        return "writing";
+    }
+    return "idle";
+}
+
+static int admin_matches(const AdminFilter *filter, const Connection *conn, const char *state, long long now)
+{
+    if ((filter->fd >= 0 && conn->socket->fd != filter->fd) || now - conn->accepted_ns < filter->min_age_ns ||
+        conn->bytes_in < filter->min_bytes_in || conn->bytes_out < filter->min_bytes_out ||
+        conn->output_length - conn->output_sent < filter->min_queued ||
+        (filter->state && strcmp(state, filter->state) != 0))
+    {
+        return 0;
+    }
+    if (filter->peer[0])
+    {
+        char peer[32];
+        snprintf(peer, sizeof(peer), "%s:%d", conn->socket->ip, conn->socket->port);
+        return strncmp(peer, filter->peer, strlen(filter->peer)) == 0;
+    }
+    return 1;
+}
+
+/*
+ * Answer the command posted to this loop, if it is still there. Called by
+ * the loop's own thread between batches (event_loop_end_iteration()).
+ */
+void admin_serve(EventLoop *loop)
+{
+    AdminRequest *request = atomic_exchange_explicit(&loop->admin, NULL, memory_order_acquire);
+    if (!request)
+    {
+        return; // Taken back by the admin thread
+    }
+
+    long long now = clock_cached_ns();
+    Connection *conn = loop->open;
+    while (conn)
+    {
+        Connection *next = conn->next;
+        const char *state = connection_state(conn);
+        if (admin_matches(&request->filter, conn, state, now))
+        {
+            int index = atomic_fetch_add_explicit(&request->count, 1, memory_order_relaxed);
+            if (index < request->capacity)
+            {
+                AdminRow *row = &request->rows[index];
+                row->owner = loop;
+                row->fd = conn->socket->fd;
+                memcpy(row->ip, conn->socket->ip, sizeof(row->ip));
+                row->port = conn->socket->port;
+                row->state = state;
+                row->accepted_ns = conn->accepted_ns;
+                row->bytes_in = conn->bytes_in;
+                row->bytes_out = conn->bytes_out;
+                row->queued = conn->output_length - conn->output_sent;
+            }
+            if (request->action == ADMIN_CLOSE)
+            {
+                // At once, queued output dropped: the connection may be the one that never drains
+                if (loop->handler.on_close)
+                {
+                    loop->handler.on_close(conn, loop->ctx);
+                }
+                event_loop_destroy(conn);
+            }
+        }
+        conn = next;
+    }
+
+    // The rows are written before the admin thread learns the loop is done
+    if (atomic_fetch_sub_explicit(&request->pending, 1, memory_order_acq_rel) == 1)
+    {
+        uint64_t one = 1;
+        syscall_count(SYSCALL_EVENTFD);
+        if (write(request->done_fd, &one, sizeof(one)) < 0)
+        {
+            perror("[ADMIN] wake failed");
+        }
+    }
+}
+
+// Post the request to the loops it concerns and wait for their rows; loops that did not answer
+static int admin_collect(AdminServer *admin)
+{
+    AdminRequest *request = &admin->request;
+    uint64_t signals;
+    while (read(request->done_fd, &signals, sizeof(signals)) > 0)
+    {
+        // Drain a wakeup left over from a command that timed out
+    }
+
+    int asked = 0;
+    for (int i = 0; i < admin->loop_count; i++)
+    {
+        asked += request->filter.loop < 0 || request->filter.loop == i;
+    }
+    atomic_store_explicit(&request->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&request->pending, asked, memory_order_relaxed);
+    for (int i = 0; i < admin->loop_count; i++)
+    {
+        if (request->filter.loop >= 0 && request->filter.loop != i)
+        {
+            continue;
+        }
+        atomic_store_explicit(&admin->loops[i]->admin, request, memory_order_release);
+        uint64_t one = 1;
+        if (write(admin->loops[i]->wake_fd, &one, sizeof(one)) < 0)
+        {
+            perror("[ADMIN] wake failed");
+        }
+    }
+
+    struct pollfd done = {.fd = request->done_fd, .events = POLLIN};
+    long long deadline = clock_now_ns() + ADMIN_TIMEOUT_MS * 1000000LL;
+    while (atomic_load_explicit(&request->pending, memory_order_acquire) > 0)
+    {
+        int left_ms = (int)((deadline - clock_now_ns()) / 1000000);
+        if (left_ms <= 0 || poll(&done, 1, left_ms) == 0)
+        {
+            break;
+        }
+        if (read(request->done_fd, &signals, sizeof(signals)) < 0 && errno != EAGAIN)
+        {
+            perror("[ADMIN] read failed");
+        }
+    }
+
+    // Too slow: take the request back from the loops that have not started on it
+    int unanswered = 0;
+    for (int i = 0; i < admin->loop_count; i++)
+    {
+        AdminRequest *expected = request;
+        if (atomic_compare_exchange_strong(&admin->loops[i]->admin, &expected, NULL))
+        {
+            atomic_fetch_sub(&request->pending, 1);
+            unanswered++;
+        }
+    }
+    while (atomic_load_explicit(&request->pending, memory_order_acquire) > 0)
+    {
+        poll(&done, 1, 10); // A loop in the middle of its walk: it is nearly done
+    }
+    return unanswered;
+}
+
+static int admin_loop_index(const AdminServer *admin, const EventLoop *loop)
+{
+    for (int i = 0; i < admin->loop_count; i++)
+    {
+        if (admin->loops[i] == loop)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+typedef struct
+{
+    const AdminServer *admin;
+    const char *key;
+} AdminSort;
+
+static int admin_compare(const void *a, const void *b, void *arg)
+{
+    const AdminRow *left = (const AdminRow *)a;
+    const AdminRow *right = (const AdminRow *)b;
+    const AdminSort *sort = (const AdminSort *)arg;
+    long long l = 0;
+    long long r = 0;
+    if (strcmp(sort->key, "age") == 0)
+    {
+        l = left->accepted_ns; // Oldest first
+        r = right->accepted_ns;
+    }
+    else if (strcmp(sort->key, "in") == 0)
+    {
+        l = right->bytes_in;
+        r = left->bytes_in;
+    }
+    else if (strcmp(sort->key, "out") == 0)
+    {
+        l = right->bytes_out;
+        r = left->bytes_out;
+    }
+    else if (strcmp(sort->key, "queued") == 0)
+    {
+        l = right->queued;
+        r = left->queued;
+    }
+    else if (strcmp(sort->key, "peer") == 0)
+    {
+        int by_ip = strcmp(left->ip, right->ip);
+        if (by_ip != 0)
+        {
+            return by_ip;
+        }
+        l = left->port;
+        r = right->port;
+    }
+    else if (strcmp(sort->key, "loop") == 0)
+    {
+        l = admin_loop_index(sort->admin, left->owner);
+        r = admin_loop_index(sort->admin, right->owner);
+    }
+    if (l == r)
+    {
+        l = left->fd;
+        r = right->fd;
+    }
+    return (l > r) - (l < r);
+}
+
+// The entry of 'names' equal to 'value', NULL if none: rows keep the pointer, so no copies
+static const char *admin_lookup(const char **names, int count, const char *value)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(names[i], value) == 0)
+        {
+            return names[i];
+        }
+    }
+    return NULL;
+}
+
+// Fill in the filter and options from "key=value" words; -1 with a message in 'error'
+static int admin_parse(char *words, AdminFilter *filter, const char **sort, int *limit, int *all, char *error,
+                       int size)
+{
+    static const char *states[] = {"idle", "writing", "coalescing", "over-budget", "closing"};
+    static const char *keys[] = {"age", "in", "out", "queued", "loop", "fd", "peer"};
+    memset(filter, 0, sizeof(*filter));
+    filter->loop = -1;
+    filter->fd = -1;
+    char *save = NULL;
+    for (char *word = strtok_r(words, " \t\r\n", &save); word; word = strtok_r(NULL, " \t\r\n", &save))
+    {
+        char *value = strchr(word, '=');
+        if (strcmp(word, "all") == 0)
+        {
+            *all = 1;
+            continue;
+        }
+        if (!value)
+        {
+            snprintf(error, size, "error: expected key=value, got '%s'\n", word);
+            return -1;
+        }
+        *value++ = '\0';
+        if (strcmp(word, "loop") == 0)
+        {
+            filter->loop = atoi(value);
+        }
+        else if (strcmp(word, "fd") == 0)
+        {
+            filter->fd = atoi(value);
+        }
+        else if (strcmp(word, "peer") == 0)
+        {
+            snprintf(filter->peer, sizeof(filter->peer), "%s", value);
+        }
+        else if (strcmp(word, "min-age") == 0)
+        {
+            filter->min_age_ns = (long long)(atof(value) * 1e9);
+        }
+        else if (strcmp(word, "min-in") == 0)
+        {
+            filter->min_bytes_in = atoll(value);
+        }
+        else if (strcmp(word, "min-out") == 0)
+        {
+            filter->min_bytes_out = atoll(value);
+        }
+        else if (strcmp(word, "min-queued") == 0)
+        {
+            filter->min_queued = atoi(value);
+        }
+        else if (strcmp(word, "limit") == 0)
+        {
+            *limit = atoi(value);
+        }
+        else if (strcmp(word, "state") == 0 &&
+                 (filter->state = admin_lookup(states, sizeof(states) / sizeof(states[0]), value)) == NULL)
+        {
+            snprintf(error, size, "error: unknown state '%s'\n", value);
+            return -1;
+        }
+        else if (strcmp(word, "sort") == 0 && (*sort = admin_lookup(keys, sizeof(keys) / sizeof(keys[0]), value)) == NULL)
+        {
+            snprintf(error, size, "error: unknown sort key '%s'\n", value);
+            return -1;
+        }
+        else if (strcmp(word, "state") != 0 && strcmp(word, "sort") != 0)
+        {
+            snprintf(error, size, "error: unknown filter '%s'\n", word);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Run one command line and write the reply to fd
+static void admin_execute(AdminServer *admin, char *line, FILE *out)
+{
+    char *rest = NULL;
+    char *command = strtok_r(line, " \t\r\n", &rest);
+    if (!command || strcmp(command, "help") == 0)
+    {
+        fprintf(out, "list [FILTER...] [sort=KEY] [limit=N]\n"
+                    "close FILTER... | close all\n"
+                    "  FILTER: loop=N fd=N peer=IP[:PORT] state=idle|writing|coalescing|over-budget|closing\n"
+                    "          min-age=SECONDS min-in=BYTES min-out=BYTES min-queued=BYTES\n"
+                    "  KEY: age in out queued (largest first), loop fd peer\n");
+        return;
+    }
+
+    AdminRequest *request = &admin->request;
+    const char *sort = "fd";
+    int limit = -1; // All
+    int all = 0;
+    char error[128];
+    if (strcmp(command, "list") == 0)
+    {
+        request->action = ADMIN_LIST;
+    }
+    else if (strcmp(command, "close") == 0)
+    {
+        request->action = ADMIN_CLOSE;
+    }
+    else
+    {
+        fprintf(out, "error: unknown command '%s' (try help)\n", command);
+        return;
+    }
+    if (admin_parse(rest, &request->filter, &sort, &limit, &all, error, sizeof(error)) < 0)
+    {
+        fprintf(out, "%s", error);
+        return;
+    }
+    const AdminFilter *filter = &request->filter;
+    if (request->action == ADMIN_CLOSE && !all &&
+        (filter->loop < 0 && filter->fd < 0 && !filter->peer[0] && !filter->state && !filter->min_age_ns &&
+         !filter->min_bytes_in && !filter->min_bytes_out && !filter->min_queued))
+    {
+        fprintf(out, "error: close needs a filter, or 'all'\n");
+        return;
+    }
+
+    int unanswered = admin_collect(admin);
+    int matched = atomic_load(&request->count);
+    int stored = matched < request->capacity ? matched : request->capacity;
+    AdminSort by = {admin, sort};
+    qsort_r(request->rows, stored, sizeof(AdminRow), admin_compare, &by);
+    int shown = limit >= 0 && limit < stored ? limit : stored;
+
+    long long now = clock_now_ns();
+    fprintf(out, "%4s %6s %-21s %9s %12s %12s %8s %s\n", "LOOP", "FD", "PEER", "AGE_S", "BYTES_IN", "BYTES_OUT",
+            "QUEUED", "STATE");
+    for (int i = 0; i < shown; i++)
+    {
+        const AdminRow *row = &request->rows[i];
+        char peer[32];
+        snprintf(peer, sizeof(peer), "%s:%d", row->ip, row->port);
+        fprintf(out, "%4d %6d %-21s %9.1f %12lld %12lld %8d %s\n", admin_loop_index(admin, row->owner), row->fd, peer,
+                (now - row->accepted_ns) / 1e9, row->bytes_in, row->bytes_out, row->queued, row->state);
+    }
+    fprintf(out, "%d connection%s %s, %d shown", matched, matched == 1 ? "" : "s",
+            request->action == ADMIN_CLOSE ? "closed" : "matched", shown);
+    if (unanswered > 0)
+    {
+        fprintf(out, "; %d loop%s busy for %d ms, not included", unanswered, unanswered == 1 ? "" : "s",
+                ADMIN_TIMEOUT_MS);
+    }
+    fprintf(out, "\n");
+}
+
+static void *admin_main(void *arg)
+{
+    AdminServer *admin = (AdminServer *)arg;
+
+    // Replies go out through stdio, which has no MSG_NOSIGNAL: a client that
+    // hangs up early must cost an EPIPE, not the process
+    sigset_t pipe;
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe, NULL);
+
+    while (!atomic_load(&admin->stopping))
+    {
+        int fd = accept4(admin->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            continue; // EINTR, or shut down by admin_stop()
+        }
+
+        // One command per connection: a line, or everything up to the client's shutdown()
+        struct timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char line[1024];
+        int length = 0;
+        ssize_t n;
+        while (length < (int)sizeof(line) - 1 && (n = recv(fd, line + length, sizeof(line) - 1 - length, 0)) > 0)
+        {
+            length += (int)n;
+            if (memchr(line, '\n', length))
+            {
+                break;
+            }
+        }
+        line[length] = '\0';
+        FILE *out = fdopen(fd, "w"); // Buffered: one write() per few KiB of rows, not one per row
+        if (!out)
+        {
+            close(fd);
+            continue;
+        }
+        admin_execute(admin, line, out);
+        fclose(out);
+    }
+    return NULL;
+}
+
+// Listen on a Unix socket at 'path' and answer commands about 'loops'
+AdminServer *admin_start(const char *path, EventLoop **loops, int count)
+{
+    AdminServer *admin = (AdminServer *)calloc(1, sizeof(AdminServer));
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (!admin || strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "[ADMIN] Cannot use %s\n", path);
+        free(admin);
+        return NULL;
+    }
+    memcpy(addr.sun_path, path, strlen(path));
+    admin->loops = (EventLoop **)malloc(count * sizeof(EventLoop *));
+    admin->rows = (AdminRow *)malloc(ADMIN_MAX_ROWS * sizeof(AdminRow));
+    admin->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    admin->request.done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!admin->loops || !admin->rows || admin->listen_fd < 0 || admin->request.done_fd < 0)
+    {
+        perror("[ADMIN] setup failed");
+        admin_stop(admin);
+        return NULL;
+    }
+    memcpy(admin->loops, loops, count * sizeof(EventLoop *));
+    admin->loop_count = count;
+    admin->request.rows = admin->rows;
+    admin->request.capacity = ADMIN_MAX_ROWS;
+    atomic_init(&admin->stopping, 0);
+
+    unlink(path); // Left behind by a server that did not exit cleanly
+    mode_t mask = umask(0177);
+    int bound = bind(admin->listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (bound < 0 || listen(admin->listen_fd, 8) < 0)
+    {
+        perror("[ADMIN] bind failed");
+        admin_stop(admin);
+        return NULL;
+    }
+    snprintf(admin->path, sizeof(admin->path), "%s", path); // Ours to unlink from now on
+
+    if (pthread_create(&admin->thread, NULL, admin_main, admin) != 0)
+    {
+        perror("[ADMIN] pthread_create failed");
+        admin_stop(admin);
+        return NULL;
+    }
+    admin->started = 1;
+    return admin;
+}
+
+// Stop answering and remove the socket; call before the loops are freed
+void admin_stop(AdminServer *admin)
+{
+    if (!admin)
+    {
+        return;
+    }
+    if (admin->started)
+    {
+        atomic_store(&admin->stopping, 1);
+        shutdown(admin->listen_fd, SHUT_RDWR); // Wakes the accept()
+        pthread_join(admin->thread, NULL);
+    }
+    if (admin->listen_fd >= 0)
+    {
+        close(admin->listen_fd);
+    }
+    if (admin->request.done_fd >= 0)
+    {
+        close(admin->request.done_fd);
+    }
+    if (admin->path[0])
+    {
+        unlink(admin->path);
+    }
+    free(admin->rows);
+    free(admin->loops);
+    free(admin);
+}
+
+// Send one command to the admin socket at 'path' and copy the reply to stdout
+int admin_command(const char *path, const char *command)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "[ADMIN] Path too long: %s\n", path);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, strlen(path));
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("[ADMIN] connect failed");
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    dprintf(fd, "%s\n", command);
+    shutdown(fd, SHUT_WR);
+
+    char buffer[4096];
+    ssize_t n;
+    int result = -1; // Until a reply that is not an error arrives
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+    {
+        if (result < 0 && strncmp(buffer, "error", n < 5 ? n : 5) != 0)
+        {
+            result = 0;
+        }
+        fwrite(buffer, 1, n, stdout);
+    }
+    close(fd);
+    return result;
+}
@@ -0,0 +1,80 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include "event_loop.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define ADMIN_MAX_ROWS 65536  // Connections one command can see
+#define ADMIN_TIMEOUT_MS 1000 // How long a command waits for a busy loop
+
+// Which connections a command applies to; every field set must match
+typedef struct
+{
+    int loop;                  // -1 = any (only that loop is asked)
+    int fd;                    // -1 = any
+    char peer[24];             // Prefix of "ip:port" ("" = any)
+    const char *state;         // One of the state names below (NULL = any)
+    long long min_age_ns;
+    long long min_bytes_in;
+    long long min_bytes_out;
+    int min_queued;
+} AdminFilter;
+
+// One connection as its loop saw it
+typedef struct
+{
+    EventLoop *owner;
+    int fd;
+    char ip[16];
+    int port;
+    const char *state; // "idle", "writing", "coalescing", "over-budget", "closing"
+    long long accepted_ns;
+    long long bytes_in;
+    long long bytes_out;
+    int queued; // Output bytes not yet written
+} AdminRow;
+
+typedef enum
+{
+    ADMIN_LIST,
+    ADMIN_CLOSE
+} AdminAction;
+
+/*
+ * A command in flight. The admin thread posts it to every loop's mailbox;
+ * each loop answers it at the end of an iteration, on its own thread, and
+ * appends its rows at an index reserved with one atomic add.
+ */
+typedef struct AdminRequest
+{
+    AdminAction action;
+    AdminFilter filter;
+    AdminRow *rows;
+    int capacity;
+    atomic_int count;   // Rows reserved; beyond capacity they were matched but not stored
+    atomic_int pending; // Loops that took the request and have not finished it
+    int done_fd;        // eventfd the last loop to finish writes
+} AdminRequest;
+
+// The admin channel: a Unix socket and the thread answering it
+typedef struct
+{
+    int listen_fd;
+    char path[108];
+    EventLoop **loops;
+    int loop_count;
+    pthread_t thread;
+    int started;
+    atomic_int stopping;
+    AdminRequest request; // Reused by every command
+    AdminRow *rows;       // ADMIN_MAX_ROWS, allocated once
+} AdminServer;
+
+/* Function prototypes for the admin channel */
+AdminServer *admin_start(const char *path, EventLoop **loops, int count);
+void admin_stop(AdminServer *admin);
+void admin_serve(EventLoop *loop);
+int admin_command(const char *path, const char *command);
+
+#endif
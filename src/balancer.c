@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+#include "balancer.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Backend selection for the proxy.
+ *
+ * Three policies share one Backend table:
+ *
+ *   round-robin  - the baseline. Every backend gets the same share of new
+ *                  connections no matter how slow it currently is, so a slow
+ *                  replica accumulates a queue and drags the tail up.
+ *
+ *   p2c          - "power of two choices". Pick two backends at random and use
+ *                  the one with fewer requests in flight. Sampling just two is
+ *                  enough to avoid herding (everyone piling onto the single
+ *                  least-loaded backend) while still steering around slow ones.
+ *
+ *   chash        - consistent hashing with bounded loads. The key (the client
+ *                  IP) lands on a ring of virtual nodes, so the same client keeps
+ *                  going to the same backend (sticky routing). To stop a hot key
+ *                  from overloading its owner, a backend is skipped while it
+ *                  carries more than load_factor * average in-flight requests
+ *                  and the walk continues clockwise to the next one.
+ *
+ * Health is passive: the proxy reports every upstream attempt. After
+ * eject_after consecutive failures a backend is ejected for eject_base_ms,
+ * doubling on each re-ejection up to eject_max_ms. If every backend is
+ * ejected we ignore ejection altogether ("panic mode") - sending traffic to
+ * a maybe-dead backend beats refusing all of it.
+ */
+
+// FNV-1a followed by a murmur3 finalizer so that similar keys
+// ("10.0.0.1", "10.0.0.2") still spread across the whole ring.
+uint32_t balancer_hash(const void *data, int len)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++)
+    {
+        h ^= bytes[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// Per-thread xorshift state: P2C only needs cheap, roughly uniform choices
+static _Thread_local uint32_t rng_state;
+
+static uint32_t next_random(void)
+{
+    if (rng_state == 0)
+    {
+        rng_state = (uint32_t)clock_now_ns() | 1u;
+    }
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+Balancer *balancer_create(BalancePolicy policy)
+{
+    Balancer *lb = (Balancer *)malloc(sizeof(Balancer));
+    if (!lb)
+    {
+        perror("[BALANCER] malloc failed");
+        return NULL;
+    }
+
+    memset(lb, 0, sizeof(Balancer));
+    lb->policy = policy;
+    lb->load_factor = 1.25;
+    lb->eject_after = 3;
+    lb->eject_base_ms = 1000;
+    lb->eject_max_ms = 30000;
+    return lb;
+}
+
+int balancer_add_backend(Balancer *lb, const char *host, int port)
+{
+    if (lb->backend_count >= BALANCER_MAX_BACKENDS)
+    {
+        fprintf(stderr, "[BALANCER] Too many backends (max %d)\n", BALANCER_MAX_BACKENDS);
+        return -1;
+    }
+
+    Backend *backend = &lb->backends[lb->backend_count];
+    snprintf(backend->host, sizeof(backend->host), "%s", host);
+    backend->port = port;
+    atomic_init(&backend->outstanding, 0);
+    atomic_init(&backend->consecutive_failures, 0);
+    atomic_init(&backend->ejected_until_ns, 0);
+    atomic_init(&backend->ejections, 0);
+    return lb->backend_count++;
+}
+
+static int compare_ring_points(const void *a, const void *b)
+{
+    const RingPoint *left = (const RingPoint *)a;
+    const RingPoint *right = (const RingPoint *)b;
+    if (left->hash != right->hash)
+    {
+        return left->hash < right->hash ? -1 : 1;
+    }
+    return left->backend - right->backend;
+}
+
+// Build the hash ring once all backends are known. Only chash needs it.
+int balancer_finalize(Balancer *lb)
+{
+    if (lb->backend_count == 0)
+    {
+        fprintf(stderr, "[BALANCER] No backends configured\n");
+        return -1;
+    }
+    if (lb->policy != BALANCE_CHASH)
+    {
+        return 0;
+    }
+
+    lb->ring_size = lb->backend_count * BALANCER_VNODES;
+    lb->ring = (RingPoint *)malloc(sizeof(RingPoint) * lb->ring_size);
+    if (!lb->ring)
+    {
+        perror("[BALANCER] ring malloc failed");
+        return -1;
+    }
+
+    int n = 0;
+    for (int b = 0; b < lb->backend_count; b++)
+    {
+        for (int v = 0; v < BALANCER_VNODES; v++)
+        {
+            char label[96];
+            int len = snprintf(label, sizeof(label), "%s:%d#%d",
+                               lb->backends[b].host, lb->backends[b].port, v);
+            lb->ring[n].hash = balancer_hash(label, len);
+            lb->ring[n].backend = b;
+            n++;
+        }
+    }
+    qsort(lb->ring, lb->ring_size, sizeof(RingPoint), compare_ring_points);
+    return 0;
+}
+
+static int backend_healthy(Backend *backend, long long now)
+{
+    return atomic_load_explicit(&backend->ejected_until_ns, memory_order_relaxed) <= now;
+}
+
+static int pick_round_robin(Balancer *lb, int ignore_health, long long now)
+{
+    for (int attempt = 0; attempt < lb->backend_count; attempt++)
+    {
+        unsigned int next = atomic_fetch_add_explicit(&lb->rr_next, 1, memory_order_relaxed);
+        int b = (int)(next % (unsigned int)lb->backend_count);
+        if (ignore_health || backend_healthy(&lb->backends[b], now))
+        {
+            return b;
+        }
+    }
+    return -1;
+}
+
+static int pick_p2c(Balancer *lb, int ignore_health, long long now)
+{
+    int healthy[BALANCER_MAX_BACKENDS];
+    int count = 0;
+    for (int b = 0; b < lb->backend_count; b++)
+    {
+        if (ignore_health || backend_healthy(&lb->backends[b], now))
+        {
+            healthy[count++] = b;
+        }
+    }
+    if (count == 0)
+    {
+        return -1;
+    }
+    if (count == 1)
+    {
+        return healthy[0];
+    }
+
+    // Two distinct random candidates: the second is drawn from the other count-1
+    int first = (int)(next_random() % (uint32_t)count);
+    int second = (int)(next_random() % (uint32_t)(count - 1));
+    if (second >= first)
+    {
+        second++;
+    }
+
+    int a = healthy[first];
+    int b = healthy[second];
+    int load_a = atomic_load_explicit(&lb->backends[a].outstanding, memory_order_relaxed);
+    int load_b = atomic_load_explicit(&lb->backends[b].outstanding, memory_order_relaxed);
+    return load_b < load_a ? b : a;
+}
+
+static int pick_chash(Balancer *lb, uint32_t key, int ignore_health, long long now)
+{
+    int total = 0;
+    int healthy_count = 0;
+    for (int b = 0; b < lb->backend_count; b++)
+    {
+        if (ignore_health || backend_healthy(&lb->backends[b], now))
+        {
+            total += atomic_load_explicit(&lb->backends[b].outstanding, memory_order_relaxed);
+            healthy_count++;
+        }
+    }
+    if (healthy_count == 0)
+    {
+        return -1;
+    }
+
+    // Bounded loads: capacity = ceil(c * (total + 1) / n), counting the new request
+    int capacity = (int)(lb->load_factor * (double)(total + 1) / (double)healthy_count);
+    if ((double)capacity < lb->load_factor * (double)(total + 1) / (double)healthy_count)
+    {
+        capacity++;
+    }
+
+    // Binary search for the first ring point clockwise from the key
+    int lo = 0;
+    int hi = lb->ring_size;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (lb->ring[mid].hash < key)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    int fallback = -1;
+    for (int step = 0; step < lb->ring_size; step++)
+    {
+        int b = lb->ring[(lo + step) % lb->ring_size].backend;
+        if (!ignore_health && !backend_healthy(&lb->backends[b], now))
+        {
+            continue;
+        }
+        if (fallback < 0)
+        {
+            fallback = b;
+        }
+        if (atomic_load_explicit(&lb->backends[b].outstanding, memory_order_relaxed) < capacity)
+        {
+            return b;
+        }
+    }
+    // Loads moved under us between the sum and the walk; take the owner
+    return fallback;
+}
+
+// Pick a backend and count one more request in flight on it.
+// Every successful pick must be paired with balancer_release().
+int balancer_pick(Balancer *lb, uint32_t key)
+{
+    long long now = clock_now_ns();
+    int backend = -1;
+
+    for (int ignore_health = 0; ignore_health <= 1 && backend < 0; ignore_health++)
+    {
+        switch (lb->policy)
+        {
+        case BALANCE_ROUND_ROBIN:
+            backend = pick_round_robin(lb, ignore_health, now);
+            break;
+        case BALANCE_P2C:
+            backend = pick_p2c(lb, ignore_health, now);
+            break;
+        case BALANCE_CHASH:
+            backend = pick_chash(lb, key, ignore_health, now);
+            break;
+        }
+    }
+
+    if (backend >= 0)
+    {
+        atomic_fetch_add_explicit(&lb->backends[backend].outstanding, 1, memory_order_relaxed);
+    }
+    return backend;
+}
+
+void balancer_release(Balancer *lb, int backend)
+{
+    atomic_fetch_sub_explicit(&lb->backends[backend].outstanding, 1, memory_order_relaxed);
+}
+
+// Passive health check: called with the outcome of every upstream attempt
+void balancer_report(Balancer *lb, int backend, int success)
+{
+    Backend *b = &lb->backends[backend];
+
+    if (success)
+    {
+        atomic_store_explicit(&b->consecutive_failures, 0, memory_order_relaxed);
+        if (atomic_load_explicit(&b->ejected_until_ns, memory_order_relaxed) != 0)
+        {
+            atomic_store_explicit(&b->ejected_until_ns, 0, memory_order_relaxed);
+            atomic_store_explicit(&b->ejections, 0, memory_order_relaxed);
+        }
+        return;
+    }
+
+    int failures = atomic_fetch_add_explicit(&b->consecutive_failures, 1, memory_order_relaxed) + 1;
+    if (failures < lb->eject_after)
+    {
+        return;
+    }
+
+    int ejections = atomic_fetch_add_explicit(&b->ejections, 1, memory_order_relaxed);
+    long period_ms = lb->eject_base_ms;
+    for (int i = 0; i < ejections && period_ms < lb->eject_max_ms; i++)
+    {
+        period_ms *= 2;
+    }
+    if (period_ms > lb->eject_max_ms)
+    {
+        period_ms = lb->eject_max_ms;
+    }
+
+    atomic_store_explicit(&b->consecutive_failures, 0, memory_order_relaxed);
+    atomic_store_explicit(&b->ejected_until_ns, clock_now_ns() + period_ms * 1000000LL,
+                          memory_order_relaxed);
+    fprintf(stderr, "[BALANCER] Ejected backend %s:%d for %ld ms after %d failures\n",
+            b->host, b->port, period_ms, failures);
+}
+
+void balancer_free(Balancer *lb)
+{
+    if (lb)
+    {
+        free(lb->ring);
+        free(lb);
+    }
+}
+
+int balancer_parse_policy(const char *name, BalancePolicy *policy)
+{
+    if (strcmp(name, "rr") == 0 || strcmp(name, "round-robin") == 0)
+    {
+        *policy = BALANCE_ROUND_ROBIN;
+    }
+    else if (strcmp(name, "p2c") == 0)
+    {
+        *policy = BALANCE_P2C;
+    }
+    else if (strcmp(name, "chash") == 0)
+    {
+        *policy = BALANCE_CHASH;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+const char *balancer_policy_name(BalancePolicy policy)
+{
+    switch (policy)
+    {
+    case BALANCE_ROUND_ROBIN:
+        return "rr";
+    case BALANCE_P2C:
+        return "p2c";
+    case BALANCE_CHASH:
+        return "chash";
+    }
+    return "?";
+}
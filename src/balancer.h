@@ -0,0 +1,63 @@
+#ifndef BALANCER_H
+#define BALANCER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define BALANCER_MAX_BACKENDS 64
+#define BALANCER_VNODES 160 // Virtual nodes per backend on the hash ring
+
+typedef enum
+{
+    BALANCE_ROUND_ROBIN,
+    BALANCE_P2C,   // Power of two choices on outstanding requests
+    BALANCE_CHASH, // Consistent hashing with bounded loads
+} BalancePolicy;
+
+typedef struct
+{
+    char host[64];
+    int port;
+    atomic_int outstanding;          // Requests currently in flight on this backend
+    atomic_int consecutive_failures; // Reset by any success
+    atomic_llong ejected_until_ns;   // Monotonic time until which the backend is skipped
+    atomic_int ejections;            // How many times it was ejected (drives backoff)
+} Backend;
+
+typedef struct
+{
+    uint32_t hash;
+    int backend;
+} RingPoint;
+
+typedef struct
+{
+    BalancePolicy policy;
+    Backend backends[BALANCER_MAX_BACKENDS];
+    int backend_count;
+
+    atomic_uint rr_next; // Round-robin cursor
+
+    RingPoint *ring; // Sorted by hash, BALANCER_VNODES points per backend
+    int ring_size;
+    double load_factor; // Bounded-load c: a backend may carry at most c * average
+
+    int eject_after;    // Consecutive failures before ejection
+    long eject_base_ms; // First ejection period, doubled on each re-ejection
+    long eject_max_ms;  // Upper bound for the doubled period
+} Balancer;
+
+/* Function prototypes for the balancer */
+Balancer *balancer_create(BalancePolicy policy);
+int balancer_add_backend(Balancer *lb, const char *host, int port);
+int balancer_finalize(Balancer *lb);
+int balancer_pick(Balancer *lb, uint32_t key);
+void balancer_release(Balancer *lb, int backend);
+void balancer_report(Balancer *lb, int backend, int success);
+void balancer_free(Balancer *lb);
+
+int balancer_parse_policy(const char *name, BalancePolicy *policy);
+const char *balancer_policy_name(BalancePolicy policy);
+uint32_t balancer_hash(const void *data, int len);
+
+#endif
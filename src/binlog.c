@@ -0,0 +1,693 @@
+#define _GNU_SOURCE
+#include "binlog.h"
+#include "clock.h"
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/*
+ * A binary log in the style of NanoLog.
+ *
+ * printf("[SEND] Sent %d bytes: %s\n", ...) spends hundreds of nanoseconds
+ * turning numbers into text, and a write() on top. Yet the format is a
+ * constant: only the arguments change. BINLOG() therefore writes the
+ * format once per call site (a definition record), and per call just the
+ * site's id, a timestamp and the raw argument bytes: an integer is 8 bytes
+ * copied, not a division loop. binlog_decode() renders the text offline.
+ *
+ * The file is mapped whole. Each thread claims a 64 KiB chunk of it with
+ * one atomic add and writes its records there with plain stores; no lock,
+ * no system call, and the kernel writes the pages back on its own, so the
+ * records of a crashed process are still in the file. A chunk header says
+ * which thread wrote it and how many bytes are valid. A claimed chunk is
+ * faulted in at once, so logging itself never takes a page fault.
+ *
+ * Records are stamped with clock_cached_ns(): inside an event loop that is
+ * the start of the iteration, so events of one iteration share a stamp and
+ * keep their order within the thread. The decoder merges all threads by
+ * time.
+ */
+
+Binlog *binlog = NULL;
+
+static int binlog_generations = 0;
+static _Thread_local BinlogChunk *thread_chunk = NULL;
+static _Thread_local int thread_generation = 0;
+static _Thread_local int thread_tid = 0;
+
+// One conversion of a format, as printf() reads it
+typedef struct
+{
+    const char *start;
+    int length;    // Of the spec, '%' and conversion character included
+    int stars;     // '*' width and precision, each an int argument before the value
+    int precision; // -1 none, -2 from a '*' argument, else the literal one
+    int arg;       // BinlogArg of the value, -1 if none can be stored
+} Conversion;
+
+// The next conversion at or after p, NULL if there is none ("%%" is not one)
+static const char *next_conversion(const char *p, Conversion *conv)
+{
+    while ((p = strchr(p, '%')))
+    {
+        if (p[1] == '%')
+        {
+            p += 2;
+            continue;
+        }
+        const char *q = p + 1;
+        conv->start = p;
+        conv->stars = 0;
+        conv->precision = -1;
+        q += strspn(q, "-+ #0'");
+        if (*q == '*')
+        {
+            conv->stars++;
+            q++;
+        }
+        q += strspn(q, "0123456789");
+        if (*q == '.')
+        {
+            q++;
+            if (*q == '*')
+            {
+                conv->stars++;
+                conv->precision = -2;
+                q++;
+            }
+            else
+            {
+                conv->precision = atoi(q);
+                q += strspn(q, "0123456789");
+            }
+        }
+        int wide = 0;
+        int long_double = 0;
+        while (*q && strchr("hlLqjzt", *q))
+        {
+            long_double |= *q == 'L';
+            wide |= *q != 'h' && *q != 'L';
+            q++;
+        }
+        switch (*q)
+        {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+            conv->arg = wide ? BINLOG_ARG_WIDE : BINLOG_ARG_INT;
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            conv->arg = long_double ? BINLOG_ARG_LONG_DOUBLE : BINLOG_ARG_DOUBLE;
+            break;
+        case 's':
+            conv->arg = wide ? -1 : BINLOG_ARG_STRING; // No wide strings
+            break;
+        case 'p':
+            conv->arg = BINLOG_ARG_POINTER;
+            break;
+        default:
+            conv->arg = -1; // %n, %m, or a malformed spec
+            break;
+        }
+        if (*q)
+        {
+            q++;
+        }
+        conv->length = (int)(q - p);
+        return q;
+    }
+    return NULL;
+}
+
+// Fill in site->args from its format; -1 if a conversion cannot be stored
+static int binlog_parse(BinlogSite *site, int *precision)
+{
+    Conversion conv;
+    const char *p = site->format;
+    site->count = 0;
+    while ((p = next_conversion(p, &conv)))
+    {
+        if (conv.arg < 0 || site->count + conv.stars + 1 > BINLOG_MAX_ARGS)
+        {
+            return -1;
+        }
+        for (int i = 0; i < conv.stars; i++)
+        {
+            precision[site->count] = -1;
+            site->args[site->count++] = BINLOG_ARG_INT;
+        }
+        precision[site->count] = conv.precision;
+        site->args[site->count++] = (unsigned char)conv.arg;
+    }
+    return 0;
+}
+
+static BinlogChunk *binlog_claim(Binlog *log)
+{
+    size_t offset = atomic_fetch_add(&log->claimed, BINLOG_CHUNK_SIZE);
+    if (offset + BINLOG_CHUNK_SIZE > log->capacity)
+    {
+        return NULL;
+    }
+    if (!thread_tid)
+    {
+        thread_tid = (int)syscall(SYS_gettid);
+    }
+    BinlogChunk *chunk = (BinlogChunk *)(log->map + offset);
+#ifdef MADV_POPULATE_WRITE
+    // Fault the chunk's 16 pages in with one call, not one trap per page while logging (Linux 5.14+)
+    madvise(chunk, BINLOG_CHUNK_SIZE, MADV_POPULATE_WRITE);
+#endif
+    memcpy(chunk->magic, "CHNK", 4);
+    chunk->tid = thread_tid;
+    chunk->used = 0;
+    thread_chunk = chunk;
+    thread_generation = log->generation;
+    return chunk;
+}
+
+// Room for one record of at most BINLOG_MAX_RECORD bytes in this thread's chunk; NULL if the file is full
+static char *binlog_space(Binlog *log)
+{
+    BinlogChunk *chunk = thread_chunk;
+    if (!chunk || thread_generation != log->generation ||
+        sizeof(BinlogChunk) + chunk->used + BINLOG_MAX_RECORD > BINLOG_CHUNK_SIZE)
+    {
+        chunk = binlog_claim(log);
+        if (!chunk)
+        {
+            atomic_fetch_add(&log->dropped, 1);
+            return NULL;
+        }
+    }
+    return (char *)(chunk + 1) + chunk->used;
+}
+
+static uint32_t align8(size_t size)
+{
+    return (uint32_t)((size + 7) & ~(size_t)7);
+}
+
+// Give the site an id in this log and write its definition; the id, or -1
+static int binlog_register(Binlog *log, BinlogSite *site)
+{
+    pthread_mutex_lock(&log->lock);
+    int id = atomic_load(&site->id);
+    if (atomic_load(&site->generation) != log->generation)
+    {
+        int precision[BINLOG_MAX_ARGS];
+        size_t file_length = strlen(site->file) + 1;
+        size_t format_length = strlen(site->format) + 1;
+        char *out = NULL;
+        id = -1;
+        if (sizeof(BinlogRecord) + 8 + file_length + format_length > BINLOG_MAX_RECORD ||
+            binlog_parse(site, precision) < 0)
+        {
+            fprintf(stderr, "[BINLOG] %s:%d: format not supported: %s", site->file, site->line, site->format);
+        }
+        else if ((out = binlog_space(log)))
+        {
+            memcpy(site->precision, precision, sizeof(precision));
+            id = ++log->sites;
+            BinlogRecord *record = (BinlogRecord *)out;
+            uint32_t meta[2] = {(uint32_t)id, (uint32_t)site->line};
+            char *p = out + sizeof(BinlogRecord);
+            memcpy(p, meta, sizeof(meta));
+            p += sizeof(meta);
+            memcpy(p, site->file, file_length);
+            p += file_length;
+            memcpy(p, site->format, format_length);
+            p += format_length;
+            record->id = 0;
+            record->size = align8(p - out);
+            thread_chunk->used += record->size;
+        }
+        // Settled unless the file was full: then the next call tries again
+        if (id != -1 || !out)
+        {
+            atomic_store(&site->id, id);
+            atomic_store_explicit(&site->generation, log->generation, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+    return id;
+}
+
+// Record one event of 'site'; the arguments must match site->format
+void binlog_record(BinlogSite *site, const char *format, ...)
+{
+    (void)format; // Only there for the compiler's format check
+    Binlog *log = binlog;
+    if (!log)
+    {
+        return;
+    }
+    int id = atomic_load_explicit(&site->generation, memory_order_acquire) == log->generation
+                 ? atomic_load_explicit(&site->id, memory_order_relaxed)
+                 : binlog_register(log, site);
+    if (id <= 0)
+    {
+        return;
+    }
+    char *out = binlog_space(log);
+    if (!out)
+    {
+        return;
+    }
+
+    char *p = out + sizeof(BinlogRecord);
+    int64_t now = clock_cached_ns();
+    memcpy(p, &now, sizeof(now));
+    p += sizeof(now);
+
+    va_list ap;
+    va_start(ap, format);
+    long long star = 0; // The last int argument: a '*' precision caps the next string
+    for (int i = 0; i < site->count; i++)
+    {
+        long long value = 0;
+        double real = 0;
+        switch (site->args[i])
+        {
+        case BINLOG_ARG_INT:
+            value = star = va_arg(ap, int);
+            memcpy(p, &value, sizeof(value));
+            p += sizeof(value);
+            break;
+        case BINLOG_ARG_WIDE:
+            value = va_arg(ap, long long);
+            memcpy(p, &value, sizeof(value));
+            p += sizeof(value);
+            break;
+        case BINLOG_ARG_DOUBLE:
+            real = va_arg(ap, double);
+            memcpy(p, &real, sizeof(real));
+            p += sizeof(real);
+            break;
+        case BINLOG_ARG_LONG_DOUBLE:
+            real = (double)va_arg(ap, long double);
+            memcpy(p, &real, sizeof(real));
+            p += sizeof(real);
+            break;
+        case BINLOG_ARG_POINTER:
+            value = (long long)(uintptr_t)va_arg(ap, void *);
+            memcpy(p, &value, sizeof(value));
+            p += sizeof(value);
+            break;
+        case BINLOG_ARG_STRING:
+        {
+            const char *text = va_arg(ap, const char *);
+            long long limit = BINLOG_MAX_STRING;
+            if (site->precision[i] == -2 && star >= 0 && star < limit)
+            {
+                limit = star;
+            }
+            else if (site->precision[i] >= 0 && site->precision[i] < limit)
+            {
+                limit = site->precision[i];
+            }
+            uint16_t length = text ? (uint16_t)strnlen(text, (size_t)limit) : 0;
+            memcpy(p, &length, sizeof(length));
+            p += sizeof(length);
+            memcpy(p, text, length);
+            p += length;
+            break;
+        }
+        }
+    }
+    va_end(ap);
+
+    BinlogRecord *record = (BinlogRecord *)out;
+    record->id = (uint32_t)id;
+    record->size = align8(p - out);
+    thread_chunk->used += record->size;
+}
+
+// Map a new log of 'capacity' bytes at path and make it the process's binlog
+int binlog_open(const char *path, size_t capacity)
+{
+    capacity -= capacity % BINLOG_CHUNK_SIZE;
+    if (capacity < 2 * BINLOG_CHUNK_SIZE)
+    {
+        capacity = 2 * BINLOG_CHUNK_SIZE;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror("[BINLOG] open failed");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)capacity) < 0)
+    {
+        perror("[BINLOG] ftruncate failed");
+        close(fd);
+        return -1;
+    }
+    char *map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("[BINLOG] mmap failed");
+        close(fd);
+        return -1;
+    }
+    Binlog *log = (Binlog *)malloc(sizeof(Binlog));
+    if (!log)
+    {
+        perror("[BINLOG] malloc failed");
+        munmap(map, capacity);
+        close(fd);
+        return -1;
+    }
+
+    // The header takes the first chunk: chunks stay aligned to their size
+    BinlogHeader *header = (BinlogHeader *)map;
+    memcpy(header->magic, BINLOG_MAGIC, sizeof(header->magic));
+    header->chunk_size = BINLOG_CHUNK_SIZE;
+    header->header_size = BINLOG_CHUNK_SIZE;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header->realtime_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    header->monotonic_ns = clock_now_ns();
+
+    log->fd = fd;
+    log->map = map;
+    log->capacity = capacity;
+    atomic_init(&log->claimed, BINLOG_CHUNK_SIZE);
+    atomic_init(&log->dropped, 0);
+    log->generation = ++binlog_generations;
+    pthread_mutex_init(&log->lock, NULL);
+    log->sites = 0;
+    binlog = log;
+    return 0;
+}
+
+// Close the process's binlog and cut the file to what was used; no thread may still log
+void binlog_close(void)
+{
+    Binlog *log = binlog;
+    if (!log)
+    {
+        return;
+    }
+    binlog = NULL;
+    size_t used = atomic_load(&log->claimed);
+    if (used > log->capacity)
+    {
+        used -= (used - log->capacity) / BINLOG_CHUNK_SIZE * BINLOG_CHUNK_SIZE; // Failed claims
+    }
+    msync(log->map, used, MS_SYNC);
+    munmap(log->map, log->capacity);
+    if (ftruncate(log->fd, (off_t)used) < 0)
+    {
+        perror("[BINLOG] ftruncate failed");
+    }
+    close(log->fd);
+    long long dropped = atomic_load(&log->dropped);
+    if (dropped > 0)
+    {
+        fprintf(stderr, "[BINLOG] %lld records dropped: the file was full\n", dropped);
+    }
+    pthread_mutex_destroy(&log->lock);
+    free(log);
+}
+
+/* Offline decoding */
+
+typedef struct
+{
+    const char *format;
+} Definition;
+
+typedef struct
+{
+    const BinlogRecord *record;
+    int64_t ns;
+    int tid;
+    size_t seq; // Position in the file: keeps a thread's events in order on equal stamps
+} Event;
+
+static int compare_events(const void *a, const void *b)
+{
+    const Event *left = (const Event *)a;
+    const Event *right = (const Event *)b;
+    if (left->ns != right->ns)
+    {
+        return left->ns < right->ns ? -1 : 1;
+    }
+    return (left->seq > right->seq) - (left->seq < right->seq);
+}
+
+// Literal text of a format, "%%" as "%"
+static void put_literal(const char *from, const char *to, FILE *out)
+{
+    for (const char *c = from; c < to; c++)
+    {
+        fputc(*c, out);
+        if (c[0] == '%' && c + 1 < to && c[1] == '%')
+        {
+            c++;
+        }
+    }
+}
+
+// Render one event with its site's format; 0, or -1 if the record is short
+static int render(const char *format, const char *p, const char *end, FILE *out)
+{
+    Conversion conv;
+    const char *text = format;
+    const char *next;
+    while ((next = next_conversion(text, &conv)))
+    {
+        put_literal(text, conv.start, out);
+        char spec[64];
+        if (conv.length >= (int)sizeof(spec))
+        {
+            return -1;
+        }
+        memcpy(spec, conv.start, conv.length);
+        spec[conv.length] = '\0';
+
+        int stars[2] = {0, 0};
+        for (int i = 0; i < conv.stars; i++)
+        {
+            long long value;
+            if (p + sizeof(value) > end)
+            {
+                return -1;
+            }
+            memcpy(&value, p, sizeof(value));
+            p += sizeof(value);
+            stars[i] = (int)value;
+        }
+
+        long long value = 0;
+        double real = 0;
+        char string[BINLOG_MAX_STRING + 1];
+        if (conv.arg == BINLOG_ARG_STRING)
+        {
+            uint16_t length;
+            if (p + sizeof(length) > end)
+            {
+                return -1;
+            }
+            memcpy(&length, p, sizeof(length));
+            p += sizeof(length);
+            if (length > BINLOG_MAX_STRING || p + length > end)
+            {
+                return -1;
+            }
+            memcpy(string, p, length);
+            string[length] = '\0';
+            p += length;
+        }
+        else
+        {
+            if (p + sizeof(value) > end)
+            {
+                return -1;
+            }
+            memcpy(&value, p, sizeof(value));
+            memcpy(&real, p, sizeof(real));
+            p += sizeof(value);
+        }
+
+        // printf() itself does the formatting, with the original spec
+#define RENDER(arg)                                                                                                    \
+    (conv.stars == 0   ? fprintf(out, spec, arg)                                                                       \
+     : conv.stars == 1 ? fprintf(out, spec, stars[0], arg)                                                             \
+                       : fprintf(out, spec, stars[0], stars[1], arg))
+        switch (conv.arg)
+        {
+        case BINLOG_ARG_INT:
+            RENDER((int)value);
+            break;
+        case BINLOG_ARG_WIDE:
+            RENDER(value);
+            break;
+        case BINLOG_ARG_DOUBLE:
+            RENDER(real);
+            break;
+        case BINLOG_ARG_LONG_DOUBLE:
+            RENDER((long double)real);
+            break;
+        case BINLOG_ARG_POINTER:
+            RENDER((void *)(uintptr_t)value);
+            break;
+        case BINLOG_ARG_STRING:
+            RENDER(string);
+            break;
+        }
+#undef RENDER
+        text = next;
+    }
+    put_literal(text, text + strlen(text), out);
+    return 0;
+}
+
+// Print the events of the binlog at path as text, all threads merged by time; events printed, -1 on error
+int binlog_decode(const char *path, FILE *out)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("[BINLOG] open failed");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(BinlogHeader))
+    {
+        fprintf(stderr, "[BINLOG] %s: not a binlog\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("[BINLOG] mmap failed");
+        return -1;
+    }
+    const BinlogHeader *header = (const BinlogHeader *)map;
+    if (memcmp(header->magic, BINLOG_MAGIC, sizeof(header->magic)) != 0 || header->chunk_size < sizeof(BinlogChunk))
+    {
+        fprintf(stderr, "[BINLOG] %s: not a binlog\n", path);
+        munmap((void *)map, size);
+        return -1;
+    }
+
+    // Pass 1: every definition, and every event with its stamp
+    Definition *definitions = NULL;
+    int defined = 0;
+    Event *events = NULL;
+    size_t count = 0;
+    size_t allocated = 0;
+    int result = 0;
+    for (size_t offset = header->header_size; offset + header->chunk_size <= size; offset += header->chunk_size)
+    {
+        const BinlogChunk *chunk = (const BinlogChunk *)(map + offset);
+        if (memcmp(chunk->magic, "CHNK", 4) != 0)
+        {
+            continue; // Never claimed
+        }
+        const char *p = (const char *)(chunk + 1);
+        const char *end = p + (chunk->used < header->chunk_size - sizeof(BinlogChunk)
+                                   ? chunk->used
+                                   : header->chunk_size - sizeof(BinlogChunk));
+        while (p + sizeof(BinlogRecord) <= end)
+        {
+            const BinlogRecord *record = (const BinlogRecord *)p;
+            if (record->size < sizeof(BinlogRecord) + 8 || p + record->size > end)
+            {
+                break; // Torn: the process died while writing it
+            }
+            if (record->id == 0)
+            {
+                uint32_t meta[2];
+                memcpy(meta, p + sizeof(BinlogRecord), sizeof(meta));
+                const char *file = p + sizeof(BinlogRecord) + sizeof(meta);
+                const char *format = file + strnlen(file, end - file) + 1;
+                if ((int)meta[0] > defined)
+                {
+                    Definition *grown = (Definition *)realloc(definitions, (meta[0] + 1) * sizeof(Definition));
+                    if (!grown)
+                    {
+                        result = -1;
+                        break;
+                    }
+                    memset(grown + defined + 1, 0, (meta[0] - defined) * sizeof(Definition));
+                    definitions = grown;
+                    defined = (int)meta[0];
+                }
+                definitions[meta[0]].format = format < end ? format : NULL;
+            }
+            else
+            {
+                if (count == allocated)
+                {
+                    allocated = allocated ? allocated * 2 : 4096;
+                    Event *grown = (Event *)realloc(events, allocated * sizeof(Event));
+                    if (!grown)
+                    {
+                        result = -1;
+                        break;
+                    }
+                    events = grown;
+                }
+                Event *event = &events[count];
+                event->record = record;
+                memcpy(&event->ns, p + sizeof(BinlogRecord), sizeof(event->ns));
+                event->tid = chunk->tid;
+                event->seq = count++;
+            }
+            p += record->size;
+        }
+    }
+    if (result < 0)
+    {
+        perror("[BINLOG] realloc failed");
+        free(definitions);
+        free(events);
+        munmap((void *)map, size);
+        return -1;
+    }
+
+    // Pass 2: in time order, as text
+    qsort(events, count, sizeof(Event), compare_events);
+    for (size_t i = 0; i < count; i++)
+    {
+        const Event *event = &events[i];
+        long long wall = header->realtime_ns + (event->ns - header->monotonic_ns);
+        time_t seconds = (time_t)(wall / 1000000000LL);
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        fprintf(out, "%02d:%02d:%02d.%06lld [%d] ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+                (wall % 1000000000LL) / 1000, event->tid);
+
+        uint32_t id = event->record->id;
+        const char *format = (int)id <= defined ? definitions[id].format : NULL;
+        const char *args = (const char *)event->record + sizeof(BinlogRecord) + sizeof(int64_t);
+        const char *end = (const char *)event->record + event->record->size;
+        if (!format)
+        {
+            fprintf(out, "<event of unknown site %u>\n", id);
+        }
+        else if (render(format, args, end, out) < 0)
+        {
+            fprintf(out, "<short record of site %u>\n", id);
+        }
+        else if (format[0] == '\0' || format[strlen(format) - 1] != '\n')
+        {
+            fputc('\n', out);
+        }
+    }
+
+    free(definitions);
+    free(events);
+    munmap((void *)map, size);
+    return (int)count;
+}
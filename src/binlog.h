@@ -0,0 +1,118 @@
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include "socket.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define BINLOG_MAGIC "BINLOG1"
+#define BINLOG_CHUNK_SIZE (64 * 1024) // What a thread claims of the file at a time
+#define BINLOG_MAX_ARGS 16
+#define BINLOG_MAX_STRING 255 // Longer %s arguments are cut
+#define BINLOG_MAX_RECORD (16 + BINLOG_MAX_ARGS * (2 + BINLOG_MAX_STRING))
+
+// How one argument is stored: an 8-byte integer or double, or a counted string
+typedef enum
+{
+    BINLOG_ARG_INT,         // int and shorter (also '*' widths), widened to 8 bytes
+    BINLOG_ARG_WIDE,        // long, long long, size_t, intmax_t, ptrdiff_t
+    BINLOG_ARG_DOUBLE,
+    BINLOG_ARG_LONG_DOUBLE, // Stored as a double
+    BINLOG_ARG_POINTER,
+    BINLOG_ARG_STRING       // 2-byte length, then the bytes
+} BinlogArg;
+
+// One BINLOG() call site: its format and, once registered, its id in the file
+typedef struct
+{
+    const char *format; // A string literal: only its id is written per record
+    const char *file;
+    int line;
+    atomic_int id;         // In the log of that generation; -1 = format not supported
+    atomic_int generation; // Log the site is registered with (0 = none yet)
+    int count;
+    unsigned char args[BINLOG_MAX_ARGS]; // BinlogArg of each argument
+    int precision[BINLOG_MAX_ARGS];      // Of string arguments: -1 none, -2 a '*' argument, else literal
+} BinlogSite;
+
+// Start of the file; the chunks follow
+typedef struct
+{
+    char magic[8];
+    uint32_t chunk_size;
+    uint32_t header_size;
+    int64_t realtime_ns;  // CLOCK_REALTIME at binlog_open() ...
+    int64_t monotonic_ns; // ... and the clock records are stamped with, at the same moment
+} BinlogHeader;
+
+// Start of a chunk: the thread writing it and how much it has written
+typedef struct
+{
+    char magic[4]; // "CHNK"; zeros = never claimed
+    int32_t tid;
+    uint32_t used; // Bytes of records after this header, updated after every record
+    uint32_t reserved;
+} BinlogChunk;
+
+/*
+ * Start of a record, 8-byte aligned. id 0 defines a site: a uint32 site id
+ * and line, then the file name and the format, NUL-terminated. Any other id
+ * is an event of that site: an int64 timestamp, then the arguments.
+ */
+typedef struct
+{
+    uint32_t id;
+    uint32_t size; // Whole record, header included
+} BinlogRecord;
+
+// An open log: a file mapped whole, handed out to threads a chunk at a time
+typedef struct
+{
+    int fd;
+    char *map;
+    size_t capacity;
+    atomic_size_t claimed; // Bytes handed out so far (header included)
+    atomic_llong dropped;  // Records lost because the file was full
+    int generation;        // Tells threads their chunk belongs to an earlier log
+    pthread_mutex_t lock;  // Guards site registration
+    int sites;
+} Binlog;
+
+// The process's binary log, NULL until binlog_open()
+extern Binlog *binlog;
+
+/* Function prototypes for the binary log */
+int binlog_open(const char *path, size_t capacity);
+void binlog_close(void);
+void binlog_record(BinlogSite *site, const char *format, ...) __attribute__((format(printf, 2, 3)));
+int binlog_decode(const char *path, FILE *out);
+
+/*
+ * Log a printf-style message as a format id plus raw arguments. The
+ * compiler checks the arguments against the format as for printf(); the
+ * text is only produced by binlog_decode(), offline.
+ */
+#define BINLOG(fmt, ...)                                                                                               \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        static BinlogSite binlog_site_ = {.format = fmt, .file = __FILE__, .line = __LINE__};                      \
+        binlog_record(&binlog_site_, fmt, ##__VA_ARGS__);                                                              \
+    } while (0)
+
+// A verbose message: a binary record while a binlog is open, else printf() if socket_verbose
+#define VERBOSE_LOG(format, ...)                                                                                       \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (binlog)                                                                                                    \
+        {                                                                                                              \
+            BINLOG(format, ##__VA_ARGS__);                                                                             \
+        }                                                                                                              \
+        else if (socket_verbose)                                                                                       \
+        {                                                                                                              \
+            printf(format, ##__VA_ARGS__);                                                                             \
+        }                                                                                                              \
+    } while (0)
+
+#endif
@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include "clock.h"
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define CLOCK_HAVE_TSC 1
+#endif
+
+/*
+ * The time, read once per loop iteration instead of once per event.
+ *
+ * clock_gettime(CLOCK_MONOTONIC) does not enter the kernel: the vDSO reads
+ * the TSC and scales it with parameters the kernel publishes in a shared
+ * page. That is still a few dozen nanoseconds, with a retry loop against
+ * concurrent updates, and code that stamps every accept, read and deadline
+ * pays it millions of times per second. Most of those stamps do not need
+ * to be more precise than "this iteration":
+ *
+ *   clock_tick()       reads the clock and keeps the value per thread; the
+ *                      event loop calls it once when epoll_wait() returns
+ *   clock_cached_ns()  that value: an inline load, no call
+ *   clock_now_ns()     a fresh reading, for what must not be stale (how
+ *                      long to sleep, how long an iteration took)
+ *
+ * A cached stamp is at most one iteration old, which is the resolution at
+ * which the loop can act on a timeout anyway.
+ *
+ * clock_use_tsc() makes clock_now_ns() read the TSC itself (rdtsc) and
+ * scale it with a factor measured against CLOCK_MONOTONIC at startup. Only
+ * with an invariant TSC (CPUID 0x80000007 EDX bit 8): one that ticks at a
+ * fixed rate in every power state and is synchronised across cores. The
+ * factor is only as good as a 20 ms calibration (a few ppm), and unlike
+ * CLOCK_MONOTONIC it does not follow NTP's slewing: fine for timeouts and
+ * latencies, not for comparing against timestamps from other machines.
+ */
+
+_Thread_local long long clock_snapshot_ns;
+
+// ns = tsc_base_ns + ((tsc - tsc_base) * tsc_mult) >> 32. Set by clock_use_tsc() before threads start
+static int tsc_enabled;
+static unsigned long long tsc_base;
+static long long tsc_base_ns;
+static unsigned long long tsc_mult;
+
+static long long monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long clock_now_ns(void)
+{
+#ifdef CLOCK_HAVE_TSC
+    if (tsc_enabled)
+    {
+        unsigned long long elapsed = __rdtsc() - tsc_base;
+        return tsc_base_ns + (long long)(((unsigned __int128)elapsed * tsc_mult) >> 32);
+    }
+#endif
+    return monotonic_ns();
+}
+
+// Snapshot the clock for clock_cached_ns() on this thread, and return it
+long long clock_tick(void)
+{
+    clock_snapshot_ns = clock_now_ns();
+    return clock_snapshot_ns;
+}
+
+#ifdef CLOCK_HAVE_TSC
+// A CLOCK_MONOTONIC reading and the TSC at the same moment: the tightest of a few brackets
+static void tsc_pair(long long *ns, unsigned long long *tsc)
+{
+    unsigned long long best = ~0ULL;
+    for (int i = 0; i < 8; i++)
+    {
+        unsigned long long before = __rdtsc();
+        long long now = monotonic_ns();
+        unsigned long long after = __rdtsc();
+        if (i == 0 || after - before < best) // The first sample always counts: *ns and *tsc are set
+        {
+            best = after - before;
+            *ns = now;
+            *tsc = before + (after - before) / 2;
+        }
+    }
+}
+#endif
+
+/*
+ * Read the TSC directly from now on (1), or go back to clock_gettime() (0).
+ * Calibrates for 20 ms. Call at startup, before other threads use the
+ * clock. Returns whether the TSC is in use.
+ */
+int clock_use_tsc(int enable)
+{
+    tsc_enabled = 0;
+    if (!enable)
+    {
+        return 0;
+    }
+#ifdef CLOCK_HAVE_TSC
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8)))
+    {
+        return 0; // Not invariant: the rate may change with frequency scaling or differ per core
+    }
+
+    long long start_ns, end_ns;
+    unsigned long long start_tsc, end_tsc;
+    tsc_pair(&start_ns, &start_tsc);
+    struct timespec pause = {0, 20000000L};
+    nanosleep(&pause, NULL);
+    tsc_pair(&end_ns, &end_tsc);
+    if (end_tsc <= start_tsc || end_ns <= start_ns)
+    {
+        return 0;
+    }
+
+    tsc_mult = (unsigned long long)(((unsigned __int128)(end_ns - start_ns) << 32) / (end_tsc - start_tsc));
+    tsc_base = end_tsc;
+    tsc_base_ns = end_ns;
+    tsc_enabled = 1;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int clock_tsc_enabled(void)
+{
+    return tsc_enabled;
+}
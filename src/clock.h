@@ -0,0 +1,23 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+// This thread's last clock_tick(); 0 if it never ticked
+extern _Thread_local long long clock_snapshot_ns;
+
+/* Function prototypes for the monotonic clock */
+long long clock_now_ns(void);
+long long clock_tick(void);
+int clock_use_tsc(int enable);
+int clock_tsc_enabled(void);
+
+/*
+ * CLOCK_MONOTONIC in nanoseconds as of this thread's last clock_tick(),
+ * i.e. the start of the current loop iteration. A thread that never ticks
+ * gets a fresh reading.
+ */
+static inline long long clock_cached_ns(void)
+{
+    return clock_snapshot_ns ? clock_snapshot_ns : clock_now_ns();
+}
+
+#endif
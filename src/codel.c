@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include "codel.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * CoDel ("Controlled Delay") applied to accepted connections.
+ *
+ * A FIFO queue that is sometimes long is fine - bursts happen. A queue that
+ * stays long is the problem: every connection in it waits the same standing
+ * delay, clients time out, and the server spends its time answering people
+ * who already gave up. CoDel looks at the *sojourn time* (how long the item
+ * at the head waited) instead of the queue length, and in particular at the
+ * minimum sojourn time over an interval: if even the luckiest connection in
+ * the last interval waited longer than 'target', the queue never drained and
+ * we are overloaded.
+ *
+ * RFC 8289 then drops at a slowly increasing rate, which works for TCP
+ * senders that back off on loss. Connecting clients don't back off, so like
+ * the request-queue variant used in RPC servers (e.g. Facebook's Wangle) we
+ * switch timeouts instead:
+ *
+ *   - normal:     only connections that waited more than 'interval' are dropped
+ *   - overloaded: anything that waited more than 2 x 'target' is dropped
+ *
+ * Overload is re-evaluated at the end of every interval. A dropped connection
+ * is rejected quickly by the caller ("busy" reply and close) rather than
+ * served late. The queue itself is bounded: codel_push() fails when it is
+ * full so the acceptor can reject immediately.
+ */
+
+CodelQueue *codel_create(int capacity, long long target_ns, long long interval_ns)
+{
+    CodelQueue *queue = (CodelQueue *)malloc(sizeof(CodelQueue));
+    if (!queue)
+    {
+        perror("[CODEL] malloc failed");
+        return NULL;
+    }
+
+    memset(queue, 0, sizeof(CodelQueue));
+    queue->items = (QueuedConnection *)malloc(sizeof(QueuedConnection) * capacity);
+    if (!queue->items)
+    {
+        perror("[CODEL] malloc failed");
+        free(queue);
+        return NULL;
+    }
+
+    queue->capacity = capacity;
+    queue->target_ns = target_ns;
+    queue->interval_ns = interval_ns;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    return queue;
+}
+
+// Returns -1 when the queue is full (or closed); the caller rejects the socket
+int codel_push(CodelQueue *queue, Socket *socket, long long enqueued_ns)
+{
+    pthread_mutex_lock(&queue->lock);
+    if (queue->closed || queue->count == queue->capacity)
+    {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    int tail = (queue->head + queue->count) % queue->capacity;
+    queue->items[tail].socket = socket;
+    queue->items[tail].enqueued_ns = enqueued_ns;
+    queue->count++;
+    queue->enqueued++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+// Decide whether an item that waited 'delay' should be dropped
+static int should_drop(CodelQueue *queue, long long now, long long delay)
+{
+    if (now > queue->interval_end)
+    {
+        // Close the interval: overloaded if the queue never got below target
+        queue->overloaded = queue->min_delay > queue->target_ns;
+        queue->min_delay = delay;
+        queue->interval_end = now + queue->interval_ns;
+    }
+    else if (delay < queue->min_delay)
+    {
+        queue->min_delay = delay;
+    }
+
+    long long timeout = queue->overloaded ? 2 * queue->target_ns : queue->interval_ns;
+    return delay > timeout;
+}
+
+CodelVerdict codel_pop(CodelQueue *queue, QueuedConnection *out)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->closed)
+    {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    if (queue->count == 0)
+    {
+        pthread_mutex_unlock(&queue->lock);
+        return CODEL_CLOSED;
+    }
+
+    *out = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+
+    long long now = clock_now_ns();
+    CodelVerdict verdict = CODEL_SERVE;
+    if (queue->target_ns > 0 && should_drop(queue, now, now - out->enqueued_ns))
+    {
+        verdict = CODEL_DROP;
+        queue->dropped++;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return verdict;
+}
+
+// Wake every waiting worker; pops drain what is left, then return CODEL_CLOSED
+void codel_close(CodelQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void codel_free(CodelQueue *queue)
+{
+    if (queue)
+    {
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->not_empty);
+        free(queue->items);
+        free(queue);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef CODEL_H
+#define CODEL_H
+
+#include "socket.h"
+#include <pthread.h>
+
+typedef enum
+{
+    CODEL_SERVE, // Hand the connection to a worker
+    CODEL_DROP,  // It waited too long: reject it
+    CODEL_CLOSED // Queue shut down, nothing left
+} CodelVerdict;
+
+typedef struct
+{
+    Socket *socket;
+    long long enqueued_ns;
+} QueuedConnection;
+
+// Accepted connections waiting for a worker, shed with CoDel
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    QueuedConnection *items;
+    int capacity;
+    int head;
+    int count;
+    int closed;
+
+    long long target_ns;   // Acceptable standing queue delay (0 disables shedding)
+    long long interval_ns; // Window over which the minimum delay is tracked
+
+    // Control state: the minimum sojourn time seen in the current interval
+    long long interval_end;
+    long long min_delay;
+    int overloaded; // Previous interval never dropped below target
+
+    long long enqueued;
+    long long dropped;
+} CodelQueue;
+
+/* Function prototypes for the CoDel accept queue */
+CodelQueue *codel_create(int capacity, long long target_ns, long long interval_ns);
+int codel_push(CodelQueue *queue, Socket *socket, long long enqueued_ns);
+CodelVerdict codel_pop(CodelQueue *queue, QueuedConnection *out);
+void codel_close(CodelQueue *queue);
+void codel_free(CodelQueue *queue);
+
+#endif
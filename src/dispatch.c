@@ -0,0 +1,155 @@
+#define _GNU_SOURCE
+#include "dispatch.h"
+#include "clock.h"
+#include "watchdog.h"
+#include "syscalls.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/*
+ * Worker-pool serving mode with overload protection.
+ *
+ *   acceptor (worker_pool_run)         workers
+ *   ---------------------------        -------------------------------------
+ *   server_accept()                    codel_pop()
+ *   codel_push() ---- CodelQueue ----> DROP?  -> reject (waited too long)
+ *     full? -> reject                  limiter_try_acquire()
+ *                                        no?  -> reject (over the limit)
+ *                                      handle(), limiter_release(latency)
+ *
+ * Every "reject" is the same cheap operation: send busy_message and close.
+ * Under overload the server therefore answers the excess quickly and keeps
+ * serving the rest at normal latency, instead of letting one big queue
+ * make every request late.
+ */
+
+static void reject(WorkerPool *pool, Socket *client)
+{
+    syscall_count(SYSCALL_SEND);
+    send(client->fd, pool->busy_message, strlen(pool->busy_message), MSG_NOSIGNAL | MSG_DONTWAIT);
+    socket_close(client);
+    free(client);
+}
+
+static void *worker_main(void *arg)
+{
+    WorkerPool *pool = (WorkerPool *)arg;
+    QueuedConnection item;
+    CodelVerdict verdict;
+    Heartbeat *heartbeat = watchdog_heartbeat("worker"); // An iteration is one connection
+
+    while ((verdict = codel_pop(pool->queue, &item)) != CODEL_CLOSED)
+    {
+        if (verdict == CODEL_DROP)
+        {
+            atomic_fetch_add(&pool->shed_codel, 1);
+            reject(pool, item.socket);
+            continue;
+        }
+
+        if (!limiter_try_acquire(pool->limiter))
+        {
+            atomic_fetch_add(&pool->shed_limit, 1);
+            reject(pool, item.socket);
+            continue;
+        }
+
+        long long start = clock_now_ns();
+        heartbeat_begin(heartbeat, start);
+        heartbeat_enter(heartbeat, "worker_pool: handle", item.socket->fd);
+        pool->handle(item.socket, pool->ctx);
+        long long end = clock_now_ns();
+        heartbeat_end(heartbeat, end);
+        limiter_release(pool->limiter, end - start);
+        atomic_fetch_add(&pool->served, 1);
+
+        socket_close(item.socket);
+        free(item.socket);
+    }
+    heartbeat_retire(heartbeat);
+    return NULL;
+}
+
+WorkerPool *worker_pool_create(ServerSocket *server, int workers, CodelQueue *queue,
+                               ConcurrencyLimiter *limiter, ConnectionHandler handle, void *ctx)
+{
+    WorkerPool *pool = (WorkerPool *)malloc(sizeof(WorkerPool));
+    if (!pool)
+    {
+        perror("[POOL] malloc failed");
+        return NULL;
+    }
+
+    memset(pool, 0, sizeof(WorkerPool));
+    pool->server = server;
+    pool->queue = queue;
+    pool->limiter = limiter;
+    pool->handle = handle;
+    pool->ctx = ctx;
+    pool->busy_message = "Server busy, try again later\n";
+    pool->worker_count = workers;
+    atomic_init(&pool->stopping, 0);
+
+    pool->workers = (pthread_t *)malloc(sizeof(pthread_t) * workers);
+    if (!pool->workers)
+    {
+        perror("[POOL] malloc failed");
+        free(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0)
+        {
+            perror("[POOL] pthread_create failed");
+            pool->worker_count = i;
+            worker_pool_free(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+// The accept loop: runs in the calling thread until worker_pool_stop()
+int worker_pool_run(WorkerPool *pool)
+{
+    while (!atomic_load(&pool->stopping))
+    {
+        Socket *client = server_accept(pool->server);
+        if (!client)
+        {
+            continue;
+        }
+
+        if (codel_push(pool->queue, client, clock_now_ns()) < 0)
+        {
+            atomic_fetch_add(&pool->shed_queue_full, 1);
+            reject(pool, client);
+        }
+    }
+    return 0;
+}
+
+void worker_pool_stop(WorkerPool *pool)
+{
+    atomic_store(&pool->stopping, 1);
+    server_stop(pool->server);
+}
+
+// Drains the queue (serving or shedding what is left) and joins the workers
+void worker_pool_free(WorkerPool *pool)
+{
+    if (pool)
+    {
+        codel_close(pool->queue);
+        for (int i = 0; i < pool->worker_count; i++)
+        {
+            pthread_join(pool->workers[i], NULL);
+        }
+        free(pool->workers);
+        free(pool);
+    }
+}
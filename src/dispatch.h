@@ -0,0 +1,40 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "socket.h"
+#include "codel.h"
+#include "limiter.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Serves one accepted connection; the pool closes and frees it afterwards
+typedef void (*ConnectionHandler)(Socket *client, void *ctx);
+
+// Acceptor thread + worker threads, with overload protection in between
+typedef struct
+{
+    ServerSocket *server;
+    CodelQueue *queue;           // Accepted connections waiting for a worker
+    ConcurrencyLimiter *limiter; // Gate in front of the handler
+    ConnectionHandler handle;
+    void *ctx;
+    const char *busy_message; // Sent to shed connections before closing them
+
+    int worker_count;
+    pthread_t *workers;
+    atomic_int stopping;
+
+    atomic_llong served;
+    atomic_llong shed_queue_full; // Rejected at accept: queue at capacity
+    atomic_llong shed_codel;      // Rejected by CoDel: waited too long
+    atomic_llong shed_limit;      // Rejected by the concurrency limiter
+} WorkerPool;
+
+/* Function prototypes for the worker pool */
+WorkerPool *worker_pool_create(ServerSocket *server, int workers, CodelQueue *queue,
+                               ConcurrencyLimiter *limiter, ConnectionHandler handle, void *ctx);
+int worker_pool_run(WorkerPool *pool);
+void worker_pool_stop(WorkerPool *pool);
+void worker_pool_free(WorkerPool *pool);
+
+#endif
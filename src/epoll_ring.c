@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+#include "epoll_ring.h"
+#include "syscalls.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * Many epoll_ctl() calls for the price of one syscall.
+ *
+ * io_uring is a pair of ring buffers shared between the process and the
+ * kernel: the process writes requests (SQEs) into the submission ring and
+ * reads results (CQEs) from the completion ring. One io_uring_enter() call
+ * tells the kernel to consume every new SQE and can wait for their CQEs in
+ * the same call. Since Linux 5.6 one of the request types is
+ * IORING_OP_EPOLL_CTL, which is epoll_ctl() with its arguments in an SQE:
+ *
+ *   sqe->fd   = the epoll instance    sqe->len = EPOLL_CTL_ADD/MOD/DEL
+ *   sqe->off  = the target fd         sqe->addr = the struct epoll_event
+ *
+ * The event loop collects its interest changes during an iteration and
+ * pushes them all here before the next epoll_wait(), so N changes cost one
+ * io_uring_enter() instead of N epoll_ctl(). Only the syscalls are used (no
+ * liburing): setup, three mmap()s of the rings, and enter.
+ *
+ * The head/tail indices are shared with the kernel, which runs on other
+ * CPUs: our tail is published with a release store after the SQE is
+ * written, and the kernel's tail is read with an acquire load before the
+ * CQEs it covers.
+ */
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    syscall_count(SYSCALL_IO_URING_ENTER);
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Whether the kernel knows IORING_OP_EPOLL_CTL: a bad epoll fd gives EBADF if so, EINVAL if not
+static int epoll_ring_probe(EpollRing *ring)
+{
+    struct epoll_event event = {.events = EPOLLIN};
+    int error = 0;
+    if (epoll_ring_push(ring, -1, EPOLL_CTL_ADD, 0, &event, 0) < 0)
+    {
+        return 0;
+    }
+    unsigned head = *ring->cq_head;
+    if (sys_io_uring_enter(ring->fd, 1, 1, IORING_ENTER_GETEVENTS) < 0)
+    {
+        return 0;
+    }
+    if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        error = -ring->cqes[head & *ring->cq_mask].res;
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    }
+    ring->pending = 0;
+    return error == EBADF;
+}
+
+// NULL if io_uring is missing, disabled or too old for IORING_OP_EPOLL_CTL
+EpollRing *epoll_ring_create(unsigned entries)
+{
+    EpollRing *ring = (EpollRing *)malloc(sizeof(EpollRing));
+    if (!ring)
+    {
+        perror("[RING] malloc failed");
+        return NULL;
+    }
+    memset(ring, 0, sizeof(EpollRing));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->entries = params.sq_entries;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        perror("[RING] mmap failed");
+        epoll_ring_free(ring);
+        return NULL;
+    }
+
+    char *sq = (char *)ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    char *cq = (char *)ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    if (!epoll_ring_probe(ring))
+    {
+        epoll_ring_free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+// Queue one epoll_ctl(); 'event' must stay valid until epoll_ring_submit(). -1 if the ring is full
+int epoll_ring_push(EpollRing *ring, int epoll_fd, int op, int fd, struct epoll_event *event, uint64_t tag)
+{
+    unsigned tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->entries)
+    {
+        return -1;
+    }
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_EPOLL_CTL;
+    sqe->fd = epoll_fd;
+    sqe->addr = (uint64_t)(uintptr_t)event;
+    sqe->len = (uint32_t)op;
+    sqe->off = (uint64_t)fd;
+    sqe->user_data = tag;
+    ring->sq_array[index] = index;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+    return 0;
+}
+
+// Consume the completions that have arrived; failures go to 'failed'
+static unsigned epoll_ring_reap(EpollRing *ring, EpollRingFailure failed, void *ctx)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned reaped = tail - head;
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        if (cqe->res < 0 && failed)
+        {
+            failed(cqe->user_data, -cqe->res, ctx);
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+/*
+ * Hand every pushed change to the kernel and wait until all are applied:
+ * one io_uring_enter() (another one only if a signal cut the wait short).
+ * Returns the number of changes, -1 if the kernel refused the batch: it
+ * took none of them, and they are withdrawn from the ring (their events
+ * may not outlive the caller's frame) for the caller to apply another way.
+ */
+int epoll_ring_submit(EpollRing *ring, EpollRingFailure failed, void *ctx)
+{
+    unsigned pending = ring->pending;
+    if (pending == 0)
+    {
+        return 0;
+    }
+    ring->pending = 0;
+
+    if (sys_io_uring_enter(ring->fd, pending, pending, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+    {
+        perror("[RING] io_uring_enter failed");
+        __atomic_store_n(ring->sq_tail, __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+        return -1;
+    }
+    unsigned completed = epoll_ring_reap(ring, failed, ctx);
+    while (completed < pending)
+    {
+        sys_io_uring_enter(ring->fd, 0, pending - completed, IORING_ENTER_GETEVENTS);
+        completed += epoll_ring_reap(ring, failed, ctx);
+    }
+    return (int)pending;
+}
+
+void epoll_ring_free(EpollRing *ring)
+{
+    if (ring)
+    {
+        if (ring->sqes && ring->sqes != MAP_FAILED)
+        {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        if (ring->cq_ring && ring->cq_ring != MAP_FAILED)
+        {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+        {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        }
+        close(ring->fd);
+        free(ring);
+    }
+}
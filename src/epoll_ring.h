@@ -0,0 +1,46 @@
+#ifndef EPOLL_RING_H
+#define EPOLL_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Called for each change the kernel rejected, with the tag it was pushed with
+typedef void (*EpollRingFailure)(uint64_t tag, int error, void *ctx);
+
+// A minimal io_uring that only carries IORING_OP_EPOLL_CTL, to batch epoll_ctl() calls
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    unsigned pending; // Pushed since the last submit
+
+    // Submission ring, shared with the kernel
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    // Completion ring
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+} EpollRing;
+
+/* Function prototypes for batched epoll_ctl() */
+EpollRing *epoll_ring_create(unsigned entries);
+int epoll_ring_push(EpollRing *ring, int epoll_fd, int op, int fd, struct epoll_event *event, uint64_t tag);
+int epoll_ring_submit(EpollRing *ring, EpollRingFailure failed, void *ctx);
+void epoll_ring_free(EpollRing *ring);
+
+#endif
@@ -0,0 +1,1119 @@
+#define _GNU_SOURCE
+#include "event_loop.h"
+#include "clock.h"
+#include "watchdog.h"
+#include "trace.h"
+#include "probes.h"
+#include "stats.h"
+#include "admin.h"
+#include "syscalls.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/*
+ * A single-threaded, non-blocking server loop driven by epoll.
+ *
+ * The blocking server serves one connection at a time: while it waits in
+ * recv() for one client, every other client waits in the accept queue.
+ * Here every socket is non-blocking and one thread asks the kernel which of
+ * them are ready:
+ *
+ *   epoll_wait()              -> a batch of ready fds
+ *     listener readable       -> accept until EAGAIN, on_accept()
+ *     connection readable     -> one recv(), on_data()
+ *     connection writable     -> write queued output, on_writable()
+ *
+ * Handlers never block. connection_send() writes at once what the socket
+ * takes and queues the rest; only then does the loop ask for EPOLLOUT,
+ * write the queue when the socket can take it and drop EPOLLOUT again once
+ * the queue is empty.
+ *
+ * A connection can opt into output coalescing (connection_set_coalescing()).
+ * Then connection_send() only appends to the queue, and the queue is written
+ * with one send() when the first of the policy's triggers fires: enough
+ * bytes queued, the end of the current batch of events, or a deadline. Many
+ * small messages cost one syscall and leave as few, full TCP segments.
+ *
+ * With a FairnessBudget (event_loop_set_budget()) a readable connection is
+ * read until it runs dry or its budget for this iteration is spent, and its
+ * writes stop at the write budget. A connection that still has work then
+ * goes to the back of a continuation queue: the next iteration polls without
+ * sleeping, serves the fresh events first and then the queue in order, one
+ * budget each. A client that always has data ready gets its share, and
+ * everyone else's requests wait at most one round for it.
+ *
+ * Interest changes (adding a new connection, arming or disarming EPOLLOUT)
+ * are not made the moment they are decided. They go on a change list that
+ * is applied once per iteration, just before the next epoll_wait(): as one
+ * io_uring_enter() for the whole list where io_uring supports
+ * IORING_OP_EPOLL_CTL (epoll_ring.c), one epoll_ctl() each otherwise. A
+ * change undone within the iteration (EPOLLOUT armed, then disarmed) costs
+ * nothing, nor does a connection accepted and closed in the same iteration.
+ * Closing never needs EPOLL_CTL_DEL: close() drops the fd from every epoll
+ * set it is in (it has no duplicates here).
+ *
+ * The loops of a group can move connections between them
+ * (event_loop_set_migration()). Each loop keeps a running total of the time
+ * it spends outside epoll_wait(); at every interval a loop compares its
+ * share of the interval with its peers', and if it is much busier than the
+ * idlest one it hands that peer some of its most active connections. Only
+ * connections that sit between messages move: nothing queued to write, no
+ * interest change or budget turn pending. The connection keeps its struct,
+ * output buffer, handler state and coalescing policy; it is removed from
+ * this epoll set, pushed onto the peer's inbox (a lock-free stack) and the
+ * peer's eventfd is written. The peer adds it to its own epoll set on its
+ * next wakeup, and anything the client sent in the meantime waits in the
+ * socket and is reported at once (level-triggered).
+ *
+ * With event_loop_use_timestamping() every accepted connection asks the
+ * kernel for software RX and TX timestamps (timestamping.c). Its reads go
+ * through recvmsg() to get the stamp of the data, and after the loop has
+ * served it, the TX stamps of what it sent are drained from its error
+ * queue. The loop keeps both delays as histograms.
+ *
+ * Connections closed while a batch is being processed may still appear
+ * later in the same batch, so they are only marked closed and freed after
+ * the batch (event_loop_end_iteration()).
+ *
+ * The loop body itself lives in event_loop_dispatch.h so that single-protocol
+ * programs can instantiate it with direct calls instead of the Handler
+ * function pointers used here.
+ */
+
+#define EVENT_LOOP_RUN event_loop_run
+#define EVENT_ON_ACCEPT(conn, ctx) (loop->handler.on_accept ? loop->handler.on_accept(conn, ctx) : 0)
+#define EVENT_ON_DATA(conn, data, length, ctx) \
+    (loop->handler.on_data ? loop->handler.on_data(conn, data, length, ctx) : 0)
+#define EVENT_ON_WRITABLE(conn, ctx) (loop->handler.on_writable ? loop->handler.on_writable(conn, ctx) : 0)
+#define EVENT_ON_CLOSE(conn, ctx)              \
+    do                                         \
+    {                                          \
+        if (loop->handler.on_close)            \
+        {                                      \
+            loop->handler.on_close(conn, ctx); \
+        }                                      \
+    } while (0)
+#include "event_loop_dispatch.h"
+
+static EventLoop *event_loop_setup(ServerSocket *server, const Handler *handler, void *ctx, uint32_t listener_flags)
+{
+    EventLoop *loop = (EventLoop *)malloc(sizeof(EventLoop));
+    if (!loop)
+    {
+        perror("[LOOP] malloc failed");
+        return NULL;
+    }
+
+    memset(loop, 0, sizeof(EventLoop));
+    loop->server = server;
+    loop->handler = *handler;
+    loop->ctx = ctx;
+    loop->write_first = 1;
+    atomic_init(&loop->stopping, 0);
+    atomic_init(&loop->inbox, NULL);
+    atomic_init(&loop->admin, NULL);
+    atomic_init(&loop->busy_ns, 0);
+    atomic_init(&loop->awake_ns, 0);
+
+    /*
+     * epoll_create1() — a kernel object holding an interest list of fds
+     *
+     *   - epoll_ctl(ADD/MOD/DEL) edits the list: which fd, which events
+     *     (EPOLLIN = readable, EPOLLOUT = writable) and a 64-bit cookie
+     *     (data.ptr) handed back with every event for that fd.
+     *   - epoll_wait() sleeps until some of them are ready and returns only
+     *     those, so the cost per wakeup depends on the number of ready fds,
+     *     not on how many are watched (unlike select()/poll()).
+     *   - Level-triggered (the default): an fd keeps being reported while it
+     *     stays ready, so a handler may read just once per event.
+     */
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->epoll_fd < 0 || loop->wake_fd < 0 || socket_set_nonblocking(&server->server_socket) < 0)
+    {
+        perror("[LOOP] setup failed");
+        event_loop_free(loop);
+        return NULL;
+    }
+
+    struct epoll_event listener = {.events = EPOLLIN | listener_flags, .data.ptr = server};
+    struct epoll_event wake = {.events = EPOLLIN, .data.ptr = loop};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, server->server_socket.fd, &listener) < 0 ||
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &wake) < 0)
+    {
+        perror("[LOOP] epoll_ctl failed");
+        event_loop_free(loop);
+        return NULL;
+    }
+    loop->ring = epoll_ring_create(EVENT_LOOP_MAX_EVENTS); // NULL: plain epoll_ctl()
+    loop->heartbeat = watchdog_heartbeat("loop");
+    return loop;
+}
+
+EventLoop *event_loop_create(ServerSocket *server, const Handler *handler, void *ctx)
+{
+    return event_loop_setup(server, handler, ctx, 0);
+}
+
+/*
+ * A loop that shares its listener with loops on other threads.
+ *
+ * Without EPOLLEXCLUSIVE, a new connection makes the listener ready in
+ * every epoll set that watches it, and the kernel wakes a waiter of each:
+ * N threads get up, one accept() succeeds and the others find EAGAIN (the
+ * thundering herd). With EPOLLEXCLUSIVE (Linux 4.5+) on the listener in
+ * each set, the kernel wakes only one (occasionally a few) of the epoll
+ * instances that are blocked in epoll_wait(). Busy threads are not blocked
+ * there, so connections go to whoever is idle, which SO_REUSEPORT's hash
+ * cannot do.
+ *
+ * EPOLLEXCLUSIVE can only be given with EPOLL_CTL_ADD, which is why it is a
+ * constructor of its own.
+ */
+EventLoop *event_loop_create_shared(ServerSocket *server, const Handler *handler, void *ctx)
+{
+    return event_loop_setup(server, handler, ctx, EPOLLEXCLUSIVE);
+}
+
+// A fresh reading; what only needs the time of this iteration uses clock_cached_ns()
+long long event_loop_now_ns(void)
+{
+    return clock_now_ns();
+}
+
+static int event_loop_poll(EventLoop *loop, struct epoll_event *events, int max_events);
+
+/*
+ * Wait for events, then snapshot the clock for the iteration: handlers,
+ * deadlines and server_accept() read clock_cached_ns() instead of the clock.
+ * A loop that may migrate connections also books the time since it last
+ * woke up as busy, for its peers to compare against; one that publishes
+ * stats books the time asleep.
+ */
+int event_loop_wait(EventLoop *loop, struct epoll_event *events, int max_events)
+{
+    long long awake = atomic_load_explicit(&loop->awake_ns, memory_order_relaxed);
+    if (loop->migration && awake)
+    {
+        // Only this thread writes busy_ns: a plain store, no read-modify-write
+        long long busy = atomic_load_explicit(&loop->busy_ns, memory_order_relaxed);
+        atomic_store_explicit(&loop->busy_ns, busy + clock_now_ns() - awake, memory_order_relaxed);
+        atomic_store_explicit(&loop->awake_ns, 0, memory_order_relaxed);
+    }
+    long long slept = loop->stats ? clock_now_ns() : 0;
+    long long traced = trace_begin();
+    long long probed = PROBE_BEGIN(loop_wait);
+    int ready = event_loop_poll(loop, events, max_events);
+    trace_end("epoll_wait", traced, ready);
+    PROBE3(loop_wait, loop->epoll_fd, ready, PROBE_ELAPSED(probed));
+    long long now = clock_tick();
+    if (slept)
+    {
+        loop->wait_ns += now - slept;
+    }
+    if (loop->migration)
+    {
+        atomic_store_explicit(&loop->awake_ns, now, memory_order_relaxed);
+    }
+    return ready;
+}
+
+/*
+ * epoll_wait(), but wake up in time for the earliest coalescing deadline.
+ *
+ * epoll_wait() takes milliseconds, far too coarse for a deadline of a few
+ * hundred microseconds, so with a deadline pending use epoll_pwait2() and
+ * its timespec timeout (Linux 5.11+). Older kernels fall back to epoll_wait()
+ * rounded up to the next millisecond.
+ */
+static int event_loop_poll(EventLoop *loop, struct epoll_event *events, int max_events)
+{
+    long long deadline = 0;
+    for (Connection *conn = loop->flush_list; conn; conn = conn->next_flush)
+    {
+        if (conn->flush_deadline_ns && (!deadline || conn->flush_deadline_ns < deadline))
+        {
+            deadline = conn->flush_deadline_ns;
+        }
+    }
+    if (loop->continue_head)
+    {
+        syscall_count(SYSCALL_EPOLL_WAIT);
+        return epoll_wait(loop->epoll_fd, events, max_events, 0); // Work is waiting: just look
+    }
+    syscall_count(SYSCALL_EPOLL_WAIT);
+    if (!deadline)
+    {
+        return epoll_wait(loop->epoll_fd, events, max_events, -1);
+    }
+
+    long long wait_ns = deadline - event_loop_now_ns();
+    if (wait_ns < 0)
+    {
+        wait_ns = 0;
+    }
+    struct timespec timeout = {wait_ns / 1000000000LL, wait_ns % 1000000000LL};
+    int ready = epoll_pwait2(loop->epoll_fd, events, max_events, &timeout, NULL);
+    if (ready < 0 && errno == ENOSYS)
+    {
+        syscall_count(SYSCALL_EPOLL_WAIT);
+        ready = epoll_wait(loop->epoll_fd, events, max_events, (int)((wait_ns + 999999) / 1000000));
+    }
+    return ready;
+}
+
+// Whether a coalescing connection's queued output should be written now.
+// Without a deadline the end of the iteration is implied, so nothing is stranded
+int event_loop_flush_due(const Connection *conn, long long now_ns)
+{
+    return !conn->coalesce || conn->coalesce->flush_at_iteration_end || !conn->flush_deadline_ns ||
+           now_ns >= conn->flush_deadline_ns;
+}
+
+// Accept one pending connection; NULL once the queue is empty
+Connection *event_loop_accept(EventLoop *loop)
+{
+    Socket *socket;
+    for (;;)
+    {
+        socket = server_accept(loop->server);
+        if (socket)
+        {
+            break;
+        }
+        // Refused by the ACL / IP limiter, or aborted by the peer: try the next one
+        if (errno != ECONNREFUSED && errno != ECONNABORTED && errno != EINTR)
+        {
+            return NULL;
+        }
+    }
+
+    Connection *conn = (Connection *)malloc(sizeof(Connection));
+    if (!conn || socket_set_nonblocking(socket) < 0)
+    {
+        perror("[LOOP] connection setup failed");
+        free(conn);
+        socket_close(socket);
+        free(socket);
+        return NULL;
+    }
+
+    memset(conn, 0, sizeof(Connection));
+    conn->socket = socket;
+    conn->loop = loop;
+    conn->accepted_ns = clock_cached_ns();
+    if (loop->timestamps)
+    {
+        conn->timestamps = (TimestampPending *)calloc(1, sizeof(TimestampPending));
+        if (conn->timestamps && timestamping_enable(socket->fd) < 0)
+        {
+            free(conn->timestamps); // Served all the same, just not measured
+            conn->timestamps = NULL;
+        }
+    }
+
+    conn->next = loop->open;
+    if (loop->open)
+    {
+        loop->open->prev = conn;
+    }
+    loop->open = conn;
+    loop->connection_count++;
+    loop->accepted++;
+    event_loop_settle(conn); // Queue the EPOLL_CTL_ADD
+    return conn;
+}
+
+// Give the connection a fresh budget the first time it is charged in an iteration
+static void budget_refill(Connection *conn)
+{
+    const FairnessBudget *budget = conn->loop->budget;
+    if (budget && conn->budget_iteration != conn->loop->iterations)
+    {
+        conn->budget_iteration = conn->loop->iterations;
+        conn->read_left = budget->read_bytes > 0 ? budget->read_bytes : INT_MAX;
+        conn->write_left = budget->write_bytes > 0 ? budget->write_bytes : INT_MAX;
+        conn->events_left = budget->events > 0 ? budget->events : INT_MAX;
+    }
+}
+
+// Out of budget with work left: continue after everyone else had a turn
+static void budget_exceeded(Connection *conn, uint32_t work)
+{
+    EventLoop *loop = conn->loop;
+    if (!conn->continue_events)
+    {
+        conn->next_continue = NULL;
+        if (loop->continue_tail)
+        {
+            loop->continue_tail->next_continue = conn;
+        }
+        else
+        {
+            loop->continue_head = conn;
+        }
+        loop->continue_tail = conn;
+        loop->over_budget++;
+    }
+    conn->continue_events |= work;
+}
+
+// One recv() into loop->input: bytes read, 0 if nothing was ready, -1 on EOF or error
+int event_loop_read(Connection *conn)
+{
+    int size = sizeof(conn->loop->input);
+    if (conn->loop->budget)
+    {
+        budget_refill(conn);
+        if (conn->read_left == 0 || conn->events_left == 0)
+        {
+            budget_exceeded(conn, EPOLLIN);
+            return 0;
+        }
+        if (size > conn->read_left)
+        {
+            size = conn->read_left;
+        }
+        conn->events_left--;
+    }
+
+    conn->loop->recv_calls++;
+    long long traced = trace_begin();
+    long long probed = PROBE_BEGIN(loop_recv);
+    ssize_t n;
+    if (conn->timestamps)
+    {
+        // recvmsg() with the data's kernel stamp, into the loop's histogram (if it still keeps one)
+        n = timestamping_recv(conn->socket->fd, conn->loop->input, size,
+                              conn->loop->timestamps ? &conn->loop->timestamps->rx : NULL);
+    }
+    else
+    {
+        syscall_count(SYSCALL_RECV);
+        n = recv(conn->socket->fd, conn->loop->input, size, 0);
+    }
+    trace_end("recv", traced, n);
+    PROBE3(loop_recv, conn->socket->fd, n, PROBE_ELAPSED(probed));
+    conn->last_read_full = n == size;
+    if (n > 0)
+    {
+        conn->window_reads++;
+        conn->bytes_in += n;
+        conn->loop->bytes_in += n;
+        if (conn->loop->budget)
+        {
+            conn->read_left -= (int)n;
+            if (conn->last_read_full && (conn->read_left == 0 || conn->events_left == 0))
+            {
+                budget_exceeded(conn, EPOLLIN);
+            }
+        }
+        return (int)n;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 0;
+    }
+    return -1;
+}
+
+// Whether to read again for the same event: only under a budget, while it lasts
+int event_loop_read_again(const Connection *conn)
+{
+    return conn->loop->budget && conn->last_read_full && !conn->continue_events && !conn->close_after_flush;
+}
+
+// On EPOLLERR: collect the TX stamps waiting on the error queue; 0 if there were none (a real error)
+int event_loop_drain_timestamps(Connection *conn)
+{
+    return timestamping_drain(conn->socket->fd, conn->timestamps, conn->loop->timestamps);
+}
+
+// send() as much of data as the socket and the write budget take: bytes written, -1 on error
+static int event_loop_write(Connection *conn, const char *data, int length)
+{
+    budget_refill(conn);
+    int written = 0;
+    while (written < length)
+    {
+        int size = length - written;
+        if (conn->loop->budget)
+        {
+            if (conn->write_left == 0)
+            {
+                budget_exceeded(conn, EPOLLOUT);
+                break;
+            }
+            if (size > conn->write_left)
+            {
+                size = conn->write_left;
+            }
+        }
+
+        conn->loop->send_calls++;
+        syscall_count(SYSCALL_SEND);
+        long long sending = conn->timestamps ? timestamping_now_ns() : 0;
+        long long traced = trace_begin();
+        long long probed = PROBE_BEGIN(loop_send);
+        ssize_t n = send(conn->socket->fd, data + written, size, MSG_NOSIGNAL);
+        trace_end("send", traced, n);
+        PROBE3(loop_send, conn->socket->fd, n, PROBE_ELAPSED(probed));
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                break;
+            }
+            return -1;
+        }
+        written += (int)n;
+        conn->bytes_out += n;
+        conn->loop->bytes_out += n;
+        if (conn->timestamps)
+        {
+            timestamping_sent(conn->timestamps, (int)n, sending);
+        }
+        if (conn->loop->budget)
+        {
+            conn->write_left -= (int)n;
+        }
+    }
+    return written;
+}
+
+// Write queued output: 1 when all of it is written, 0 if the socket is full
+// or the write budget is spent, -1 on error
+int event_loop_flush(Connection *conn)
+{
+    int written = event_loop_write(conn, conn->output + conn->output_sent, conn->output_length - conn->output_sent);
+    if (written < 0)
+    {
+        return -1;
+    }
+    conn->output_sent += written;
+    if (conn->output_sent < conn->output_length)
+    {
+        return 0;
+    }
+    conn->output_length = 0;
+    conn->output_sent = 0;
+    return 1;
+}
+
+// Bring the epoll interest in line with the output queue after the handler ran
+void event_loop_settle(Connection *conn)
+{
+    // Output held back by coalescing is written by the loop, not on EPOLLOUT
+    conn->wanted = EPOLLIN | (conn->output_length > 0 && !conn->flush_queued ? EPOLLOUT : 0);
+    if (conn->wanted != conn->events && !conn->change_queued)
+    {
+        conn->change_queued = 1;
+        conn->next_change = conn->loop->changes;
+        conn->loop->changes = conn;
+    }
+}
+
+// The kernel rejected a change: the connection would never hear from epoll again
+static void change_failed(uint64_t tag, int error, void *ctx)
+{
+    Connection *conn = (Connection *)(uintptr_t)tag;
+    EventLoop *loop = (EventLoop *)ctx;
+    fprintf(stderr, "[LOOP] epoll_ctl(fd %d) failed: %s\n", conn->socket->fd, strerror(error));
+    if (loop->handler.on_close)
+    {
+        loop->handler.on_close(conn, loop->ctx);
+    }
+    event_loop_destroy(conn);
+}
+
+// One epoll_ctl() for a change; a rejected one closes its connection
+static void apply_change(EventLoop *loop, int op, struct epoll_event *event)
+{
+    Connection *conn = (Connection *)event->data.ptr;
+    loop->ctl_calls++;
+    syscall_count(SYSCALL_EPOLL_CTL);
+    if (epoll_ctl(loop->epoll_fd, op, conn->socket->fd, event) < 0)
+    {
+        change_failed((uintptr_t)conn, errno, loop);
+    }
+}
+
+/*
+ * Hand a batch to the ring. If the kernel refuses it, the connections were
+ * already marked as registered: they get their epoll_ctl() one by one
+ * instead, or a new one would never be polled and a reply would wait for an
+ * EPOLLOUT that was never armed.
+ */
+static void submit_changes(EventLoop *loop, struct epoll_event *events, const int *ops, int batched)
+{
+    loop->ring_calls++;
+    if (epoll_ring_submit(loop->ring, change_failed, loop) < 0)
+    {
+        for (int i = 0; i < batched; i++)
+        {
+            apply_change(loop, ops[i], &events[i]);
+        }
+    }
+}
+
+// Register every queued interest change with epoll, batched through the ring if there is one
+static void apply_changes(EventLoop *loop)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    int ops[EVENT_LOOP_MAX_EVENTS];
+    int batched = 0;
+    while (loop->changes)
+    {
+        Connection *conn = loop->changes;
+        loop->changes = conn->next_change;
+        conn->change_queued = 0;
+        if (conn->closed || conn->wanted == conn->events)
+        {
+            continue; // Closed before it mattered, or changed and changed back
+        }
+
+        int op = conn->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        conn->events = conn->wanted;
+        if (!loop->ring)
+        {
+            struct epoll_event event = {.events = conn->wanted, .data.ptr = conn};
+            apply_change(loop, op, &event);
+            continue;
+        }
+
+        if (batched == EVENT_LOOP_MAX_EVENTS)
+        {
+            submit_changes(loop, events, ops, batched);
+            batched = 0;
+        }
+        events[batched].events = conn->wanted;
+        events[batched].data.ptr = conn;
+        ops[batched] = op;
+        epoll_ring_push(loop->ring, loop->epoll_fd, op, conn->socket->fd, &events[batched], (uintptr_t)conn);
+        batched++;
+        loop->ring_ops++;
+    }
+    if (batched > 0)
+    {
+        submit_changes(loop, events, ops, batched);
+    }
+}
+
+// Tear a connection down now; its memory is released by event_loop_end_iteration()
+void event_loop_destroy(Connection *conn)
+{
+    EventLoop *loop = conn->loop;
+    conn->closed = 1;
+    loop->disconnects++;
+    socket_close(conn->socket); // Also removes it from the epoll set: no EPOLL_CTL_DEL
+
+    if (conn->prev)
+    {
+        conn->prev->next = conn->next;
+    }
+    else
+    {
+        loop->open = conn->next;
+    }
+    if (conn->next)
+    {
+        conn->next->prev = conn->prev;
+    }
+
+    if (conn->continue_events)
+    {
+        Connection **link = &loop->continue_head;
+        Connection *previous = NULL;
+        while (*link != conn)
+        {
+            previous = *link;
+            link = &previous->next_continue;
+        }
+        *link = conn->next_continue;
+        if (loop->continue_tail == conn)
+        {
+            loop->continue_tail = previous;
+        }
+        conn->continue_events = 0;
+    }
+
+    /*
+     * The flush pass skips closed connections and unlinks them itself, but
+     * a teardown inside event_loop_end_iteration() (an admin close, a
+     * rejected epoll change) comes after that pass and is freed before the
+     * next one: it must not stay on the list.
+     */
+    if (conn->flush_queued)
+    {
+        for (Connection **link = &loop->flush_list; *link; link = &(*link)->next_flush)
+        {
+            if (*link == conn)
+            {
+                *link = conn->next_flush;
+                break;
+            }
+        }
+        conn->flush_queued = 0;
+    }
+
+    conn->next_closed = loop->closed;
+    loop->closed = conn;
+    loop->connection_count--;
+}
+
+/*
+ * Next over-budget connection whose turn has come, with the work it has
+ * left; NULL once the queue only holds connections that were already
+ * served in this iteration.
+ */
+Connection *event_loop_next_turn(EventLoop *loop, uint32_t *revents)
+{
+    Connection *conn = loop->continue_head;
+    if (!conn || conn->budget_iteration == loop->iterations)
+    {
+        return NULL;
+    }
+    loop->continue_head = conn->next_continue;
+    if (!loop->continue_head)
+    {
+        loop->continue_tail = NULL;
+    }
+    *revents = conn->continue_events;
+    conn->continue_events = 0;
+    return conn;
+}
+
+// Take in the connections peers handed over; called when wake_fd fires
+void event_loop_adopt(EventLoop *loop)
+{
+    uint64_t signals;
+    syscall_count(SYSCALL_EVENTFD);
+    if (read(loop->wake_fd, &signals, sizeof(signals)) < 0 && errno != EAGAIN)
+    {
+        perror("[LOOP] wake read failed");
+    }
+
+    // Peers push before they write wake_fd, so nothing pushed before this read is missed
+    Connection *conn = atomic_exchange_explicit(&loop->inbox, NULL, memory_order_acquire);
+    long long now = clock_cached_ns();
+    while (conn)
+    {
+        Connection *next = conn->next_handoff;
+        conn->prev = NULL;
+        conn->next = loop->open;
+        if (loop->open)
+        {
+            loop->open->prev = conn;
+        }
+        loop->open = conn;
+        loop->connection_count++;
+        loop->migrated_in++;
+        conn->arrived_ns = now;
+        event_loop_settle(conn); // EPOLL_CTL_ADD into this loop's set
+        conn = next;
+    }
+}
+
+// Can the connection move to another loop: registered, and nothing pending on this one
+static int migratable(const Connection *conn)
+{
+    return conn->events && !conn->closed && !conn->close_after_flush && conn->output_length == 0 &&
+           !conn->flush_queued && !conn->continue_events && !conn->change_queued;
+}
+
+// A peer's busy time up to 'now', including the stretch it is in
+static long long loop_busy_ns(EventLoop *loop, long long now)
+{
+    long long awake = atomic_load_explicit(&loop->awake_ns, memory_order_relaxed);
+    long long busy = atomic_load_explicit(&loop->busy_ns, memory_order_relaxed);
+    return awake && now > awake ? busy + now - awake : busy;
+}
+
+/*
+ * Hand up to 'quota' connections to 'target', taking those that had at
+ * least the average number of reads since the last rebalancing: they are
+ * where the load comes from. A connection that just arrived stays for a few
+ * intervals so it cannot bounce between two loops.
+ */
+static void hand_off(EventLoop *loop, EventLoop *target, int quota, long long now)
+{
+    long long reads = 0;
+    int active = 0;
+    for (Connection *conn = loop->open; conn; conn = conn->next)
+    {
+        if (conn->window_reads > 0)
+        {
+            active++;
+            reads += conn->window_reads;
+        }
+    }
+    // Moving the only active connection would just move the hot spot
+    if (quota > active / 2)
+    {
+        quota = active / 2;
+    }
+
+    long long settle_ns = 4LL * loop->migration->interval_ms * 1000000LL;
+    Connection *batch = NULL;
+    Connection *last = NULL;
+    Connection *conn = loop->open;
+    while (conn)
+    {
+        Connection *next = conn->next;
+        int busy = conn->window_reads > 0 && (long long)conn->window_reads * active >= reads;
+        conn->window_reads = 0;
+        if (quota == 0 || !busy || !migratable(conn) || (conn->arrived_ns && now - conn->arrived_ns < settle_ns))
+        {
+            conn = next;
+            continue;
+        }
+
+        // Out of our set first, so this loop never sees another event for it
+        loop->ctl_calls++;
+        syscall_count(SYSCALL_EPOLL_CTL);
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->socket->fd, NULL) < 0)
+        {
+            conn = next;
+            continue;
+        }
+        if (conn->prev)
+        {
+            conn->prev->next = conn->next;
+        }
+        else
+        {
+            loop->open = conn->next;
+        }
+        if (conn->next)
+        {
+            conn->next->prev = conn->prev;
+        }
+        loop->connection_count--;
+        loop->migrated_out++;
+
+        conn->loop = target;
+        conn->events = 0;
+        conn->budget_iteration = -1; // Counted against the target's iterations from now on
+        conn->next_handoff = batch;
+        batch = conn;
+        if (!last)
+        {
+            last = conn;
+        }
+        quota--;
+        conn = next;
+    }
+    if (!batch)
+    {
+        return;
+    }
+
+    // Push the whole batch onto the target's inbox, then wake it
+    Connection *head = atomic_load_explicit(&target->inbox, memory_order_relaxed);
+    do
+    {
+        last->next_handoff = head;
+    } while (!atomic_compare_exchange_weak_explicit(&target->inbox, &head, batch, memory_order_release,
+                                                    memory_order_relaxed));
+    uint64_t one = 1;
+    syscall_count(SYSCALL_EVENTFD);
+    if (write(target->wake_fd, &one, sizeof(one)) < 0)
+    {
+        perror("[LOOP] wake failed");
+    }
+}
+
+// Every interval: compare loads and hand work to the idlest peer if this loop is much busier
+static void rebalance(EventLoop *loop)
+{
+    const MigrationPolicy *policy = loop->migration;
+    long long now = clock_cached_ns();
+    long long elapsed = now - loop->rebalanced_ns;
+    if (elapsed < policy->interval_ms * 1000000LL)
+    {
+        return;
+    }
+    loop->rebalanced_ns = now;
+
+    int load = 0;
+    int idlest_load = 0;
+    EventLoop *idlest = NULL;
+    for (int i = 0; i < loop->peer_count; i++)
+    {
+        long long busy = loop_busy_ns(loop->peers[i], now);
+        int peer_load = (int)((busy - loop->peer_busy_seen[i]) * 100 / elapsed);
+        loop->peer_busy_seen[i] = busy;
+        if (loop->peers[i] == loop)
+        {
+            load = peer_load;
+        }
+        else if (!idlest || peer_load < idlest_load)
+        {
+            idlest = loop->peers[i];
+            idlest_load = peer_load;
+        }
+    }
+    int quota = idlest && load - idlest_load >= policy->threshold_pct ? policy->max_per_round : 0;
+    hand_off(loop, idlest, quota, now);
+}
+
+// Answer the admin channel, apply the iteration's interest changes, then free what was closed
+void event_loop_end_iteration(EventLoop *loop)
+{
+    if (atomic_load_explicit(&loop->admin, memory_order_relaxed))
+    {
+        admin_serve(loop); // Between batches: every connection is in a settled state
+    }
+    apply_changes(loop);
+    while (loop->closed)
+    {
+        Connection *conn = loop->closed;
+        loop->closed = conn->next_closed;
+        free(conn->socket);
+        free(conn->output);
+        free(conn->timestamps);
+        free(conn);
+    }
+    if (loop->migration && !atomic_load_explicit(&loop->stopping, memory_order_relaxed))
+    {
+        rebalance(loop);
+    }
+    if (loop->syscalls_thread)
+    {
+        // Everything from the epoll_wait() that began this iteration to the changes applied above
+        long long made = 0;
+        for (int i = 0; i < SYSCALL_KINDS; i++)
+        {
+            long long calls = loop->syscalls_thread->calls[i] - loop->syscalls_seen.calls[i];
+            loop->syscalls.calls[i] += calls;
+            made += calls;
+        }
+        loop->syscalls_seen = *loop->syscalls_thread;
+        loop->iteration_syscalls[syscall_bucket(made)]++;
+    }
+    if (loop->stats)
+    {
+        stats_publish(loop);
+    }
+}
+
+/*
+ * Send bytes to the peer. Usually the socket has room, so with nothing
+ * queued they are written at once, straight from 'data'; only what the
+ * socket does not take (EAGAIN) is queued, and only then does the loop
+ * register for EPOLLOUT. That saves the epoll_ctl() to arm EPOLLOUT, the
+ * extra wakeup and the epoll_ctl() to disarm it for every reply.
+ *
+ * Each call is a send() of its own: a handler that answers with several
+ * small pieces should coalesce them (connection_set_coalescing()), or
+ * Nagle's algorithm may hold the later pieces until the peer ACKs.
+ */
+int connection_send(Connection *conn, const char *data, int length)
+{
+    if (conn->closed)
+    {
+        return -1;
+    }
+
+    if (!conn->coalesce && conn->loop->write_first && conn->output_length == 0)
+    {
+        int written = event_loop_write(conn, data, length);
+        if (written < 0)
+        {
+            return -1;
+        }
+        data += written;
+        length -= written;
+        if (length == 0)
+        {
+            return 0;
+        }
+    }
+
+    // Reclaim the already-written head before growing
+    if (conn->output_sent > 0)
+    {
+        memmove(conn->output, conn->output + conn->output_sent, conn->output_length - conn->output_sent);
+        conn->output_length -= conn->output_sent;
+        conn->output_sent = 0;
+    }
+
+    if (conn->output_length + length > conn->output_capacity)
+    {
+        int capacity = conn->output_capacity ? conn->output_capacity : 4096;
+        while (capacity < conn->output_length + length)
+        {
+            capacity *= 2;
+        }
+        char *output = (char *)realloc(conn->output, capacity);
+        if (!output)
+        {
+            perror("[LOOP] realloc failed");
+            return -1;
+        }
+        conn->output = output;
+        conn->output_capacity = capacity;
+    }
+
+    memcpy(conn->output + conn->output_length, data, length);
+    conn->output_length += length;
+
+    const CoalescePolicy *policy = conn->coalesce;
+    if (!policy)
+    {
+        return 0; // Written when EPOLLOUT fires (see event_loop_settle())
+    }
+    if (policy->max_bytes > 0 && conn->output_length >= policy->max_bytes)
+    {
+        return event_loop_flush(conn) < 0 ? -1 : 0; // Big enough: one send() now
+    }
+    if (!conn->flush_queued && !(conn->events & EPOLLOUT))
+    {
+        // First bytes of a new batch: start the clock (as of this iteration) and hold them back
+        conn->flush_queued = 1;
+        conn->flush_deadline_ns = policy->max_delay_us > 0 ? clock_cached_ns() + policy->max_delay_us * 1000LL : 0;
+        conn->next_flush = conn->loop->flush_list;
+        conn->loop->flush_list = conn;
+    }
+    return 0;
+}
+
+// Switch batching of interest changes through io_uring on or off; 0 if it is unavailable
+int event_loop_use_ring(EventLoop *loop, int enable)
+{
+    if (!enable)
+    {
+        epoll_ring_free(loop->ring);
+        loop->ring = NULL;
+    }
+    else if (!loop->ring)
+    {
+        loop->ring = epoll_ring_create(EVENT_LOOP_MAX_EVENTS);
+    }
+    return loop->ring != NULL;
+}
+
+/*
+ * Switch SO_TIMESTAMPING on for the connections accepted from now on, or
+ * off; call it before the loop runs. Connections handed over by a peer
+ * keep what they had.
+ */
+int event_loop_use_timestamping(EventLoop *loop, int enable)
+{
+    if (!enable)
+    {
+        free(loop->timestamps);
+        loop->timestamps = NULL;
+    }
+    else if (!loop->timestamps)
+    {
+        loop->timestamps = (Timestamps *)calloc(1, sizeof(Timestamps));
+        if (!loop->timestamps)
+        {
+            perror("[LOOP] calloc failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Let the loop hand connections to the other loops in 'peers' (which
+ * includes this one) under 'policy' (kept by reference); NULL turns it off.
+ * Set it on every loop of the group before any of them runs.
+ */
+int event_loop_set_migration(EventLoop *loop, EventLoop **peers, int count, const MigrationPolicy *policy)
+{
+    free(loop->peer_busy_seen);
+    loop->peer_busy_seen = NULL;
+    loop->migration = NULL;
+    if (!policy)
+    {
+        return 0;
+    }
+    loop->peer_busy_seen = (long long *)calloc(count, sizeof(long long));
+    if (!loop->peer_busy_seen)
+    {
+        perror("[LOOP] calloc failed");
+        return -1;
+    }
+    loop->peers = peers;
+    loop->peer_count = count;
+    loop->rebalanced_ns = event_loop_now_ns();
+    loop->migration = policy;
+    return 0;
+}
+
+// Limit every connection to 'budget' (kept by reference) per iteration; NULL turns it off
+void event_loop_set_budget(EventLoop *loop, const FairnessBudget *budget)
+{
+    loop->budget = budget;
+}
+
+// Coalesce output with 'policy' (kept by reference) from now on; NULL turns it off
+void connection_set_coalescing(Connection *conn, const CoalescePolicy *policy)
+{
+    conn->coalesce = policy;
+}
+
+// Close once everything queued so far has been written
+void connection_close(Connection *conn)
+{
+    conn->close_after_flush = 1;
+}
+
+void event_loop_stop(EventLoop *loop)
+{
+    atomic_store(&loop->stopping, 1);
+    uint64_t one = 1;
+    syscall_count(SYSCALL_EVENTFD);
+    if (write(loop->wake_fd, &one, sizeof(one)) < 0)
+    {
+        perror("[LOOP] wake failed");
+    }
+}
+
+// Closes every remaining connection (on_close is called for each)
+void event_loop_free(EventLoop *loop)
+{
+    if (loop)
+    {
+        if (loop->wake_fd >= 0)
+        {
+            event_loop_adopt(loop); // Handed over after this loop stopped: close those too
+        }
+        loop->flush_list = NULL;
+        while (loop->open)
+        {
+            Connection *conn = loop->open;
+            if (loop->handler.on_close)
+            {
+                loop->handler.on_close(conn, loop->ctx);
+            }
+            event_loop_destroy(conn);
+        }
+        event_loop_end_iteration(loop);
+
+        if (loop->epoll_fd >= 0)
+        {
+            close(loop->epoll_fd);
+        }
+        if (loop->wake_fd >= 0)
+        {
+            close(loop->wake_fd);
+        }
+        epoll_ring_free(loop->ring);
+        free(loop->timestamps);
+        heartbeat_retire(loop->heartbeat);
+        free(loop->peer_busy_seen);
+        free(loop);
+    }
+}
@@ -0,0 +1,206 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "socket.h"
+#include "epoll_ring.h"
+#include "syscalls.h"
+#include "timestamping.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define EVENT_LOOP_MAX_EVENTS 256
+#define EVENT_LOOP_READ_BUFFER 65536
+
+typedef struct EventLoop EventLoop;
+struct Heartbeat;
+struct StatsLoopSlot;
+struct AdminRequest;
+
+/*
+ * Opt-in output coalescing for one connection. connection_send() then only
+ * queues; the queue goes out in one send() when the first trigger fires.
+ */
+typedef struct
+{
+    int max_bytes;              // Flush as soon as this much is queued (0 = no size trigger)
+    int flush_at_iteration_end; // Flush after the current batch of events, before sleeping
+    int max_delay_us;           // Flush when the oldest queued byte is this old (0 = end of iteration)
+} CoalescePolicy;
+
+/*
+ * How much one connection may do per loop iteration before the others get
+ * their turn. A connection that runs out with work left is queued for the
+ * next iteration, behind everyone that was ready before it.
+ */
+typedef struct
+{
+    int read_bytes;  // Bytes read per iteration (0 = no limit)
+    int write_bytes; // Bytes written per iteration (0 = until the socket is full)
+    int events;      // on_data calls per iteration (0 = no limit)
+} FairnessBudget;
+
+/*
+ * When a loop of a group hands connections to a less-loaded peer. A loop's
+ * load is the share of wall time it spent outside epoll_wait() over the
+ * last interval.
+ */
+typedef struct
+{
+    int interval_ms;   // How often a loop compares its load with its peers'
+    int threshold_pct; // Hand off only when this many points busier than the idlest peer
+    int max_per_round; // Connections handed off per interval at most
+} MigrationPolicy;
+
+// One accepted connection owned by an EventLoop
+typedef struct Connection
+{
+    Socket *socket;
+    EventLoop *loop;
+    void *user; // Per-connection state for the handler
+
+    char *output; // Bytes queued by connection_send() and not yet written
+    int output_length;
+    int output_sent;
+    int output_capacity;
+
+    const CoalescePolicy *coalesce; // NULL = off
+    long long flush_deadline_ns;    // When max_delay_us runs out for the queued bytes
+    int flush_queued;               // On the loop's flush list
+    struct Connection *next_flush;
+
+    long long budget_iteration; // Iteration the budget below was refilled for
+    int read_left;
+    int write_left;
+    int events_left;
+    int last_read_full;         // The last recv() filled what was asked for: more may be waiting
+    uint32_t continue_events;   // Work left over budget (EPOLLIN/EPOLLOUT); 0 = not queued
+    struct Connection *next_continue;
+
+    int window_reads;                // Reads that returned data since the loop last rebalanced
+    long long arrived_ns;            // When a peer handed it to this loop (0 = accepted here)
+    struct Connection *next_handoff; // In the receiving loop's inbox
+
+    long long accepted_ns; // For the admin channel: its age ...
+    long long bytes_in;    // ... and its traffic, whichever loop served it
+    long long bytes_out;
+
+    TimestampPending *timestamps; // Sends waiting for their TX stamp (NULL = not timestamped)
+
+    uint32_t events;         // Interest registered with epoll (0 = not yet added, EPOLLOUT = armed)
+    uint32_t wanted;         // Interest to register before the next epoll_wait()
+    int change_queued;       // On the loop's change list
+    struct Connection *next_change;
+    int close_after_flush;   // connection_close() was called
+    int closed;              // Already torn down; freed at the end of the iteration
+    struct Connection *prev; // Open connections of the loop
+    struct Connection *next;
+    struct Connection *next_closed;
+} Connection;
+
+/*
+ * The application: callbacks the loop makes for each connection. 'data' is
+ * only valid during on_data. Returning a negative value from on_accept,
+ * on_data or on_writable closes the connection at once (queued output is
+ * dropped); use connection_close() for a graceful close after the output
+ * is written. NULL callbacks are skipped.
+ */
+typedef struct
+{
+    int (*on_accept)(Connection *conn, void *ctx);
+    int (*on_data)(Connection *conn, const char *data, int length, void *ctx);
+    int (*on_writable)(Connection *conn, void *ctx); // All queued output has been written
+    void (*on_close)(Connection *conn, void *ctx);
+} Handler;
+
+struct EventLoop
+{
+    ServerSocket *server;
+    int epoll_fd; // Listener registered with data.ptr = server, wake_fd with data.ptr = loop
+    int wake_fd;  // eventfd written by event_loop_stop() and by peers handing over connections
+    Handler handler;
+    void *ctx;
+    atomic_int stopping;
+    int write_first; // connection_send() tries send() before queueing (default 1)
+    struct Heartbeat *heartbeat; // Iteration timing for the watchdog (NULL = no watchdog running)
+    struct StatsLoopSlot *stats; // Counters published every iteration (NULL = no stats segment)
+    _Atomic(struct AdminRequest *) admin; // Command posted by the admin channel, answered in end_iteration
+
+    Connection *open;       // Every live connection, for event_loop_free()
+    Connection *closed;     // Torn down this iteration, freed before the next epoll_wait
+    Connection *flush_list; // Coalescing connections holding back output
+    Connection *changes;    // Interest changes, applied in event_loop_end_iteration()
+    EpollRing *ring;        // Batches the changes into one syscall (NULL = epoll_ctl() each)
+    Timestamps *timestamps; // SO_TIMESTAMPING on accepted connections, and the delays (NULL = off)
+
+    const FairnessBudget *budget; // NULL = one recv() per event, writes until the socket is full
+    Connection *continue_head;    // Over-budget connections, served round-robin
+    Connection *continue_tail;
+
+    const MigrationPolicy *migration; // NULL = connections stay on the loop that accepted them
+    EventLoop **peers;                // Every loop of the group, this one included
+    int peer_count;
+    long long *peer_busy_seen;        // Each peer's busy time at the last rebalancing
+    long long rebalanced_ns;
+    _Atomic(Connection *) inbox;      // Handed over by peers, adopted when wake_fd fires
+    atomic_llong busy_ns;             // Time spent outside epoll_wait(), read by the peers
+    atomic_llong awake_ns;            // When the current busy stretch began (0 = waiting)
+
+    int connection_count;
+    char input[EVENT_LOOP_READ_BUFFER];
+
+    long long iterations;
+    long long accepted;
+    long long listener_wakeups; // Times epoll reported the listener ready
+    long long accept_misses;    // ... and accept() found nothing (another loop was faster)
+    long long disconnects;      // Connections torn down by this loop
+    long long bytes_in;
+    long long bytes_out;
+    long long wait_ns;          // Time spent in epoll_wait(); only measured with a stats slot
+    long long recv_calls;  // recv() syscalls made by the loop
+    long long send_calls;  // send() syscalls made by the loop
+    long long ctl_calls;   // epoll_ctl() syscalls made by the loop
+    long long ring_calls;  // io_uring_enter() syscalls that applied a batch of changes
+    long long ring_ops;    // Interest changes applied through the ring
+    long long over_budget; // Times a connection was cut off by its budget
+    long long migrated_out; // Connections handed to a peer
+    long long migrated_in;  // Connections taken over from a peer
+    long long requests;     // on_data calls
+    SyscallCounts syscalls;                        // Made by the loop's thread while it ran the loop
+    const SyscallCounts *syscalls_thread;          // That thread's table (NULL = not running)
+    SyscallCounts syscalls_seen;                   // ... as of the end of the previous iteration
+    long long iteration_syscalls[SYSCALL_BUCKETS]; // Iterations by syscalls made (syscall_bucket())
+};
+
+/* Function prototypes for the event loop */
+EventLoop *event_loop_create(ServerSocket *server, const Handler *handler, void *ctx);
+EventLoop *event_loop_create_shared(ServerSocket *server, const Handler *handler, void *ctx);
+int event_loop_run(EventLoop *loop);
+void event_loop_stop(EventLoop *loop);
+void event_loop_set_budget(EventLoop *loop, const FairnessBudget *budget);
+int event_loop_use_ring(EventLoop *loop, int enable);
+int event_loop_use_timestamping(EventLoop *loop, int enable);
+int event_loop_set_migration(EventLoop *loop, EventLoop **peers, int count, const MigrationPolicy *policy);
+void event_loop_free(EventLoop *loop);
+
+// For handlers
+int connection_send(Connection *conn, const char *data, int length);
+void connection_close(Connection *conn);
+void connection_set_coalescing(Connection *conn, const CoalescePolicy *policy);
+
+// Building blocks of the loop body in event_loop_dispatch.h
+int event_loop_wait(EventLoop *loop, struct epoll_event *events, int max_events);
+int event_loop_flush_due(const Connection *conn, long long now_ns);
+long long event_loop_now_ns(void);
+Connection *event_loop_accept(EventLoop *loop);
+int event_loop_read(Connection *conn);
+int event_loop_read_again(const Connection *conn);
+int event_loop_drain_timestamps(Connection *conn);
+int event_loop_flush(Connection *conn);
+void event_loop_settle(Connection *conn);
+void event_loop_destroy(Connection *conn);
+Connection *event_loop_next_turn(EventLoop *loop, uint32_t *revents);
+void event_loop_adopt(EventLoop *loop);
+void event_loop_end_iteration(EventLoop *loop);
+
+#endif
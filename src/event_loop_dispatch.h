@@ -0,0 +1,237 @@
+/*
+ * The body of the event loop, written once and instantiated per handler set.
+ *
+ * event_loop.c includes this file with the callbacks mapped to the Handler
+ * function pointers, which gives the general event_loop_run(). A program
+ * that serves a single protocol can include it again with the callbacks
+ * mapped straight to its own functions:
+ *
+ *   #define EVENT_LOOP_RUN echo_loop_run
+ *   #define EVENT_ON_ACCEPT(conn, ctx) 0
+ *   #define EVENT_ON_DATA(conn, data, length, ctx) echo_on_data(conn, data, length, ctx)
+ *   #define EVENT_ON_WRITABLE(conn, ctx) 0
+ *   #define EVENT_ON_CLOSE(conn, ctx) ((void)0)
+ *   #include "event_loop_dispatch.h"
+ *
+ * Then echo_loop_run(loop) makes direct calls the compiler can inline: no
+ * indirect branch per event. Each macro is #undef'd at the end, so the file
+ * can be included several times in one translation unit (the helper below is
+ * named after EVENT_LOOP_RUN for the same reason).
+ */
+
+#include "event_loop.h"
+#include "clock.h"
+#include "watchdog.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+
+#if !defined(EVENT_LOOP_RUN) || !defined(EVENT_ON_ACCEPT) || !defined(EVENT_ON_DATA) || \
+    !defined(EVENT_ON_WRITABLE) || !defined(EVENT_ON_CLOSE)
+#error "define EVENT_LOOP_RUN and the EVENT_ON_* callbacks before including event_loop_dispatch.h"
+#endif
+
+#define EVENT_LOOP_PASTE_(a, b) a##b
+#define EVENT_LOOP_PASTE(a, b) EVENT_LOOP_PASTE_(a, b)
+#define EVENT_LOOP_SERVE EVENT_LOOP_PASTE(EVENT_LOOP_RUN, _serve)
+#define EVENT_LOOP_STRING_(a) #a
+#define EVENT_LOOP_STRING(a) EVENT_LOOP_STRING_(a)
+#define EVENT_LOOP_NAME EVENT_LOOP_STRING(EVENT_LOOP_RUN) // Names the callbacks in watchdog reports
+
+// Handle what is ready on one connection: from epoll, or its turn in the continuation queue
+static void EVENT_LOOP_SERVE(EventLoop *loop, Connection *conn, uint32_t revents)
+{
+    void *ctx = loop->ctx;
+    (void)ctx;
+    int failed = 0;
+    if (conn->timestamps && revents & EPOLLERR && event_loop_drain_timestamps(conn) > 0)
+    {
+        revents &= ~EPOLLERR; // Only TX stamps: nothing to read unless EPOLLIN says so
+    }
+    if (revents & (EPOLLIN | EPOLLHUP | EPOLLERR))
+    {
+        int n;
+        do
+        {
+            n = event_loop_read(conn);
+            if (n > 0)
+            {
+                int fd = conn->socket->fd;
+                heartbeat_enter(loop->heartbeat, EVENT_LOOP_NAME ": on_data", fd);
+                loop->requests++;
+                long long traced = trace_begin();
+                failed = EVENT_ON_DATA(conn, loop->input, n, ctx) < 0;
+                trace_end(EVENT_LOOP_NAME ": on_data", traced, fd);
+            }
+            else if (n < 0)
+            {
+                failed = 1; // EOF or error (EAGAIN comes back as 0 bytes)
+            }
+        } while (!failed && n > 0 && event_loop_read_again(conn));
+    }
+    if (!failed && revents & EPOLLOUT && conn->output_length > 0)
+    {
+        int fd = conn->socket->fd;
+        int drained = event_loop_flush(conn);
+        heartbeat_enter(loop->heartbeat, EVENT_LOOP_NAME ": on_writable", fd);
+        long long traced = trace_begin();
+        failed = drained < 0 || (drained > 0 && !conn->close_after_flush && EVENT_ON_WRITABLE(conn, ctx) < 0);
+        trace_end(EVENT_LOOP_NAME ": on_writable", traced, fd);
+    }
+
+    if (!failed && conn->close_after_flush && conn->output_length > 0)
+    {
+        failed = event_loop_flush(conn) < 0; // Closing: nothing left to coalesce with
+    }
+    if (failed || (conn->close_after_flush && conn->output_length == 0))
+    {
+        EVENT_ON_CLOSE(conn, ctx);
+        event_loop_destroy(conn);
+    }
+    else
+    {
+        if (conn->timestamps && conn->timestamps->unstamped)
+        {
+            event_loop_drain_timestamps(conn); // Before they raise EPOLLERR and cost a wakeup
+        }
+        event_loop_settle(conn);
+    }
+}
+
+int EVENT_LOOP_RUN(EventLoop *loop)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    void *ctx = loop->ctx;
+    (void)ctx;
+    trace_name_thread(EVENT_LOOP_NAME);
+    loop->syscalls_thread = &syscall_counts; // Counted per thread; the loop takes its share each iteration
+    loop->syscalls_seen = syscall_counts;
+
+    while (!atomic_load_explicit(&loop->stopping, memory_order_relaxed))
+    {
+        int ready = event_loop_wait(loop, events, EVENT_LOOP_MAX_EVENTS);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("[LOOP] epoll_wait failed");
+            loop->syscalls_thread = NULL;
+            return -1;
+        }
+        loop->iterations++;
+        heartbeat_begin(loop->heartbeat, clock_cached_ns());
+
+        for (int i = 0; i < ready; i++)
+        {
+            void *tag = events[i].data.ptr;
+            if (tag == loop->server)
+            {
+                Connection *conn;
+                long long accepted = loop->accepted;
+                loop->listener_wakeups++;
+                while ((conn = event_loop_accept(loop)) != NULL)
+                {
+                    int fd = conn->socket->fd;
+                    heartbeat_enter(loop->heartbeat, EVENT_LOOP_NAME ": on_accept", fd);
+                    long long traced = trace_begin();
+                    int refused = EVENT_ON_ACCEPT(conn, ctx) < 0;
+                    trace_end(EVENT_LOOP_NAME ": on_accept", traced, fd);
+                    if (refused || (conn->close_after_flush && conn->output_length == 0))
+                    {
+                        EVENT_ON_CLOSE(conn, ctx);
+                        event_loop_destroy(conn);
+                        continue;
+                    }
+                    event_loop_settle(conn);
+                }
+                if (loop->accepted == accepted)
+                {
+                    loop->accept_misses++;
+                }
+                continue;
+            }
+            if (tag == loop)
+            {
+                // Connections handed over by a peer, or event_loop_stop() (the while condition does the rest)
+                event_loop_adopt(loop);
+                continue;
+            }
+
+            Connection *conn = (Connection *)tag;
+            if (conn->closed)
+            {
+                continue; // Closed earlier in this batch
+            }
+
+            if (conn->continue_events)
+            {
+                // Over budget: it waits for its turn in the queue below
+                conn->continue_events |= events[i].events & (EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLERR);
+                continue;
+            }
+            EVENT_LOOP_SERVE(loop, conn, events[i].events);
+        }
+
+        // Then the connections that ran out of budget earlier, oldest first
+        Connection *turn;
+        uint32_t work;
+        while ((turn = event_loop_next_turn(loop, &work)) != NULL)
+        {
+            EVENT_LOOP_SERVE(loop, turn, work);
+        }
+
+        // Coalesced output that is due goes out now, one send() per connection
+        if (loop->flush_list)
+        {
+            long long now = event_loop_now_ns();
+            Connection **link = &loop->flush_list;
+            while (*link)
+            {
+                Connection *conn = *link;
+                if (!conn->closed && conn->output_length > 0 && !event_loop_flush_due(conn, now))
+                {
+                    link = &conn->next_flush;
+                    continue;
+                }
+                *link = conn->next_flush;
+                conn->flush_queued = 0;
+                if (conn->closed || conn->output_length == 0)
+                {
+                    continue;
+                }
+                if (event_loop_flush(conn) < 0)
+                {
+                    EVENT_ON_CLOSE(conn, ctx);
+                    event_loop_destroy(conn);
+                }
+                else
+                {
+                    event_loop_settle(conn); // A partial write arms EPOLLOUT for the rest
+                }
+            }
+        }
+
+        event_loop_end_iteration(loop);
+        if (loop->heartbeat)
+        {
+            heartbeat_end(loop->heartbeat, clock_now_ns());
+        }
+    }
+    loop->syscalls_thread = NULL; // Gone with the thread once it returns
+    return 0;
+}
+
+#undef EVENT_LOOP_NAME
+#undef EVENT_LOOP_STRING
+#undef EVENT_LOOP_STRING_
+#undef EVENT_LOOP_SERVE
+#undef EVENT_LOOP_PASTE
+#undef EVENT_LOOP_PASTE_
+#undef EVENT_LOOP_RUN
+#undef EVENT_ON_ACCEPT
+#undef EVENT_ON_DATA
+#undef EVENT_ON_WRITABLE
+#undef EVENT_ON_CLOSE
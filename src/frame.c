@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include "frame.h"
+#include "sniff.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Framed reading: every read delivers a batch.
+ *
+ * A pipelining client sends several requests before waiting for answers, so
+ * one recv() often returns many of them at once. Reading header and payload
+ * separately per message wastes that: two syscalls per message, and the
+ * handler sees one message at a time. frame_reader_next() instead makes one
+ * socket_receive() into a buffer, cuts out every complete frame and hands
+ * all of them over together. The handler can then work on the batch as a
+ * whole: one lookup for all keys, one reply for all requests.
+ *
+ * Frames point into the reader's buffer and stay valid until the next call.
+ * A frame cut off at the end of a read is moved to the front of the buffer
+ * and completed by the following reads.
+ */
+
+FrameReader *frame_reader_create(Socket *socket, FrameSizer frame_size, int capacity)
+{
+    FrameReader *reader = (FrameReader *)malloc(sizeof(FrameReader));
+    if (!reader)
+    {
+        perror("[FRAME] malloc failed");
+        return NULL;
+    }
+    memset(reader, 0, sizeof(FrameReader));
+
+    // +1: socket_receive() NUL-terminates what it reads
+    reader->buffer = (char *)malloc(capacity + 1);
+    if (!reader->buffer)
+    {
+        perror("[FRAME] malloc failed");
+        free(reader);
+        return NULL;
+    }
+    reader->socket = socket;
+    reader->frame_size = frame_size;
+    reader->capacity = capacity;
+    return reader;
+}
+
+// Cut complete frames out of the buffered bytes; -1 on a malformed frame
+static int frame_reader_split(FrameReader *reader)
+{
+    int count = 0;
+    while (count < FRAME_BATCH_MAX && reader->start < reader->end)
+    {
+        int available = reader->end - reader->start;
+        int size = reader->frame_size((const unsigned char *)reader->buffer + reader->start, available);
+        if (size < 0)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+        if (size > reader->capacity)
+        {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        if (size == 0 || size > available)
+        {
+            break; // The rest has not arrived yet
+        }
+        reader->frames[count].data = reader->buffer + reader->start;
+        reader->frames[count].length = size;
+        reader->start += size;
+        count++;
+    }
+    return count;
+}
+
+int frame_reader_next(FrameReader *reader, const Frame **frames)
+{
+    for (;;)
+    {
+        // Frames left over from a read that held more than FRAME_BATCH_MAX
+        int count = frame_reader_split(reader);
+        if (count != 0)
+        {
+            if (count > 0)
+            {
+                *frames = reader->frames;
+                reader->frames_read += count;
+                reader->batches++;
+            }
+            return count;
+        }
+
+        // Keep the incomplete tail and make room after it
+        int tail = reader->end - reader->start;
+        if (reader->start > 0)
+        {
+            memmove(reader->buffer, reader->buffer + reader->start, tail);
+            reader->start = 0;
+            reader->end = tail;
+        }
+        if (reader->end == reader->capacity)
+        {
+            errno = EMSGSIZE; // Still no complete frame in a full buffer
+            return -1;
+        }
+
+        int n = socket_receive(reader->socket, reader->buffer + reader->end, reader->capacity - reader->end + 1);
+        reader->reads++;
+        if (n <= 0)
+        {
+            return n; // 0: peer closed (a partial frame is dropped)
+        }
+        reader->end += n;
+    }
+}
+
+int frame_reader_serve(FrameReader *reader, FrameBatchHandler handle, void *ctx)
+{
+    const Frame *frames;
+    int count;
+    while ((count = frame_reader_next(reader, &frames)) > 0)
+    {
+        if (handle(reader->socket, frames, count, ctx) < 0)
+        {
+            return -1;
+        }
+    }
+    return count;
+}
+
+void frame_reader_free(FrameReader *reader)
+{
+    if (reader)
+    {
+        free(reader->buffer);
+        free(reader);
+    }
+}
+
+int frame_size_binary(const unsigned char *data, int length)
+{
+    if (data[0] != SNIFF_BINARY_MAGIC || (length > 1 && data[1] != SNIFF_BINARY_VERSION))
+    {
+        return -1;
+    }
+    if (length < SNIFF_BINARY_HEADER)
+    {
+        return 0;
+    }
+    return SNIFF_BINARY_HEADER + (data[2] << 8 | data[3]);
+}
+
+int frame_size_line(const unsigned char *data, int length)
+{
+    const unsigned char *newline = (const unsigned char *)memchr(data, '\n', length);
+    return newline ? (int)(newline - data) + 1 : 0;
+}
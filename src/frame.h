@@ -0,0 +1,52 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "socket.h"
+
+#define FRAME_BATCH_MAX 64 // Frames handed to the handler per call at most
+
+// One complete message inside the reader's buffer
+typedef struct
+{
+    const char *data;
+    int length; // Whole frame, header included
+} Frame;
+
+/*
+ * Size of the frame at the start of data: the full frame length as soon as
+ * the header says it (even if not all of it has arrived), 0 if more bytes
+ * are needed to tell, -1 if the bytes cannot start a valid frame.
+ */
+typedef int (*FrameSizer)(const unsigned char *data, int length);
+
+// Gets every complete frame of one read; a negative return stops serving
+typedef int (*FrameBatchHandler)(Socket *socket, const Frame *frames, int count, void *ctx);
+
+// Splits a byte stream read with socket_receive() into frames, a batch per read
+typedef struct
+{
+    Socket *socket;
+    FrameSizer frame_size;
+    char *buffer;
+    int capacity; // Largest frame accepted
+    int start;    // First byte not yet handed out as a frame
+    int end;      // One past the last byte read
+
+    Frame frames[FRAME_BATCH_MAX];
+
+    long long reads;
+    long long frames_read;
+    long long batches;
+} FrameReader;
+
+/* Function prototypes for the framed reader */
+FrameReader *frame_reader_create(Socket *socket, FrameSizer frame_size, int capacity);
+int frame_reader_next(FrameReader *reader, const Frame **frames);
+int frame_reader_serve(FrameReader *reader, FrameBatchHandler handle, void *ctx);
+void frame_reader_free(FrameReader *reader);
+
+// Sizers for the built-in framings
+int frame_size_binary(const unsigned char *data, int length); // sniff.h binary protocol
+int frame_size_line(const unsigned char *data, int length);   // '\n'-terminated lines
+
+#endif
@@ -0,0 +1,446 @@
+#define _GNU_SOURCE
+#include "hedge.h"
+#include "clock.h"
+#include "socket.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/*
+ * Hedged requests ("The Tail at Scale", Dean & Barroso).
+ *
+ * With replicated backends the slow tail usually comes from one replica
+ * being momentarily slow (GC pause, full queue, noisy neighbour), not from
+ * the request itself. So once a request has been outstanding longer than,
+ * say, the 95th percentile of recent latencies, we send the same request to
+ * a second replica and take whichever answer arrives first. Only ~5% of
+ * requests are duplicated, but the p99 drops towards the p95.
+ *
+ * The danger is overload: if every replica is slow, every request crosses
+ * the percentile and hedging doubles the load exactly when there is no spare
+ * capacity. The RetryBudget caps hedges and retries together to a fixed
+ * fraction of the request rate.
+ *
+ * Protocol assumptions: one request per connection (like the `server`
+ * command), the response is a single line (or everything up to EOF), and
+ * optionally the replica greets us with one line before reading.
+ */
+
+#define HEDGE_MIN_SAMPLES 20     // Don't hedge until the window means something
+#define HEDGE_RECOMPUTE_EVERY 32 // Samples between percentile recomputations
+
+typedef struct
+{
+    int fd;
+    int replica;
+    char buffer[HEDGE_RESPONSE_MAX];
+    int length;
+    int greeting_pending;
+    int is_hedge;
+    int connecting;
+    const char *request;
+    int request_len;
+    int request_sent;
+} Attempt;
+
+static void budget_refill(RetryBudget *budget, long long now)
+{
+    double elapsed_sec = (now - budget->last_refill_ns) / 1e9;
+    budget->last_refill_ns = now;
+    budget->balance += elapsed_sec * budget->min_per_sec;
+    if (budget->balance > budget->max_balance)
+    {
+        budget->balance = budget->max_balance;
+    }
+}
+
+static void budget_deposit(RetryBudget *budget, long long now)
+{
+    budget_refill(budget, now);
+    budget->balance += budget->ratio;
+    if (budget->balance > budget->max_balance)
+    {
+        budget->balance = budget->max_balance;
+    }
+}
+
+static int budget_withdraw(RetryBudget *budget, long long now)
+{
+    budget_refill(budget, now);
+    if (budget->balance < 1.0)
+    {
+        return 0;
+    }
+    budget->balance -= 1.0;
+    return 1;
+}
+
+HedgeClient *hedge_client_create(void)
+{
+    HedgeClient *client = (HedgeClient *)malloc(sizeof(HedgeClient));
+    if (!client)
+    {
+        perror("[HEDGE] malloc failed");
+        return NULL;
+    }
+
+    memset(client, 0, sizeof(HedgeClient));
+    client->hedging = 1;
+    client->hedge_percentile = 95.0;
+    client->min_hedge_delay_us = 500;
+    client->timeout_ms = 2000;
+    client->expect_greeting = 0;
+
+    // 10% extra attempts, one per second as a floor, bursts of at most 10
+    client->budget.ratio = 0.1;
+    client->budget.min_per_sec = 1.0;
+    client->budget.max_balance = 10.0;
+    client->budget.balance = 10.0;
+    client->budget.last_refill_ns = clock_now_ns();
+    return client;
+}
+
+int hedge_add_replica(HedgeClient *client, const char *host, int port)
+{
+    if (client->replica_count >= HEDGE_MAX_REPLICAS)
+    {
+        fprintf(stderr, "[HEDGE] Too many replicas (max %d)\n", HEDGE_MAX_REPLICAS);
+        return -1;
+    }
+
+    // Resolve once; every attempt then connect()s straight to the sockaddr
+    ClientSocket *resolved = create_client_socket(host, port);
+    if (!resolved)
+    {
+        return -1;
+    }
+
+    Replica *replica = &client->replicas[client->replica_count];
+    snprintf(replica->host, sizeof(replica->host), "%s", host);
+    replica->port = port;
+    replica->addr = resolved->server_addr;
+    client_free(resolved);
+    return client->replica_count++;
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+    long long left = *(const long long *)a;
+    long long right = *(const long long *)b;
+    return (left > right) - (left < right);
+}
+
+static void record_latency(HedgeClient *client, long long latency_us)
+{
+    client->latencies_us[client->latency_next] = latency_us;
+    client->latency_next = (client->latency_next + 1) % HEDGE_LATENCY_WINDOW;
+    if (client->latency_count < HEDGE_LATENCY_WINDOW)
+    {
+        client->latency_count++;
+    }
+
+    if (client->latency_count < HEDGE_MIN_SAMPLES ||
+        ++client->samples_since_recompute < HEDGE_RECOMPUTE_EVERY)
+    {
+        return;
+    }
+    client->samples_since_recompute = 0;
+
+    long long sorted[HEDGE_LATENCY_WINDOW];
+    memcpy(sorted, client->latencies_us, sizeof(long long) * client->latency_count);
+    qsort(sorted, client->latency_count, sizeof(long long), compare_ll);
+
+    int index = (int)(client->hedge_percentile / 100.0 * (client->latency_count - 1));
+    client->hedge_delay_us = sorted[index];
+    if (client->hedge_delay_us < client->min_hedge_delay_us)
+    {
+        client->hedge_delay_us = client->min_hedge_delay_us;
+    }
+}
+
+/*
+ * Start an attempt without blocking: the socket is O_NONBLOCK from the start,
+ * connect() returns EINPROGRESS and the request is written once poll()
+ * reports POLLOUT. A blocking connect here would freeze the whole request
+ * (including reading the primary's answer) whenever a replica's accept
+ * queue is full and its SYN gets dropped.
+ */
+static int attempt_start(HedgeClient *client, Attempt *attempt, int replica, const char *request)
+{
+    attempt->replica = replica;
+    attempt->length = 0;
+    attempt->greeting_pending = client->expect_greeting;
+    attempt->request = request;
+    attempt->request_len = (int)strlen(request);
+    attempt->request_sent = 0;
+    attempt->connecting = 1;
+
+    attempt->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (attempt->fd < 0)
+    {
+        return -1;
+    }
+
+    const struct sockaddr_in *addr = &client->replicas[replica].addr;
+    if (connect(attempt->fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(attempt->fd);
+        attempt->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// POLLOUT: finish the handshake, then push the request. Returns -1 on failure.
+static int attempt_write(Attempt *attempt)
+{
+    if (attempt->connecting)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(attempt->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0)
+        {
+            return -1;
+        }
+        attempt->connecting = 0;
+    }
+
+    while (attempt->request_sent < attempt->request_len)
+    {
+        int sent = send(attempt->fd, attempt->request + attempt->request_sent,
+                        attempt->request_len - attempt->request_sent, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        }
+        attempt->request_sent += sent;
+    }
+    return 0;
+}
+
+// Returns 1 once a full response is buffered, 0 if more is needed, -1 on failure
+static int attempt_read(Attempt *attempt)
+{
+    int room = HEDGE_RESPONSE_MAX - 1 - attempt->length;
+    int n = recv(attempt->fd, attempt->buffer + attempt->length, room, 0);
+    if (n < 0)
+    {
+        return errno == EINTR || errno == EAGAIN ? 0 : -1;
+    }
+    attempt->length += n;
+    attempt->buffer[attempt->length] = '\0';
+
+    if (attempt->greeting_pending)
+    {
+        char *newline = memchr(attempt->buffer, '\n', attempt->length);
+        if (!newline)
+        {
+            return n == 0 ? -1 : 0;
+        }
+        int greeting = (int)(newline - attempt->buffer) + 1;
+        memmove(attempt->buffer, attempt->buffer + greeting, attempt->length - greeting + 1);
+        attempt->length -= greeting;
+        attempt->greeting_pending = 0;
+    }
+
+    if (memchr(attempt->buffer, '\n', attempt->length) || attempt->length == HEDGE_RESPONSE_MAX - 1)
+    {
+        return 1;
+    }
+    if (n == 0)
+    {
+        // EOF: whatever arrived is the response, nothing at all is a failure
+        return attempt->length > 0 ? 1 : -1;
+    }
+    return 0;
+}
+
+static void attempt_close(Attempt *attempt)
+{
+    if (attempt->fd >= 0)
+    {
+        close(attempt->fd);
+        attempt->fd = -1;
+    }
+}
+
+// Next replica not already used by this request (round-robin order)
+static int next_replica(HedgeClient *client, const int *used, int used_count)
+{
+    for (int step = 0; step < client->replica_count; step++)
+    {
+        int candidate = client->next_replica;
+        client->next_replica = (client->next_replica + 1) % client->replica_count;
+
+        int taken = 0;
+        for (int i = 0; i < used_count; i++)
+        {
+            taken |= used[i] == candidate;
+        }
+        if (!taken)
+        {
+            return candidate;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Send 'request' and copy the first complete response into 'response'.
+ * Returns the response length or -1 if no replica answered in time.
+ */
+int hedge_request(HedgeClient *client, const char *request, char *response, int response_size)
+{
+    long long start = clock_now_ns();
+    long long deadline = start + (long long)client->timeout_ms * 1000000LL;
+    int hedge_armed = client->hedging && client->replica_count > 1 && client->hedge_delay_us > 0;
+    long long hedge_at = start + client->hedge_delay_us * 1000LL;
+
+    Attempt attempts[HEDGE_MAX_REPLICAS];
+    int used[HEDGE_MAX_REPLICAS];
+    int attempt_count = 0;
+    int live = 0;
+
+    client->stats.requests++;
+    budget_deposit(&client->budget, start);
+
+    // Launch (or re-launch) until something is in flight or we run out of options
+    int need_attempt = 1;
+    int first_attempt = 1;
+    int result = -1;
+
+    while (result < 0)
+    {
+        long long now = clock_now_ns();
+
+        if (need_attempt || (hedge_armed && now >= hedge_at))
+        {
+            int is_hedge = !need_attempt;
+            if (is_hedge)
+            {
+                hedge_armed = 0;
+            }
+
+            int replica = next_replica(client, used, attempt_count);
+            if (replica < 0)
+            {
+                need_attempt = 0;
+            }
+            else if (!first_attempt && !budget_withdraw(&client->budget, now))
+            {
+                client->stats.budget_denied++;
+                need_attempt = 0;
+            }
+            else
+            {
+                Attempt *attempt = &attempts[attempt_count];
+                attempt->is_hedge = is_hedge;
+                used[attempt_count++] = replica;
+                if (!first_attempt)
+                {
+                    if (is_hedge)
+                    {
+                        client->stats.hedges++;
+                    }
+                    else
+                    {
+                        client->stats.retries++;
+                    }
+                }
+                first_attempt = 0;
+
+                if (attempt_start(client, attempt, replica, request) == 0)
+                {
+                    live++;
+                    need_attempt = 0;
+                }
+                // A failed connect leaves need_attempt set: retry on the next replica
+                continue;
+            }
+        }
+
+        if (live == 0 || now >= deadline)
+        {
+            break;
+        }
+
+        // Wait for a response, but wake up in time to send the hedge
+        long long wake = deadline;
+        if (hedge_armed && hedge_at < wake)
+        {
+            wake = hedge_at;
+        }
+        int wait_ms = (int)((wake - now + 999999LL) / 1000000LL);
+
+        struct pollfd pfds[HEDGE_MAX_REPLICAS];
+        int owners[HEDGE_MAX_REPLICAS];
+        int nfds = 0;
+        for (int i = 0; i < attempt_count; i++)
+        {
+            if (attempts[i].fd >= 0)
+            {
+                pfds[nfds].fd = attempts[i].fd;
+                pfds[nfds].events = attempts[i].request_sent < attempts[i].request_len ? POLLOUT : POLLIN;
+                owners[nfds++] = i;
+            }
+        }
+
+        int ready = poll(pfds, nfds, wait_ms);
+        if (ready < 0 && errno != EINTR)
+        {
+            break;
+        }
+
+        for (int p = 0; p < nfds && ready > 0 && result < 0; p++)
+        {
+            if (!pfds[p].revents)
+            {
+                continue;
+            }
+            Attempt *attempt = &attempts[owners[p]];
+            int state = pfds[p].events == POLLOUT ? attempt_write(attempt) : attempt_read(attempt);
+            if (state == 1)
+            {
+                int length = attempt->length < response_size - 1 ? attempt->length : response_size - 1;
+                memcpy(response, attempt->buffer, length);
+                response[length] = '\0';
+                result = length;
+                if (attempt->is_hedge)
+                {
+                    client->stats.hedge_wins++;
+                }
+            }
+            else if (state < 0)
+            {
+                attempt_close(attempt);
+                live--;
+                need_attempt = live == 0;
+            }
+        }
+    }
+
+    // The losers are simply closed; the replica sees EPIPE/RST on its reply
+    for (int i = 0; i < attempt_count; i++)
+    {
+        attempt_close(&attempts[i]);
+    }
+
+    if (result < 0)
+    {
+        client->stats.failures++;
+        return -1;
+    }
+
+    record_latency(client, (clock_now_ns() - start) / 1000);
+    return result;
+}
+
+void hedge_client_free(HedgeClient *client)
+{
+    free(client);
+}
@@ -0,0 +1,71 @@
+#ifndef HEDGE_H
+#define HEDGE_H
+
+#include <netinet/in.h>
+
+#define HEDGE_MAX_REPLICAS 16
+#define HEDGE_LATENCY_WINDOW 1024 // Recent latencies kept for the percentile
+#define HEDGE_RESPONSE_MAX 4096
+
+typedef struct
+{
+    char host[64];
+    int port;
+    struct sockaddr_in addr; // Resolved once in hedge_add_replica()
+} Replica;
+
+/*
+ * Retry budget (token bucket shared by hedges and retries).
+ * Every request deposits 'ratio' tokens, every extra attempt withdraws one.
+ * With ratio = 0.1 at most ~10% extra load is ever sent, no matter how slow
+ * the replicas get. 'min_per_sec' tokens trickle in regardless, so a client
+ * with very little traffic can still hedge now and then.
+ */
+typedef struct
+{
+    double balance;
+    double ratio;
+    double min_per_sec;
+    double max_balance;
+    long long last_refill_ns;
+} RetryBudget;
+
+typedef struct
+{
+    long long requests;
+    long long hedges;        // Duplicate attempts sent after the hedge delay
+    long long hedge_wins;    // Requests answered by the duplicate
+    long long retries;       // Attempts re-sent after a failure
+    long long budget_denied; // Hedges/retries skipped for lack of budget
+    long long failures;      // Requests that got no response at all
+} HedgeStats;
+
+typedef struct
+{
+    Replica replicas[HEDGE_MAX_REPLICAS];
+    int replica_count;
+    int next_replica; // Round-robin choice of the primary
+
+    int hedging;             // 0 = plain requests with retries only
+    double hedge_percentile; // Hedge once the primary is slower than this percentile
+    long min_hedge_delay_us; // Floor for the delay while the window is cold/fast
+    int timeout_ms;          // Whole-request deadline
+    int expect_greeting;     // Replicas send one line before reading the request
+
+    long long latencies_us[HEDGE_LATENCY_WINDOW];
+    int latency_count; // Samples in the window (saturates at the window size)
+    int latency_next;  // Ring buffer write position
+    long hedge_delay_us;
+    int samples_since_recompute;
+
+    RetryBudget budget;
+    HedgeStats stats;
+} HedgeClient;
+
+/* Function prototypes for hedged requests (a HedgeClient is single-threaded) */
+HedgeClient *hedge_client_create(void);
+int hedge_add_replica(HedgeClient *client, const char *host, int port);
+int hedge_request(HedgeClient *client, const char *request, char *response, int response_size);
+void hedge_client_free(HedgeClient *client);
+
+#endif
@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include "iplimit.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Per-source-IP admission control, checked in server_accept() right after
+ * accept() returns and before the Socket is allocated.
+ *
+ * Two limits per address:
+ *   - a token bucket: 'rate' new connections per second, bursts up to 'burst'
+ *   - a cap on concurrently open connections (released by socket_close())
+ *
+ * The state lives in a fixed-size open-addressing hash table. Nothing is
+ * ever allocated after startup and nothing takes a lock, so several accept
+ * threads can share one table:
+ *
+ *   - A lookup probes IP_LIMIT_PROBE slots starting at hash(addr).
+ *   - A free slot is claimed with one CAS on 'owner' (0 -> addr).
+ *   - When all probed slots are taken, the one with the oldest last_seen_ms
+ *     that has no open connections is recycled (approximate LRU: we only
+ *     look at the probe window, not the whole table). The CAS expects
+ *     "(old addr, 0 connections)", so a slot that gained a connection in the
+ *     meantime is never stolen.
+ *   - If nothing can be evicted the connection is admitted untracked: under
+ *     a flood of distinct addresses we fail open rather than reject everyone.
+ *
+ * Address and connection count share one 64-bit word, so incrementing the
+ * count can't race with the slot being handed to another address.
+ */
+
+static uint32_t slot_hash(uint32_t addr)
+{
+    // Fibonacci hashing: multiply by 2^64 / golden ratio and keep the high
+    // half, which depends on every input bit. (The low bits of a product only
+    // depend on the low input bits, and in network byte order those are the
+    // first octet - the same for a whole subnet.)
+    return (uint32_t)(((uint64_t)addr * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+IpLimiter *ip_limiter_create(int slots, double rate_per_sec, double burst, int max_connections)
+{
+    IpLimiter *limiter = (IpLimiter *)malloc(sizeof(IpLimiter));
+    if (!limiter)
+    {
+        perror("[IPLIMIT] malloc failed");
+        return NULL;
+    }
+
+    // Round up to a power of two so the probe can mask instead of divide
+    uint32_t size = 64;
+    while ((int)size < slots)
+    {
+        size <<= 1;
+    }
+
+    memset(limiter, 0, sizeof(IpLimiter));
+    limiter->slots = (IpSlot *)calloc(size, sizeof(IpSlot));
+    if (!limiter->slots)
+    {
+        perror("[IPLIMIT] calloc failed");
+        free(limiter);
+        return NULL;
+    }
+
+    limiter->epoch_ns = clock_now_ns();
+    limiter->mask = size - 1;
+    limiter->rate_milli = (uint64_t)(rate_per_sec * 1000.0);
+    if (rate_per_sec > 0 && limiter->rate_milli == 0)
+    {
+        fprintf(stderr, "[IPLIMIT] rate %g/s is below one connection per 1000 s\n", rate_per_sec);
+        free(limiter->slots);
+        free(limiter);
+        return NULL;
+    }
+    limiter->burst_milli = (uint32_t)(burst * 1000.0);
+    limiter->max_connections = max_connections > 0 ? (uint32_t)max_connections : 0;
+    return limiter;
+}
+
+static void claim_slot(IpSlot *slot, uint32_t burst_milli, uint32_t now_ms)
+{
+    atomic_store_explicit(&slot->bucket, (uint64_t)burst_milli << 32 | now_ms, memory_order_relaxed);
+}
+
+/*
+ * Milliseconds from 'then_ms' to 'now_ms' on the 32-bit clock. Each loop of a
+ * group passes its own iteration's clock snapshot, so 'now_ms' may be a little
+ * older than a stamp another loop left: a difference just short of 2^32 is
+ * that lag and counts as no time passed. Anything else is real elapsed time,
+ * up to ~49 days, however long the slot sat idle.
+ */
+static uint32_t ms_since(uint32_t now_ms, uint32_t then_ms)
+{
+    uint32_t elapsed_ms = now_ms - then_ms;
+    return elapsed_ms > UINT32_MAX - IP_LIMIT_SKEW_MS ? 0 : elapsed_ms;
+}
+
+// Take one token and one connection from an owned slot
+static int charge(IpLimiter *limiter, int index, uint32_t addr, uint32_t now_ms)
+{
+    IpSlot *slot = &limiter->slots[index];
+    atomic_store_explicit(&slot->last_seen_ms, now_ms, memory_order_relaxed);
+
+    if (limiter->rate_milli > 0)
+    {
+        uint64_t bucket = atomic_load_explicit(&slot->bucket, memory_order_relaxed);
+        for (;;)
+        {
+            uint32_t last_ms = (uint32_t)bucket;
+            uint64_t tokens = bucket >> 32;
+            uint32_t elapsed_ms = ms_since(now_ms, last_ms);
+            tokens += (uint64_t)elapsed_ms * limiter->rate_milli / 1000;
+            if (tokens > limiter->burst_milli)
+            {
+                tokens = limiter->burst_milli;
+            }
+            if (tokens < 1000)
+            {
+                atomic_fetch_add_explicit(&limiter->rejected_rate, 1, memory_order_relaxed);
+                return IP_REJECT_RATE;
+            }
+
+            // A lagging snapshot keeps the newer stamp, or the next charge would refill twice
+            uint64_t updated = (tokens - 1000) << 32 | (elapsed_ms > 0 ? now_ms : last_ms);
+            if (atomic_compare_exchange_weak_explicit(&slot->bucket, &bucket, updated,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+    }
+
+    uint64_t owner = atomic_load_explicit(&slot->owner, memory_order_relaxed);
+    for (;;)
+    {
+        if ((uint32_t)(owner >> 32) != addr)
+        {
+            // Recycled for another address between lookup and here
+            atomic_fetch_add_explicit(&limiter->untracked, 1, memory_order_relaxed);
+            return IP_ADMIT_UNTRACKED;
+        }
+        uint32_t connections = (uint32_t)owner;
+        if (limiter->max_connections && connections >= limiter->max_connections)
+        {
+            atomic_fetch_add_explicit(&limiter->rejected_connections, 1, memory_order_relaxed);
+            return IP_REJECT_CONNECTIONS;
+        }
+        if (atomic_compare_exchange_weak_explicit(&slot->owner, &owner, owner + 1,
+                                                  memory_order_acq_rel, memory_order_relaxed))
+        {
+            return index;
+        }
+    }
+}
+
+/*
+ * Decide whether a new connection from 'addr' (network byte order) may be
+ * accepted. Returns the slot index to pass to ip_limiter_release() on close,
+ * IP_ADMIT_UNTRACKED (admitted, nothing to release) or an IP_REJECT_* code.
+ */
+int ip_limiter_admit(IpLimiter *limiter, uint32_t addr, long long now_ns)
+{
+    uint32_t now_ms = (uint32_t)((now_ns - limiter->epoch_ns) / 1000000LL);
+    if (addr == 0)
+    {
+        return IP_ADMIT_UNTRACKED; // 0 marks free slots; 0.0.0.0 is never a real peer
+    }
+
+    uint32_t start = slot_hash(addr);
+    int victim = -1;
+    uint64_t victim_owner = 0;
+    uint32_t victim_age = 0;
+
+    for (int i = 0; i < IP_LIMIT_PROBE; i++)
+    {
+        int index = (int)((start + i) & limiter->mask);
+        IpSlot *slot = &limiter->slots[index];
+        uint64_t owner = atomic_load_explicit(&slot->owner, memory_order_acquire);
+        uint32_t key = (uint32_t)(owner >> 32);
+
+        if (key == addr)
+        {
+            return charge(limiter, index, addr, now_ms);
+        }
+        if (key == 0)
+        {
+            uint64_t expected = 0;
+            if (atomic_compare_exchange_strong_explicit(&slot->owner, &expected, (uint64_t)addr << 32,
+                                                        memory_order_acq_rel, memory_order_acquire))
+            {
+                claim_slot(slot, limiter->burst_milli, now_ms);
+                return charge(limiter, index, addr, now_ms);
+            }
+            // Lost the race; if the winner was the same address, use its slot
+            if ((uint32_t)(expected >> 32) == addr)
+            {
+                return charge(limiter, index, addr, now_ms);
+            }
+            owner = expected;
+        }
+
+        uint32_t age = ms_since(now_ms, atomic_load_explicit(&slot->last_seen_ms, memory_order_relaxed));
+        if ((uint32_t)owner == 0 && (victim < 0 || age > victim_age))
+        {
+            victim = index;
+            victim_owner = owner;
+            victim_age = age;
+        }
+    }
+
+    if (victim >= 0 &&
+        atomic_compare_exchange_strong_explicit(&limiter->slots[victim].owner, &victim_owner,
+                                                (uint64_t)addr << 32,
+                                                memory_order_acq_rel, memory_order_relaxed))
+    {
+        atomic_fetch_add_explicit(&limiter->evictions, 1, memory_order_relaxed);
+        claim_slot(&limiter->slots[victim], limiter->burst_milli, now_ms);
+        return charge(limiter, victim, addr, now_ms);
+    }
+
+    atomic_fetch_add_explicit(&limiter->untracked, 1, memory_order_relaxed);
+    return IP_ADMIT_UNTRACKED;
+}
+
+// Give back the connection counted by a successful ip_limiter_admit()
+void ip_limiter_release(IpLimiter *limiter, int slot_index, uint32_t addr)
+{
+    if (slot_index < 0)
+    {
+        return;
+    }
+
+    IpSlot *slot = &limiter->slots[slot_index];
+    uint64_t owner = atomic_load_explicit(&slot->owner, memory_order_relaxed);
+    while ((uint32_t)(owner >> 32) == addr && (uint32_t)owner > 0)
+    {
+        if (atomic_compare_exchange_weak_explicit(&slot->owner, &owner, owner - 1,
+                                                  memory_order_acq_rel, memory_order_relaxed))
+        {
+            return;
+        }
+    }
+}
+
+void ip_limiter_free(IpLimiter *limiter)
+{
+    if (limiter)
+    {
+        free(limiter->slots);
+        free(limiter);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef IPLIMIT_H
+#define IPLIMIT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define IP_LIMIT_PROBE 8 // Slots examined per lookup before evicting
+#define IP_LIMIT_SKEW_MS 60000 // How far behind another loop's stamp a clock snapshot may lag
+
+// ip_limiter_admit() results below zero
+#define IP_ADMIT_UNTRACKED -1    // Admitted, but the table had no room to track it
+#define IP_REJECT_RATE -2        // Token bucket empty: connecting too fast
+#define IP_REJECT_CONNECTIONS -3 // Already at the concurrent-connection cap
+
+/*
+ * One tracked source address. Each field is a single atomic word so every
+ * update is one compare-and-swap, and no lock is ever taken on accept.
+ */
+typedef struct
+{
+    _Atomic uint64_t owner;        // IPv4 address << 32 | open connections (0 = free slot)
+    _Atomic uint64_t bucket;       // Milli-tokens << 32 | last refill (ms since table creation)
+    _Atomic uint32_t last_seen_ms; // For approximate LRU eviction
+    uint32_t padding;
+} IpSlot;
+
+typedef struct IpLimiter
+{
+    IpSlot *slots;
+    uint32_t mask; // slot count - 1 (power of two)
+    long long epoch_ns;
+
+    uint64_t rate_milli;      // Refill: milli-tokens per second, so fractional rates survive (0 = no rate limit)
+    uint32_t burst_milli;     // Bucket size in milli-tokens
+    uint32_t max_connections; // 0 = no cap
+
+    atomic_llong rejected_rate;
+    atomic_llong rejected_connections;
+    atomic_llong evictions;
+    atomic_llong untracked;
+} IpLimiter;
+
+/* Function prototypes for the per-IP limiter */
+IpLimiter *ip_limiter_create(int slots, double rate_per_sec, double burst, int max_connections);
+int ip_limiter_admit(IpLimiter *limiter, uint32_t addr, long long now_ns);
+void ip_limiter_release(IpLimiter *limiter, int slot, uint32_t addr);
+void ip_limiter_free(IpLimiter *limiter);
+
+#endif
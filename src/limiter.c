@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include "limiter.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Adaptive concurrency limit (in the spirit of TCP congestion control and
+ * Netflix's concurrency-limits).
+ *
+ * A server has some concurrency at which it is fully busy. Below it, more
+ * concurrent requests mean more throughput at the same latency. Above it,
+ * extra requests only queue somewhere (run queue, locks, disk) and latency
+ * grows while throughput stays flat. We can't know that point in advance,
+ * but we can see latency rise when we pass it:
+ *
+ *   - long_rtt_ns is a slow moving average of latency, our estimate of the
+ *     latency without queueing.
+ *   - AIMD: a sample slower than tolerance x long_rtt cuts the limit by
+ *     'backoff'; otherwise the limit grows by one.
+ *   - Gradient: limit = limit x clamp(tolerance x long_rtt / sample, 0.5, 1)
+ *     + sqrt(limit). At the baseline the sqrt term lets the limit probe
+ *     upwards; as queueing builds the gradient drops below 1 and pulls it
+ *     down, proportionally to how much slower we got.
+ *
+ * When the limit is reached, limiter_try_acquire() fails and the caller
+ * rejects the request right away - cheap for us and for the client, instead
+ * of queueing it into a timeout.
+ */
+
+#define LIMITER_LONG_RTT_ALPHA 0.01 // ~100-sample memory for the baseline
+
+ConcurrencyLimiter *limiter_create(LimitAlgorithm algorithm, int initial, int min_limit, int max_limit)
+{
+    ConcurrencyLimiter *limiter = (ConcurrencyLimiter *)malloc(sizeof(ConcurrencyLimiter));
+    if (!limiter)
+    {
+        perror("[LIMITER] malloc failed");
+        return NULL;
+    }
+
+    memset(limiter, 0, sizeof(ConcurrencyLimiter));
+    limiter->algorithm = algorithm;
+    limiter->limit = initial;
+    limiter->min_limit = min_limit;
+    limiter->max_limit = max_limit;
+    limiter->tolerance = 2.0;
+    limiter->backoff = 0.9;
+    limiter->smoothing = 0.2;
+    pthread_mutex_init(&limiter->lock, NULL);
+    return limiter;
+}
+
+// Returns 1 if the request may run (pair it with limiter_release), 0 to reject it
+int limiter_try_acquire(ConcurrencyLimiter *limiter)
+{
+    pthread_mutex_lock(&limiter->lock);
+    int allowed = limiter->algorithm == LIMIT_OFF || limiter->inflight < (int)limiter->limit;
+    if (allowed)
+    {
+        limiter->inflight++;
+        limiter->accepted++;
+    }
+    else
+    {
+        limiter->rejected++;
+    }
+    pthread_mutex_unlock(&limiter->lock);
+    return allowed;
+}
+
+void limiter_release(ConcurrencyLimiter *limiter, long long latency_ns)
+{
+    pthread_mutex_lock(&limiter->lock);
+    // Was the limit actually being used? An idle server's latency says nothing about the limit.
+    int app_limited = limiter->inflight * 2 < (int)limiter->limit;
+    limiter->inflight--;
+
+    double sample = (double)latency_ns;
+    if (limiter->samples++ == 0)
+    {
+        limiter->long_rtt_ns = sample;
+    }
+    else
+    {
+        limiter->long_rtt_ns += LIMITER_LONG_RTT_ALPHA * (sample - limiter->long_rtt_ns);
+    }
+    // A much faster sample means the baseline is stale (we were overloaded); let it recover
+    if (limiter->long_rtt_ns > 2.0 * sample)
+    {
+        limiter->long_rtt_ns *= 0.95;
+    }
+
+    if (!app_limited)
+    {
+        if (limiter->algorithm == LIMIT_AIMD)
+        {
+            if (sample > limiter->tolerance * limiter->long_rtt_ns)
+            {
+                limiter->limit *= limiter->backoff;
+            }
+            else
+            {
+                limiter->limit += 1.0;
+            }
+        }
+        else if (limiter->algorithm == LIMIT_GRADIENT)
+        {
+            double gradient = limiter->tolerance * limiter->long_rtt_ns / sample;
+            gradient = gradient < 0.5 ? 0.5 : (gradient > 1.0 ? 1.0 : gradient);
+            double target = limiter->limit * gradient + sqrt(limiter->limit);
+            limiter->limit = limiter->limit * (1.0 - limiter->smoothing) + target * limiter->smoothing;
+        }
+    }
+
+    if (limiter->limit < limiter->min_limit)
+    {
+        limiter->limit = limiter->min_limit;
+    }
+    if (limiter->limit > limiter->max_limit)
+    {
+        limiter->limit = limiter->max_limit;
+    }
+    pthread_mutex_unlock(&limiter->lock);
+}
+
+int limiter_current(ConcurrencyLimiter *limiter)
+{
+    pthread_mutex_lock(&limiter->lock);
+    int limit = (int)limiter->limit;
+    pthread_mutex_unlock(&limiter->lock);
+    return limit;
+}
+
+void limiter_free(ConcurrencyLimiter *limiter)
+{
+    if (limiter)
+    {
+        pthread_mutex_destroy(&limiter->lock);
+        free(limiter);
+    }
+}
+
+int limiter_parse_algorithm(const char *name, LimitAlgorithm *algorithm)
+{
+    if (strcmp(name, "off") == 0)
+    {
+        *algorithm = LIMIT_OFF;
+    }
+    else if (strcmp(name, "aimd") == 0)
+    {
+        *algorithm = LIMIT_AIMD;
+    }
+    else if (strcmp(name, "gradient") == 0)
+    {
+        *algorithm = LIMIT_GRADIENT;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef LIMITER_H
+#define LIMITER_H
+
+#include <pthread.h>
+
+typedef enum
+{
+    LIMIT_OFF,      // Unlimited: the old behaviour
+    LIMIT_AIMD,     // Additive increase, multiplicative decrease on slow samples
+    LIMIT_GRADIENT, // Scale by long-term / short-term latency ratio
+} LimitAlgorithm;
+
+// Adaptive cap on requests dispatched concurrently
+typedef struct
+{
+    LimitAlgorithm algorithm;
+    pthread_mutex_t lock;
+
+    double limit;
+    int min_limit;
+    int max_limit;
+    int inflight;
+
+    double long_rtt_ns; // Slow EWMA of latency: the "no queueing" baseline
+    long long samples;  // Latency samples seen
+    double tolerance;   // Latency may grow to tolerance x baseline before we back off
+    double backoff;     // AIMD: multiplier applied to the limit on a slow sample
+    double smoothing;   // Gradient: weight of each new limit estimate
+
+    long long accepted;
+    long long rejected;
+} ConcurrencyLimiter;
+
+/* Function prototypes for the concurrency limiter */
+ConcurrencyLimiter *limiter_create(LimitAlgorithm algorithm, int initial, int min_limit, int max_limit);
+int limiter_try_acquire(ConcurrencyLimiter *limiter);
+void limiter_release(ConcurrencyLimiter *limiter, long long latency_ns);
+int limiter_current(ConcurrencyLimiter *limiter);
+void limiter_free(ConcurrencyLimiter *limiter);
+
+int limiter_parse_algorithm(const char *name, LimitAlgorithm *algorithm);
+
+#endif
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include "loop_group.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * One event loop per thread, all serving the same port.
+ *
+ * A single loop uses one core. To use more, several loops must get
+ * connections from the same port, and there are three ways to share it:
+ *
+ *   herd        the listener is in every loop's epoll set. Each new
+ *               connection wakes every idle loop; one accept() wins and the
+ *               rest find EAGAIN. Kept as the baseline.
+ *   exclusive   the same, with EPOLLEXCLUSIVE: the kernel wakes one idle
+ *               loop. A loop busy with requests is not waiting and is not
+ *               woken, so new connections go where there is capacity.
+ *   reuseport   every loop has its own listener on the port (SO_REUSEPORT)
+ *               and the kernel picks the queue by hashing the 4-tuple. No
+ *               shared accept queue at all, but the choice ignores load.
+ *
+ * Each loop has its own epoll set, connections and buffers. A connection
+ * stays on the loop that accepted it unless migration is on
+ * (loop_group_migrate()): then a loop that stays much busier than its
+ * peers hands some of its active connections to the idlest one, whichever
+ * way they were accepted (see event_loop.c).
+ */
+
+LoopGroup *loop_group_create(ServerSocket *server, int count, LoopShare share, const Handler *handler, void *ctx)
+{
+    LoopGroup *group = (LoopGroup *)malloc(sizeof(LoopGroup));
+    if (!group)
+    {
+        perror("[GROUP] malloc failed");
+        return NULL;
+    }
+    memset(group, 0, sizeof(LoopGroup));
+    group->share = share;
+    group->count = count;
+    group->loops = (EventLoop **)calloc(count, sizeof(EventLoop *));
+    group->listeners = (ServerSocket **)calloc(count, sizeof(ServerSocket *));
+    group->threads = (pthread_t *)calloc(count, sizeof(pthread_t));
+    group->thread_args = (LoopThread *)calloc(count, sizeof(LoopThread));
+    group->results = (int *)calloc(count, sizeof(int));
+    if (!group->loops || !group->listeners || !group->threads || !group->thread_args || !group->results)
+    {
+        perror("[GROUP] malloc failed");
+        loop_group_free(group);
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        ServerSocket *listener = server;
+        if (share == LOOP_SHARE_REUSEPORT && i > 0)
+        {
+            // 'server' was bound with SO_REUSEPORT; join its group on the same address
+            listener = create_server_socket(server->server_socket.ip, server->server_socket.port, server->backlog);
+            if (!listener || server_reuse_port(listener) < 0 || server_bind(listener) < 0 ||
+                server_listen(listener) < 0)
+            {
+                fprintf(stderr, "[GROUP] Could not open listener %d with SO_REUSEPORT\n", i);
+                server_free(listener);
+                loop_group_free(group);
+                return NULL;
+            }
+            listener->acl = server->acl;
+            listener->ip_limiter = server->ip_limiter;
+        }
+        group->listeners[i] = listener;
+
+        group->loops[i] = share == LOOP_SHARE_EXCLUSIVE ? event_loop_create_shared(listener, handler, ctx)
+                                                        : event_loop_create(listener, handler, ctx);
+        if (!group->loops[i])
+        {
+            loop_group_free(group);
+            return NULL;
+        }
+    }
+    return group;
+}
+
+// Let the loops move connections between them under 'policy' (kept by reference); before loop_group_start()
+int loop_group_migrate(LoopGroup *group, const MigrationPolicy *policy)
+{
+    for (int i = 0; i < group->count; i++)
+    {
+        if (event_loop_set_migration(group->loops[i], group->loops, group->count, policy) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void *loop_thread_main(void *arg)
+{
+    LoopThread *thread = (LoopThread *)arg;
+    LoopGroup *group = thread->group;
+    group->results[thread->index] = group->run(group->loops[thread->index]);
+    return NULL;
+}
+
+// Start a thread per loop, each calling run (NULL = event_loop_run)
+int loop_group_start(LoopGroup *group, LoopRunner run)
+{
+    group->run = run ? run : event_loop_run;
+    for (int i = 0; i < group->count; i++)
+    {
+        group->thread_args[i].group = group;
+        group->thread_args[i].index = i;
+        if (pthread_create(&group->threads[i], NULL, loop_thread_main, &group->thread_args[i]) != 0)
+        {
+            perror("[GROUP] pthread_create failed");
+            loop_group_stop(group);
+            return -1;
+        }
+        group->started++;
+    }
+    return 0;
+}
+
+// Wait for every loop to return; -1 if any of them failed
+int loop_group_wait(LoopGroup *group)
+{
+    int result = 0;
+    for (int i = 0; i < group->started; i++)
+    {
+        pthread_join(group->threads[i], NULL);
+        if (group->results[i] < 0)
+        {
+            result = -1;
+        }
+    }
+    group->started = 0;
+    return result;
+}
+
+void loop_group_stop(LoopGroup *group)
+{
+    for (int i = 0; i < group->started; i++)
+    {
+        event_loop_stop(group->loops[i]);
+    }
+    loop_group_wait(group);
+}
+
+// Frees the loops and the listeners the group opened, not the caller's server
+void loop_group_free(LoopGroup *group)
+{
+    if (group)
+    {
+        loop_group_stop(group);
+        for (int i = 0; i < group->count; i++)
+        {
+            if (group->loops)
+            {
+                event_loop_free(group->loops[i]);
+            }
+            if (group->listeners && i > 0 && group->share == LOOP_SHARE_REUSEPORT)
+            {
+                server_free(group->listeners[i]);
+            }
+        }
+        free(group->loops);
+        free(group->listeners);
+        free(group->threads);
+        free(group->thread_args);
+        free(group->results);
+        free(group);
+    }
+}
+
+int loop_group_parse_share(const char *name, LoopShare *share)
+{
+    if (strcmp(name, "exclusive") == 0)
+    {
+        *share = LOOP_SHARE_EXCLUSIVE;
+    }
+    else if (strcmp(name, "reuseport") == 0)
+    {
+        *share = LOOP_SHARE_REUSEPORT;
+    }
+    else if (strcmp(name, "herd") == 0)
+    {
+        *share = LOOP_SHARE_HERD;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
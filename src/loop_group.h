@@ -0,0 +1,49 @@
+#ifndef LOOP_GROUP_H
+#define LOOP_GROUP_H
+
+#include "event_loop.h"
+#include <pthread.h>
+
+// How the loops of a group get their connections
+typedef enum
+{
+    LOOP_SHARE_EXCLUSIVE, // One listener in every loop's epoll with EPOLLEXCLUSIVE
+    LOOP_SHARE_REUSEPORT, // A listener per loop, SO_REUSEPORT spreads connections by hash
+    LOOP_SHARE_HERD,      // One listener in every loop's epoll, no flag: all waiters wake
+} LoopShare;
+
+// Runs one loop until it is stopped: event_loop_run() or an instantiation of event_loop_dispatch.h
+typedef int (*LoopRunner)(EventLoop *loop);
+
+struct LoopGroup;
+
+typedef struct
+{
+    struct LoopGroup *group;
+    int index;
+} LoopThread;
+
+// Several event loops, one thread each, serving the same port
+typedef struct LoopGroup
+{
+    LoopShare share;
+    int count;
+    EventLoop **loops;
+    ServerSocket **listeners; // Listener of each loop; with SO_REUSEPORT all but the first are ours
+    pthread_t *threads;
+    LoopThread *thread_args;
+    LoopRunner run;
+    int *results; // What each runner returned
+    int started;
+} LoopGroup;
+
+/* Function prototypes for groups of event loops */
+LoopGroup *loop_group_create(ServerSocket *server, int count, LoopShare share, const Handler *handler, void *ctx);
+int loop_group_migrate(LoopGroup *group, const MigrationPolicy *policy);
+int loop_group_start(LoopGroup *group, LoopRunner run);
+int loop_group_wait(LoopGroup *group);
+void loop_group_stop(LoopGroup *group);
+void loop_group_free(LoopGroup *group);
+int loop_group_parse_share(const char *name, LoopShare *share);
+
+#endif
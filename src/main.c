@@ -1,64 +1,1086 @@
+#define _GNU_SOURCE
 #include "socket.h"
+#include "balancer.h"
+#include "proxy.h"
+#include "hedge.h"
+#include "dispatch.h"
+#include "iplimit.h"
+#include "acl.h"
+#include "sniff.h"
+#include "event_loop.h"
+#include "loop_group.h"
+#include "clock.h"
+#include "watchdog.h"
+#include "trace.h"
+#include "binlog.h"
+#include "stats.h"
+#include "metrics.h"
+#include "admin.h"
+#include "frame.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
-int main(int argc, char *argv[])
+static void print_usage(const char *program)
 {
-    if (argc < 2)
+    fprintf(stderr, "Usage: %s server <ip> <port> [--delay-ms N] [--slow-pct P]\n", program);
+    fprintf(stderr, "              [--tsc] [--watchdog-ms T] [--trace FILE] [--binlog FILE] [--stats]\n");
+    fprintf(stderr, "              [--metrics-port P] [--admin-socket PATH]\n");
+    fprintf(stderr, "              [--workers N [--limiter off|aimd|gradient] [--codel-target-ms T]]\n");
+    fprintf(stderr, "              [--loop epoll [--read-budget B] [--write-budget B] [--event-budget N] [--timestamping]\n");
+    fprintf(stderr, "                            [--threads N [--accept exclusive|reuseport|herd] [--migrate]]]\n");
+    fprintf(stderr, "       %s client <host> <port> [message]\n", program);
+    fprintf(stderr, "       %s hedge <host:port>... [--count N] [--percentile P] [--no-hedge]\n", program);
+    fprintf(stderr, "       %s proxy <ip> <port> <rr|p2c|chash> <host:port>... [--pool N]\n", program);
+    fprintf(stderr, "       %s decode <binlog file>\n", program);
+    fprintf(stderr, "       %s top <server pid> [--interval-ms N] [--count N]\n", program);
+    fprintf(stderr, "       %s admin <socket> [list|close] [FILTER...] [sort=KEY] [limit=N] (or: help)\n", program);
+}
+
+// Split "host:port" into its parts; host must hold at least 64 bytes
+static int parse_host_port(const char *spec, char *host, int *port)
+{
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec || colon - spec >= 64)
+    {
+        return -1;
+    }
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+    *port = atoi(colon + 1);
+    return *port > 0 ? 0 : -1;
+}
+
+static int run_proxy(int argc, char *argv[])
+{
+    if (argc < 6)
     {
-        fprintf(stderr, "Usage: %s server <ip> <port>\n", argv[0]);
+        print_usage(argv[0]);
         return 1;
     }
 
-    if (strcmp(argv[1], "server") == 0)
+    BalancePolicy policy;
+    if (balancer_parse_policy(argv[4], &policy) < 0)
+    {
+        fprintf(stderr, "Unknown balancing policy: %s\n", argv[4]);
+        return 1;
+    }
+
+    Balancer *lb = balancer_create(policy);
+    if (!lb)
+    {
+        return 1;
+    }
+
+    int pool_size = 2;
+    for (int i = 5; i < argc; i++)
     {
-        if (argc < 4)
+        if (strcmp(argv[i], "--pool") == 0 && i + 1 < argc)
+        {
+            pool_size = atoi(argv[++i]);
+            continue;
+        }
+
+        char host[64];
+        int port;
+        if (parse_host_port(argv[i], host, &port) < 0 || balancer_add_backend(lb, host, port) < 0)
         {
-            fprintf(stderr, "Usage: %s server <ip> <port>\n", argv[0]);
+            fprintf(stderr, "Invalid backend: %s\n", argv[i]);
+            balancer_free(lb);
             return 1;
         }
+    }
+
+    if (balancer_finalize(lb) < 0)
+    {
+        balancer_free(lb);
+        return 1;
+    }
+
+    ServerSocket *server = create_server_socket(argv[2], atoi(argv[3]), 128);
+    if (!server || server_bind(server) < 0 || server_listen(server) < 0)
+    {
+        fprintf(stderr, "Failed to create proxy listener\n");
+        server_free(server);
+        balancer_free(lb);
+        return 1;
+    }
+
+    Proxy *proxy = proxy_create(server, lb, pool_size);
+    if (!proxy)
+    {
+        server_free(server);
+        balancer_free(lb);
+        return 1;
+    }
+
+    printf("[PROXY] Balancing %d backends with %s (pool: %d per backend)\n",
+           lb->backend_count, balancer_policy_name(policy), pool_size);
+
+    // The proxy relays bytes without printing them
+    socket_verbose = 0;
+    proxy_run(proxy);
+
+    proxy_free(proxy);
+    server_free(server);
+    balancer_free(lb);
+    return 0;
+}
+
+typedef struct
+{
+    int delay_ms; // Deliberately slow mode: delay the reply by delay_ms...
+    int slow_pct; // ...for this percentage of requests
+} ServerOptions;
+
+// The application protocol: greet, read one message, acknowledge it
+static void serve_client(Socket *client, void *ctx)
+{
+    ServerOptions *options = (ServerOptions *)ctx;
+
+    socket_send(client, "Welcome to the server!\n");
+
+    char buffer[SOCKET_BUFFER_SIZE];
+    int bytes_received = socket_receive(client, buffer, SOCKET_BUFFER_SIZE - 1);
+    if (!bytes_received)
+    {
+        fprintf(stderr, "Failed to receive data from client\n");
+        return;
+    }
+
+    if (options->delay_ms > 0 && rand() % 100 < options->slow_pct)
+    {
+        struct timespec pause = {options->delay_ms / 1000, (options->delay_ms % 1000) * 1000000L};
+        nanosleep(&pause, NULL);
+    }
+
+    socket_send(client, "Message received\n");
+}
+
+// The same protocol for the epoll loop: callbacks instead of blocking calls
+static int greet_on_accept(Connection *conn, void *ctx)
+{
+    (void)ctx;
+    return connection_send(conn, "Welcome to the server!\n", 23);
+}
+
+// Application metrics on the --metrics-port page; NULL (not counted) without it
+static Metric *greet_messages;
+static Metric *greet_message_bytes;
+
+static int greet_on_data(Connection *conn, const char *data, int length, void *ctx)
+{
+    (void)ctx;
+    metric_add(greet_messages, 1);
+    metric_observe(greet_message_bytes, length);
+    VERBOSE_LOG("[RECEIVE] Received %d bytes: %.*s\n", length, length, data);
+    connection_close(conn); // After the reply is written
+    return connection_send(conn, "Message received\n", 17);
+}
+
+static const Handler greet_handler = {greet_on_accept, greet_on_data, NULL, NULL};
+
+/*
+ * This program serves one protocol in epoll mode, so it instantiates the loop
+ * body with direct calls (see event_loop_dispatch.h). Other programs can use
+ * event_loop_run() with any Handler.
+ */
+#define EVENT_LOOP_RUN greet_loop_run
+#define EVENT_ON_ACCEPT(conn, ctx) greet_on_accept(conn, ctx)
+#define EVENT_ON_DATA(conn, data, length, ctx) greet_on_data(conn, data, length, ctx)
+#define EVENT_ON_WRITABLE(conn, ctx) 0
+#define EVENT_ON_CLOSE(conn, ctx) ((void)0)
+#include "event_loop_dispatch.h"
+
+// --sniff: HTTP on the same port. Answers one request, then closes
+static void serve_http(Socket *client, void *ctx)
+{
+    (void)ctx;
+    char buffer[SOCKET_BUFFER_SIZE];
+    if (socket_receive(client, buffer, SOCKET_BUFFER_SIZE - 1) <= 0)
+    {
+        return;
+    }
+    socket_send(client, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 23\r\n"
+                        "Connection: close\r\n\r\nWelcome to the server!\n");
+}
+
+// --sniff: RESP (Redis protocol). PING gets +PONG, anything else an error
+static void serve_resp(Socket *client, void *ctx)
+{
+    (void)ctx;
+    char buffer[SOCKET_BUFFER_SIZE];
+    int n;
+    while ((n = socket_receive(client, buffer, SOCKET_BUFFER_SIZE - 1)) > 0)
+    {
+        buffer[n] = '\0';
+        socket_send(client, strstr(buffer, "PING") || strstr(buffer, "ping") ? "+PONG\r\n"
+                                                                             : "-ERR unknown command\r\n");
+    }
+}
+
+// --sniff: the framed binary protocol (see sniff.h). Echoes every frame back
+// Echo every frame of a read back in one send(): the frames sit back to back in the buffer
+static int echo_frames(Socket *client, const Frame *frames, int count, void *ctx)
+{
+    (void)ctx;
+    const Frame *last = &frames[count - 1];
+    int length = (int)(last->data + last->length - frames[0].data);
+    return send(client->fd, frames[0].data, length, MSG_NOSIGNAL) == length ? 0 : -1;
+}
+
+static void serve_binary(Socket *client, void *ctx)
+{
+    (void)ctx;
+    FrameReader *reader = frame_reader_create(client, frame_size_binary, SNIFF_BINARY_HEADER + 65535);
+    if (reader)
+    {
+        frame_reader_serve(reader, echo_frames, NULL);
+        frame_reader_free(reader);
+    }
+}
+
+typedef struct
+{
+    Acl *acl;
+    const char *path;
+    AclAction default_action;
+} AclReloader;
+
+// Rebuild the ACL from its file on every SIGHUP and swap it in while serving
+static void *acl_reload_main(void *arg)
+{
+    AclReloader *reloader = (AclReloader *)arg;
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+
+    int signal_number;
+    while (sigwait(&signals, &signal_number) == 0)
+    {
+        AclTable *table = acl_table_load(reloader->path, reloader->default_action);
+        if (!table)
+        {
+            fprintf(stderr, "[ACL] Reload failed, keeping the current rules\n");
+            continue;
+        }
+        int rules = table->rules;
+        acl_swap(reloader->acl, table);
+        printf("[ACL] Reloaded %s: %d rules\n", reloader->path, rules);
+    }
+    return NULL;
+}
+
+// SIGUSR2 switches span tracing on; the next one switches it off and writes the trace to the file
+static void *trace_switch_main(void *arg)
+{
+    const char *path = (const char *)arg;
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR2);
+
+    int signal_number;
+    while (sigwait(&signals, &signal_number) == 0)
+    {
+        if (!atomic_load(&trace_enabled))
+        {
+            trace_reset();
+            trace_set_enabled(1);
+            printf("[TRACE] Recording (send SIGUSR2 again to stop)\n");
+            continue;
+        }
+        trace_set_enabled(0);
+        int spans = trace_dump(path);
+        if (spans >= 0)
+        {
+            printf("[TRACE] Wrote %d spans to %s (open in ui.perfetto.dev or chrome://tracing)\n", spans, path);
+        }
+    }
+    return NULL;
+}
+
+static int run_server(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    char *ip = argv[2];
+    int port = atoi(argv[3]);
+
+    ServerOptions options = {.delay_ms = 0, .slow_pct = 100};
+    int workers = 0; // 0 = the classic one-connection-at-a-time loop
+    int epoll_loop = 0;
+    LimitAlgorithm limit_algorithm = LIMIT_GRADIENT;
+    int codel_target_ms = 5;
+    double ip_rate = 0;   // New connections per second per source IP (0 = unlimited)
+    double ip_burst = 0;  // Token bucket size; defaults to one second of ip_rate
+    int ip_max_conns = 0; // Concurrent connections per source IP (0 = unlimited)
+    AclReloader acl_reloader = {NULL, NULL, ACL_ALLOW};
+    int sniff = 0; // Detect HTTP / RESP / binary on the one port
+    int sniff_timeout_ms = 200;
+    int defer_accept_s = 1;
+    FairnessBudget budget = {0, 0, 0}; // Per connection per loop iteration (0 = no limit)
+    int loop_threads = 1;
+    LoopShare share = LOOP_SHARE_EXCLUSIVE;
+    int migrate = 0; // Move connections from busy loop threads to idle ones
+    int watchdog_ms = 0; // Report serving iterations longer than this (0 = no watchdog)
+    const char *trace_path = NULL; // Where SIGUSR2 writes the span trace
+    const char *binlog_path = NULL; // Verbose messages as binary records instead of text
+    int publish_stats = 0; // Event-loop counters in shared memory, for `top`
+    int metrics_port = 0;  // Prometheus page on this port (0 = none)
+    const char *admin_path = NULL; // Unix socket listing and closing the loops' connections
+    int timestamping = 0; // SO_TIMESTAMPING on accepted connections: RX and TX delay histograms
+    for (int i = 4; i < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--sniff") == 0)
+        {
+            sniff = 1;
+            i--; // A flag without a value
+        }
+        else if (strcmp(argv[i], "--migrate") == 0)
+        {
+            migrate = 1;
+            i--;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            publish_stats = 1;
+            i--;
+        }
+        else if (strcmp(argv[i], "--timestamping") == 0)
+        {
+            timestamping = 1;
+            i--;
+        }
+        else if (strcmp(argv[i], "--tsc") == 0)
+        {
+            // Calibrate now, before any other thread reads the clock
+            printf("[CLOCK] %s\n",
+                   clock_use_tsc(1) ? "Reading the TSC directly" : "No invariant TSC, using clock_gettime()");
+            i--;
+        }
+        else if (i + 1 >= argc)
+        {
+            break;
+        }
+        else if (strcmp(argv[i], "--delay-ms") == 0)
+        {
+            options.delay_ms = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--slow-pct") == 0)
+        {
+            options.slow_pct = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--loop") == 0)
+        {
+            epoll_loop = strcmp(argv[i + 1], "epoll") == 0;
+        }
+        else if (strcmp(argv[i], "--workers") == 0)
+        {
+            workers = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--limiter") == 0 && limiter_parse_algorithm(argv[i + 1], &limit_algorithm) < 0)
+        {
+            fprintf(stderr, "Unknown limiter: %s\n", argv[i + 1]);
+            return 1;
+        }
+        else if (strcmp(argv[i], "--codel-target-ms") == 0)
+        {
+            codel_target_ms = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--ip-rate") == 0)
+        {
+            ip_rate = atof(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--ip-burst") == 0)
+        {
+            ip_burst = atof(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--ip-max-conns") == 0)
+        {
+            ip_max_conns = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--acl") == 0)
+        {
+            acl_reloader.path = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--acl-default") == 0 && acl_parse_action(argv[i + 1], &acl_reloader.default_action) < 0)
+        {
+            fprintf(stderr, "Unknown ACL action: %s\n", argv[i + 1]);
+            return 1;
+        }
+        else if (strcmp(argv[i], "--sniff-timeout-ms") == 0)
+        {
+            sniff_timeout_ms = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--defer-accept") == 0)
+        {
+            defer_accept_s = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--admin-socket") == 0)
+        {
+            admin_path = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--metrics-port") == 0)
+        {
+            metrics_port = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--read-budget") == 0)
+        {
+            budget.read_bytes = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--write-budget") == 0)
+        {
+            budget.write_bytes = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--event-budget") == 0)
+        {
+            budget.events = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--watchdog-ms") == 0)
+        {
+            watchdog_ms = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+            trace_path = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--binlog") == 0)
+        {
+            binlog_path = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--threads") == 0)
+        {
+            loop_threads = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--accept") == 0 && loop_group_parse_share(argv[i + 1], &share) < 0)
+        {
+            fprintf(stderr, "Unknown accept mode: %s\n", argv[i + 1]);
+            return 1;
+        }
+    }
+    srand((unsigned int)time(NULL) ^ (unsigned int)getpid());
+
+    if (binlog_path)
+    {
+        if (binlog_open(binlog_path, 64UL << 20) < 0)
+        {
+            return 1;
+        }
+        printf("[BINLOG] Logging to %s; render it with: %s decode %s\n", binlog_path, argv[0], binlog_path);
+    }
+
+    if (trace_path)
+    {
+        // Only the switch thread takes SIGUSR2: blocked here, before any other thread exists
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR2);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+        // ... and it takes nothing else: created with every signal blocked
+        sigset_t everything, previous;
+        sigfillset(&everything);
+        pthread_sigmask(SIG_SETMASK, &everything, &previous);
+        pthread_t switch_thread;
+        pthread_create(&switch_thread, NULL, trace_switch_main, (void *)trace_path);
+        pthread_detach(switch_thread);
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+        printf("[TRACE] Send SIGUSR2 to pid %d to start and stop recording into %s\n", (int)getpid(), trace_path);
+    }
+
+    ServerSocket *server = create_server_socket(ip, port, workers > 0 || epoll_loop ? 128 : 5);
+
+    if (!server)
+    {
+        fprintf(stderr, "Failed to create server\n");
+        return 1;
+    }
+
+    if (ip_rate > 0 || ip_max_conns > 0)
+    {
+        // Reject abusive sources in server_accept(), before anything is allocated
+        double burst = ip_burst > 0 ? ip_burst : (ip_rate > 1 ? ip_rate : 1);
+        server->ip_limiter = ip_limiter_create(4096, ip_rate, burst, ip_max_conns);
+        if (!server->ip_limiter)
+        {
+            server_free(server);
+            return 1;
+        }
+    }
+
+    if (acl_reloader.path)
+    {
+        AclTable *table = acl_table_load(acl_reloader.path, acl_reloader.default_action);
+        server->acl = table ? acl_create(table) : NULL;
+        if (!server->acl)
+        {
+            acl_table_free(table);
+            ip_limiter_free(server->ip_limiter);
+            server_free(server);
+            return 1;
+        }
+        printf("[ACL] Loaded %s: %d rules, %zu KiB (send SIGHUP to reload)\n",
+               acl_reloader.path, table->rules, acl_table_memory(table) / 1024);
+
+        // Only the reload thread takes SIGHUP: block it here, before any other
+        // thread exists, so every thread inherits the mask
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
 
-        char *ip = argv[2];
-        int port = atoi(argv[3]);
+        acl_reloader.acl = server->acl;
+        pthread_t reload_thread;
+        pthread_create(&reload_thread, NULL, acl_reload_main, &acl_reloader);
+        pthread_detach(reload_thread);
+    }
+
+    // Started after the signal masks are set, like every other thread
+    if (watchdog_ms > 0 && watchdog_start(watchdog_ms) == 0)
+    {
+        printf("[WATCHDOG] Reporting iterations longer than %d ms\n", watchdog_ms);
+    }
+
+    // The loops' counters feed both `top` and the metrics page
+    StatsSegment *stats = epoll_loop && (publish_stats || metrics_port > 0) ? stats_create() : NULL;
+    if (metrics_port > 0 && metrics_start(ip, metrics_port, stats) == 0)
+    {
+        static const double sizes[] = {16, 64, 256, 1024, 4096};
+        greet_messages = metrics_counter("greet_messages_total", "Messages received from clients.");
+        greet_message_bytes = metrics_histogram("greet_message_bytes", "Size of the messages received.", sizes,
+                                                sizeof(sizes) / sizeof(sizes[0]));
+        printf("[METRICS] Serving http://%s:%d/metrics\n", ip, metrics_port);
+    }
 
-        ServerSocket *server = create_server_socket(ip, port, 5);
+    if (epoll_loop && loop_threads > 1 && share == LOOP_SHARE_REUSEPORT)
+    {
+        server_reuse_port(server); // Before bind: the other loops join this port
+    }
+    server_bind(server);
+    server_listen(server);
 
-        if (!server)
+    // Every connection goes to serve_client unless --sniff puts a protocol router in front.
+    // The event loops ignore --sniff: no router for them, and no TCP_DEFER_ACCEPT, which
+    // would hold back their server-speaks-first clients until the defer timeout
+    ConnectionHandler handle = serve_client;
+    void *handle_ctx = &options;
+    ProtocolRouter *router = NULL;
+    if (sniff && !epoll_loop)
+    {
+        router = protocol_router_create(sniff_timeout_ms);
+        if (!router)
         {
-            fprintf(stderr, "Failed to create server\n");
+            server_free(server);
             return 1;
         }
+        protocol_router_add(router, "HTTP", sniff_match_http, serve_http, NULL);
+        protocol_router_add(router, "RESP", sniff_match_resp, serve_resp, NULL);
+        protocol_router_add(router, "binary", sniff_match_binary, serve_binary, NULL);
+
+        // Clients that wait for our greeting say nothing: give them the line protocol
+        router->on_silent = serve_client;
+        router->silent_ctx = &options;
+        handle = protocol_router_serve;
+        handle_ctx = router;
 
-        server_bind(server);
-        server_listen(server);
+        if (defer_accept_s > 0)
+        {
+            server_defer_accept(server, defer_accept_s);
+        }
+    }
 
-        while (1)
+    if (epoll_loop && loop_threads > 1)
+    {
+        // A loop per thread on the same port; see loop_group.c for the accept modes
+        static const MigrationPolicy migration = {.interval_ms = 100, .threshold_pct = 25, .max_per_round = 8};
+        LoopGroup *group = loop_group_create(server, loop_threads, share, &greet_handler, &options);
+        if (group && migrate && loop_group_migrate(group, &migration) < 0)
         {
-            Socket *client = server_accept(server);
-            if (!client)
+            loop_group_free(group);
+            group = NULL;
+        }
+        for (int i = 0; group && i < group->count; i++)
+        {
+            if (budget.read_bytes > 0 || budget.write_bytes > 0 || budget.events > 0)
+            {
+                event_loop_set_budget(group->loops[i], &budget);
+            }
+            if (timestamping)
+            {
+                event_loop_use_timestamping(group->loops[i], 1);
+            }
+            if (stats)
+            {
+                stats_attach_loop(stats, group->loops[i]);
+            }
+        }
+        if (stats && publish_stats)
+        {
+            printf("[STATS] Publishing %d loops; watch with: %s top %d\n", group->count, argv[0], (int)getpid());
+        }
+        AdminServer *admin = group && admin_path ? admin_start(admin_path, group->loops, group->count) : NULL;
+        if (admin)
+        {
+            printf("[ADMIN] Listening on %s; try: %s admin %s list\n", admin_path, argv[0], admin_path);
+        }
+        int result = group && loop_group_start(group, greet_loop_run) == 0 ? loop_group_wait(group) : -1;
+        admin_stop(admin);
+        metrics_stop(); // Before the loops' counters go away
+        loop_group_free(group);
+        stats_free(stats);
+        ip_limiter_free(server->ip_limiter);
+        server_free(server);
+        return result < 0;
+    }
+
+    if (epoll_loop)
+    {
+        // One thread, many connections: the greeting protocol as epoll callbacks
+        EventLoop *loop = event_loop_create(server, &greet_handler, &options);
+        if (loop && (budget.read_bytes > 0 || budget.write_bytes > 0 || budget.events > 0))
+        {
+            event_loop_set_budget(loop, &budget);
+        }
+        if (loop && timestamping)
+        {
+            event_loop_use_timestamping(loop, 1);
+        }
+        if (loop && stats && stats_attach_loop(stats, loop) >= 0 && publish_stats)
+        {
+            printf("[STATS] Publishing the loop; watch with: %s top %d\n", argv[0], (int)getpid());
+        }
+        AdminServer *admin = loop && admin_path ? admin_start(admin_path, &loop, 1) : NULL;
+        if (admin)
+        {
+            printf("[ADMIN] Listening on %s; try: %s admin %s list\n", admin_path, argv[0], admin_path);
+        }
+        int result = loop ? greet_loop_run(loop) : -1;
+        admin_stop(admin);
+        metrics_stop();
+        event_loop_free(loop);
+        stats_free(stats);
+        ip_limiter_free(server->ip_limiter);
+        server_free(server);
+        return result < 0;
+    }
+
+    if (workers > 0)
+    {
+        // Worker-pool mode: CoDel sheds connections that queued too long and the
+        // adaptive limiter rejects work beyond what the server can absorb
+        CodelQueue *queue = codel_create(1024, codel_target_ms * 1000000LL, 100 * 1000000LL);
+        ConcurrencyLimiter *limiter = limiter_create(limit_algorithm, workers, 1, workers);
+        WorkerPool *pool = NULL;
+        if (queue && limiter)
+        {
+            pool = worker_pool_create(server, workers, queue, limiter, handle, handle_ctx);
+        }
+        if (!pool)
+        {
+            codel_free(queue);
+            limiter_free(limiter);
+            ip_limiter_free(server->ip_limiter);
+            protocol_router_free(router);
+            server_free(server);
+            return 1;
+        }
+        worker_pool_run(pool);
+        worker_pool_free(pool);
+        limiter_free(limiter);
+        codel_free(queue);
+        ip_limiter_free(server->ip_limiter);
+        protocol_router_free(router);
+        server_free(server);
+        return 0;
+    }
+
+    // One connection at a time: a slow client stalls everyone, which the watchdog reports
+    Heartbeat *heartbeat = watchdog_heartbeat("server");
+    while (1)
+    {
+        Socket *client = server_accept(server);
+        if (!client)
+        {
+            if (errno != ECONNREFUSED) // Per-IP rejections are already reported
             {
                 fprintf(stderr, "Failed to accept client\n");
-                continue;
             }
-            socket_send(client, "Welcome to the server!\n");
+            continue;
+        }
+
+        heartbeat_begin(heartbeat, clock_now_ns());
+        heartbeat_enter(heartbeat, sniff ? "protocol_router_serve" : "serve_client", client->fd);
+        handle(client, handle_ctx);
+        heartbeat_end(heartbeat, clock_now_ns());
+
+        socket_close(client);
+        free(client);
+    }
+
+    return 0;
+}
+
+static int run_client(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const char *message = argc > 4 ? argv[4] : "Hello, Server!";
+
+    ClientSocket *client = create_client_socket(argv[2], atoi(argv[3]));
+    if (!client || client_connect(client) < 0)
+    {
+        fprintf(stderr, "Failed to connect to %s:%s\n", argv[2], argv[3]);
+        client_free(client);
+        return 1;
+    }
+
+    // The server greets first, then answers our one message
+    char buffer[SOCKET_BUFFER_SIZE];
+    socket_receive(&client->client_socket, buffer, SOCKET_BUFFER_SIZE - 1);
+    socket_send(&client->client_socket, message);
+    socket_receive(&client->client_socket, buffer, SOCKET_BUFFER_SIZE - 1);
+
+    client_free(client);
+    return 0;
+}
 
-            char buffer[SOCKET_BUFFER_SIZE];
-            int bytes_received = socket_receive(client, buffer, SOCKET_BUFFER_SIZE - 1);
-            if (!bytes_received)
+static int compare_latency(const void *a, const void *b)
+{
+    long long left = *(const long long *)a;
+    long long right = *(const long long *)b;
+    return (left > right) - (left < right);
+}
+
+// Issue --count requests against replicated `server` instances and report the tail
+static int run_hedge(int argc, char *argv[])
+{
+    HedgeClient *hedger = hedge_client_create();
+    if (!hedger)
+    {
+        return 1;
+    }
+    // The `server` command greets every connection before reading the request
+    hedger->expect_greeting = 1;
+
+    int count = 200;
+    socket_verbose = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+        {
+            count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--percentile") == 0 && i + 1 < argc)
+        {
+            hedger->hedge_percentile = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-hedge") == 0)
+        {
+            hedger->hedging = 0;
+        }
+        else
+        {
+            char host[64];
+            int port;
+            if (parse_host_port(argv[i], host, &port) < 0 || hedge_add_replica(hedger, host, port) < 0)
             {
-                fprintf(stderr, "Failed to receive data from client\n");
-                socket_close(client);
-                free(client);
-                continue;
+                fprintf(stderr, "Invalid replica: %s\n", argv[i]);
+                hedge_client_free(hedger);
+                return 1;
             }
+        }
+    }
 
-            socket_send(client, "Message received\n");
+    if (hedger->replica_count == 0 || count <= 0)
+    {
+        print_usage(argv[0]);
+        hedge_client_free(hedger);
+        return 1;
+    }
 
-            socket_close(client);
-            free(client);
+    long long *latencies = (long long *)malloc(sizeof(long long) * count);
+    if (!latencies)
+    {
+        perror("[HEDGE] malloc failed");
+        hedge_client_free(hedger);
+        return 1;
+    }
+    int completed = 0;
+    char response[HEDGE_RESPONSE_MAX];
+
+    for (int i = 0; i < count; i++)
+    {
+        long long start = clock_now_ns();
+        if (hedge_request(hedger, "Hello, Server!\n", response, sizeof(response)) >= 0)
+        {
+            latencies[completed++] = (clock_now_ns() - start) / 1000;
+        }
+    }
+
+    qsort(latencies, completed, sizeof(long long), compare_latency);
+    printf("[HEDGE] %d/%d requests answered (hedging %s at p%.1f)\n",
+           completed, count, hedger->hedging ? "on" : "off", hedger->hedge_percentile);
+    if (completed > 0)
+    {
+        printf("[HEDGE] latency p50=%lldus p99=%lldus max=%lldus\n",
+               latencies[completed / 2], latencies[(completed - 1) * 99 / 100], latencies[completed - 1]);
+    }
+    printf("[HEDGE] hedges=%lld (won %lld) retries=%lld budget_denied=%lld failures=%lld\n",
+           hedger->stats.hedges, hedger->stats.hedge_wins, hedger->stats.retries,
+           hedger->stats.budget_denied, hedger->stats.failures);
+
+    free(latencies);
+    hedge_client_free(hedger);
+    return 0;
+}
+
+// Per-second rates of one loop between two snapshots, or of several loops added up
+typedef struct
+{
+    double connections;
+    double accepted;
+    double closed;
+    double kib_in;
+    double kib_out;
+    double recv_calls;
+    double send_calls;
+    double iterations;
+    double requests;
+    double syscalls;
+    double busy_pct;
+} TopRow;
+
+static void top_rates(const long long *now, const long long *then, TopRow *row)
+{
+    memset(row, 0, sizeof(TopRow));
+    row->connections = (double)now[STATS_CONNECTIONS];
+    long long elapsed = now[STATS_PUBLISHED_NS] - then[STATS_PUBLISHED_NS];
+    if (elapsed <= 0)
+    {
+        return; // No iteration since the last frame: idle
+    }
+    double seconds = elapsed / 1e9;
+    row->accepted = (now[STATS_ACCEPTED] - then[STATS_ACCEPTED]) / seconds;
+    row->closed = (now[STATS_CLOSED] - then[STATS_CLOSED]) / seconds;
+    row->kib_in = (now[STATS_BYTES_IN] - then[STATS_BYTES_IN]) / 1024.0 / seconds;
+    row->kib_out = (now[STATS_BYTES_OUT] - then[STATS_BYTES_OUT]) / 1024.0 / seconds;
+    row->recv_calls = (now[STATS_RECV_CALLS] - then[STATS_RECV_CALLS]) / seconds;
+    row->send_calls = (now[STATS_SEND_CALLS] - then[STATS_SEND_CALLS]) / seconds;
+    row->iterations = (now[STATS_ITERATIONS] - then[STATS_ITERATIONS]) / seconds;
+    row->requests = (now[STATS_REQUESTS] - then[STATS_REQUESTS]) / seconds;
+    for (int kind = 0; kind < SYSCALL_KINDS; kind++)
+    {
+        row->syscalls += (now[STATS_SYSCALLS + kind] - then[STATS_SYSCALLS + kind]) / seconds;
+    }
+    double waited = (double)(now[STATS_WAIT_NS] - then[STATS_WAIT_NS]) / elapsed;
+    row->busy_pct = waited < 1 ? 100.0 * (1 - waited) : 0;
+}
+
+static void top_add(TopRow *sum, const TopRow *row)
+{
+    sum->connections += row->connections;
+    sum->accepted += row->accepted;
+    sum->closed += row->closed;
+    sum->kib_in += row->kib_in;
+    sum->kib_out += row->kib_out;
+    sum->recv_calls += row->recv_calls;
+    sum->send_calls += row->send_calls;
+    sum->iterations += row->iterations;
+    sum->requests += row->requests;
+    sum->syscalls += row->syscalls;
+    sum->busy_pct += row->busy_pct;
+}
+
+// busy_pct of a sum is the average over its 'loops'
+static void top_print(const char *label, const TopRow *row, int loops)
+{
+    printf("%-22s %6.0f %9.0f %9.0f %10.1f %10.1f %9.0f %9.0f %9.0f %9.0f %7.2f %6.1f\n", label, row->connections,
+           row->accepted, row->closed, row->kib_in, row->kib_out, row->recv_calls, row->send_calls, row->iterations,
+           row->requests, row->requests > 0 ? row->syscalls / row->requests : 0, loops > 0 ? row->busy_pct / loops : 0);
+}
+
+// Watch a server started with --stats: its shared-memory counters, refreshed every interval
+static int run_top(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    int pid = atoi(argv[2]);
+    int interval_ms = 1000;
+    int count = 0; // Frames to print (0 = until the server goes away)
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--interval-ms") == 0)
+        {
+            interval_ms = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--count") == 0)
+        {
+            count = atoi(argv[i + 1]);
+        }
+    }
+    StatsSegment *stats = stats_open(pid);
+    if (!stats)
+    {
+        return 1;
+    }
+
+    // The first frame shows averages since the server started publishing
+    static long long previous[STATS_MAX_LOOPS][STATS_COUNTERS];
+    for (int i = 0; i < STATS_MAX_LOOPS; i++)
+    {
+        previous[i][STATS_PUBLISHED_NS] = stats->started_ns;
+    }
+    int redraw = isatty(STDOUT_FILENO);
+    struct timespec pause = {interval_ms / 1000, (interval_ms % 1000) * 1000000L};
+    for (int frame = 0; count == 0 || frame < count; frame++)
+    {
+        if (frame > 0)
+        {
+            nanosleep(&pause, NULL);
+        }
+        if (kill(pid, 0) < 0 && errno == ESRCH)
+        {
+            printf("[STATS] Server %d is gone; removing its stats segment\n", pid);
+            stats_close(stats);
+            stats_remove(pid);
+            return 0;
+        }
+
+        int loops = atomic_load_explicit(&stats->loop_count, memory_order_acquire);
+        TopRow listeners[STATS_MAX_LISTENERS];
+        int listener_loops[STATS_MAX_LISTENERS];
+        TopRow total;
+        memset(listeners, 0, sizeof(listeners));
+        memset(listener_loops, 0, sizeof(listener_loops));
+        memset(&total, 0, sizeof(total));
+
+        if (redraw)
+        {
+            printf("\033[H\033[2J");
+        }
+        printf("socket_discovery pid %d: %d loop(s) on %d listener(s), up %.1f s\n", pid, loops,
+               stats->listener_count, (clock_now_ns() - stats->started_ns) / 1e9);
+        printf("%-22s %6s %9s %9s %10s %10s %9s %9s %9s %9s %7s %6s\n", "LOOP", "CONNS", "ACCEPT/s", "CLOSE/s",
+               "IN KiB/s", "OUT KiB/s", "RECV/s", "SEND/s", "ITER/s", "REQ/s", "SYS/REQ", "BUSY%");
+        for (int i = 0; i < loops; i++)
+        {
+            long long now[STATS_COUNTERS];
+            if (stats_snapshot(stats, i, now) < 0)
+            {
+                memcpy(now, previous[i], sizeof(now)); // Kept changing under us: show it idle this frame
+            }
+            TopRow row;
+            top_rates(now, previous[i], &row);
+            memcpy(previous[i], now, sizeof(now));
+
+            char label[32];
+            snprintf(label, sizeof(label), "loop %d", i);
+            top_print(label, &row, 1);
+            int listener = stats->loops[i].listener;
+            top_add(&listeners[listener], &row);
+            listener_loops[listener]++;
+            top_add(&total, &row);
+        }
+        for (int i = 0; i < stats->listener_count; i++)
+        {
+            char label[48];
+            snprintf(label, sizeof(label), "%s:%d fd %d", stats->listeners[i].ip, stats->listeners[i].port,
+                     stats->listeners[i].fd);
+            top_print(label, &listeners[i], listener_loops[i]);
+        }
+        top_print("total", &total, loops);
+        fflush(stdout);
+    }
+    stats_close(stats);
+    return 0;
+}
+
+// Render a binlog written by server --binlog as text
+static int run_decode(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    return binlog_decode(argv[2], stdout) < 0;
+}
+
+// One command to a server started with --admin-socket; its words are joined back into a line
+static int run_admin(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    char command[1024] = "list";
+    if (argc > 3)
+    {
+        int length = 0;
+        for (int i = 3; i < argc && length < (int)sizeof(command); i++)
+        {
+            length += snprintf(command + length, sizeof(command) - length, "%s%s", i > 3 ? " " : "", argv[i]);
         }
     }
+    return admin_command(argv[2], command) < 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "server") == 0)
+    {
+        int result = run_server(argc, argv);
+        metrics_stop();
+        binlog_close();
+        return result;
+    }
+    else if (strcmp(argv[1], "client") == 0)
+    {
+        return run_client(argc, argv);
+    }
+    else if (strcmp(argv[1], "hedge") == 0)
+    {
+        return run_hedge(argc, argv);
+    }
+    else if (strcmp(argv[1], "proxy") == 0)
+    {
+        return run_proxy(argc, argv);
+    }
+    else if (strcmp(argv[1], "decode") == 0)
+    {
+        return run_decode(argc, argv);
+    }
+    else if (strcmp(argv[1], "admin") == 0)
+    {
+        return run_admin(argc, argv);
+    }
+    else if (strcmp(argv[1], "top") == 0)
+    {
+        return run_top(argc, argv);
+    }
     else
     {
         printf("Unknown command: %s\n", argv[1]);
@@ -0,0 +1,497 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/*
+ * A Prometheus endpoint: GET /metrics on an admin port of its own.
+ *
+ * The page has three parts:
+ *   - the event loops' counters, read from their stats slots (stats.c)
+ *     under the seqlock, labelled with the loop and its listener;
+ *   - the serving threads' iteration-time histograms, when the watchdog
+ *     keeps heartbeats;
+ *   - metrics the application registered with metrics_counter(),
+ *     metrics_gauge() and metrics_histogram().
+ *
+ * Nothing on that list grows with the number of connections, and nothing
+ * on it takes a lock a loop takes: a scrape costs the loops nothing, however
+ * many connections they hold.
+ *
+ * The scrape itself allocates nothing. The text is rendered line by line
+ * into one fixed buffer, which goes out with send() whenever it fills up,
+ * so the page may be any size. The response has no Content-Length: it ends
+ * when the connection closes (Connection: close), which Prometheus accepts.
+ */
+
+MetricsServer *metrics = NULL;
+
+// A loop counter on the page: its name, type and help, and a scale for units
+typedef struct
+{
+    StatsCounter counter;
+    const char *name;
+    const char *type;
+    const char *help;
+    double scale; // 0 = print the raw integer
+} LoopMetric;
+
+static const LoopMetric loop_metrics[] = {
+    {STATS_CONNECTIONS, "socket_connections", "gauge", "Open connections.", 0},
+    {STATS_ACCEPTED, "socket_accepted_total", "counter", "Connections accepted.", 0},
+    {STATS_CLOSED, "socket_closed_total", "counter", "Connections closed.", 0},
+    {STATS_BYTES_IN, "socket_received_bytes_total", "counter", "Bytes received.", 0},
+    {STATS_BYTES_OUT, "socket_sent_bytes_total", "counter", "Bytes sent.", 0},
+    {STATS_RECV_CALLS, "socket_recv_calls_total", "counter", "recv() system calls.", 0},
+    {STATS_SEND_CALLS, "socket_send_calls_total", "counter", "send() system calls.", 0},
+    {STATS_CTL_CALLS, "socket_epoll_ctl_calls_total", "counter", "epoll_ctl() system calls.", 0},
+    {STATS_ITERATIONS, "socket_loop_iterations_total", "counter", "Event loop iterations.", 0},
+    {STATS_WAIT_NS, "socket_loop_wait_seconds_total", "counter", "Time spent waiting in epoll_wait().", 1e-9},
+    {STATS_OVER_BUDGET, "socket_over_budget_total", "counter", "Connections cut off by their budget.", 0},
+    {STATS_MIGRATED_IN, "socket_migrated_in_total", "counter", "Connections taken over from a peer loop.", 0},
+    {STATS_MIGRATED_OUT, "socket_migrated_out_total", "counter", "Connections handed to a peer loop.", 0},
+    {STATS_REQUESTS, "socket_requests_total", "counter", "Messages handed to on_data.", 0},
+};
+
+// Send what is buffered; after a failure the rest of the scrape is dropped
+static void metrics_flush(MetricsServer *server)
+{
+    int sent = 0;
+    while (server->client_fd >= 0 && sent < server->length)
+    {
+        ssize_t n = send(server->client_fd, server->buffer + sent, server->length - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK)
+        {
+            n = write(server->client_fd, server->buffer + sent, server->length - sent);
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            server->client_fd = -1;
+            break;
+        }
+        sent += (int)n;
+    }
+    server->sent += sent;
+    server->length = 0;
+}
+
+// Append one formatted line to the buffer, sending the buffer first if it does not fit
+static void __attribute__((format(printf, 2, 3))) emit(MetricsServer *server, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(server->buffer + server->length, METRICS_BUFFER_SIZE - server->length, format, ap);
+    va_end(ap);
+    if (n >= METRICS_BUFFER_SIZE - server->length)
+    {
+        metrics_flush(server);
+        va_start(ap, format);
+        n = vsnprintf(server->buffer, METRICS_BUFFER_SIZE, format, ap);
+        va_end(ap);
+        if (n >= METRICS_BUFFER_SIZE)
+        {
+            n = METRICS_BUFFER_SIZE - 1; // One line longer than the buffer: cut
+        }
+    }
+    server->length += n;
+}
+
+// One kernel-timestamp delay histogram per loop that stamps its connections (timestamping.c)
+static void render_delays(MetricsServer *server, int loops, const int *consistent, const char *name,
+                          const char *help, int sum_counter, int first_bucket)
+{
+    StatsSegment *stats = server->stats;
+    int described = 0;
+    for (int i = 0; i < loops; i++)
+    {
+        const long long *snapshot = server->snapshots[i];
+        if (!consistent[i] || !snapshot[STATS_TIMESTAMPING])
+        {
+            continue;
+        }
+        if (!described)
+        {
+            emit(server, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+            described = 1;
+        }
+        const StatsListener *listener = &stats->listeners[stats->loops[i].listener];
+        long long cumulative = 0;
+        for (int bucket = 0; bucket < TIMESTAMP_BUCKETS - 1; bucket++)
+        {
+            cumulative += snapshot[first_bucket + bucket];
+            emit(server, "%s_bucket{loop=\"%d\",listener=\"%s:%d\",le=\"%.9g\"} %lld\n", name, i, listener->ip,
+                 listener->port, (128LL << bucket) / 1e9, cumulative);
+        }
+        cumulative += snapshot[first_bucket + TIMESTAMP_BUCKETS - 1];
+        emit(server, "%s_bucket{loop=\"%d\",listener=\"%s:%d\",le=\"+Inf\"} %lld\n", name, i, listener->ip,
+             listener->port, cumulative);
+        emit(server, "%s_sum{loop=\"%d\",listener=\"%s:%d\"} %.9f\n", name, i, listener->ip, listener->port,
+             snapshot[sum_counter] / 1e9);
+        emit(server, "%s_count{loop=\"%d\",listener=\"%s:%d\"} %lld\n", name, i, listener->ip, listener->port,
+             cumulative);
+    }
+}
+
+static void render_loops(MetricsServer *server)
+{
+    StatsSegment *stats = server->stats;
+    int loops = atomic_load_explicit(&stats->loop_count, memory_order_acquire);
+    int consistent[STATS_MAX_LOOPS];
+    for (int i = 0; i < loops; i++)
+    {
+        consistent[i] = stats_snapshot(stats, i, server->snapshots[i]) == 0;
+    }
+
+    for (size_t m = 0; m < sizeof(loop_metrics) / sizeof(loop_metrics[0]); m++)
+    {
+        const LoopMetric *metric = &loop_metrics[m];
+        emit(server, "# HELP %s %s\n# TYPE %s %s\n", metric->name, metric->help, metric->name, metric->type);
+        for (int i = 0; i < loops; i++)
+        {
+            if (!consistent[i])
+            {
+                continue; // Its loop kept writing: skip it this scrape rather than show a torn value
+            }
+            const StatsListener *listener = &stats->listeners[stats->loops[i].listener];
+            long long value = server->snapshots[i][metric->counter];
+            if (metric->scale > 0)
+            {
+                emit(server, "%s{loop=\"%d\",listener=\"%s:%d\"} %.9f\n", metric->name, i, listener->ip,
+                     listener->port, value * metric->scale);
+            }
+            else
+            {
+                emit(server, "%s{loop=\"%d\",listener=\"%s:%d\"} %lld\n", metric->name, i, listener->ip,
+                     listener->port, value);
+            }
+        }
+    }
+
+    // Syscalls by kind, and iterations by how many they made (syscalls.c)
+    emit(server, "# HELP socket_syscalls_total System calls made by the loop.\n# TYPE socket_syscalls_total counter\n");
+    for (int i = 0; i < loops; i++)
+    {
+        const StatsListener *listener = &stats->listeners[stats->loops[i].listener];
+        for (int kind = 0; consistent[i] && kind < SYSCALL_KINDS; kind++)
+        {
+            emit(server, "socket_syscalls_total{loop=\"%d\",listener=\"%s:%d\",kind=\"%s\"} %lld\n", i,
+                 listener->ip, listener->port, syscall_names[kind], server->snapshots[i][STATS_SYSCALLS + kind]);
+        }
+    }
+    const char *name = "socket_iteration_syscalls";
+    emit(server, "# HELP %s System calls per loop iteration.\n# TYPE %s histogram\n", name, name);
+    for (int i = 0; i < loops; i++)
+    {
+        if (!consistent[i])
+        {
+            continue;
+        }
+        const StatsListener *listener = &stats->listeners[stats->loops[i].listener];
+        const long long *snapshot = server->snapshots[i];
+        long long cumulative = 0;
+        long long sum = 0;
+        for (int bucket = 0; bucket < SYSCALL_BUCKETS - 1; bucket++)
+        {
+            cumulative += snapshot[STATS_ITERATION_SYSCALLS + bucket];
+            emit(server, "%s_bucket{loop=\"%d\",listener=\"%s:%d\",le=\"%lld\"} %lld\n", name, i, listener->ip,
+                 listener->port, (1LL << bucket) - 1, cumulative);
+        }
+        cumulative += snapshot[STATS_ITERATION_SYSCALLS + SYSCALL_BUCKETS - 1];
+        for (int kind = 0; kind < SYSCALL_KINDS; kind++)
+        {
+            sum += snapshot[STATS_SYSCALLS + kind]; // Every syscall the loop made fell in some iteration
+        }
+        emit(server, "%s_bucket{loop=\"%d\",listener=\"%s:%d\",le=\"+Inf\"} %lld\n", name, i, listener->ip,
+             listener->port, cumulative);
+        emit(server, "%s_sum{loop=\"%d\",listener=\"%s:%d\"} %lld\n", name, i, listener->ip, listener->port, sum);
+        emit(server, "%s_count{loop=\"%d\",listener=\"%s:%d\"} %lld\n", name, i, listener->ip, listener->port,
+             cumulative);
+    }
+
+    render_delays(server, loops, consistent, "socket_rx_delay_seconds",
+                  "From the kernel receiving the data to the recv() that returned it.", STATS_RX_DELAY_NS,
+                  STATS_RX_DELAY);
+    render_delays(server, loops, consistent, "socket_tx_delay_seconds",
+                  "From send() to the kernel handing the data to the driver.", STATS_TX_DELAY_NS, STATS_TX_DELAY);
+}
+
+/*
+ * Each serving thread's iteration times, from its heartbeat's log2
+ * histogram. The heartbeats are copied out under the watchdog's lock and
+ * rendered after it is released: rendering sends to the scraper, and a
+ * scraper that stops reading must not hold up the watchdog, or a thread
+ * registering its heartbeat, for as long as it likes.
+ */
+static void render_heartbeats(MetricsServer *server)
+{
+    int threads = 0;
+    pthread_mutex_lock(&watchdog->lock);
+    for (Heartbeat *heartbeat = watchdog->heartbeats; heartbeat && threads < METRICS_MAX_THREADS;
+         heartbeat = heartbeat->next)
+    {
+        if (atomic_load_explicit(&heartbeat->retired, memory_order_relaxed))
+        {
+            continue;
+        }
+        HeartbeatSnapshot *copy = &server->heartbeats[threads++];
+        memcpy(copy->name, heartbeat->name, sizeof(copy->name));
+        copy->total_ns = atomic_load_explicit(&heartbeat->total_ns, memory_order_relaxed);
+        for (int i = 0; i < HEARTBEAT_BUCKETS; i++)
+        {
+            copy->histogram[i] = atomic_load_explicit(&heartbeat->histogram[i], memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&watchdog->lock);
+
+    const char *name = "socket_iteration_seconds";
+    emit(server, "# HELP %s Time serving threads spent per iteration.\n# TYPE %s histogram\n", name, name);
+    for (int t = 0; t < threads; t++)
+    {
+        const HeartbeatSnapshot *heartbeat = &server->heartbeats[t];
+        long long cumulative = 0;
+        for (int i = 0; i < HEARTBEAT_BUCKETS - 1; i++)
+        {
+            cumulative += heartbeat->histogram[i];
+            emit(server, "%s_bucket{thread=\"%s\",le=\"%.9g\"} %lld\n", name, heartbeat->name, (2LL << i) / 1e6,
+                 cumulative);
+        }
+        // The last bucket also holds everything longer: it has no upper bound
+        cumulative += heartbeat->histogram[HEARTBEAT_BUCKETS - 1];
+        emit(server, "%s_bucket{thread=\"%s\",le=\"+Inf\"} %lld\n", name, heartbeat->name, cumulative);
+        emit(server, "%s_sum{thread=\"%s\"} %.9f\n", name, heartbeat->name, heartbeat->total_ns / 1e9);
+        emit(server, "%s_count{thread=\"%s\"} %lld\n", name, heartbeat->name, cumulative);
+    }
+}
+
+static void render_user(MetricsServer *server)
+{
+    int count = atomic_load_explicit(&server->count, memory_order_acquire);
+    for (int i = 0; i < count; i++)
+    {
+        Metric *metric = &server->metrics[i];
+        static const char *types[] = {"counter", "gauge", "histogram"};
+        emit(server, "# HELP %s %s\n# TYPE %s %s\n", metric->name, metric->help, metric->name, types[metric->type]);
+        if (metric->type != METRIC_HISTOGRAM)
+        {
+            emit(server, "%s %lld\n", metric->name, atomic_load_explicit(&metric->value, memory_order_relaxed));
+            continue;
+        }
+        long long cumulative = 0;
+        for (int b = 0; b < metric->bucket_count; b++)
+        {
+            cumulative += atomic_load_explicit(&metric->buckets[b], memory_order_relaxed);
+            emit(server, "%s_bucket{le=\"%.9g\"} %lld\n", metric->name, metric->bounds[b], cumulative);
+        }
+        cumulative += atomic_load_explicit(&metric->buckets[metric->bucket_count], memory_order_relaxed);
+        emit(server, "%s_bucket{le=\"+Inf\"} %lld\n", metric->name, cumulative);
+        emit(server, "%s_sum %.9g\n", metric->name, atomic_load(&metric->sum));
+        emit(server, "%s_count %lld\n", metric->name, cumulative);
+    }
+}
+
+/*
+ * Write the whole page to fd: a socket, or any file. Only one render may
+ * run at a time; the admin thread is normally the only caller. Bytes
+ * written, -1 if fd failed.
+ */
+int metrics_render(int fd)
+{
+    MetricsServer *server = metrics;
+    if (!server)
+    {
+        return -1;
+    }
+    server->client_fd = fd;
+    server->length = 0;
+    server->sent = 0;
+    server->scrapes++;
+
+    if (server->stats)
+    {
+        render_loops(server);
+    }
+    if (watchdog)
+    {
+        render_heartbeats(server);
+    }
+    render_user(server);
+    emit(server, "# HELP metrics_scrapes_total Scrapes of this endpoint.\n# TYPE metrics_scrapes_total counter\n");
+    emit(server, "metrics_scrapes_total %lld\n", server->scrapes);
+    metrics_flush(server);
+    return server->client_fd >= 0 ? (int)server->sent : -1;
+}
+
+static void *metrics_main(void *arg)
+{
+    MetricsServer *server = (MetricsServer *)arg;
+    int listener = server->server->server_socket.fd;
+    while (!atomic_load(&server->stopping))
+    {
+        // accept() directly rather than server_accept(): no Socket to allocate per scrape
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            continue; // EINTR, or shut down by metrics_stop()
+        }
+
+        // A scraper that connects and says nothing, or stops reading the page,
+        // must not hold up the next one
+        struct timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[1024];
+        ssize_t n = recv(fd, request, sizeof(request) - 1, 0);
+        request[n > 0 ? n : 0] = '\0';
+
+        if (strncmp(request, "GET /metrics", 12) == 0 || strncmp(request, "GET / ", 6) == 0)
+        {
+            static const char header[] = "HTTP/1.1 200 OK\r\n"
+                                         "Content-Type: text/plain; version=0.0.4\r\n"
+                                         "Connection: close\r\n\r\n";
+            if (send(fd, header, sizeof(header) - 1, MSG_NOSIGNAL) == (ssize_t)sizeof(header) - 1)
+            {
+                metrics_render(fd);
+            }
+        }
+        else
+        {
+            static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            send(fd, not_found, sizeof(not_found) - 1, MSG_NOSIGNAL);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+// Serve GET /metrics on ip:port from a thread of its own; 'stats' may be NULL
+int metrics_start(char *ip, int port, StatsSegment *stats)
+{
+    MetricsServer *server = (MetricsServer *)calloc(1, sizeof(MetricsServer));
+    if (!server)
+    {
+        perror("[METRICS] calloc failed");
+        return -1;
+    }
+    server->server = create_server_socket(ip, port, 16);
+    if (!server->server || server_bind(server->server) < 0 || server_listen(server->server) < 0)
+    {
+        server_free(server->server);
+        free(server);
+        return -1;
+    }
+    server->stats = stats;
+    atomic_init(&server->stopping, 0);
+    atomic_init(&server->count, 0);
+    pthread_mutex_init(&server->lock, NULL);
+    metrics = server;
+    if (pthread_create(&server->thread, NULL, metrics_main, server) != 0)
+    {
+        perror("[METRICS] pthread_create failed");
+        metrics = NULL;
+        pthread_mutex_destroy(&server->lock);
+        server_free(server->server);
+        free(server);
+        return -1;
+    }
+    return 0;
+}
+
+// Stop serving and free the endpoint; no thread may still update a metric
+void metrics_stop(void)
+{
+    MetricsServer *server = metrics;
+    if (!server)
+    {
+        return;
+    }
+    atomic_store(&server->stopping, 1);
+    shutdown(server->server->server_socket.fd, SHUT_RDWR); // Wakes the accept()
+    pthread_join(server->thread, NULL);
+    metrics = NULL;
+    server_free(server->server);
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+}
+
+static Metric *metrics_register(const char *name, const char *help, MetricType type, const double *bounds,
+                                int bucket_count)
+{
+    MetricsServer *server = metrics;
+    if (!server)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&server->lock);
+    int index = atomic_load(&server->count);
+    if (index == METRICS_MAX)
+    {
+        pthread_mutex_unlock(&server->lock);
+        fprintf(stderr, "[METRICS] More than %d metrics: %s is not exported\n", METRICS_MAX, name);
+        return NULL;
+    }
+    Metric *metric = &server->metrics[index];
+    snprintf(metric->name, sizeof(metric->name), "%s", name);
+    snprintf(metric->help, sizeof(metric->help), "%s", help);
+    metric->type = type;
+    metric->bucket_count = bucket_count;
+    if (bucket_count > 0)
+    {
+        memcpy(metric->bounds, bounds, bucket_count * sizeof(double));
+    }
+    // Counted only once filled in: the scrape thread may be rendering right now
+    atomic_store_explicit(&server->count, index + 1, memory_order_release);
+    pthread_mutex_unlock(&server->lock);
+    return metric;
+}
+
+// A counter on the page; NULL (ignored by metric_add()) when no endpoint runs
+Metric *metrics_counter(const char *name, const char *help)
+{
+    return metrics_register(name, help, METRIC_COUNTER, NULL, 0);
+}
+
+Metric *metrics_gauge(const char *name, const char *help)
+{
+    return metrics_register(name, help, METRIC_GAUGE, NULL, 0);
+}
+
+// A histogram with 'count' ascending upper bounds (+Inf is implicit)
+Metric *metrics_histogram(const char *name, const char *help, const double *bounds, int count)
+{
+    if (count > METRICS_MAX_BUCKETS)
+    {
+        fprintf(stderr, "[METRICS] %s: more than %d buckets\n", name, METRICS_MAX_BUCKETS);
+        return NULL;
+    }
+    return metrics_register(name, help, METRIC_HISTOGRAM, bounds, count);
+}
+
+// Count one observation into its bucket and the sum
+void metric_observe(Metric *metric, double value)
+{
+    if (!metric)
+    {
+        return;
+    }
+    int bucket = 0;
+    while (bucket < metric->bucket_count && value > metric->bounds[bucket])
+    {
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&metric->buckets[bucket], 1, memory_order_relaxed);
+    double sum = atomic_load_explicit(&metric->sum, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&metric->sum, &sum, sum + value, memory_order_relaxed,
+                                                  memory_order_relaxed))
+    {
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "socket.h"
+#include "stats.h"
+#include "watchdog.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define METRICS_MAX 64             // User-registered metrics
+#define METRICS_MAX_BUCKETS 16     // Histogram bounds, +Inf not included
+#define METRICS_BUFFER_SIZE 16384  // Rendered text is sent whenever this much is ready
+#define METRICS_MAX_THREADS 256    // Heartbeats copied per scrape; threads past this are left off the page
+
+typedef enum
+{
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM
+} MetricType;
+
+// One user metric. Updates are relaxed atomics: no lock on the serving path
+typedef struct
+{
+    char name[64];
+    char help[128];
+    MetricType type;
+    atomic_llong value;                            // Counter or gauge
+    int bucket_count;
+    double bounds[METRICS_MAX_BUCKETS];            // Upper bounds, ascending
+    atomic_llong buckets[METRICS_MAX_BUCKETS + 1]; // Per bucket (not cumulative); the last is +Inf
+    _Atomic double sum;
+} Metric;
+
+// A serving thread's iteration times, copied off its heartbeat under the watchdog's lock
+typedef struct
+{
+    char name[32];
+    long long total_ns;
+    long long histogram[HEARTBEAT_BUCKETS];
+} HeartbeatSnapshot;
+
+/*
+ * The admin endpoint: a ServerSocket of its own with one thread answering
+ * scrapes, the registered metrics, and where the loops' counters are.
+ */
+typedef struct
+{
+    ServerSocket *server;
+    StatsSegment *stats; // Per-loop counters (NULL = no event loops)
+    pthread_t thread;
+    atomic_int stopping;
+    pthread_mutex_t lock; // Guards registration only
+    Metric metrics[METRICS_MAX];
+    atomic_int count;
+
+    // Scrape state, reused by every scrape
+    int client_fd;
+    int length;     // Buffered, not sent yet
+    long long sent; // By this scrape so far
+    char buffer[METRICS_BUFFER_SIZE];
+    long long snapshots[STATS_MAX_LOOPS][STATS_COUNTERS];
+    HeartbeatSnapshot heartbeats[METRICS_MAX_THREADS];
+    long long scrapes;
+} MetricsServer;
+
+// The process's metrics endpoint, NULL until metrics_start()
+extern MetricsServer *metrics;
+
+/* Function prototypes for the metrics endpoint */
+int metrics_start(char *ip, int port, StatsSegment *stats);
+void metrics_stop(void);
+Metric *metrics_counter(const char *name, const char *help);
+Metric *metrics_gauge(const char *name, const char *help);
+Metric *metrics_histogram(const char *name, const char *help, const double *bounds, int count);
+int metrics_render(int fd);
+void metric_observe(Metric *metric, double value);
+
+// Count 'delta' more (metric may be NULL: no endpoint)
+static inline void metric_add(Metric *metric, long long delta)
+{
+    if (metric)
+    {
+        atomic_fetch_add_explicit(&metric->value, delta, memory_order_relaxed);
+    }
+}
+
+static inline void metric_set(Metric *metric, long long value)
+{
+    if (metric)
+    {
+        atomic_store_explicit(&metric->value, value, memory_order_relaxed);
+    }
+}
+
+#endif
@@ -0,0 +1,21 @@
+#define _GNU_SOURCE
+#include "probes.h"
+
+/*
+ * The probes' semaphores. A tracer finds each one through its probe's note
+ * and increments it while attached, decrements it when it detaches; the
+ * code only reads them. They live in the .probes section, where systemtap
+ * and bcc expect them. 'used' keeps one whose only reference is in a
+ * probe's asm: link-time optimization would drop it and break the link.
+ */
+
+#define PROBE_DEFINE(name) \
+    __attribute__((used, section(".probes"))) volatile unsigned short PROBE_SEMAPHORE(name) = 0
+
+PROBE_DEFINE(accept);
+PROBE_DEFINE(send);
+PROBE_DEFINE(receive);
+PROBE_DEFINE(close);
+PROBE_DEFINE(loop_wait);
+PROBE_DEFINE(loop_recv);
+PROBE_DEFINE(loop_send);
@@ -0,0 +1,97 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+#include "clock.h"
+
+/*
+ * USDT (user-level statically defined tracing) probes.
+ *
+ * Each PROBEn() site compiles to a single nop plus an entry in the ELF
+ * .note.stapsdt section naming the provider ("socket_discovery"), the probe
+ * and where its arguments live at the nop. bpftrace, perf, systemtap and bcc
+ * read the note and put a uprobe on the nop when asked to; until then the
+ * nop is all a probe costs:
+ *
+ *   bpftrace -e 'usdt:./build/socket_discovery:socket_discovery:receive
+ *                { @recv_ns = hist(arg2); }'
+ *   readelf -n build/socket_discovery          # lists every probe
+ *
+ * The note layout is the one <sys/sdt.h> emits; it is written out here so
+ * the build needs no systemtap headers. Every argument is passed as a signed
+ * 8-byte value ("-8@<operand>").
+ *
+ * Latency arguments need two clock reads, which are not free. Each probe
+ * therefore has a semaphore, a counter in the .probes section that the
+ * tracer increments while it is attached. PROBE_BEGIN() reads the clock only
+ * then, and returns 0 (a latency of 0) otherwise.
+ */
+
+#define PROBE_PROVIDER "socket_discovery"
+#define PROBE_SEMAPHORE(name) socket_discovery_##name##_semaphore
+
+#define PROBE_DECLARE(name) extern volatile unsigned short PROBE_SEMAPHORE(name)
+#define PROBE_ENABLED(name) __builtin_expect(PROBE_SEMAPHORE(name) != 0, 0)
+
+// Start of a timed probe: the time, or 0 while nothing is attached
+#define PROBE_BEGIN(name) (PROBE_ENABLED(name) ? clock_now_ns() : 0)
+// Nanoseconds since PROBE_BEGIN(), 0 if it returned 0
+#define PROBE_ELAPSED(begun) ((begun) ? clock_now_ns() - (begun) : 0)
+
+/* Probes, with their arguments */
+PROBE_DECLARE(accept);     // fd (-1: none), latency ns
+PROBE_DECLARE(send);       // fd, bytes (-1: error), latency ns
+PROBE_DECLARE(receive);    // fd, bytes (0: EOF, -1: error), latency ns
+PROBE_DECLARE(close);      // fd, result
+PROBE_DECLARE(loop_wait);  // epoll fd, ready events, latency ns
+PROBE_DECLARE(loop_recv);  // fd, bytes, latency ns
+PROBE_DECLARE(loop_send);  // fd, bytes, latency ns
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+#define PROBE_STR_(x) #x
+#define PROBE_STR(x) PROBE_STR_(x)
+
+/*
+ * The nop, the note describing it and, once per object file, the
+ * _.stapsdt.base symbol tracers use to detect prelinking.
+ */
+#define PROBE_ASM_(name, args)                                                                                         \
+    "990: nop\n"                                                                                                       \
+    ".pushsection .note.stapsdt,\"\",\"note\"\n"                                                                       \
+    ".balign 4\n"                                                                                                      \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                                                                 \
+    "991: .asciz \"stapsdt\"\n"                                                                                        \
+    "992: .balign 4\n"                                                                                                 \
+    "993: .8byte 990b\n"                                                                                               \
+    ".8byte _.stapsdt.base\n"                                                                                          \
+    ".8byte " PROBE_STR(PROBE_SEMAPHORE(name)) "\n"                                                                    \
+    ".asciz \"" PROBE_PROVIDER "\"\n"                                                                                  \
+    ".asciz \"" #name "\"\n"                                                                                           \
+    ".asciz \"" args "\"\n"                                                                                            \
+    "994: .balign 4\n"                                                                                                 \
+    ".popsection\n"                                                                                                    \
+    ".ifndef _.stapsdt.base\n"                                                                                         \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"                                            \
+    ".weak _.stapsdt.base\n"                                                                                           \
+    ".hidden _.stapsdt.base\n"                                                                                         \
+    "_.stapsdt.base: .space 1\n"                                                                                       \
+    ".size _.stapsdt.base, 1\n"                                                                                        \
+    ".popsection\n"                                                                                                    \
+    ".endif\n"
+
+#define PROBE2(name, x1, x2)                                                                                           \
+    __asm__ __volatile__(PROBE_ASM_(name, "-8@%[a1] -8@%[a2]")::[a1] "nor"((long long)(x1)),                            \
+                         [a2] "nor"((long long)(x2)))
+#define PROBE3(name, x1, x2, x3)                                                                                       \
+    __asm__ __volatile__(PROBE_ASM_(name, "-8@%[a1] -8@%[a2] -8@%[a3]")::[a1] "nor"((long long)(x1)),                   \
+                         [a2] "nor"((long long)(x2)), [a3] "nor"((long long)(x3)))
+
+#else
+
+// No note format for this architecture: probes compile to nothing
+#define PROBE2(name, x1, x2) ((void)(x1), (void)(x2))
+#define PROBE3(name, x1, x2, x3) ((void)(x1), (void)(x2), (void)(x3))
+
+#endif
+
+#endif
@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include "proxy.h"
+#include "clock.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+/*
+ * TCP (layer 4) load-balancing proxy.
+ *
+ * Every accepted client gets its own thread ("session"):
+ *
+ *   1) Pick a backend with the Balancer. The key is a hash of the client IP,
+ *      which only matters for the chash policy (sticky routing).
+ *   2) Take a warm upstream connection from that backend's pool, or connect()
+ *      a new one. A failed connect is reported to the balancer (passive health
+ *      check) and we pick again, at most once per backend.
+ *   3) Relay bytes in both directions with poll() until both sides are done.
+ *      When one side sends FIN we shutdown(SHUT_WR) the other, so
+ *      half-closed protocols keep working.
+ *   4) Release the backend and top the pool back up.
+ *
+ * Pooled connections are never reused after a session: the proxy does not
+ * understand the application protocol, so it cannot know whether an upstream
+ * connection is back in a clean state. What the pool saves is the connect()
+ * round trip (and the backend's accept()) on the request path.
+ */
+
+// An idle pooled connection is usable unless the backend already closed it.
+// The peek may legitimately find bytes (e.g. a greeting) - those are relayed later.
+static int upstream_alive(int fd)
+{
+    char byte;
+    int n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+static int pool_take(Proxy *proxy, int backend)
+{
+    UpstreamPool *pool = &proxy->pools[backend];
+    long long oldest_allowed = clock_now_ns() - proxy->pool_idle_ms * 1000000LL;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->count == 0)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return -1;
+        }
+        int fd = pool->fds[pool->head];
+        long long created = pool->created_ns[pool->head];
+        pool->head = (pool->head + 1) % PROXY_POOL_MAX;
+        pool->count--;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (created >= oldest_allowed && upstream_alive(fd))
+        {
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+static void pool_refill(Proxy *proxy, int backend)
+{
+    UpstreamPool *pool = &proxy->pools[backend];
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        int missing = proxy->pool_size - pool->count;
+        pthread_mutex_unlock(&pool->lock);
+        if (missing <= 0 || atomic_load(&proxy->stopping))
+        {
+            return;
+        }
+
+        int fd = socket_connect_timeout(&proxy->upstream_addr[backend], proxy->connect_timeout_ms);
+        balancer_report(proxy->lb, backend, fd >= 0);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->count < proxy->pool_size)
+        {
+            int tail = (pool->head + pool->count) % PROXY_POOL_MAX;
+            pool->fds[tail] = fd;
+            pool->created_ns[tail] = clock_now_ns();
+            pool->count++;
+            fd = -1;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        if (fd >= 0)
+        {
+            // Another session filled the pool first
+            close(fd);
+            return;
+        }
+    }
+}
+
+// Write all of len bytes, looping over partial sends
+static int send_all(int fd, const char *data, int len)
+{
+    while (len > 0)
+    {
+        int sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+// Shuttle bytes both ways until each direction has seen EOF (or an error)
+static void relay(int client_fd, int upstream_fd)
+{
+    char buffer[PROXY_RELAY_BUFFER_SIZE];
+    struct pollfd pfds[2] = {
+        {.fd = client_fd, .events = POLLIN},
+        {.fd = upstream_fd, .events = POLLIN},
+    };
+    int open_directions = 2;
+
+    while (open_directions > 0)
+    {
+        if (poll(pfds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+
+        for (int side = 0; side < 2; side++)
+        {
+            if (pfds[side].fd < 0 || !(pfds[side].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+
+            int from = side == 0 ? client_fd : upstream_fd;
+            int to = side == 0 ? upstream_fd : client_fd;
+            int n = recv(from, buffer, sizeof(buffer), 0);
+
+            if (n > 0 && send_all(to, buffer, n) == 0)
+            {
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            // EOF or error on 'from': pass the FIN on and stop polling that side
+            shutdown(to, SHUT_WR);
+            pfds[side].fd = -1;
+            open_directions--;
+            if (n < 0)
+            {
+                return;
+            }
+        }
+    }
+}
+
+typedef struct
+{
+    Proxy *proxy;
+    Socket *client;
+} Session;
+
+static void *session_main(void *arg)
+{
+    Session *session = (Session *)arg;
+    Proxy *proxy = session->proxy;
+    Socket *client = session->client;
+    free(session);
+
+    uint32_t key = balancer_hash(&client->address.sin_addr, sizeof(client->address.sin_addr));
+    int backend = -1;
+    int upstream_fd = -1;
+
+    for (int attempt = 0; attempt < proxy->lb->backend_count && upstream_fd < 0; attempt++)
+    {
+        backend = balancer_pick(proxy->lb, key);
+        if (backend < 0)
+        {
+            break;
+        }
+
+        upstream_fd = pool_take(proxy, backend);
+        if (upstream_fd < 0)
+        {
+            upstream_fd = socket_connect_timeout(&proxy->upstream_addr[backend], proxy->connect_timeout_ms);
+            balancer_report(proxy->lb, backend, upstream_fd >= 0);
+        }
+        if (upstream_fd < 0)
+        {
+            balancer_release(proxy->lb, backend);
+            backend = -1;
+        }
+    }
+
+    if (upstream_fd >= 0)
+    {
+        relay(client->fd, upstream_fd);
+        close(upstream_fd);
+        balancer_release(proxy->lb, backend);
+    }
+    else
+    {
+        fprintf(stderr, "[PROXY] No backend available for %s:%d\n", client->ip, client->port);
+    }
+
+    socket_close(client);
+    free(client);
+
+    if (backend >= 0)
+    {
+        pool_refill(proxy, backend);
+    }
+
+    atomic_fetch_sub(&proxy->active_sessions, 1);
+    return NULL;
+}
+
+Proxy *proxy_create(ServerSocket *listener, Balancer *lb, int pool_size)
+{
+    Proxy *proxy = (Proxy *)malloc(sizeof(Proxy));
+    if (!proxy)
+    {
+        perror("[PROXY] malloc failed");
+        return NULL;
+    }
+
+    memset(proxy, 0, sizeof(Proxy));
+    proxy->listener = listener;
+    proxy->lb = lb;
+    proxy->pool_size = pool_size < PROXY_POOL_MAX ? pool_size : PROXY_POOL_MAX;
+    proxy->pool_idle_ms = 30000;
+    proxy->connect_timeout_ms = 1000;
+    atomic_init(&proxy->active_sessions, 0);
+    atomic_init(&proxy->stopping, 0);
+
+    // Resolve every backend once; sessions then connect() straight to the sockaddr
+    for (int b = 0; b < lb->backend_count; b++)
+    {
+        ClientSocket *resolved = create_client_socket(lb->backends[b].host, lb->backends[b].port);
+        if (!resolved)
+        {
+            free(proxy);
+            return NULL;
+        }
+        proxy->upstream_addr[b] = resolved->server_addr;
+        client_free(resolved);
+        pthread_mutex_init(&proxy->pools[b].lock, NULL);
+    }
+
+    return proxy;
+}
+
+int proxy_run(Proxy *proxy)
+{
+    for (int b = 0; b < proxy->lb->backend_count; b++)
+    {
+        pool_refill(proxy, b);
+    }
+
+    while (!atomic_load(&proxy->stopping))
+    {
+        Socket *client = server_accept(proxy->listener);
+        if (!client)
+        {
+            continue;
+        }
+
+        Session *session = (Session *)malloc(sizeof(Session));
+        if (!session)
+        {
+            socket_close(client);
+            free(client);
+            continue;
+        }
+        session->proxy = proxy;
+        session->client = client;
+
+        atomic_fetch_add(&proxy->active_sessions, 1);
+
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, session_main, session) != 0)
+        {
+            perror("[PROXY] pthread_create failed");
+            atomic_fetch_sub(&proxy->active_sessions, 1);
+            socket_close(client);
+            free(client);
+            free(session);
+        }
+        pthread_attr_destroy(&attr);
+    }
+    return 0;
+}
+
+// Ask proxy_run() to return. server_stop() on the listener wakes a blocked accept().
+void proxy_stop(Proxy *proxy)
+{
+    atomic_store(&proxy->stopping, 1);
+    server_stop(proxy->listener);
+}
+
+void proxy_free(Proxy *proxy)
+{
+    if (!proxy)
+    {
+        return;
+    }
+
+    // Sessions hold a pointer to the proxy; let them finish first
+    while (atomic_load(&proxy->active_sessions) > 0)
+    {
+        struct timespec pause = {0, 1000000};
+        nanosleep(&pause, NULL);
+    }
+
+    for (int b = 0; b < proxy->lb->backend_count; b++)
+    {
+        UpstreamPool *pool = &proxy->pools[b];
+        for (int i = 0; i < pool->count; i++)
+        {
+            close(pool->fds[(pool->head + i) % PROXY_POOL_MAX]);
+        }
+        pthread_mutex_destroy(&pool->lock);
+    }
+    free(proxy);
+}
@@ -0,0 +1,41 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "socket.h"
+#include "balancer.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define PROXY_POOL_MAX 32
+#define PROXY_RELAY_BUFFER_SIZE 16384
+
+// Pre-connected, idle upstream connections for one backend (FIFO)
+typedef struct
+{
+    pthread_mutex_t lock;
+    int fds[PROXY_POOL_MAX];
+    long long created_ns[PROXY_POOL_MAX];
+    int head;  // Oldest idle connection
+    int count; // Idle connections currently pooled
+} UpstreamPool;
+
+typedef struct
+{
+    ServerSocket *listener;
+    Balancer *lb;
+    struct sockaddr_in upstream_addr[BALANCER_MAX_BACKENDS]; // Resolved once
+    UpstreamPool pools[BALANCER_MAX_BACKENDS];
+    int pool_size;          // Idle connections kept warm per backend
+    long pool_idle_ms;      // Pooled connections older than this are discarded
+    int connect_timeout_ms; // Upstream connect() deadline
+    atomic_int active_sessions;
+    atomic_int stopping;
+} Proxy;
+
+/* Function prototypes for the proxy */
+Proxy *proxy_create(ServerSocket *listener, Balancer *lb, int pool_size);
+int proxy_run(Proxy *proxy);
+void proxy_stop(Proxy *proxy);
+void proxy_free(Proxy *proxy);
+
+#endif
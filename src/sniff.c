@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include "sniff.h"
+#include "clock.h"
+#include "syscalls.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/*
+ * Several protocols on one listening port.
+ *
+ * Every supported protocol is client-speaks-first and can be recognised from
+ * its first few bytes:
+ *
+ *   HTTP/1.x  "GET ", "POST ", ...   HTTP/2 prior knowledge  "PRI * HTTP/2.0"
+ *   RESP      "*<digits>"  (a Redis command array)
+ *   binary    0xB5 <version>  (SNIFF_BINARY_MAGIC)
+ *
+ * protocol_router_serve() looks at those bytes with recv(MSG_PEEK): the kernel
+ * copies them out but leaves them in the socket receive queue, so the codec
+ * that gets the connection reads the stream from its very first byte, as if
+ * nobody had looked. No buffer is handed over and nothing is re-injected.
+ *
+ * Pair this with server_defer_accept() so accept() only returns connections
+ * that already have data: then the peek almost always succeeds at once. The
+ * router's timeout covers the rest - clients that stay silent (or talk a
+ * server-speaks-first protocol and wait for a greeting) and clients that send
+ * fewer bytes than a matcher needs.
+ */
+
+// SNIFF_MATCH if data starts with token, SNIFF_NEED_MORE if data is a prefix of it
+static SniffResult match_token(const unsigned char *data, int length, const char *token)
+{
+    int token_length = (int)strlen(token);
+    int compare = length < token_length ? length : token_length;
+    if (memcmp(data, token, compare) != 0)
+    {
+        return SNIFF_NO_MATCH;
+    }
+    return compare == token_length ? SNIFF_MATCH : SNIFF_NEED_MORE;
+}
+
+SniffResult sniff_match_http(const unsigned char *data, int length)
+{
+    static const char *methods[] = {"GET ", "POST ", "PUT ", "HEAD ", "DELETE ", "OPTIONS ",
+                                    "PATCH ", "CONNECT ", "TRACE ", "PRI * HTTP/2.0"};
+    SniffResult result = SNIFF_NO_MATCH;
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++)
+    {
+        SniffResult r = match_token(data, length, methods[i]);
+        if (r == SNIFF_MATCH)
+        {
+            return r;
+        }
+        if (r == SNIFF_NEED_MORE)
+        {
+            result = r;
+        }
+    }
+    return result;
+}
+
+SniffResult sniff_match_resp(const unsigned char *data, int length)
+{
+    if (data[0] != '*')
+    {
+        return SNIFF_NO_MATCH;
+    }
+    if (length < 2)
+    {
+        return SNIFF_NEED_MORE;
+    }
+    return data[1] >= '0' && data[1] <= '9' ? SNIFF_MATCH : SNIFF_NO_MATCH;
+}
+
+SniffResult sniff_match_binary(const unsigned char *data, int length)
+{
+    if (data[0] != SNIFF_BINARY_MAGIC)
+    {
+        return SNIFF_NO_MATCH;
+    }
+    if (length < 2)
+    {
+        return SNIFF_NEED_MORE;
+    }
+    return data[1] == SNIFF_BINARY_VERSION ? SNIFF_MATCH : SNIFF_NO_MATCH;
+}
+
+ProtocolRouter *protocol_router_create(int timeout_ms)
+{
+    ProtocolRouter *router = (ProtocolRouter *)malloc(sizeof(ProtocolRouter));
+    if (!router)
+    {
+        perror("[SNIFF] malloc failed");
+        return NULL;
+    }
+    memset(router, 0, sizeof(ProtocolRouter));
+    router->timeout_ms = timeout_ms;
+    return router;
+}
+
+int protocol_router_add(ProtocolRouter *router, const char *name, ProtocolMatcher match,
+                        ConnectionHandler handle, void *ctx)
+{
+    if (router->codec_count == SNIFF_MAX_CODECS)
+    {
+        return -1;
+    }
+    ProtocolCodec *codec = &router->codecs[router->codec_count++];
+    codec->name = name;
+    codec->match = match;
+    codec->handle = handle;
+    codec->ctx = ctx;
+    atomic_init(&codec->connections, 0);
+    return 0;
+}
+
+/*
+ * Wait until more than 'have' bytes are queued, or the deadline passes.
+ *
+ * Peeked bytes stay in the receive queue, so a plain poll() would report the
+ * socket readable straight away. SO_RCVLOWAT raises the "readable" threshold:
+ * poll() only returns once at least have+1 bytes are waiting.
+ */
+static int wait_for_bytes(int fd, int have, long long deadline)
+{
+    int low_water = have + 1;
+    syscall_count(SYSCALL_SETSOCKOPT);
+    setsockopt(fd, SOL_SOCKET, SO_RCVLOWAT, &low_water, sizeof(low_water));
+
+    int ready = 0;
+    for (;;)
+    {
+        long long remaining_ms = (deadline - clock_now_ns()) / 1000000LL;
+        if (remaining_ms <= 0)
+        {
+            break;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        syscall_count(SYSCALL_POLL);
+        ready = poll(&pfd, 1, (int)remaining_ms);
+        if (ready >= 0 || errno != EINTR)
+        {
+            break;
+        }
+    }
+
+    low_water = 1;
+    syscall_count(SYSCALL_SETSOCKOPT);
+    setsockopt(fd, SOL_SOCKET, SO_RCVLOWAT, &low_water, sizeof(low_water));
+    return ready;
+}
+
+// A ConnectionHandler: usable with the blocking loop or as a WorkerPool handler
+void protocol_router_serve(Socket *client, void *ctx)
+{
+    ProtocolRouter *router = (ProtocolRouter *)ctx;
+    long long deadline = clock_now_ns() + router->timeout_ms * 1000000LL;
+    unsigned char peek[SNIFF_PEEK_BYTES];
+    int length = 0;
+    int previous = 0;
+
+    for (;;)
+    {
+        // Under TCP_DEFER_ACCEPT the first peek normally finds data already queued
+        syscall_count(SYSCALL_RECV);
+        int n = (int)recv(client->fd, peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT);
+        if (n == 0)
+        {
+            return; // Closed before saying anything
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            return;
+        }
+        length = n > 0 ? n : 0;
+
+        int need_more = 0;
+        for (int i = 0; length > 0 && i < router->codec_count; i++)
+        {
+            ProtocolCodec *codec = &router->codecs[i];
+            SniffResult result = codec->match(peek, length);
+            if (result == SNIFF_MATCH)
+            {
+                if (socket_verbose)
+                {
+                    printf("[SNIFF] %s:%d speaks %s\n", client->ip, client->port, codec->name);
+                }
+                atomic_fetch_add_explicit(&codec->connections, 1, memory_order_relaxed);
+                codec->handle(client, codec->ctx);
+                return;
+            }
+            need_more |= result == SNIFF_NEED_MORE;
+        }
+
+        if (length > 0 && (!need_more || length == (int)sizeof(peek) || length == previous))
+        {
+            break; // Nothing can match, however much more arrives (or the peer stopped sending)
+        }
+        previous = length;
+        if (wait_for_bytes(client->fd, length, deadline) <= 0)
+        {
+            break; // Timed out (or the socket failed)
+        }
+    }
+
+    ConnectionHandler fallback = length > 0 ? router->on_unknown : router->on_silent;
+    void *fallback_ctx = length > 0 ? router->unknown_ctx : router->silent_ctx;
+    atomic_fetch_add_explicit(length > 0 ? &router->unknown : &router->silent, 1, memory_order_relaxed);
+    if (socket_verbose)
+    {
+        printf("[SNIFF] %s:%d %s\n", client->ip, client->port,
+               length > 0 ? "sent an unknown protocol" : "sent nothing before the timeout");
+    }
+    if (fallback)
+    {
+        fallback(client, fallback_ctx);
+    }
+}
+
+void protocol_router_free(ProtocolRouter *router)
+{
+    free(router);
+}
@@ -0,0 +1,63 @@
+#ifndef SNIFF_H
+#define SNIFF_H
+
+#include "socket.h"
+#include "dispatch.h"
+#include <stdatomic.h>
+
+#define SNIFF_PEEK_BYTES 16 // Enough to tell every supported protocol apart
+#define SNIFF_MAX_CODECS 8
+
+// Framed binary protocol: 0xB5, version, 16-bit big-endian payload length, payload
+#define SNIFF_BINARY_MAGIC 0xB5
+#define SNIFF_BINARY_VERSION 1
+#define SNIFF_BINARY_HEADER 4
+
+typedef enum
+{
+    SNIFF_NO_MATCH,
+    SNIFF_MATCH,
+    SNIFF_NEED_MORE, // Could still match once more bytes arrive
+} SniffResult;
+
+// Looks at the first bytes of a connection without consuming them
+typedef SniffResult (*ProtocolMatcher)(const unsigned char *data, int length);
+
+typedef struct
+{
+    const char *name;
+    ProtocolMatcher match;
+    ConnectionHandler handle; // Reads the connection from its very first byte
+    void *ctx;
+    atomic_llong connections;
+} ProtocolCodec;
+
+// Routes each connection to the first codec whose matcher accepts its opening bytes
+typedef struct
+{
+    ProtocolCodec codecs[SNIFF_MAX_CODECS];
+    int codec_count;
+    int timeout_ms; // How long to wait for enough bytes to decide
+
+    ConnectionHandler on_silent; // Client sent nothing in time (NULL = close)
+    void *silent_ctx;
+    ConnectionHandler on_unknown; // Bytes matched no codec (NULL = close)
+    void *unknown_ctx;
+
+    atomic_llong silent;
+    atomic_llong unknown;
+} ProtocolRouter;
+
+/* Function prototypes for protocol detection */
+ProtocolRouter *protocol_router_create(int timeout_ms);
+int protocol_router_add(ProtocolRouter *router, const char *name, ProtocolMatcher match,
+                        ConnectionHandler handle, void *ctx);
+void protocol_router_serve(Socket *client, void *router);
+void protocol_router_free(ProtocolRouter *router);
+
+// Matchers for the built-in protocols
+SniffResult sniff_match_http(const unsigned char *data, int length);
+SniffResult sniff_match_resp(const unsigned char *data, int length);
+SniffResult sniff_match_binary(const unsigned char *data, int length);
+
+#endif
@@ -1,10 +1,26 @@
+#define _GNU_SOURCE
 #include "socket.h"
+#include "iplimit.h"
+#include "acl.h"
+#include "clock.h"
+#include "trace.h"
+#include "probes.h"
+#include "syscalls.h"
+#include "binlog.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+
+// Trace output is on by default; see socket.h
+int socket_verbose = 1;
 
 ServerSocket *create_server_socket(char *ip, int port, int backlog)
 {
@@ -26,6 +42,7 @@ ServerSocket *create_server_socket(char *ip, int port, int backlog)
     // SOCK_STREAM: Socket type - TCP (reliable, ordered delivery)
     // 0: Protocol - use default protocol for AF_INET + SOCK_STREAM
     // Result is stored in server->server_socket.fd
+    syscall_count(SYSCALL_SOCKET);
     server->server_socket.fd = socket(AF_INET, SOCK_STREAM, 0);
 
     // Check if socket() failed (returns -1 on error)
@@ -42,6 +59,13 @@ ServerSocket *create_server_socket(char *ip, int port, int backlog)
     // Store the backlog (queue size for pending connections)
     server->backlog = backlog;
 
+    // No ACL or per-IP limits unless the caller installs them (acl.h, iplimit.h)
+    server->acl = NULL;
+    server->ip_limiter = NULL;
+    atomic_init(&server->stopping, 0);
+    server->server_socket.ip_limiter = NULL;
+    server->server_socket.ip_slot = IP_ADMIT_UNTRACKED;
+
     // Store the IP address in the server structure for later reference
     strcpy(server->server_socket.ip, ip);
 
@@ -73,7 +97,10 @@ ServerSocket *create_server_socket(char *ip, int port, int backlog)
 
     // Print success message showing the file descriptor number
     // File descriptors are usually: 0=stdin, 1=stdout, 2=stderr, 3+=our sockets
-    printf("[SERVER] Socket created successfully (fd: %d)\n", server->server_socket.fd);
+    if (socket_verbose)
+    {
+        printf("[SERVER] Socket created successfully (fd: %d)\n", server->server_socket.fd);
+    }
 
     // Return pointer to the initialized server structure
     return server;
@@ -81,7 +108,10 @@ ServerSocket *create_server_socket(char *ip, int port, int backlog)
 
 int server_bind(ServerSocket *server)
 {
-    printf("[SERVER] Binding socket to %s:%d...\n", server->server_socket.ip, server->server_socket.port);
+    if (socket_verbose)
+    {
+        printf("[SERVER] Binding socket to %s:%d...\n", server->server_socket.ip, server->server_socket.port);
+    }
 
     /*
      * bind() — what it really does (detailed)
@@ -153,7 +183,10 @@ int server_bind(ServerSocket *server)
         return -1;
     }
 
-    printf("[SERVER] Socket bound successfully\n");
+    if (socket_verbose)
+    {
+        printf("[SERVER] Socket bound successfully\n");
+    }
     return 0;
 }
 
@@ -212,25 +245,114 @@ int server_listen(ServerSocket *server)
         return -1;
     }
 
-    printf("[SERVER] Listening on %s:%d (backlog: %d)\n",
-           server->server_socket.ip,
-           server->server_socket.port,
-           server->backlog);
+    if (socket_verbose)
+    {
+        printf("[SERVER] Listening on %s:%d (backlog: %d)\n",
+               server->server_socket.ip,
+               server->server_socket.port,
+               server->backlog);
+    }
     return 0;
 }
 
-Socket *server_accept(ServerSocket *server)
+int server_reuse_port(ServerSocket *server)
 {
-    // Allocate memory for a new Socket structure to hold client info
-    Socket *client_socket = (Socket *)malloc(sizeof(Socket));
-    if (!client_socket)
+    /*
+     * SO_REUSEPORT — several listening sockets on the same address and port
+     *
+     * 1) Purpose
+     *    - Every socket that sets it before bind() may bind the same ip:port,
+     *      as long as all of them belong to the same user. Each gets its own
+     *      accept queue.
+     *    - The kernel spreads incoming connections over the group by a hash
+     *      of the 4-tuple (source/destination address and port), so each
+     *      thread can own a listener and accept without sharing anything.
+     *
+     * 2) The catch: the balancing is static
+     *    - A connection is assigned to a queue at SYN time, whether or not
+     *      that queue's thread is busy. A thread stuck on expensive requests
+     *      keeps getting its share while idle threads wait.
+     *    - Closing one of the sockets drops the connections still in its
+     *      queue.
+     *    - A shared listener watched with EPOLLEXCLUSIVE (event_loop.c) is the
+     *      dynamic alternative: whichever thread is waiting takes the next
+     *      connection.
+     */
+    int one = 1;
+    syscall_count(SYSCALL_SETSOCKOPT);
+    if (setsockopt(server->server_socket.fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
     {
-        perror("[SERVER] malloc failed");
-        return NULL;
+        perror("[SERVER] setsockopt(SO_REUSEPORT) failed");
+        return -1;
     }
+    return 0;
+}
 
-    // Prepare to accept incoming connection
-    socklen_t addr_len = sizeof(client_socket->address);
+int socket_set_nonblocking(Socket *socket)
+{
+    /*
+     * O_NONBLOCK — make calls on this fd return instead of sleeping
+     *
+     *   - accept() on an empty queue, recv() with nothing to read and send()
+     *     into a full buffer fail with EAGAIN/EWOULDBLOCK instead of blocking.
+     *   - An event loop needs this: it learns from epoll_wait() that an fd is
+     *     probably ready and then must never be put to sleep by one slow peer
+     *     while hundreds of other connections wait.
+     *   - The flag belongs to the open file description, so it affects every
+     *     copy of the fd (dup(), fork()).
+     */
+    syscall_count(SYSCALL_FCNTL);
+    int flags = fcntl(socket->fd, F_GETFL, 0);
+    syscall_count(SYSCALL_FCNTL);
+    if (flags < 0 || fcntl(socket->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        perror("[SOCKET] fcntl(O_NONBLOCK) failed");
+        return -1;
+    }
+    return 0;
+}
+
+int server_defer_accept(ServerSocket *server, int seconds)
+{
+    /*
+     * TCP_DEFER_ACCEPT — don't wake accept() until the client has sent data
+     *
+     * 1) Purpose
+     *    - Normally a connection enters the accept queue as soon as the
+     *      three-way handshake completes. With TCP_DEFER_ACCEPT the kernel
+     *      keeps it in the SYN queue until the first data segment arrives,
+     *      so accept() returns connections that already have bytes to read.
+     *    - Protocol detection (sniff.c) can then MSG_PEEK immediately instead
+     *      of parking a thread on a connection that hasn't said anything yet.
+     *
+     * 2) The timeout
+     *    - 'seconds' is how long the kernel waits for that data. It is turned
+     *      into a number of SYN-ACK retransmissions, so the real wait is
+     *      rounded up to the retransmission schedule (1s, 3s, 7s, ...).
+     *    - When it expires the connection is still delivered (on the client's
+     *      next ACK) with no data. Silent and server-speaks-first clients
+     *      therefore still arrive, just late; a read timeout must handle them.
+     *
+     * 3) Side effects
+     *    - Clients that send first never notice: their connect() completed
+     *      long ago from their point of view.
+     *    - Set it on the listening socket; accepted sockets don't need it.
+     */
+    syscall_count(SYSCALL_SETSOCKOPT);
+    if (setsockopt(server->server_socket.fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds)) < 0)
+    {
+        perror("[SERVER] setsockopt(TCP_DEFER_ACCEPT) failed");
+        return -1;
+    }
+    return 0;
+}
+
+Socket *server_accept(ServerSocket *server)
+{
+    // Accept into stack storage first: a connection the IP limiter rejects
+    // must not cost a heap allocation
+    struct sockaddr_in address;
+    socklen_t addr_len = sizeof(address);
 
     /*
      * accept() — what it really does (detailed)
@@ -263,16 +385,96 @@ Socket *server_accept(ServerSocket *server)
      *    - Ensure listen() was called successfully before accept().
      *
      */
-    client_socket->fd = accept(server->server_socket.fd,
-                               (struct sockaddr *)&client_socket->address,
-                               &addr_len);
+    long long traced = trace_begin();
+    long long probed = PROBE_BEGIN(accept);
+    int fd = accept(server->server_socket.fd, (struct sockaddr *)&address, &addr_len);
+    syscall_count(SYSCALL_ACCEPT);
+    trace_end("accept", traced, fd);
+    PROBE2(accept, fd, PROBE_ELAPSED(probed));
+
+    if (fd < 0)
+    {
+        // On a non-blocking listener EAGAIN just means the queue is empty, and
+        // after server_stop() the failure (EINVAL) is how a blocked accept() wakes up
+        if (errno != EAGAIN && errno != EWOULDBLOCK && !atomic_load(&server->stopping))
+        {
+            perror("[SERVER] accept failed");
+        }
+        return NULL;
+    }
+
+    /*
+     * Source-prefix allow/deny list (acl.c)
+     *
+     *   - Checked before the rate limiter so denied addresses can't use up
+     *     tokens or table slots, and before the Socket exists.
+     *   - A compressed-trie lookup: a few loads, no lock, however many rules.
+     */
+    if (server->acl && acl_check_v4(server->acl, address.sin_addr.s_addr) == ACL_DENY)
+    {
+        if (socket_verbose)
+        {
+            char ip[16];
+            inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+            printf("[SERVER] Rejected %s: denied by ACL\n", ip);
+        }
+        syscall_count(SYSCALL_CLOSE);
+        close(fd);
+        errno = ECONNREFUSED;
+        return NULL;
+    }
+
+    /*
+     * Per-source-IP admission (iplimit.c)
+     *
+     *   - The kernel has already completed the handshake, so the cheapest
+     *     possible rejection is close() right here: no Socket, no buffers,
+     *     nothing handed to a worker. The client sees a connection that is
+     *     closed immediately (FIN, or RST if it already sent data).
+     *   - The check is a few atomic operations on a fixed table; it takes no
+     *     lock and never allocates, so a flood cannot make it slower.
+     *   - Token refill needs the time, but not to the nanosecond: an event
+     *     loop accepting a burst of connections stamps them all with the
+     *     time of its iteration (clock_cached_ns(), clock.c) instead of
+     *     reading the clock once per connection.
+     */
+    int ip_slot = IP_ADMIT_UNTRACKED;
+    if (server->ip_limiter)
+    {
+        ip_slot = ip_limiter_admit(server->ip_limiter, address.sin_addr.s_addr, clock_cached_ns());
+        if (ip_slot < IP_ADMIT_UNTRACKED)
+        {
+            if (socket_verbose)
+            {
+                char ip[16];
+                inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+                printf("[SERVER] Rejected %s: %s\n", ip,
+                       ip_slot == IP_REJECT_RATE ? "connection rate limit" : "too many connections");
+            }
+            syscall_count(SYSCALL_CLOSE);
+            close(fd);
+            errno = ECONNREFUSED;
+            return NULL;
+        }
+    }
 
-    if (client_socket->fd < 0)
+    // Allocate memory for a new Socket structure to hold client info
+    Socket *client_socket = (Socket *)malloc(sizeof(Socket));
+    if (!client_socket)
     {
-        perror("[SERVER] accept failed");
-        free(client_socket);
+        perror("[SERVER] malloc failed");
+        if (server->ip_limiter)
+        {
+            ip_limiter_release(server->ip_limiter, ip_slot, address.sin_addr.s_addr);
+        }
+        syscall_count(SYSCALL_CLOSE);
+        close(fd);
         return NULL;
     }
+    client_socket->fd = fd;
+    client_socket->address = address;
+    client_socket->ip_limiter = server->ip_limiter;
+    client_socket->ip_slot = ip_slot;
 
     // Convert network byte order to host byte order for the port number
     // ntohs(): "network to host short" (short = 16-bit number like port)
@@ -320,12 +522,174 @@ Socket *server_accept(ServerSocket *server)
     inet_ntop(AF_INET, &client_socket->address.sin_addr,
               client_socket->ip, sizeof(client_socket->ip));
 
-    printf("[SERVER] Accepted connection from %s:%d (fd: %d)\n",
-           client_socket->ip, client_socket->port, client_socket->fd);
+    VERBOSE_LOG("[SERVER] Accepted connection from %s:%d (fd: %d)\n",
+                client_socket->ip, client_socket->port, client_socket->fd);
 
     return client_socket;
 }
 
+ClientSocket *create_client_socket(const char *host, int port)
+{
+    ClientSocket *client = (ClientSocket *)malloc(sizeof(ClientSocket));
+    if (!client)
+    {
+        perror("[CLIENT] malloc failed");
+        return NULL;
+    }
+
+    /*
+     * getaddrinfo() — resolve a hostname (or dotted IP) to a binary address
+     *
+     * Purpose:
+     *   - Turns "localhost", "example.com" or "127.0.0.1" into a sockaddr_in
+     *     we can hand to connect(). It replaces the older gethostbyname(),
+     *     which is not thread-safe (it returns a pointer to static storage).
+     *
+     * Arguments used here:
+     *   - hints.ai_family = AF_INET: only IPv4 results (Socket stores sockaddr_in).
+     *   - hints.ai_socktype = SOCK_STREAM: only TCP results.
+     *
+     * Return value:
+     *   - 0 on success and a linked list in 'res' that must be released with
+     *     freeaddrinfo(). A non-zero EAI_* code on failure (use gai_strerror()).
+     */
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int gai_result = getaddrinfo(host, NULL, &hints, &res);
+    if (gai_result != 0 || !res)
+    {
+        fprintf(stderr, "[CLIENT] Could not resolve %s: %s\n", host, gai_strerror(gai_result));
+        free(client);
+        return NULL;
+    }
+
+    memset(&client->server_addr, 0, sizeof(client->server_addr));
+    memcpy(&client->server_addr, res->ai_addr, sizeof(client->server_addr));
+    client->server_addr.sin_port = htons(port);
+    freeaddrinfo(res);
+
+    // Same socket() call as the server side: an IPv4 TCP endpoint
+    syscall_count(SYSCALL_SOCKET);
+    client->client_socket.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (client->client_socket.fd < 0)
+    {
+        perror("[CLIENT] socket creation failed");
+        free(client);
+        return NULL;
+    }
+
+    // The Socket part describes the peer we talk to, like an accepted Socket does
+    client->client_socket.address = client->server_addr;
+    client->client_socket.port = port;
+    client->client_socket.ip_limiter = NULL;
+    client->client_socket.ip_slot = IP_ADMIT_UNTRACKED;
+    inet_ntop(AF_INET, &client->server_addr.sin_addr,
+              client->client_socket.ip, sizeof(client->client_socket.ip));
+
+    return client;
+}
+
+int client_connect(ClientSocket *client)
+{
+    if (socket_verbose)
+    {
+        printf("[CLIENT] Connecting to %s:%d...\n", client->client_socket.ip, client->client_socket.port);
+    }
+
+    /*
+     * connect() — actively open a TCP connection
+     *
+     * 1) Purpose
+     *    - connect(fd, addr, addrlen) asks the kernel to start the TCP 3-way
+     *      handshake with the remote address (SYN -> SYN-ACK -> ACK).
+     *    - The kernel picks an ephemeral local port automatically (no bind() needed).
+     *
+     * 2) Blocking behavior
+     *    - On a blocking socket, connect() returns once the handshake completes
+     *      (or fails). On loopback that is a few microseconds; over a WAN it is
+     *      at least one round trip.
+     *
+     * 3) Common errors & causes
+     *    - ECONNREFUSED: Nothing is listening on that port (RST received).
+     *    - ETIMEDOUT: SYNs were never answered (host down, firewall).
+     *    - ENETUNREACH: No route to the destination network.
+     */
+    syscall_count(SYSCALL_CONNECT);
+    int connect_result = connect(client->client_socket.fd,
+                                 (struct sockaddr *)&client->server_addr,
+                                 sizeof(client->server_addr));
+    if (connect_result < 0)
+    {
+        if (socket_verbose)
+        {
+            perror("[CLIENT] connect failed");
+        }
+        return -1;
+    }
+
+    if (socket_verbose)
+    {
+        printf("[CLIENT] Connected successfully!\n");
+    }
+    return 0;
+}
+
+int socket_connect_timeout(const struct sockaddr_in *addr, int timeout_ms)
+{
+    syscall_count(SYSCALL_SOCKET);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    /*
+     * A blocking connect() to an unresponsive host waits for the kernel's own
+     * SYN retry schedule (over a minute on Linux). To bound it we:
+     *   1) switch the socket to O_NONBLOCK, so connect() returns EINPROGRESS
+     *      right after sending the SYN,
+     *   2) poll() for POLLOUT, which fires when the handshake completes or fails,
+     *   3) read the outcome with getsockopt(SO_ERROR),
+     *   4) restore blocking mode so the caller gets an ordinary socket.
+     */
+    syscall_count(SYSCALL_FCNTL);
+    int flags = fcntl(fd, F_GETFL, 0);
+    syscall_count(SYSCALL_FCNTL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    syscall_count(SYSCALL_CONNECT);
+    int result = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+    if (result < 0 && errno == EINPROGRESS)
+    {
+        struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+        syscall_count(SYSCALL_POLL);
+        result = poll(&pfd, 1, timeout_ms) == 1 ? 0 : -1;
+        if (result == 0)
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            syscall_count(SYSCALL_GETSOCKOPT);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            result = err == 0 ? 0 : -1;
+        }
+    }
+
+    if (result < 0)
+    {
+        syscall_count(SYSCALL_CLOSE);
+        close(fd);
+        return -1;
+    }
+
+    syscall_count(SYSCALL_FCNTL);
+    fcntl(fd, F_SETFL, flags);
+    return fd;
+}
+
 int socket_send(Socket *socket, const char *data)
 {
 
@@ -340,7 +704,10 @@ int socket_send(Socket *socket, const char *data)
      *   1) socket->fd: The file descriptor of the socket (from accept()).
      *   2) data: Pointer to the buffer containing data to send.
      *   3) strlen(data): Length of the data in bytes (assumes null-terminated string).
-     *   4) 0: Flags (0 = no special behavior).
+     *   4) MSG_NOSIGNAL: If the peer already closed, fail with EPIPE instead of
+     *      raising SIGPIPE (whose default action kills the whole process). A client
+     *      that gives up early - e.g. a hedged request whose other copy won - must
+     *      not be able to take the server down.
      *
      * What happens at the kernel level when send() is called:
      *
@@ -408,7 +775,12 @@ int socket_send(Socket *socket, const char *data)
      *    - Packet sniffers (tcpdump, Wireshark) show the actual bytes on the wire.
      *    - Use SO_SNDBUF socket option to tune the send buffer size.
      */
-    int bytes_sent = send(socket->fd, data, strlen(data), 0);
+    long long traced = trace_begin();
+    long long probed = PROBE_BEGIN(send);
+    int bytes_sent = send(socket->fd, data, strlen(data), MSG_NOSIGNAL);
+    syscall_count(SYSCALL_SEND);
+    trace_end("send", traced, bytes_sent);
+    PROBE3(send, socket->fd, bytes_sent, PROBE_ELAPSED(probed));
 
     if (bytes_sent < 0)
     {
@@ -416,7 +788,7 @@ int socket_send(Socket *socket, const char *data)
         return -1;
     }
 
-    printf("[SEND] Sent %d bytes: %s\n", bytes_sent, data);
+    VERBOSE_LOG("[SEND] Sent %d bytes: %s\n", bytes_sent, data);
     return bytes_sent;
 }
 
@@ -503,7 +875,12 @@ int socket_receive(Socket *socket, char *buffer, int buffer_size)
      *    - Add recv() in a loop to handle partial reads properly.
      *    - Use MSG_DONTWAIT flag for non-blocking recv() if needed.
      */
+    long long traced = trace_begin();
+    long long probed = PROBE_BEGIN(receive);
     int bytes_received = recv(socket->fd, buffer, buffer_size - 1, 0);
+    syscall_count(SYSCALL_RECV);
+    trace_end("recv", traced, bytes_received);
+    PROBE3(receive, socket->fd, bytes_received, PROBE_ELAPSED(probed));
 
     if (bytes_received < 0)
     {
@@ -514,7 +891,7 @@ int socket_receive(Socket *socket, char *buffer, int buffer_size)
     // Null-terminate the received data (make it a valid C string)
     buffer[bytes_received] = '\0';
 
-    printf("[RECEIVE] Received %d bytes: %s\n", bytes_received, buffer);
+    VERBOSE_LOG("[RECEIVE] Received %d bytes: %s\n", bytes_received, buffer);
     return bytes_received;
 }
 
@@ -522,7 +899,7 @@ int socket_close(Socket *socket)
 {
     if (socket && socket->fd >= 0)
     {
-        printf("[CLOSE] Closing socket (fd: %d)\n", socket->fd);
+        VERBOSE_LOG("[CLOSE] Closing socket (fd: %d)\n", socket->fd);
 
         /*
          * close() - Close a socket (detailed kernel-level explanation)
@@ -563,16 +940,41 @@ int socket_close(Socket *socket)
          *
          */
         int close_result = close(socket->fd);
+        syscall_count(SYSCALL_CLOSE);
+        PROBE2(close, socket->fd, close_result);
         if (close_result < 0)
         {
             perror("close failed");
             return -1;
         }
         socket->fd = -1;
+
+        // Give the connection back to its source IP's concurrent-connection cap
+        if (socket->ip_limiter)
+        {
+            ip_limiter_release(socket->ip_limiter, socket->ip_slot, socket->address.sin_addr.s_addr);
+            socket->ip_limiter = NULL;
+        }
     }
     return 0;
 }
 
+/*
+ * Make the threads blocked in server_accept() on this listener return.
+ *
+ * shutdown(SHUT_RDWR) on a listening socket takes it out of the LISTEN
+ * state: the pending connections are reset and every accept() waiting on
+ * it, now and later, fails with EINVAL. Unlike close(), the fd stays valid,
+ * so a thread about to call accept() cannot end up on a reused descriptor.
+ * The stopping flag tells server_accept() that this failure is the expected
+ * one, not worth an error message.
+ */
+void server_stop(ServerSocket *server)
+{
+    atomic_store(&server->stopping, 1);
+    shutdown(server->server_socket.fd, SHUT_RDWR);
+}
+
 void server_free(ServerSocket *server)
 {
     if (server)
@@ -592,4 +994,13 @@ void server_free(ServerSocket *server)
          */
         free(server);
     }
+}
+
+void client_free(ClientSocket *client)
+{
+    if (client)
+    {
+        socket_close(&client->client_socket);
+        free(client);
+    }
 }
\ No newline at end of file
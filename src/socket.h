@@ -2,8 +2,16 @@
 #define SOCKET_H
 
 #include <netinet/in.h>
+#include <stdatomic.h>
 
-int SOCKET_BUFFER_SIZE = 1024;
+#define SOCKET_BUFFER_SIZE 1024
+
+// Set to 0 to silence the per-call [SERVER]/[SEND]/[RECEIVE] trace output
+// (benchmarks and the proxy hot path do this).
+extern int socket_verbose;
+
+struct IpLimiter; // iplimit.h: optional per-source-IP admission control
+struct Acl;       // acl.h: optional allow/deny list by source prefix
 
 typedef struct
 {
@@ -11,19 +19,39 @@ typedef struct
     struct sockaddr_in address; // Socket address structure
     int port;                   // Port number
     char ip[16];                // IP address (e.g., "127.0.0.1")
+    struct IpLimiter *ip_limiter; // Limiter that admitted this connection (NULL if none)
+    int ip_slot;                  // Its slot there, released by socket_close()
 } Socket;
 
 typedef struct
 {
     Socket server_socket;
-    int backlog; // Queue length for pending connections
+    int backlog;                  // Queue length for pending connections
+    struct Acl *acl;              // Checked by server_accept() first (NULL = allow all)
+    struct IpLimiter *ip_limiter; // Checked by server_accept() before allocating (NULL = off)
+    atomic_int stopping;          // Set by server_stop(): accept() failing is expected from then on
 } ServerSocket;
 
+typedef struct
+{
+    Socket client_socket;           // Local end of the connection
+    struct sockaddr_in server_addr; // Remote address we connect to
+} ClientSocket;
+
 /* Function prototypes for the socket wrapper library */
 ServerSocket *create_server_socket(char *ip, int port, int backlog);
 int server_bind(ServerSocket *server);
 int server_listen(ServerSocket *server);
+int server_defer_accept(ServerSocket *server, int seconds);
+int server_reuse_port(ServerSocket *server);
+int socket_set_nonblocking(Socket *socket);
 Socket *server_accept(ServerSocket *server);
+void server_stop(ServerSocket *server);
+
+// Client functions
+ClientSocket *create_client_socket(const char *host, int port);
+int client_connect(ClientSocket *client);
+int socket_connect_timeout(const struct sockaddr_in *addr, int timeout_ms);
 
 // Send/Receive functions
 int socket_send(Socket *socket, const char *data);
@@ -31,6 +59,7 @@ int socket_receive(Socket *socket, char *buffer, int buffer_size);
 
 // Cleanup functions
 void server_free(ServerSocket *server);
+void client_free(ClientSocket *client);
 int socket_close(Socket *socket);
 
 #endif
\ No newline at end of file
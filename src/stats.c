@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include "stats.h"
+#include "event_loop.h"
+#include "clock.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Counters of a running server, readable by another process.
+ *
+ * Each event loop copies its counters into its own slot of a POSIX shared
+ * memory segment at the end of every iteration. `socket_discovery top`
+ * maps the same segment and reads the slots: no request to the server, no
+ * system call on either side, and the server's stdout stays free.
+ *
+ * A slot is guarded by a seqlock. The loop makes seq odd, stores the
+ * counters and makes it even again; stores only, ~20 of them, in a cache
+ * line no other thread writes. The reader reads seq, copies, reads seq
+ * again and retries if it was odd or moved: it never blocks the writer,
+ * and a snapshot is always one iteration's consistent set of counters.
+ */
+
+// The shm_open() name of a server's segment
+static void stats_name(int pid, char *name, int size)
+{
+    snprintf(name, size, "/socket_discovery.%d", pid);
+}
+
+// A zeroed segment for this process, /dev/shm/socket_discovery.<pid>
+StatsSegment *stats_create(void)
+{
+    char name[64];
+    stats_name((int)getpid(), name, sizeof(name));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("[STATS] shm_open failed");
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(StatsSegment)) < 0)
+    {
+        perror("[STATS] ftruncate failed");
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    StatsSegment *stats = mmap(NULL, sizeof(StatsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the segment
+    if (stats == MAP_FAILED)
+    {
+        perror("[STATS] mmap failed");
+        shm_unlink(name);
+        return NULL;
+    }
+    stats->magic = STATS_MAGIC;
+    stats->version = STATS_VERSION;
+    stats->size = sizeof(StatsSegment);
+    stats->counter_count = STATS_COUNTERS;
+    stats->pid = (int32_t)getpid();
+    stats->started_ns = clock_now_ns();
+    return stats;
+}
+
+/*
+ * Give a loop the next slot, and its listener an entry if it has none yet.
+ * Call from one thread, before the loop runs.
+ */
+int stats_attach_loop(StatsSegment *stats, EventLoop *loop)
+{
+    int index = atomic_load(&stats->loop_count);
+    if (index >= STATS_MAX_LOOPS)
+    {
+        fprintf(stderr, "[STATS] More than %d loops: loop %d is not published\n", STATS_MAX_LOOPS, index);
+        return -1;
+    }
+
+    Socket *listener = &loop->server->server_socket;
+    int entry = 0;
+    while (entry < stats->listener_count && stats->listeners[entry].fd != listener->fd)
+    {
+        entry++;
+    }
+    if (entry == stats->listener_count)
+    {
+        if (entry == STATS_MAX_LISTENERS)
+        {
+            fprintf(stderr, "[STATS] More than %d listeners\n", STATS_MAX_LISTENERS);
+            return -1;
+        }
+        stats->listeners[entry].fd = listener->fd;
+        stats->listeners[entry].port = listener->port;
+        snprintf(stats->listeners[entry].ip, sizeof(stats->listeners[entry].ip), "%s", listener->ip);
+        stats->listener_count++;
+    }
+
+    StatsLoopSlot *slot = &stats->loops[index];
+    slot->listener = entry;
+    loop->stats = slot;
+    stats_publish(loop);
+    atomic_store_explicit(&stats->loop_count, index + 1, memory_order_release);
+    return index;
+}
+
+// Copy the loop's counters into its slot; only the loop's own thread calls this
+void stats_publish(EventLoop *loop)
+{
+    StatsLoopSlot *slot = loop->stats;
+    long long values[STATS_COUNTERS] = {
+        [STATS_PUBLISHED_NS] = clock_cached_ns(),
+        [STATS_ITERATIONS] = loop->iterations,
+        [STATS_CONNECTIONS] = loop->connection_count,
+        [STATS_ACCEPTED] = loop->accepted,
+        [STATS_CLOSED] = loop->disconnects,
+        [STATS_BYTES_IN] = loop->bytes_in,
+        [STATS_BYTES_OUT] = loop->bytes_out,
+        [STATS_RECV_CALLS] = loop->recv_calls,
+        [STATS_SEND_CALLS] = loop->send_calls,
+        [STATS_CTL_CALLS] = loop->ctl_calls,
+        [STATS_WAIT_NS] = loop->wait_ns,
+        [STATS_OVER_BUDGET] = loop->over_budget,
+        [STATS_MIGRATED_IN] = loop->migrated_in,
+        [STATS_MIGRATED_OUT] = loop->migrated_out,
+        [STATS_REQUESTS] = loop->requests,
+    };
+    memcpy(&values[STATS_SYSCALLS], loop->syscalls.calls, sizeof(loop->syscalls.calls));
+    memcpy(&values[STATS_ITERATION_SYSCALLS], loop->iteration_syscalls, sizeof(loop->iteration_syscalls));
+    if (loop->timestamps)
+    {
+        values[STATS_TIMESTAMPING] = 1;
+        values[STATS_RX_DELAY_NS] = loop->timestamps->rx.sum_ns;
+        memcpy(&values[STATS_RX_DELAY], loop->timestamps->rx.buckets, sizeof(loop->timestamps->rx.buckets));
+        values[STATS_TX_DELAY_NS] = loop->timestamps->tx.sum_ns;
+        memcpy(&values[STATS_TX_DELAY], loop->timestamps->tx.buckets, sizeof(loop->timestamps->tx.buckets));
+    }
+
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); // The odd seq is visible before any counter changes
+    for (int i = 0; i < STATS_COUNTERS; i++)
+    {
+        atomic_store_explicit(&slot->counters[i], values[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+// Unmap the segment and remove its name
+void stats_free(StatsSegment *stats)
+{
+    if (!stats)
+    {
+        return;
+    }
+    char name[64];
+    stats_name(stats->pid, name, sizeof(name));
+    munmap(stats, sizeof(StatsSegment));
+    shm_unlink(name);
+}
+
+// Map the segment of server 'pid' read-only; NULL if there is none or it is not one we can read
+StatsSegment *stats_open(int pid)
+{
+    char name[64];
+    stats_name(pid, name, sizeof(name));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "[STATS] No stats segment for pid %d (start the server with --stats)\n", pid);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(StatsSegment))
+    {
+        fprintf(stderr, "[STATS] /dev/shm%s is too small\n", name);
+        close(fd);
+        return NULL;
+    }
+    StatsSegment *stats = mmap(NULL, sizeof(StatsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats == MAP_FAILED)
+    {
+        perror("[STATS] mmap failed");
+        return NULL;
+    }
+    if (stats->magic != STATS_MAGIC || stats->version != STATS_VERSION || stats->size < sizeof(StatsSegment))
+    {
+        fprintf(stderr, "[STATS] /dev/shm%s: unknown format (version %u, expected %d)\n", name, stats->version,
+                STATS_VERSION);
+        munmap(stats, sizeof(StatsSegment));
+        return NULL;
+    }
+    return stats;
+}
+
+// One consistent copy of loop 'index''s counters; -1 if its loop kept writing
+int stats_snapshot(const StatsSegment *stats, int index, long long *counters)
+{
+    const StatsLoopSlot *slot = &stats->loops[index];
+    for (int attempt = 0; attempt < 1000; attempt++)
+    {
+        unsigned before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (before & 1)
+        {
+            if (attempt >= 16)
+            {
+                sched_yield(); // The writer may be preempted mid-write: let it finish
+            }
+            continue;
+        }
+        for (int i = 0; i < STATS_COUNTERS; i++)
+        {
+            counters[i] = atomic_load_explicit(&slot->counters[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire); // The copies complete before seq is read again
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == before)
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Remove the segment a server that is gone left behind
+void stats_remove(int pid)
+{
+    char name[64];
+    stats_name(pid, name, sizeof(name));
+    shm_unlink(name);
+}
+
+void stats_close(StatsSegment *stats)
+{
+    if (stats)
+    {
+        munmap(stats, sizeof(StatsSegment));
+    }
+}
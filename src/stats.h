@@ -0,0 +1,95 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "syscalls.h"
+#include "timestamping.h"
+
+typedef struct EventLoop EventLoop;
+
+#define STATS_MAGIC 0x53544154u // "STAT"
+#define STATS_VERSION 4
+#define STATS_MAX_LOOPS 64
+#define STATS_MAX_LISTENERS 64
+
+// What each loop publishes; index into StatsLoopSlot.counters
+typedef enum
+{
+    STATS_PUBLISHED_NS, // CLOCK_MONOTONIC of the snapshot: rates are deltas over this
+    STATS_ITERATIONS,
+    STATS_CONNECTIONS,  // Open now (a gauge)
+    STATS_ACCEPTED,
+    STATS_CLOSED,
+    STATS_BYTES_IN,
+    STATS_BYTES_OUT,
+    STATS_RECV_CALLS,
+    STATS_SEND_CALLS,
+    STATS_CTL_CALLS,
+    STATS_WAIT_NS,      // Time spent in epoll_wait(): the rest of the wall time is busy
+    STATS_OVER_BUDGET,
+    STATS_MIGRATED_IN,
+    STATS_MIGRATED_OUT,
+    STATS_REQUESTS,                                            // on_data calls
+    STATS_SYSCALLS,                                            // SYSCALL_KINDS counters, by SyscallKind
+    STATS_ITERATION_SYSCALLS = STATS_SYSCALLS + SYSCALL_KINDS, // SYSCALL_BUCKETS counters, by syscall_bucket()
+    STATS_TIMESTAMPING = STATS_ITERATION_SYSCALLS + SYSCALL_BUCKETS, // 1 if it stamps its connections
+    STATS_RX_DELAY_NS,                                         // Sum of the RX delays, then ...
+    STATS_RX_DELAY,                                            // ... TIMESTAMP_BUCKETS counters, by delay_bucket()
+    STATS_TX_DELAY_NS = STATS_RX_DELAY + TIMESTAMP_BUCKETS,    // The same for the TX delays
+    STATS_TX_DELAY,
+    STATS_COUNTERS = STATS_TX_DELAY + TIMESTAMP_BUCKETS
+} StatsCounter;
+
+/*
+ * One loop's counters behind a seqlock: seq is odd while its loop writes
+ * them. Only that loop writes; a reader copies the counters and retries if
+ * seq was odd or changed meanwhile. A slot fills a whole number of cache
+ * lines, so two loops never write the same line.
+ */
+typedef struct StatsLoopSlot
+{
+    _Alignas(64) atomic_uint seq;
+    int listener; // Index into StatsSegment.listeners
+    atomic_llong counters[STATS_COUNTERS];
+} StatsLoopSlot;
+
+// A listening socket: written once, before its loops start
+typedef struct
+{
+    int fd;
+    int port;
+    char ip[16];
+} StatsListener;
+
+/*
+ * The shared-memory segment: /dev/shm/socket_discovery.<pid>. A reader
+ * checks magic and version before anything else; any change to this layout
+ * or to the counters bumps STATS_VERSION.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;          // Of the whole segment
+    uint32_t counter_count; // STATS_COUNTERS of the writer
+    int32_t pid;
+    int32_t listener_count;
+    atomic_int loop_count;  // Slots in use; a slot is filled in before it is counted
+    int32_t reserved;
+    int64_t started_ns;     // CLOCK_MONOTONIC when the server started publishing
+    StatsListener listeners[STATS_MAX_LISTENERS];
+    StatsLoopSlot loops[STATS_MAX_LOOPS];
+} StatsSegment;
+
+/* Function prototypes for the stats segment */
+StatsSegment *stats_create(void);
+int stats_attach_loop(StatsSegment *stats, EventLoop *loop);
+void stats_publish(EventLoop *loop);
+void stats_free(StatsSegment *stats);
+StatsSegment *stats_open(int pid);
+int stats_snapshot(const StatsSegment *stats, int index, long long *counters);
+void stats_close(StatsSegment *stats);
+void stats_remove(int pid);
+
+#endif
@@ -0,0 +1,57 @@
+#define _GNU_SOURCE
+#include "syscalls.h"
+
+/*
+ * How many system calls the library makes, by kind.
+ *
+ * On loopback a syscall (~100-300 ns of entry, exit and mitigations, plus
+ * the work) costs more than everything the wrapper does around it, so the
+ * number of syscalls per request is the figure that decides throughput.
+ * Every call site in socket.c, event_loop.c and epoll_ring.c counts the
+ * call it makes into a thread-local table: one increment of a TLS slot,
+ * no atomic and no shared cache line. Only bind() and listen() are left
+ * out: they run once per listener, before there is anything to count per.
+ *
+ * At the end of every iteration an event loop adds what its thread's table
+ * gained to a table of its own and sorts the iteration into a histogram by
+ * how many syscalls it made. It publishes both, with its request count
+ * (on_data calls), alongside its other counters (stats.c). From there
+ * `top`, the Prometheus endpoint and bench/bench_syscalls.c show syscalls
+ * per request; the bench fails when a path makes more than its budget.
+ */
+
+_Thread_local SyscallCounts syscall_counts;
+
+const char *const syscall_names[SYSCALL_KINDS] = {
+    [SYSCALL_ACCEPT] = "accept",
+    [SYSCALL_RECV] = "recv",
+    [SYSCALL_SEND] = "send",
+    [SYSCALL_EPOLL_WAIT] = "epoll_wait",
+    [SYSCALL_EPOLL_CTL] = "epoll_ctl",
+    [SYSCALL_IO_URING_ENTER] = "io_uring_enter",
+    [SYSCALL_CLOSE] = "close",
+    [SYSCALL_SETSOCKOPT] = "setsockopt",
+    [SYSCALL_FCNTL] = "fcntl",
+    [SYSCALL_EVENTFD] = "eventfd",
+    [SYSCALL_POLL] = "poll",
+    [SYSCALL_SOCKET] = "socket",
+    [SYSCALL_CONNECT] = "connect",
+    [SYSCALL_GETSOCKOPT] = "getsockopt",
+};
+
+long long syscall_total(const SyscallCounts *counts)
+{
+    long long total = 0;
+    for (int i = 0; i < SYSCALL_KINDS; i++)
+    {
+        total += counts->calls[i];
+    }
+    return total;
+}
+
+// The histogram bucket of an iteration that made 'calls' syscalls
+int syscall_bucket(long long calls)
+{
+    int bucket = calls > 0 ? 64 - __builtin_clzll((unsigned long long)calls) : 0;
+    return bucket < SYSCALL_BUCKETS ? bucket : SYSCALL_BUCKETS - 1;
+}
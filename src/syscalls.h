@@ -0,0 +1,46 @@
+#ifndef SYSCALLS_H
+#define SYSCALLS_H
+
+// The system calls the library counts (see syscalls.c)
+typedef enum
+{
+    SYSCALL_ACCEPT,
+    SYSCALL_RECV,
+    SYSCALL_SEND,
+    SYSCALL_EPOLL_WAIT,
+    SYSCALL_EPOLL_CTL,
+    SYSCALL_IO_URING_ENTER, // Batches of epoll_ctl() changes (epoll_ring.c)
+    SYSCALL_CLOSE,
+    SYSCALL_SETSOCKOPT,
+    SYSCALL_FCNTL,
+    SYSCALL_EVENTFD,        // read()/write() of a loop's wake eventfd
+    SYSCALL_POLL,
+    SYSCALL_SOCKET,
+    SYSCALL_CONNECT,
+    SYSCALL_GETSOCKOPT,
+    SYSCALL_KINDS
+} SyscallKind;
+
+// Iterations by syscalls made: bucket i counts [2^(i-1), 2^i), bucket 0 none; the last one has no end
+#define SYSCALL_BUCKETS 9
+
+// One thread's counts: plain increments, only that thread writes them
+typedef struct
+{
+    long long calls[SYSCALL_KINDS];
+} SyscallCounts;
+
+extern _Thread_local SyscallCounts syscall_counts;
+extern const char *const syscall_names[SYSCALL_KINDS];
+
+/* Function prototypes for syscall accounting */
+long long syscall_total(const SyscallCounts *counts);
+int syscall_bucket(long long calls);
+
+// Count one call of 'kind' on this thread
+static inline void syscall_count(SyscallKind kind)
+{
+    syscall_counts.calls[kind]++;
+}
+
+#endif
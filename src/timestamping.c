@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+#include "timestamping.h"
+#include "syscalls.h"
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * Kernel timestamps, to tell time in the network stack from time in the
+ * handlers.
+ *
+ * A latency measured around on_data() starts when the loop got round to the
+ * connection, not when the request arrived: the time it sat in the socket's
+ * receive queue while the loop was busy is invisible. SO_TIMESTAMPING asks
+ * the kernel to stamp packets at fixed points and hand the stamps back:
+ *
+ *   SOF_TIMESTAMPING_RX_SOFTWARE  stamp each packet as it enters the stack
+ *                                 (netif_receive_skb), before any socket
+ *                                 sees it
+ *   SOF_TIMESTAMPING_TX_SOFTWARE  stamp outgoing packets as the driver takes
+ *                                 them (skb_tx_timestamp() in its xmit
+ *                                 routine; loopback calls it too)
+ *   SOF_TIMESTAMPING_SOFTWARE     report the software stamps above
+ *   SOF_TIMESTAMPING_OPT_ID       tag each TX stamp with the stream offset of
+ *                                 the last byte of the send() it belongs to
+ *   SOF_TIMESTAMPING_OPT_TSONLY   without a copy of the packet
+ *
+ * An RX stamp comes with the data: recvmsg() returns it as an
+ * SCM_TIMESTAMPING control message, and for TCP it is the stamp of the last
+ * packet the read consumed. Now minus that stamp is how long the bytes
+ * waited between the wire and the application.
+ *
+ * A TX stamp comes later, on the socket's error queue: a queued entry makes
+ * epoll report EPOLLERR, and recvmsg(MSG_ERRQUEUE) returns it with a
+ * sock_extended_err (origin SO_EE_ORIGIN_TIMESTAMPING, the OPT_ID key in
+ * ee_data) next to the stamp. Each send() is remembered with its key and
+ * its time; the stamp minus that time is how long the stack took to hand
+ * the bytes to the driver. The error queue is level-triggered like
+ * everything else in epoll, so it is drained with recvmmsg(), a batch per
+ * syscall, whenever EPOLLERR comes. The driver usually stamps the packet
+ * inside send() itself, so the loop drains right after serving a
+ * connection that sent: otherwise every reply's stamp would cost a wakeup
+ * of its own.
+ *
+ * The stamps are CLOCK_REALTIME, so this module reads that clock too (a
+ * vDSO call, no syscall). On loopback the driver hands the packet straight
+ * to the receive path inside the sender's send(), so the TX delay is the
+ * TCP/IP stack's own time and the RX delay is queueing plus the wakeup of
+ * the loop: both are what a NIC adds to, not what it replaces.
+ */
+
+#define TIMESTAMP_DRAIN_BATCH 8 // Error queue entries per recvmmsg()
+
+// Room for a stamp and an extended error with the offender's address
+typedef union
+{
+    char buffer[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+                CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    struct cmsghdr align;
+} TimestampControl;
+
+// Ask for software RX and TX stamps on a connected TCP socket: 0, or -1 if the kernel refuses
+int timestamping_enable(int fd)
+{
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    syscall_count(SYSCALL_SETSOCKOPT);
+    return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+}
+
+// The clock the kernel stamps with, in nanoseconds
+long long timestamping_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// The software stamp among a message's control messages, 0 if there is none
+static long long software_stamp(struct msghdr *msg)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+        {
+            struct scm_timestamping stamps;
+            memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            return (long long)stamps.ts[0].tv_sec * 1000000000LL + stamps.ts[0].tv_nsec;
+        }
+    }
+    return 0;
+}
+
+// recv() that also records how long the bytes waited in the kernel into 'rx' (may be NULL)
+ssize_t timestamping_recv(int fd, char *buffer, int size, DelayHistogram *rx)
+{
+    TimestampControl control;
+    struct iovec iov = {buffer, (size_t)size};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer,
+                         .msg_controllen = sizeof(control.buffer)};
+    syscall_count(SYSCALL_RECV);
+    ssize_t n = recvmsg(fd, &msg, 0);
+    long long stamp;
+    if (n > 0 && rx && (stamp = software_stamp(&msg)) != 0)
+    {
+        delay_observe(rx, timestamping_now_ns() - stamp);
+    }
+    return n;
+}
+
+/*
+ * Remember a send() of 'bytes', called at 'sent_ns' (timestamping_now_ns()
+ * before the call: on loopback the driver has stamped the packet by the
+ * time send() returns), until its TX stamp comes back.
+ */
+void timestamping_sent(TimestampPending *pending, int bytes, long long sent_ns)
+{
+    pending->sent += (uint32_t)bytes;
+    pending->unstamped += pending->sent_ns[pending->next] == 0;
+    pending->keys[pending->next] = pending->sent - 1; // OPT_ID on TCP: the offset of the last byte
+    pending->sent_ns[pending->next] = sent_ns;
+    pending->next = (pending->next + 1) % TIMESTAMP_PENDING;
+}
+
+// Match one error queue entry with its send(); entries that are not TX stamps are skipped
+static void tx_stamp(struct msghdr *msg, TimestampPending *pending, Timestamps *timestamps)
+{
+    const struct sock_extended_err *error = NULL;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+            (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+        {
+            error = (const struct sock_extended_err *)CMSG_DATA(cmsg);
+        }
+    }
+    long long stamp = software_stamp(msg);
+    if (!error || error->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || error->ee_info != SCM_TSTAMP_SND || !stamp)
+    {
+        return;
+    }
+    for (int i = 0; i < TIMESTAMP_PENDING; i++)
+    {
+        if (pending->sent_ns[i] && pending->keys[i] == error->ee_data)
+        {
+            if (timestamps)
+            {
+                delay_observe(&timestamps->tx, stamp - pending->sent_ns[i]);
+            }
+            pending->sent_ns[i] = 0;
+            pending->unstamped--;
+            return;
+        }
+    }
+    if (timestamps)
+    {
+        timestamps->tx_unmatched++; // Its slot was taken by a later send()
+    }
+}
+
+/*
+ * Read the TX stamps off the error queue into 'timestamps' (may be NULL:
+ * only drain). Returns how many entries there were; 0 means the EPOLLERR
+ * was a real socket error, which the next read reports.
+ */
+int timestamping_drain(int fd, TimestampPending *pending, Timestamps *timestamps)
+{
+    TimestampControl controls[TIMESTAMP_DRAIN_BATCH];
+    struct mmsghdr messages[TIMESTAMP_DRAIN_BATCH];
+    int drained = 0;
+    int n;
+    do
+    {
+        memset(messages, 0, sizeof(messages));
+        for (int i = 0; i < TIMESTAMP_DRAIN_BATCH; i++)
+        {
+            messages[i].msg_hdr.msg_control = controls[i].buffer;
+            messages[i].msg_hdr.msg_controllen = sizeof(controls[i].buffer);
+        }
+        syscall_count(SYSCALL_RECV);
+        n = recvmmsg(fd, messages, TIMESTAMP_DRAIN_BATCH, MSG_ERRQUEUE | MSG_DONTWAIT, NULL);
+        for (int i = 0; i < n; i++)
+        {
+            tx_stamp(&messages[i].msg_hdr, pending, timestamps);
+        }
+        drained += n > 0 ? n : 0;
+    } while (n == TIMESTAMP_DRAIN_BATCH); // A full batch: there may be more
+    return drained;
+}
+
+void delay_observe(DelayHistogram *histogram, long long ns)
+{
+    ns = ns > 0 ? ns : 0; // The realtime clock may have stepped back
+    histogram->count++;
+    histogram->sum_ns += ns;
+    histogram->buckets[delay_bucket(ns)]++;
+}
+
+// The histogram bucket of a delay of 'ns' nanoseconds
+int delay_bucket(long long ns)
+{
+    int bucket = ns >= 128 ? 64 - __builtin_clzll((unsigned long long)ns) - 7 : 0;
+    return bucket < TIMESTAMP_BUCKETS ? bucket : TIMESTAMP_BUCKETS - 1;
+}
@@ -0,0 +1,50 @@
+#ifndef TIMESTAMPING_H
+#define TIMESTAMPING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Delays: bucket 0 counts those under 128 ns, bucket i [2^(i+6), 2^(i+7)) ns; the last one has no end
+#define TIMESTAMP_BUCKETS 24
+#define TIMESTAMP_PENDING 8 // Sends per connection still waiting for their TX timestamp
+
+// One kind of delay, written by one loop thread only
+typedef struct
+{
+    long long count;
+    long long sum_ns;
+    long long buckets[TIMESTAMP_BUCKETS];
+} DelayHistogram;
+
+// What a loop measured on its timestamped connections
+typedef struct
+{
+    DelayHistogram rx;      // Kernel arrival of the data to the recv() that returned it
+    DelayHistogram tx;      // send() to the handoff to the driver
+    long long tx_unmatched; // TX timestamps whose send() was no longer remembered
+} Timestamps;
+
+/*
+ * One connection's sends that have no TX timestamp yet, keyed the way the
+ * kernel keys them with SOF_TIMESTAMPING_OPT_ID on TCP: the offset of the
+ * send()'s last byte in the stream.
+ */
+typedef struct
+{
+    uint32_t sent;  // Bytes handed to send() since timestamping was switched on
+    int next;       // Slot the next send() takes (the oldest one)
+    int unstamped;  // Slots in use
+    uint32_t keys[TIMESTAMP_PENDING];
+    long long sent_ns[TIMESTAMP_PENDING]; // CLOCK_REALTIME; 0 = slot free
+} TimestampPending;
+
+/* Function prototypes for kernel timestamping */
+int timestamping_enable(int fd);
+long long timestamping_now_ns(void);
+ssize_t timestamping_recv(int fd, char *buffer, int size, DelayHistogram *rx);
+void timestamping_sent(TimestampPending *pending, int bytes, long long sent_ns);
+int timestamping_drain(int fd, TimestampPending *pending, Timestamps *timestamps);
+void delay_observe(DelayHistogram *histogram, long long ns);
+int delay_bucket(long long ns);
+
+#endif
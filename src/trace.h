@@ -0,0 +1,53 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "clock.h"
+#include <stdatomic.h>
+
+#define TRACE_RING_EVENTS 65536 // Spans kept per thread; older ones are overwritten
+
+// One finished span: a name (a string literal), when and for how long, and a number (fd or bytes)
+typedef struct
+{
+    const char *name;
+    long long start_ns;
+    long long duration_ns;
+    long long arg;
+} TraceSpan;
+
+// The spans of one thread. Only that thread writes; trace_dump() reads
+typedef struct TraceRing
+{
+    int tid;
+    const char *label; // Thread name in the viewer
+    unsigned long long recorded; // Spans ever recorded: the next slot is recorded % TRACE_RING_EVENTS
+    TraceSpan spans[TRACE_RING_EVENTS];
+    struct TraceRing *next;
+} TraceRing;
+
+// Whether spans are recorded now; read on every trace_begin()
+extern atomic_int trace_enabled;
+
+/* Function prototypes for span tracing */
+void trace_set_enabled(int enabled);
+void trace_name_thread(const char *label);
+void trace_record(const char *name, long long start_ns, long long duration_ns, long long arg);
+int trace_dump(const char *path);
+void trace_reset(void);
+
+// Start of a span: its start time, or 0 while tracing is off (then trace_end() does nothing)
+static inline long long trace_begin(void)
+{
+    return atomic_load_explicit(&trace_enabled, memory_order_relaxed) ? clock_now_ns() : 0;
+}
+
+// End of a span started by trace_begin(); 'name' must be a string literal
+static inline void trace_end(const char *name, long long begun_ns, long long arg)
+{
+    if (begun_ns)
+    {
+        trace_record(name, begun_ns, clock_now_ns() - begun_ns, arg);
+    }
+}
+
+#endif
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include "watchdog.h"
+#include "clock.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Finds serving threads that are stuck.
+ *
+ * A loop that blocks (a handler calling socket_receive() on a slow peer, a
+ * DNS lookup, a full disk) stalls every connection it owns, and nothing
+ * says so: the clients just wait. Each serving thread therefore keeps a
+ * Heartbeat: the time its current iteration began (0 while it waits for
+ * work), the callback it entered last and for which fd, and a histogram of
+ * how long its iterations take.
+ *
+ * The watchdog thread looks at every heartbeat four times per threshold.
+ * An iteration that began more than a threshold ago is a stall in
+ * progress; it is reported once, while it is still happening, with the
+ * callback and fd, so the report names the culprit even if the thread
+ * never comes back.
+ *
+ * Each report is also written to ftrace's trace_marker when tracefs is
+ * mounted and writable. It then appears in the kernel trace next to the
+ * scheduler events, and in perf as the ftrace:print event:
+ *
+ *   perf record -e ftrace:print -e sched:sched_switch -g -p <pid>
+ *   perf script | grep -A20 'stall:'
+ *
+ * shows what the stuck thread was doing when it was flagged.
+ */
+
+Watchdog *watchdog = NULL;
+
+static int open_trace_marker(void)
+{
+    int fd = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+    }
+    return fd;
+}
+
+// Iteration time below which 'pct' percent of the iterations finished: the upper end of its bucket, in us
+static long long heartbeat_percentile_us(Heartbeat *heartbeat, double pct)
+{
+    long long counts[HEARTBEAT_BUCKETS];
+    long long total = 0;
+    for (int i = 0; i < HEARTBEAT_BUCKETS; i++)
+    {
+        counts[i] = atomic_load_explicit(&heartbeat->histogram[i], memory_order_relaxed);
+        total += counts[i];
+    }
+    long long rank = (long long)(pct / 100.0 * total);
+    long long seen = 0;
+    for (int i = 0; i < HEARTBEAT_BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (counts[i] > 0 && seen >= rank)
+        {
+            return 2LL << i;
+        }
+    }
+    return 0;
+}
+
+// One line: iterations, percentiles of their duration, slow ones
+void heartbeat_print(Heartbeat *heartbeat, FILE *out)
+{
+    fprintf(out, "%s: %lld iterations, p50 < %lld us, p99 < %lld us, max < %lld us, %lld slow\n", heartbeat->name,
+            atomic_load(&heartbeat->iterations), heartbeat_percentile_us(heartbeat, 50.0),
+            heartbeat_percentile_us(heartbeat, 99.0), heartbeat_percentile_us(heartbeat, 100.0),
+            atomic_load(&heartbeat->slow));
+}
+
+static void report_stall(Heartbeat *heartbeat, long long stalled_ns)
+{
+    const char *doing = atomic_load_explicit(&heartbeat->doing, memory_order_relaxed);
+    int fd = atomic_load_explicit(&heartbeat->fd, memory_order_relaxed);
+    char line[256];
+    int length = snprintf(line, sizeof(line), "stall: %s stuck for %lld ms in %s (fd %d)\n", heartbeat->name,
+                          stalled_ns / 1000000, doing ? doing : "the loop itself", fd);
+    fprintf(stderr, "[WATCHDOG] %s", line);
+    heartbeat_print(heartbeat, stderr);
+    if (watchdog->marker_fd >= 0 && write(watchdog->marker_fd, line, length) < 0)
+    {
+        close(watchdog->marker_fd); // Not allowed after all: stop trying
+        watchdog->marker_fd = -1;
+    }
+}
+
+static void *watchdog_main(void *arg)
+{
+    (void)arg;
+    long long period_ns = watchdog->threshold_ns / 4 > 1000000 ? watchdog->threshold_ns / 4 : 1000000;
+    struct timespec period = {period_ns / 1000000000LL, period_ns % 1000000000LL};
+    while (!atomic_load(&watchdog->stopping))
+    {
+        nanosleep(&period, NULL);
+        long long now = clock_now_ns();
+        pthread_mutex_lock(&watchdog->lock);
+        for (Heartbeat *heartbeat = watchdog->heartbeats; heartbeat; heartbeat = heartbeat->next)
+        {
+            long long begun = atomic_load_explicit(&heartbeat->begun_ns, memory_order_acquire);
+            if (!begun || begun == heartbeat->flagged_ns || now - begun < watchdog->threshold_ns ||
+                atomic_load_explicit(&heartbeat->retired, memory_order_relaxed))
+            {
+                continue;
+            }
+            heartbeat->flagged_ns = begun;
+            heartbeat->stalls++;
+            report_stall(heartbeat, now - begun);
+        }
+        pthread_mutex_unlock(&watchdog->lock);
+    }
+    return NULL;
+}
+
+// Start the process's watchdog: iterations longer than threshold_ms are reported
+int watchdog_start(int threshold_ms)
+{
+    Watchdog *dog = (Watchdog *)malloc(sizeof(Watchdog));
+    if (!dog)
+    {
+        perror("[WATCHDOG] malloc failed");
+        return -1;
+    }
+    memset(dog, 0, sizeof(Watchdog));
+    dog->threshold_ns = threshold_ms * 1000000LL;
+    dog->marker_fd = open_trace_marker();
+    atomic_init(&dog->stopping, 0);
+    pthread_mutex_init(&dog->lock, NULL);
+    watchdog = dog;
+    if (pthread_create(&dog->thread, NULL, watchdog_main, NULL) != 0)
+    {
+        perror("[WATCHDOG] pthread_create failed");
+        watchdog = NULL;
+        pthread_mutex_destroy(&dog->lock);
+        free(dog);
+        return -1;
+    }
+    return 0;
+}
+
+// Stop the watchdog and free every heartbeat; no serving thread may still use one
+void watchdog_stop(void)
+{
+    Watchdog *dog = watchdog;
+    if (!dog)
+    {
+        return;
+    }
+    atomic_store(&dog->stopping, 1);
+    pthread_join(dog->thread, NULL);
+    watchdog = NULL;
+    while (dog->heartbeats)
+    {
+        Heartbeat *heartbeat = dog->heartbeats;
+        dog->heartbeats = heartbeat->next;
+        free(heartbeat);
+    }
+    if (dog->marker_fd >= 0)
+    {
+        close(dog->marker_fd);
+    }
+    pthread_mutex_destroy(&dog->lock);
+    free(dog);
+}
+
+// A heartbeat named "<kind> <n>" for a new serving thread; NULL when no watchdog runs
+Heartbeat *watchdog_heartbeat(const char *kind)
+{
+    if (!watchdog)
+    {
+        return NULL;
+    }
+    Heartbeat *heartbeat = (Heartbeat *)calloc(1, sizeof(Heartbeat));
+    if (!heartbeat)
+    {
+        perror("[WATCHDOG] calloc failed");
+        return NULL;
+    }
+    atomic_init(&heartbeat->fd, -1);
+    pthread_mutex_lock(&watchdog->lock);
+    snprintf(heartbeat->name, sizeof(heartbeat->name), "%s %d", kind, watchdog->count++);
+    heartbeat->next = watchdog->heartbeats;
+    watchdog->heartbeats = heartbeat;
+    pthread_mutex_unlock(&watchdog->lock);
+    return heartbeat;
+}
+
+// The thread is done with it; it stays allocated until watchdog_stop()
+void heartbeat_retire(Heartbeat *heartbeat)
+{
+    if (heartbeat)
+    {
+        atomic_store(&heartbeat->retired, 1);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define HEARTBEAT_BUCKETS 25 // Iteration durations: bucket i counts [2^i, 2^(i+1)) microseconds
+
+/*
+ * What one serving thread (an event loop, a worker, the blocking accept
+ * loop) publishes for the watchdog. Only that thread writes it, so every
+ * update is a relaxed store: no locked instruction on the serving path.
+ */
+typedef struct Heartbeat
+{
+    char name[32];
+    atomic_llong begun_ns;       // Start of the current iteration (0 = waiting for work)
+    _Atomic(const char *) doing; // Callback entered last in this iteration (NULL = none yet)
+    atomic_int fd;               // Connection it was entered for (-1 = none)
+    atomic_llong iterations;
+    atomic_llong total_ns;       // Sum of their durations
+    atomic_llong slow;           // Iterations that took longer than the threshold
+    atomic_llong histogram[HEARTBEAT_BUCKETS];
+    atomic_int retired;          // Its thread is gone; the watchdog skips it
+
+    long long flagged_ns; // begun_ns of the last stall reported (watchdog thread only)
+    long long stalls;     // Stalls reported while they were happening
+    struct Heartbeat *next;
+} Heartbeat;
+
+// A thread that checks every heartbeat a few times per threshold
+typedef struct
+{
+    long long threshold_ns;
+    int marker_fd; // ftrace trace_marker, -1 if tracefs is not available
+    pthread_t thread;
+    atomic_int stopping;
+    pthread_mutex_t lock; // Guards the heartbeat list (registration is rare)
+    Heartbeat *heartbeats;
+    int count;
+} Watchdog;
+
+// The process's watchdog, NULL until watchdog_start()
+extern Watchdog *watchdog;
+
+/* Function prototypes for the stall watchdog */
+int watchdog_start(int threshold_ms);
+void watchdog_stop(void);
+Heartbeat *watchdog_heartbeat(const char *kind);
+void heartbeat_retire(Heartbeat *heartbeat);
+void heartbeat_print(Heartbeat *heartbeat, FILE *out);
+
+// A new iteration starts: the thread has work (hb may be NULL: no watchdog)
+static inline void heartbeat_begin(Heartbeat *hb, long long now_ns)
+{
+    if (hb)
+    {
+        atomic_store_explicit(&hb->doing, NULL, memory_order_relaxed);
+        atomic_store_explicit(&hb->fd, -1, memory_order_relaxed);
+        atomic_store_explicit(&hb->begun_ns, now_ns, memory_order_release);
+    }
+}
+
+// About to call 'what' (a string literal) for connection 'fd'
+static inline void heartbeat_enter(Heartbeat *hb, const char *what, int fd)
+{
+    if (hb)
+    {
+        atomic_store_explicit(&hb->fd, fd, memory_order_relaxed);
+        atomic_store_explicit(&hb->doing, what, memory_order_relaxed);
+    }
+}
+
+// The iteration is over: count its duration and go back to waiting
+static inline void heartbeat_end(Heartbeat *hb, long long now_ns)
+{
+    if (!hb)
+    {
+        return;
+    }
+    long long begun = atomic_load_explicit(&hb->begun_ns, memory_order_relaxed);
+    atomic_store_explicit(&hb->begun_ns, 0, memory_order_relaxed);
+    long long us = (now_ns - begun) / 1000;
+    int bucket = us > 0 ? 63 - __builtin_clzll((unsigned long long)us) : 0;
+    if (bucket >= HEARTBEAT_BUCKETS)
+    {
+        bucket = HEARTBEAT_BUCKETS - 1;
+    }
+    atomic_llong *count = &hb->histogram[bucket];
+    atomic_store_explicit(count, atomic_load_explicit(count, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&hb->iterations, atomic_load_explicit(&hb->iterations, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&hb->total_ns, atomic_load_explicit(&hb->total_ns, memory_order_relaxed) + now_ns - begun,
+                          memory_order_relaxed);
+    if (watchdog && now_ns - begun >= watchdog->threshold_ns)
+    {
+        atomic_store_explicit(&hb->slow, atomic_load_explicit(&hb->slow, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+    }
+}
+
+#endif